@@ -76,6 +76,14 @@ typedef enum {
      * strucutre should be made - history
      */ 
     RC_FSM_STOP_PROCESSING,
+
+    /* indicates that a size, depth, count or mode argument was 
+     * out of range, or the call is not allowed in this state 
+     */ 
+    RC_FSM_INVALID_ARGUMENT,
+
+    /* number of return codes, add new codes above */ 
+    RC_FSM_LAST
 } RC_FSM_t;
 
 
@@ -83,6 +91,22 @@ typedef enum {
 #define FSM_NULL_STATE_ID   ( -1 )
 #define FSM_NULL_EVENT_ID   ( -1 )
 
+/*
+ * These are the maximum states and events that fsm uses 
+ * for sizing during create, a table holds fewer.  The IDs
+ * are compiled to 16 bits.
+ */ 
+#define FSM_MAX_STATES  ( 0xffff ) 
+#define FSM_MAX_EVENTS  ( 0xffff ) 
+
+/*
+ * event ID of the default tuple of a sparse event table, and 
+ * the next state that stays in the current state, see 
+ * state_tuple_t
+ */
+#define FSM_DEFAULT_EVENT_ID  ( -2 )
+#define FSM_SAME_STATE        ( -2 )
+
 
 /*
  * typedef RC_FSM_t (*event_cb_t)(void *p2event, void *p2parm)
@@ -181,7 +205,8 @@ typedef struct {
  *
  * next_state is the next state as result of the event. It is 
  *          possible that a state transition associated with an event 
- *          remain in the current state.
+ *          remain in the current state, either by giving the state
+ *          or FSM_SAME_STATE.
  * 
  * An example: 
  *   static event_tuple_t  state_wait_for_init_ack_events[] =
@@ -212,13 +237,118 @@ typedef struct {
  *        {established_s,                 state_established_events},
  *        {wait_for_term_ack_s,           state_wait_for_term_ack_events},
  *        {FSM_NULL_STATE_ID, NULL}};          / requied to end table / 
+ *
+ * A state may also carry a timeout.  When a timer wheel is attached 
+ * with fsm_timer_attach, the engine arms the state timer on entry 
+ * to the state and cancels it on exit, the timeout event is then 
+ * delivered like any other event.  A transition back into the same
+ * state leaves the running timer alone, unless FSM_TIMEOUT_REARM 
+ * is set to restart it.
+ *
+ *        {wait_for_init_ack_s,           state_wait_for_init_ack_events,
+ *                                        300, init_tmo_e, 0},
+ *
+ * A state that handles only a few of many events can list just 
+ * those, in ascending event ID order ended by FSM_NULL_EVENT_ID,
+ * and set FSM_EVENTS_SPARSE in its event flags.  The events left 
+ * out take the tuple with the ID FSM_DEFAULT_EVENT_ID when there 
+ * is one, else the class default.  The class default is the tuple
+ * of the same ID that the state table terminator may point to, 
+ * else a NULL handler.  Defaults usually stay in FSM_SAME_STATE.
+ *
+ *   static event_tuple_t  state_established_events[] =
+ *     {{term_rcvd_e,          event_term_rcvd,     idle_s},
+ *      {FSM_DEFAULT_EVENT_ID, event_ignore,        FSM_SAME_STATE},
+ *      {FSM_NULL_EVENT_ID,    NULL,                0}};
+ *
+ *        {established_s,                 state_established_events,
+ *                                        0, 0, 0, FSM_EVENTS_SPARSE},
+ *
+ * How the class stores each state, as a row indexed directly by
+ * event or as a sorted list of the events off its default, does 
+ * not depend on how its table is written, see fsm_class_set_layout.
+ * FSM_LAYOUT_FORCE_DENSE or FSM_LAYOUT_FORCE_SPARSE in the event 
+ * flags fix it for one state.
  */
+#define FSM_TIMEOUT_REARM    ( 0x0001 )
+
+#define FSM_EVENTS_SPARSE        ( 0x0001 )
+#define FSM_LAYOUT_FORCE_DENSE   ( 0x0002 )
+#define FSM_LAYOUT_FORCE_SPARSE  ( 0x0004 )
+
 typedef struct {
     uint32_t        state_id;
     event_tuple_t  *p2event_tuple;
+
+    /* optional, timeout in timer wheel ticks, 0 for none */
+    uint32_t        timeout;
+    uint32_t        timeout_event;
+    uint32_t        timeout_flags;
+
+    /* 
+     * optional, FSM_EVENTS_SPARSE for a sparse event table and 
+     * the FSM_LAYOUT_FORCE_ flags
+     */
+    uint32_t        event_flags;
 } state_tuple_t;
 
 
+/*
+ * Compiled transition cell.  The class compiles the user state
+ * and event tables into rows of these cells, validated at create
+ * time, that the engine reaches with two small index tables, see
+ * fsm_class_t.
+ *
+ * handler_index is the index into the compiled handler table,
+ *          index 0 is reserved for the NULL handler.
+ *
+ * next_state is the normalized next state from the event table.
+ */
+typedef struct {
+    uint16_t   handler_index;
+    uint16_t   next_state;
+} fsm_cell_t;
+
+#define FSM_NULL_HANDLER_INDEX   ( 0 )
+
+/*
+ * Compiled sparse state, its events are sparse_events[first] to 
+ * sparse_events[first + count - 1] in ascending order with their
+ * cells in sparse_cells, all other events take default_cell.
+ */
+#define FSM_ROW_SPARSE           ( 0x80000000 )
+
+typedef struct {
+    uint32_t     first;
+    uint16_t     count;
+    uint16_t     reserved;
+    fsm_cell_t   default_cell;
+} fsm_sparse_state_t;
+
+/* matrix and handler table are aligned to this boundary */
+#define FSM_CACHE_LINE           ( 64 )
+
+/*
+ * Layout modes of a class, see fsm_class_set_layout.
+ *
+ * FSM_LAYOUT_AUTO measures each state, the events off its most
+ *          common cell, whether its row is shared and the handlers
+ *          it reaches, and picks the faster form per state.  This
+ *          is the fsm_class_create default.
+ *
+ * FSM_LAYOUT_DENSE keeps every state as a row.
+ *
+ * FSM_LAYOUT_SPARSE keeps every state as a sorted event list.
+ *
+ * FSM_LAYOUT_DECLARED keeps as lists the states declared with
+ *          FSM_EVENTS_SPARSE that list few events.
+ */
+#define FSM_LAYOUT_AUTO          ( 0 )
+#define FSM_LAYOUT_DENSE         ( 1 )
+#define FSM_LAYOUT_SPARSE        ( 2 )
+#define FSM_LAYOUT_DECLARED      ( 3 )
+
+
 /*
  * Historical record of state changes
  */
@@ -233,12 +363,221 @@ typedef struct {
 
 #define FSM_HISTORY   ( 64 )
 
+
+/*
+ * History policy, per state machine or as the default of a class.
+ *
+ * FSM_HISTORY_OFF records nothing and needs no buffer.
+ *
+ * FSM_HISTORY_ALL records every transition in a ring of depth
+ *          entries, a power of two.  This is the fsm_create default
+ *          with a depth of FSM_HISTORY.
+ *
+ * FSM_HISTORY_SAMPLED records one transition in every sample.
+ *
+ * FSM_HISTORY_ON_ERROR keeps only the last FSM_HISTORY_LEADUP 
+ *          transitions, inline, until a handler returns other than
+ *          RC_FSM_OK.  The ring of depth entries is then allocated,
+ *          seeded with the lead-up and records every transition 
+ *          from there on.  Healthy state machines carry no buffer.
+ */
+#define FSM_HISTORY_OFF        ( 0 )
+#define FSM_HISTORY_ALL        ( 1 )
+#define FSM_HISTORY_SAMPLED    ( 2 )
+#define FSM_HISTORY_ON_ERROR   ( 3 )
+
+#define FSM_HISTORY_LEADUP     ( 4 )
+#define FSM_HISTORY_MAX_DEPTH  ( 1 << 16 )
+
+typedef struct {
+    uint32_t   mode;
+    uint32_t   depth;
+    uint32_t   sample;
+} fsm_history_policy_t;
+
+
+/*
+ * Finite State Machine class.  The class is the validated and
+ * compiled form of the user description and state tables.  It
+ * is built once and shared, read-only, by any number of state
+ * machine instances.
+ */
+#define FSM_CLASS_TAG    ( 0xc1a55ed0 )
+#define FSM_NAME_LEN     ( 32 )
+
+typedef struct fsm_class_s {
+    /* for class validation */
+    uint32_t       tag;
+
+    char           fsm_name[FSM_NAME_LEN];
+
+    /* number states in table */
+    uint32_t       number_states;
+
+    /* number events in each state-event table */
+    uint32_t       number_events;
+
+    /* pointer to the user state table */
+    state_tuple_t  *state_table;
+
+    /* description of normalized states and events */
+    state_description_t  *state_description_table;
+    event_description_t  *event_description_table;
+
+    /* history policy of the state machines created on the class */
+    fsm_history_policy_t  history_policy;
+
+    /* names the tables in a trace, 0 until first traced */
+    uint32_t       trace_class_id;
+
+    /*
+     * per thread event counters, allocated by the first 
+     * fsm_stats_enable and counting while stats_enabled is set
+     */
+    struct fsm_stats_s  *stats;
+    boolean_t      stats_enabled;
+
+    /*
+     * handler latency histograms, allocated by the first 
+     * fsm_latency_enable
+     */
+    struct fsm_latency_s  *latency;
+
+    /*
+     * state populations, allocated by fsm_population_enable
+     */
+    struct fsm_population_s  *population;
+
+    /*
+     * Compiled transition table, compressed in two levels.  Events
+     * that behave alike in every dense state share an event class,
+     * a column of the rows, and states with the same cells share a
+     * row.  The cell of (state, event) is
+     *
+     *     rows[state_row[state] + event_class[event]]
+     *
+     * unless FSM_ROW_SPARSE is set in state_row[state], the state
+     * is then the sparse state of the remaining bits, see 
+     * fsm_sparse_state_t.  The arrays are one cache aligned block
+     * at sparse_states.  When every state is a row and this would
+     * not be smaller than the state x event matrix, the matrix is
+     * kept instead, with state_row and event_class NULL, and the 
+     * cell is rows[state * number_events + event].  The table of 
+     * distinct handlers is referenced by the cells.  layout_mode 
+     * chose the form of each state.
+     */
+    uint32_t       layout_mode;
+    fsm_cell_t    *rows;
+    uint32_t      *state_row;
+    uint16_t      *event_class;
+    uint32_t       number_rows;
+    uint32_t       number_event_classes;
+
+    fsm_sparse_state_t  *sparse_states;
+    uint16_t      *sparse_events;
+    fsm_cell_t    *sparse_cells;
+    uint32_t       number_sparse_states;
+    uint32_t       number_sparse_entries;
+
+    event_cb_t    *handler_table;
+    uint32_t       number_handlers;
+} fsm_class_t;
+
+
+/*
+ * Compiled table of a class, see fsm_class_get_layout.  The 
+ * dense size is that of the full state x event matrix of cells,
+ * the compressed size that of the rows, the sparse event lists
+ * and the index tables.
+ */
+typedef struct {
+    uint32_t   number_states;
+    uint32_t   number_events;
+
+    /* distinct handlers, without the NULL handler */
+    uint32_t   number_handlers;
+
+    /* distinct rows and event classes kept */
+    uint32_t   number_rows;
+    uint32_t   number_event_classes;
+
+    /* states kept as event lists, and the events listed */
+    uint32_t   number_sparse_states;
+    uint32_t   number_sparse_entries;
+
+    uint64_t   dense_bytes;
+    uint64_t   compressed_bytes;
+
+    /* FSM_LAYOUT_ mode the class was compiled with */
+    uint32_t   layout_mode;
+} fsm_class_layout_t;
+
+
+/*
+ * Compiled form of one state, see fsm_class_get_state_layout.
+ * The default cell of a dense state is its most common cell.
+ */
+#define FSM_STATE_LAYOUT_DENSE   ( 0 )
+#define FSM_STATE_LAYOUT_SPARSE  ( 1 )
+
+typedef struct {
+    /* FSM_STATE_LAYOUT_DENSE or FSM_STATE_LAYOUT_SPARSE */
+    uint32_t   layout;
+
+    /* events off the default cell, those listed when sparse */
+    uint32_t   entries;
+
+    /* distinct handlers the state reaches, without the NULL handler */
+    uint32_t   handlers;
+
+    /* other states sharing the row, when dense */
+    uint32_t   shared;
+} fsm_state_layout_t;
+
+
+/*
+ * Lightweight state machine instance.  An instance holds only
+ * its current state, flags and a pointer to the shared class,
+ * there is no name and no history.  Instances are owned by the
+ * user and initialized in place with fsm_instance_init.
+ */
+#define FSM_INSTANCE_EXCEPTION   ( 0x0001 )
+
+typedef struct {
+    fsm_class_t   *fsm_class;
+
+    uint16_t       curr_state;
+
+    /* valid when FSM_INSTANCE_EXCEPTION is set in flags */
+    uint16_t       exception_state;
+
+    uint32_t       flags;
+} fsm_instance_t;
+
+/*
+ * Event posted by a handler with fsm_post_event
+ */
+typedef struct {
+    uint32_t   normalized_event;
+    void      *p2event_buffer;
+    void      *p2parm;
+} fsm_event_t;
+
+
 /*
  * Finite State Machine structure 
  *
  */
 #define FSM_TAG          ( 0xba5eba11 )
-#define FSM_NAME_LEN     ( 32 )
+
+/* 
+ * fsm->flags, time the event handlers, see fsm_latency.h, and 
+ * counted in the state populations, with the state entry time,
+ * see fsm_population.h 
+ */
+#define FSM_FLAG_LATENCY     ( 0x0001 )
+#define FSM_FLAG_POPULATION  ( 0x0002 )
+#define FSM_FLAG_DWELL       ( 0x0004 )
 
 typedef struct {
     /* for fsm validation */
@@ -266,17 +605,63 @@ typedef struct {
     /* debug and trace flags*/
     uint32_t       flags;
 
+    /* identifies the state machine in traces, see fsm_set_instance_id */
+    uint32_t       instance_id;
+
+    /* time stamp counter on entry to the state, with FSM_FLAG_DWELL */
+    uint64_t       state_entry_tsc;
+
     /* pointer to the state table */
     state_tuple_t  *state_table;
 
     /* description of normalized states and events */ 
     state_description_t  *state_description_table; 
-    event_description_t  *event_description_table; 
+    event_description_t  *event_description_table;
+
+    /* compiled class, built and owned by fsm_create */
+    struct fsm_class_s  *fsm_class;
 
     /* starts at 0 and wraps */
     uint32_t       history_index; 
-    /* memory is malloc'ed to record history */  
+    /* 
+     * history ring of history_mask+1 entries, NULL when off or 
+     * not yet promoted.  The ring is malloc'ed unless it fits the
+     * preallocated history_buffer, as provided by a pool.
+     */
     fsm_history_t *history;
+    uint32_t       history_mask;
+    fsm_history_t *history_buffer;
+    uint32_t       history_buffer_depth;
+
+    fsm_history_policy_t  history_policy;
+    uint32_t       history_countdown;
+    fsm_history_t  history_leadup[FSM_HISTORY_LEADUP];
+
+    /*
+     * run-to-completion queue of events posted by the handlers,
+     * NULL until configured by fsm_set_event_queue.  The head
+     * and tail are free running, the size is a power of two.
+     */
+    fsm_event_t   *event_queue;
+    uint32_t       event_queue_size;
+    uint32_t       event_queue_head;
+    uint32_t       event_queue_tail;
+
+    /* set while the outermost fsm_engine call is running */
+    boolean_t      engine_active;
+
+    /*
+     * state timeouts, NULL until a wheel is attached with 
+     * fsm_timer_attach
+     */
+    struct fsm_timer_wheel_s  *timer_wheel;
+    struct fsm_timer_s        *state_timer;
+
+    /*
+     * pool the state machine was created in, NULL when created 
+     * by fsm_create
+     */
+    struct fsm_pool_s         *pool;
 } fsm_t;
 
 
@@ -287,6 +672,14 @@ extern void
 fsm_display_table(fsm_t *fsm);
 
 
+/*
+ * show the event counters of a class as a heatmap of the table,
+ * see fsm_stats.h
+ */
+extern void
+fsm_display_heatmap(fsm_class_t *fsm_class);
+
+
 /*
  * shows state machine history
  */
@@ -294,11 +687,28 @@ extern void
 fsm_show_history(fsm_t *fsm);
 
 
+/*
+ * set the history policy of a state machine, or the default
+ * of the state machines later created on a class
+ */
+extern RC_FSM_t
+fsm_set_history_policy(fsm_t *fsm, fsm_history_policy_t *policy);
+
+extern RC_FSM_t
+fsm_class_set_history_policy(fsm_class_t *fsm_class, 
+                             fsm_history_policy_t *policy);
+
+
 /* get state */
 extern RC_FSM_t
 fsm_get_state(fsm_t *fsm, uint32_t *p2state);
 
 
+/* set the ID that identifies the state machine in traces */
+extern RC_FSM_t
+fsm_set_instance_id(fsm_t *fsm, uint32_t instance_id);
+
+
 /*
  * allows event handler to update the next state based upon
  * an unexpected condition when processing the event.
@@ -307,6 +717,24 @@ extern RC_FSM_t
 fsm_set_exception_state(fsm_t *fsm, uint32_t exception_state);
 
 
+/*
+ * configure the run-to-completion event queue
+ */
+extern RC_FSM_t
+fsm_set_event_queue(fsm_t *fsm, uint32_t queue_size);
+
+
+/*
+ * allows event handler to raise a follow-up event, processed
+ * once the current event completes
+ */
+extern RC_FSM_t
+fsm_post_event(fsm_t *fsm,
+               uint32_t normalized_event,
+               void *p2event_buffer,
+               void *p2parm);
+
+
 /*
  * destroy a state machine
  */
@@ -314,6 +742,14 @@ extern RC_FSM_t
 fsm_destroy(fsm_t **fsm);  
 
 
+/*
+ * destroy a state machine readers may still hold, freed once 
+ * their epoch sections end, see fsm_epoch.h
+ */
+extern RC_FSM_t 
+fsm_destroy_deferred(fsm_t **fsm);  
+
+
 /*
  * create and config a state machine
  */
@@ -336,5 +772,79 @@ fsm_engine(fsm_t *fsm,
            void *p2parm);
 
 
+/*
+ * build and validate a shared state machine class
+ */
+extern RC_FSM_t
+fsm_class_create(fsm_class_t **fsm_class,
+                 char *fsm_name,
+                 state_description_t *state_description_table,
+                 event_description_t *event_description_table,
+                 state_tuple_t *state_table);
+
+
+/*
+ * destroy a state machine class, all instances must be
+ * done with it
+ */
+extern RC_FSM_t
+fsm_class_destroy(fsm_class_t **fsm_class);
+
+
+/*
+ * report how a class compiled its tables, and show it
+ */
+extern RC_FSM_t
+fsm_class_get_layout(fsm_class_t *fsm_class, fsm_class_layout_t *layout);
+
+extern RC_FSM_t
+fsm_class_get_state_layout(fsm_class_t *fsm_class,
+                           uint32_t state,
+                           fsm_state_layout_t *layout);
+
+extern void
+fsm_display_layout(fsm_class_t *fsm_class);
+
+
+/*
+ * recompile the tables of a class in another layout mode, no
+ * thread may be running the class
+ */
+extern RC_FSM_t
+fsm_class_set_layout(fsm_class_t *fsm_class, uint32_t layout_mode);
+
+
+/*
+ * initialize a lightweight instance of a class
+ */
+extern RC_FSM_t
+fsm_instance_init(fsm_instance_t *instance,
+                  fsm_class_t *fsm_class,
+                  uint32_t initial_state);
+
+
+/* get instance state */
+extern RC_FSM_t
+fsm_instance_get_state(fsm_instance_t *instance, uint32_t *p2state);
+
+
+/*
+ * allows event handler to update the next state of an instance
+ */
+extern RC_FSM_t
+fsm_instance_set_exception_state(fsm_instance_t *instance,
+                                 uint32_t exception_state);
+
+
+/*
+ * API to drive a lightweight instance
+ */
+extern RC_FSM_t
+fsm_instance_engine(fsm_instance_t *instance,
+                    uint32_t normalized_event,
+                    void *p2event_buffer,
+                    void *p2parm);
+
+
 #endif  /* __FSM_H__ */
 
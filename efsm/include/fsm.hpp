@@ -0,0 +1,586 @@
+/*------------------------------------------------------------------
+ * fsm.hpp - C++ front-end with compile time table checks
+ *
+ * Copyright (c) 2005-2009 by Cisco Systems, Inc.
+ * All rights reserved. 
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *------------------------------------------------------------------
+ */
+
+
+
+#ifndef __FSM_HPP__
+#define __FSM_HPP__
+
+/*
+ * Header-only C++17 front-end.  States and events are enums, the
+ * transitions a constexpr table, and the checks fsm_create makes 
+ * of the C tables at run time are static_asserts here: normalized
+ * IDs, a transition for every state and event, next states in 
+ * range and the table sizes.  Handlers are callables, lambdas or
+ * function objects, each of its own type.  The engine finds the 
+ * row of a (state, event) in a constexpr table and switches on 
+ * it, with the handler inlined in its case, so there is no call
+ * through a pointer.  A plain function works too, through a 
+ * pointer the compiler knows.
+ *
+ * The same definition also builds the C tables, so a state machine
+ * moves over one at a time: fsm_create, fsm_class_create, 
+ * fsm_display_table and fsm_instance_engine all work on it, and an
+ * fsm_instance_t may be driven by either engine.
+ *
+ *    enum class state { idle, established };
+ *    enum class event { open, close };
+ *
+ *    constexpr auto states = efsm::names(
+ *        efsm::name(state::idle, "Idle State"),
+ *        efsm::name(state::established, "Established State"));
+ *
+ *    constexpr auto events = efsm::names(
+ *        efsm::name(event::open, "Open"),
+ *        efsm::name(event::close, "Close"));
+ *
+ *    constexpr auto rows = efsm::rows(
+ *        efsm::transition(state::idle, event::open, 
+ *                         [](void *, void *) { return RC_FSM_OK; },
+ *                         state::established),
+ *        efsm::transition(state::idle, event::close, efsm::none,
+ *                         state::idle),
+ *        ...);
+ *
+ *    using session_fsm = efsm::machine<states, events, rows>;
+ *
+ *    session_fsm::engine(&instance, event::open, p2event, p2parm);
+ *
+ * The definition must be constexpr variables with static storage,
+ * as above, since the machine takes them as template parameters.
+ */
+
+#include <cstddef>
+#include <array>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+extern "C" {
+#include "fsm.h"
+}
+
+
+namespace efsm {
+
+/*
+ * state or event ID and its description
+ */
+template <typename Id>
+struct name {
+    using id_type = Id;
+
+    Id           id;
+    const char  *description;
+
+    constexpr name (Id id, const char *description)
+        : id(id), description(description) { }
+};
+
+template <typename Id, typename... More>
+constexpr std::array<name<Id>, 1 + sizeof...(More)>
+names (name<Id> first, More... more)
+{
+    return {{ first, more... }};
+}
+
+
+/*
+ * handler of a transition without processing, the NULL handler 
+ * of the C tables: the event is accepted but there is no state
+ * transition
+ */
+struct no_handler { };
+
+constexpr no_handler none { };
+
+
+/*
+ * one transition, (state, event) -> handler, next state
+ */
+template <typename State, typename Event, typename Handler>
+struct row {
+    State      state;
+    Event      event;
+    Handler    handler;
+    State      next_state;
+};
+
+template <typename State, typename Event, typename Handler>
+constexpr row<State, Event, Handler>
+transition (State state, Event event, Handler handler, State next_state)
+{
+    return { state, event, handler, next_state };
+}
+
+template <typename... Rows>
+constexpr std::tuple<Rows...>
+rows (Rows... rows)
+{
+    return std::tuple<Rows...>(rows...);
+}
+
+
+/*
+ * The state machine of a definition.  States, Events and Rows 
+ * are the constexpr tables made with names and rows.  Everything
+ * is static, the state is kept by an fsm_instance_t or fsm_t.
+ */
+template <const auto &States, const auto &Events, const auto &Rows>
+class machine {
+  public:
+    using state_type = typename std::remove_cv_t<
+                           std::remove_reference_t<decltype(States)>>
+                           ::value_type::id_type;
+    using event_type = typename std::remove_cv_t<
+                           std::remove_reference_t<decltype(Events)>>
+                           ::value_type::id_type;
+
+    static constexpr std::size_t number_states = States.size();
+    static constexpr std::size_t number_events = Events.size();
+
+  private:
+    using rows_type = std::remove_cv_t<std::remove_reference_t<
+                                           decltype(Rows)>>;
+
+    static constexpr std::size_t number_rows = 
+                                     std::tuple_size_v<rows_type>;
+
+    using row_sequence = std::make_index_sequence<number_rows>;
+
+    template <std::size_t I>
+    using row_type = std::tuple_element_t<I, rows_type>;
+
+    template <std::size_t I>
+    using handler_type = decltype(row_type<I>::handler);
+
+    template <typename Id>
+    static constexpr std::size_t 
+    index (Id id)
+    {
+        return (static_cast<std::size_t>(id));
+    }
+
+    /*
+     * the checks of fsm_create, in constant expressions
+     */
+    template <const auto &Names>
+    static constexpr bool 
+    normalized ()
+    {
+        for (std::size_t i = 0; i < Names.size(); i++) {
+            if (index(Names[i].id) != i) {
+                return (false);
+            }
+        }
+        return (true);
+    }
+
+    template <std::size_t... I>
+    static constexpr bool 
+    rows_typed (std::index_sequence<I...>)
+    {
+        return ((std::is_same_v<decltype(row_type<I>::state), 
+                                state_type> &&
+                 std::is_same_v<decltype(row_type<I>::event), 
+                                event_type>) && ...);
+    }
+
+    template <std::size_t... I>
+    static constexpr bool 
+    handlers_callable (std::index_sequence<I...>)
+    {
+        return ((std::is_same_v<handler_type<I>, no_handler> ||
+                 std::is_invocable_r_v<RC_FSM_t, const handler_type<I> &,
+                                       void *, void *>) && ...);
+    }
+
+    template <std::size_t... I>
+    static constexpr bool 
+    rows_in_range (std::index_sequence<I...>)
+    {
+        return (((index(std::get<I>(Rows).state) < number_states) && 
+                 (index(std::get<I>(Rows).event) < number_events) &&
+                 (index(std::get<I>(Rows).next_state) < number_states))
+                && ...);
+    }
+
+    /*
+     * row of each (state, event) cell, and how many rows give it
+     */
+    struct cell_map {
+        std::size_t   row[number_states][number_events];
+        std::size_t   count[number_states][number_events];
+    };
+
+    static constexpr void 
+    place (cell_map &map, std::size_t i, std::size_t state, 
+           std::size_t event)
+    {
+        if (state < number_states && event < number_events) {
+            map.row[state][event] = i;
+            map.count[state][event]++;
+        }
+    }
+
+    template <std::size_t... I>
+    static constexpr cell_map 
+    map_cells (std::index_sequence<I...>)
+    {
+        cell_map map { };
+
+        (place(map, I, index(std::get<I>(Rows).state), 
+                       index(std::get<I>(Rows).event)), ...);
+        return (map);
+    }
+
+    static constexpr cell_map cells = map_cells(row_sequence { });
+
+    static constexpr bool
+    cells_complete ()
+    {
+        for (std::size_t i = 0; i < number_states; i++) {
+            for (std::size_t j = 0; j < number_events; j++) {
+                if (cells.count[i][j] == 0) {
+                    return (false);
+                }
+            }
+        }
+        return (true);
+    }
+
+    static constexpr bool
+    cells_unique ()
+    {
+        for (std::size_t i = 0; i < number_states; i++) {
+            for (std::size_t j = 0; j < number_events; j++) {
+                if (cells.count[i][j] > 1) {
+                    return (false);
+                }
+            }
+        }
+        return (true);
+    }
+
+    static_assert(number_states >= 1 && number_states < FSM_MAX_STATES,
+                  "the number of states is out of range");
+    static_assert(number_events >= 1 && number_events < FSM_MAX_EVENTS,
+                  "the number of events is out of range");
+    static_assert(normalized<States>(), 
+                  "state IDs must be 0, 1, ... in the order listed");
+    static_assert(normalized<Events>(), 
+                  "event IDs must be 0, 1, ... in the order listed");
+    static_assert(rows_typed(row_sequence { }),
+                  "transitions must use the state and event types");
+    static_assert(handlers_callable(row_sequence { }),
+                  "handlers must be callable as RC_FSM_t(void *, void *)"
+                  " or efsm::none");
+    static_assert(rows_in_range(row_sequence { }),
+                  "transition state, event or next state out of range");
+    static_assert(cells_complete(), 
+                  "every state needs a transition for every event");
+    static_assert(cells_unique(), 
+                  "a state has two transitions for the same event");
+
+    /*
+     * the handler of row I.  A row without a handler leaves the 
+     * next state at no_transition.
+     */
+    static constexpr uint32_t no_transition = FSM_NULL_STATE_ID;
+
+    template <std::size_t I>
+    static RC_FSM_t 
+    call (void *p2event_buffer, void *p2parm, uint32_t *next_state)
+    {
+        constexpr auto &r = std::get<I>(Rows);
+
+        if constexpr (std::is_same_v<handler_type<I>, no_handler>) {
+            return (RC_FSM_OK);
+        } else {
+            *next_state = static_cast<uint32_t>(index(r.next_state));
+            return (r.handler(p2event_buffer, p2parm));
+        }
+    }
+
+    /*
+     * call<I> of the rows in [Lo, Hi).  The rows are split in 
+     * halves down to blocks of up to 16, each a switch the compiler
+     * makes a jump table of, so the engine reaches a row with a
+     * few compares and one direct jump, and call<I> and its handler
+     * inline in the case.
+     */
+    static constexpr std::size_t dispatch_block = 16;
+
+    template <std::size_t I, std::size_t Hi>
+    static RC_FSM_t 
+    call_at (void *p2event_buffer, void *p2parm, uint32_t *next_state)
+    {
+        if constexpr (I < Hi) {
+            return (call<I>(p2event_buffer, p2parm, next_state));
+        } else {
+            return (RC_FSM_INVALID_EVENT);
+        }
+    }
+
+    template <std::size_t Lo, std::size_t Hi>
+    static RC_FSM_t 
+    dispatch (std::size_t row, void *p2event_buffer, void *p2parm, 
+              uint32_t *next_state)
+    {
+        if constexpr (Hi - Lo > dispatch_block) {
+            constexpr std::size_t mid = Lo + (Hi - Lo) / 2;
+
+            if (row < mid) {
+                return (dispatch<Lo, mid>(row, p2event_buffer, p2parm,
+                                          next_state));
+            }
+            return (dispatch<mid, Hi>(row, p2event_buffer, p2parm,
+                                      next_state));
+        } else {
+            switch (row - Lo) {
+            case 0:
+                return (call_at<Lo + 0, Hi>(p2event_buffer, p2parm, 
+                                            next_state));
+            case 1:
+                return (call_at<Lo + 1, Hi>(p2event_buffer, p2parm, 
+                                            next_state));
+            case 2:
+                return (call_at<Lo + 2, Hi>(p2event_buffer, p2parm, 
+                                            next_state));
+            case 3:
+                return (call_at<Lo + 3, Hi>(p2event_buffer, p2parm, 
+                                            next_state));
+            case 4:
+                return (call_at<Lo + 4, Hi>(p2event_buffer, p2parm, 
+                                            next_state));
+            case 5:
+                return (call_at<Lo + 5, Hi>(p2event_buffer, p2parm, 
+                                            next_state));
+            case 6:
+                return (call_at<Lo + 6, Hi>(p2event_buffer, p2parm, 
+                                            next_state));
+            case 7:
+                return (call_at<Lo + 7, Hi>(p2event_buffer, p2parm, 
+                                            next_state));
+            case 8:
+                return (call_at<Lo + 8, Hi>(p2event_buffer, p2parm, 
+                                            next_state));
+            case 9:
+                return (call_at<Lo + 9, Hi>(p2event_buffer, p2parm, 
+                                            next_state));
+            case 10:
+                return (call_at<Lo + 10, Hi>(p2event_buffer, p2parm, 
+                                             next_state));
+            case 11:
+                return (call_at<Lo + 11, Hi>(p2event_buffer, p2parm, 
+                                             next_state));
+            case 12:
+                return (call_at<Lo + 12, Hi>(p2event_buffer, p2parm, 
+                                             next_state));
+            case 13:
+                return (call_at<Lo + 13, Hi>(p2event_buffer, p2parm, 
+                                             next_state));
+            case 14:
+                return (call_at<Lo + 14, Hi>(p2event_buffer, p2parm, 
+                                             next_state));
+            case 15:
+                return (call_at<Lo + 15, Hi>(p2event_buffer, p2parm, 
+                                             next_state));
+            default:
+                return (RC_FSM_INVALID_EVENT);
+            }
+        }
+    }
+
+    /*
+     * the C handler of row I, for the C tables
+     */
+    template <std::size_t I>
+    static RC_FSM_t 
+    trampoline (void *p2event_buffer, void *p2parm)
+    {
+        return (std::get<I>(Rows).handler(p2event_buffer, p2parm));
+    }
+
+    struct c_tables {
+        state_description_t   states[number_states + 1];
+        event_description_t   events[number_events + 1];
+        event_tuple_t         cells[number_states][number_events];
+        state_tuple_t         table[number_states + 1];
+    };
+
+    template <std::size_t I>
+    static void 
+    c_row (c_tables &t)
+    {
+        event_tuple_t &cell = t.cells[index(std::get<I>(Rows).state)]
+                                     [index(std::get<I>(Rows).event)];
+
+        cell.eventID = static_cast<uint32_t>(index(std::get<I>(Rows).event));
+        cell.next_state = 
+               static_cast<uint32_t>(index(std::get<I>(Rows).next_state));
+        if constexpr (std::is_same_v<handler_type<I>, no_handler>) {
+            cell.event_handler = NULL;
+        } else {
+            cell.event_handler = &trampoline<I>;
+        }
+    }
+
+    template <std::size_t... I>
+    static void 
+    c_rows (c_tables &t, std::index_sequence<I...>)
+    {
+        (c_row<I>(t), ...);
+    }
+
+    static c_tables 
+    build_c_tables ()
+    {
+        c_tables t { };
+        std::size_t i;
+
+        for (i = 0; i < number_states; i++) {
+            t.states[i].state_id = static_cast<uint32_t>(i);
+            t.states[i].description = 
+                               const_cast<char *>(States[i].description);
+        }
+        t.states[i].state_id = FSM_NULL_STATE_ID;
+
+        for (i = 0; i < number_events; i++) {
+            t.events[i].event_id = static_cast<uint32_t>(i);
+            t.events[i].description = 
+                               const_cast<char *>(Events[i].description);
+        }
+        t.events[i].event_id = FSM_NULL_EVENT_ID;
+
+        c_rows(t, row_sequence { });
+        return (t);
+    }
+
+  public:
+    /*
+     * The C tables of the definition, built once.  They live as 
+     * long as the program, as fsm_create requires.
+     */
+    static c_tables &
+    tables ()
+    {
+        static c_tables t = build_c_tables();
+        static bool linked = link_tables(t);
+
+        (void)linked;
+        return (t);
+    }
+
+    /*
+     * class and state machine of the C library on the definition
+     */
+    static RC_FSM_t 
+    class_create (fsm_class_t **fsm_class, 
+                  const char *name = "State Machine")
+    {
+        c_tables &t = tables();
+
+        return (fsm_class_create(fsm_class, const_cast<char *>(name),
+                                 t.states, t.events, t.table));
+    }
+
+    static RC_FSM_t 
+    create (fsm_t **fsm, state_type initial_state,
+            const char *name = "State Machine")
+    {
+        c_tables &t = tables();
+
+        return (fsm_create(fsm, const_cast<char *>(name),
+                           static_cast<uint32_t>(index(initial_state)),
+                           t.states, t.events, t.table));
+    }
+
+    /*
+     * Drives an instance, with the results of fsm_instance_engine 
+     * including exception states.  The handler is called directly,
+     * without the class, so the class statistics are not kept.  
+     */
+    static RC_FSM_t
+    engine (fsm_instance_t *instance,
+            event_type normalized_event,
+            void *p2event_buffer,
+            void *p2parm)
+    {
+        uint32_t next_state;
+        RC_FSM_t rc;
+
+        if (index(normalized_event) >= number_events) {
+            return (RC_FSM_INVALID_EVENT);
+        }
+
+        next_state = no_transition;
+        rc = dispatch<0, number_rows>(cells.row[instance->curr_state]
+                                               [index(normalized_event)],
+                                      p2event_buffer, p2parm, 
+                                      &next_state);
+
+        /* the NULL handler of the C tables */
+        if (rc != RC_FSM_OK || next_state == no_transition) {
+            return (rc);
+        }
+
+        if (instance->flags & FSM_INSTANCE_EXCEPTION) {
+            instance->flags &= ~FSM_INSTANCE_EXCEPTION;
+            next_state = instance->exception_state;
+        }
+        instance->curr_state = static_cast<uint16_t>(next_state);
+        return (RC_FSM_OK);
+    }
+
+    static state_type 
+    state (const fsm_instance_t *instance)
+    {
+        return (static_cast<state_type>(instance->curr_state));
+    }
+
+  private:
+    static bool 
+    link_tables (c_tables &t)
+    {
+        std::size_t i;
+
+        for (i = 0; i < number_states; i++) {
+            t.table[i].state_id = static_cast<uint32_t>(i);
+            t.table[i].p2event_tuple = t.cells[i];
+        }
+        t.table[i].state_id = FSM_NULL_STATE_ID;
+        t.table[i].p2event_tuple = NULL;
+        return (true);
+    }
+};
+
+}  /* namespace efsm */
+
+#endif /* __FSM_HPP__ */
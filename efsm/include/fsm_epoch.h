@@ -0,0 +1,90 @@
+/*------------------------------------------------------------------
+ * fsm_epoch.h - Finite State Machine epoch based reclamation
+ *
+ * Copyright (c) 2005-2009 by Cisco Systems, Inc.
+ * All rights reserved. 
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *------------------------------------------------------------------
+ */
+
+
+
+#ifndef __FSM_EPOCH_H__
+#define __FSM_EPOCH_H__
+
+#include "fsm.h"
+
+
+/*
+ * Epoch based reclamation.  A thread that reads state machines 
+ * other threads may destroy, say looked up in a shared table, does
+ * so between fsm_epoch_enter and fsm_epoch_exit.  State machines 
+ * destroyed with fsm_destroy_deferred, and any object retired with
+ * fsm_epoch_retire, are only freed once every thread that was in 
+ * such a section when they were retired has left it.  Readers take
+ * no lock and write only their own epoch.
+ *
+ * Retired objects wait on a list of the retiring thread and are 
+ * freed by its later calls once the global epoch has moved on 
+ * twice.  The lists of threads that exit are handed to the next 
+ * thread to poll.
+ */
+
+/* retires between two attempts to reclaim */
+#define FSM_EPOCH_POLL     ( 64 )
+
+
+/* reclaim routine of a retired object */
+typedef void (*fsm_epoch_reclaim_t)(void *object);
+
+
+/*
+ * read-side sections, they nest
+ */
+extern void
+fsm_epoch_enter(void);
+
+extern void
+fsm_epoch_exit(void);
+
+
+/*
+ * free the object with reclaim once no reader can hold it
+ */
+extern RC_FSM_t
+fsm_epoch_retire(void *object, fsm_epoch_reclaim_t reclaim);
+
+
+/*
+ * try to move the epoch on and reclaim what the calling thread
+ * retired, and reclaim everything retired, waiting for readers
+ */
+extern void
+fsm_epoch_poll(void);
+
+extern void
+fsm_epoch_drain(void);
+
+
+#endif  /* __FSM_EPOCH_H__ */
+
@@ -0,0 +1,149 @@
+/*------------------------------------------------------------------
+ * fsm_executor.h - Finite State Machine multi-core executor
+ *
+ * Copyright (c) 2005-2009 by Cisco Systems, Inc.
+ * All rights reserved. 
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *------------------------------------------------------------------
+ */
+
+
+
+#ifndef __FSM_EXECUTOR_H__
+#define __FSM_EXECUTOR_H__
+
+#include <pthread.h>
+
+#include "fsm.h"
+#include "fsm_mailbox.h"
+
+
+/* largest number of worker threads */
+#define FSM_EXECUTOR_MAX_WORKERS   ( 256 )
+
+/* default number of events a worker drains from a mailbox in a go */
+#define FSM_EXECUTOR_QUANTUM       ( 64 )
+
+
+/*
+ * Worker counters, see fsm_executor_get_stats
+ *
+ * drains is the number of mailbox drains run by the worker.
+ *
+ * events is the number of events those drains processed.
+ *
+ * steals is the number of mailboxes taken from other workers.
+ *
+ * sleeps is the number of times the worker found no work.
+ */
+typedef struct {
+    uint64_t   drains;
+    uint64_t   events;
+    uint64_t   steals;
+    uint64_t   sleeps;
+} fsm_worker_stats_t;
+
+
+/*
+ * Executor worker.  Each worker owns a run-queue of the mailboxes 
+ * that have events pending, linked through the mailboxes.  Workers
+ * are cache line aligned so that neighbours do not share a line.
+ */
+typedef struct {
+    pthread_mutex_t      lock;
+    fsm_mailbox_t       *run_head;
+    fsm_mailbox_t       *run_tail;
+    uint32_t             run_length;
+
+    pthread_t            thread;
+    uint32_t             index;
+    struct fsm_executor_s *executor;
+
+    fsm_worker_stats_t   stats;
+} __attribute__((aligned(FSM_CACHE_LINE))) fsm_worker_t;
+
+
+/*
+ * Sharded executor.  Mailboxes are homed on a worker by a hash of
+ * their state machine.  A worker drains the mailboxes of its own
+ * run-queue and, when that is empty, steals whole mailboxes from
+ * the other workers.  Since a mailbox is scheduled on at most one
+ * run-queue at a time and drained by one worker at a time, the 
+ * events of each state machine are processed in order.
+ */
+#define FSM_EXECUTOR_TAG  ( 0xe8ec0101 )
+
+typedef struct fsm_executor_s {
+    /* for executor validation */
+    uint32_t             tag;
+
+    uint32_t             number_workers;
+    uint32_t             quantum;
+    uint32_t             running;
+
+    fsm_worker_t        *workers;
+
+    /* idle workers wait here */
+    pthread_mutex_t      idle_lock;
+    pthread_cond_t       idle_cond;
+    uint32_t             sleepers;
+} fsm_executor_t;
+
+
+/*
+ * create an executor and start its worker threads
+ */
+extern RC_FSM_t
+fsm_executor_create(fsm_executor_t **executor,
+                    uint32_t number_workers,
+                    uint32_t quantum);
+
+
+/*
+ * stop the worker threads and destroy the executor
+ */
+extern RC_FSM_t
+fsm_executor_destroy(fsm_executor_t **executor);
+
+
+/*
+ * post an event to a mailbox and schedule it on the executor
+ */
+extern RC_FSM_t
+fsm_executor_post(fsm_executor_t *executor,
+                  fsm_mailbox_t *mailbox,
+                  uint32_t normalized_event,
+                  void *p2event_buffer,
+                  void *p2parm);
+
+
+/*
+ * read the counters of a worker
+ */
+extern RC_FSM_t
+fsm_executor_get_stats(fsm_executor_t *executor,
+                       uint32_t worker,
+                       fsm_worker_stats_t *stats);
+
+
+#endif  /* __FSM_EXECUTOR_H__ */
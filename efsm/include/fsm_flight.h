@@ -0,0 +1,132 @@
+/*------------------------------------------------------------------
+ * fsm_flight.h - Finite State Machine flight recorder
+ *
+ * Copyright (c) 2005-2009 by Cisco Systems, Inc.
+ * All rights reserved. 
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *------------------------------------------------------------------
+ */
+
+
+
+#ifndef __FSM_FLIGHT_H__
+#define __FSM_FLIGHT_H__
+
+#include "fsm.h"
+#include "fsm_trace.h"
+
+
+/* space at the start of the file for the header */
+#define FSM_FLIGHT_HEADER_SIZE   ( 4096 )
+
+/* space after the header for the class names */
+#define FSM_FLIGHT_NAMES_SIZE    ( 64 * 1024 )
+
+/* record rings, a thread writes to ring thread % FSM_FLIGHT_REGIONS */
+#define FSM_FLIGHT_REGIONS       ( 16 )
+
+/* smallest record ring */
+#define FSM_FLIGHT_MIN_RECORDS   ( 64 )
+
+
+/*
+ * Flight recorder file.  The file is mapped shared and written 
+ * with plain stores, so what was written is in the file even when
+ * the process dies.  All values are in host byte order.
+ *
+ *    fsm_flight_header_t, padded to FSM_FLIGHT_HEADER_SIZE
+ *    class names at names_offset, names_used bytes of entries of
+ *        fsm_trace_file_class_t followed by number_states strings
+ *        and number_events strings, each a uint32_t length and the 
+ *        characters
+ *    number_regions fsm_flight_region_t at regions_offset
+ *    number_regions rings of number_records fsm_trace_record_t at
+ *        records_offset, record n of region r in slot 
+ *        r * number_records + n % number_records
+ *
+ * Each thread writes to the region of its thread number, so the
+ * threads do not share the head they claim slots from.  The head
+ * of a region is the number of records claimed in it.  A slot 
+ * holds record n when its reserved field is the low 32 bits of 
+ * n + 1, anything else is a record cut short by the crash.  The 
+ * regions are merged by time stamp when the file is read.
+ */
+#define FSM_FLIGHT_MAGIC         ( 0x46534d46 )    /* "FSMF" */
+#define FSM_FLIGHT_VERSION       ( 2 )
+
+typedef struct {
+    uint64_t   head;
+    uint8_t    pad[FSM_CACHE_LINE - sizeof(uint64_t)];
+} fsm_flight_region_t;
+
+typedef struct {
+    uint32_t   magic;
+    uint32_t   version;
+    uint32_t   record_size;
+    uint32_t   number_records;
+
+    uint32_t   names_offset;
+    uint32_t   names_size;
+    uint32_t   names_used;
+    uint32_t   records_offset;
+
+    uint32_t   number_regions;
+    uint32_t   regions_offset;
+
+    /* time stamp ticks per second, calibrated at open */
+    uint64_t   tsc_hz;
+
+    /* time stamp and wall clock, nanoseconds since the epoch, at open */
+    uint64_t   open_tsc;
+    uint64_t   open_time;
+
+    uint32_t   pid;
+
+    /* set by fsm_flight_recorder_close */
+    uint32_t   closed;
+} fsm_flight_header_t;
+
+
+/*
+ * open a file of size bytes as the flight recorder and start 
+ * recording every fsm_engine event
+ */
+extern RC_FSM_t
+fsm_flight_recorder_open(char *path, uint64_t size);
+
+
+/*
+ * stop recording and close the file
+ */
+extern RC_FSM_t
+fsm_flight_recorder_close(void);
+
+
+/*
+ * write a record, called by the engine while the recorder is open
+ */
+extern void
+fsm_flight_record(fsm_class_t *fsm_class, fsm_trace_record_t *record);
+
+
+#endif  /* __FSM_FLIGHT_H__ */
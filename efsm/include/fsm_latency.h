@@ -0,0 +1,104 @@
+/*------------------------------------------------------------------
+ * fsm_latency.h - Finite State Machine handler latency histograms
+ *
+ * Copyright (c) 2005-2009 by Cisco Systems, Inc.
+ * All rights reserved. 
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *------------------------------------------------------------------
+ */
+
+
+
+#ifndef __FSM_LATENCY_H__
+#define __FSM_LATENCY_H__
+
+#include "fsm.h"
+
+
+/*
+ * Log-linear histogram of handler durations in time stamp counter
+ * ticks.  Durations below FSM_LATENCY_SUB_BUCKETS have a bucket 
+ * each, above that every power of two is split in 
+ * FSM_LATENCY_SUB_BUCKETS buckets, about 3% wide.  Durations of 
+ * 2^32 ticks and more go in the last bucket.
+ */
+#define FSM_LATENCY_SUB_BITS      ( 5 )
+#define FSM_LATENCY_SUB_BUCKETS   ( 1 << FSM_LATENCY_SUB_BITS )
+#define FSM_LATENCY_BUCKETS       ( FSM_LATENCY_SUB_BUCKETS * \
+                                    (32 - FSM_LATENCY_SUB_BITS + 1) )
+
+/*
+ * threads with private histograms, threads numbered beyond share
+ * one set with atomic increments
+ */
+#define FSM_LATENCY_SHARDS        ( 64 )
+
+
+/*
+ * Latency of one handler, merged over the threads, in ticks.  The
+ * percentiles are the top of the bucket they fall in, max is exact.
+ */
+typedef struct {
+    uint64_t   count;
+    uint64_t   p50;
+    uint64_t   p99;
+    uint64_t   p999;
+    uint64_t   max;
+} fsm_latency_stats_t;
+
+
+/*
+ * time the handlers of a state machine, sets or clears 
+ * FSM_FLAG_LATENCY in fsm->flags
+ */
+extern RC_FSM_t
+fsm_latency_enable(fsm_t *fsm);
+
+extern RC_FSM_t
+fsm_latency_disable(fsm_t *fsm);
+
+
+/*
+ * latency of a handler of a class, by handler or by table cell
+ */
+extern RC_FSM_t
+fsm_latency_get(fsm_class_t *fsm_class, 
+                event_cb_t event_handler, 
+                fsm_latency_stats_t *stats);
+
+extern RC_FSM_t
+fsm_latency_get_cell(fsm_class_t *fsm_class, 
+                     uint32_t state,
+                     uint32_t normalized_event,
+                     fsm_latency_stats_t *stats);
+
+
+/*
+ * zero the histograms of a class
+ */
+extern RC_FSM_t
+fsm_latency_reset(fsm_class_t *fsm_class);
+
+
+#endif  /* __FSM_LATENCY_H__ */
+
@@ -0,0 +1,179 @@
+/*------------------------------------------------------------------
+ * fsm_mailbox.h - Finite State Machine lock-free mailbox
+ *
+ * Copyright (c) 2005-2009 by Cisco Systems, Inc.
+ * All rights reserved. 
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *------------------------------------------------------------------
+ */
+
+
+
+#ifndef __FSM_MAILBOX_H__
+#define __FSM_MAILBOX_H__
+
+#include "fsm.h"
+
+
+/*
+ * One slot of the mailbox ring.  The sequence number tells the
+ * producers and the consumer whose turn it is to use the slot.
+ */
+typedef struct {
+    uint32_t   sequence;
+    uint32_t   normalized_event;
+    void      *p2event_buffer;
+    void      *p2parm;
+} fsm_mailbox_slot_t;
+
+
+/* drain batch sizes are counted in power of two buckets */
+#define FSM_MAILBOX_BATCH_BUCKETS   ( 8 )
+
+/*
+ * Mailbox counters, see fsm_mailbox_get_stats
+ *
+ * depth is the number of events waiting when read.
+ *
+ * posted and post_failures count the producer enqueues that
+ *      succeeded and those that found the mailbox full.
+ *
+ * drains and drained count the consumer drains and the events
+ *      they processed, max_drain is the largest drain.  A drain
+ *      ends when the consumer gives the scheduled flag back or 
+ *      keeps it for a later drain, so a call that takes the flag
+ *      back for a late event counts two drains.
+ *
+ * drain_batch[i] counts the drains of 2^(i-1) < n <= 2^i events,
+ *      the last bucket holds all the larger drains.
+ */
+typedef struct {
+    uint32_t   depth;
+    uint64_t   posted;
+    uint64_t   post_failures;
+    uint64_t   drains;
+    uint64_t   drained;
+    uint32_t   max_drain;
+    uint64_t   drain_batch[FSM_MAILBOX_BATCH_BUCKETS];
+} fsm_mailbox_stats_t;
+
+
+/*
+ * Lock-free multi-producer, single-consumer mailbox attached to
+ * one state machine.  Any thread may post events, producers never
+ * block.  The scheduled flag makes sure that exactly one thread at
+ * a time drains the mailbox into fsm_engine: the producer whose 
+ * post finds the mailbox idle is told to schedule a drain, and the 
+ * drain hands the flag back once the mailbox is empty.
+ *
+ * The producer and consumer fields are kept on separate cache 
+ * lines.
+ */
+#define FSM_MAILBOX_TAG  ( 0x3a11b0c5 )
+
+typedef struct fsm_mailbox_s {
+    /* for mailbox validation */
+    uint32_t             tag;
+
+    /* number of slots, a power of two */
+    uint32_t             size;
+
+    fsm_mailbox_slot_t  *slots;
+
+    /* state machine driven by the drains */
+    fsm_t               *fsm;
+
+    uint8_t              pad0[FSM_CACHE_LINE - 
+                              (2 * sizeof(uint32_t)) - 
+                              (2 * sizeof(void *))];
+
+    /* producers */
+    uint32_t             tail;
+    uint32_t             pad1;
+    uint64_t             posted;
+    uint64_t             post_failures;
+
+    uint8_t              pad2[FSM_CACHE_LINE - 
+                              (2 * sizeof(uint32_t)) - 
+                              (2 * sizeof(uint64_t))];
+
+    /* consumer */
+    uint32_t             scheduled;
+    uint32_t             head;
+    uint64_t             drains;
+    uint64_t             drained;
+    uint32_t             max_drain;
+    uint64_t             drain_batch[FSM_MAILBOX_BATCH_BUCKETS];
+
+    /* run-queue link while scheduled on an executor worker */
+    struct fsm_mailbox_s *next_scheduled;
+} fsm_mailbox_t;
+
+
+/*
+ * create a mailbox for a state machine
+ */
+extern RC_FSM_t
+fsm_mailbox_create(fsm_mailbox_t **mailbox,
+                   fsm_t *fsm,
+                   uint32_t size);
+
+
+/*
+ * destroy a mailbox, no thread may be using it
+ */
+extern RC_FSM_t
+fsm_mailbox_destroy(fsm_mailbox_t **mailbox);
+
+
+/*
+ * post an event from any thread
+ */
+extern RC_FSM_t
+fsm_mailbox_post(fsm_mailbox_t *mailbox,
+                 uint32_t normalized_event,
+                 void *p2event_buffer,
+                 void *p2parm,
+                 boolean_t *p2schedule);
+
+
+/*
+ * drain the mailbox into the state machine, by the thread that 
+ * holds the scheduled flag
+ */
+extern RC_FSM_t
+fsm_mailbox_drain(fsm_mailbox_t *mailbox,
+                  uint32_t max_events,
+                  boolean_t *p2reschedule,
+                  uint32_t *p2drained);
+
+
+/*
+ * read the mailbox counters
+ */
+extern RC_FSM_t
+fsm_mailbox_get_stats(fsm_mailbox_t *mailbox,
+                      fsm_mailbox_stats_t *stats);
+
+
+#endif  /* __FSM_MAILBOX_H__ */
@@ -0,0 +1,186 @@
+/*------------------------------------------------------------------
+ * fsm_pool.h - Finite State Machine object pool
+ *
+ * Copyright (c) 2005-2009 by Cisco Systems, Inc.
+ * All rights reserved. 
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *------------------------------------------------------------------
+ */
+
+
+
+#ifndef __FSM_POOL_H__
+#define __FSM_POOL_H__
+
+#include <pthread.h>
+
+#include "fsm.h"
+
+
+/* default number of state machines per slab */
+#define FSM_POOL_SLAB_OBJECTS     ( 1024 )
+
+/* most free objects a thread keeps for itself */
+#define FSM_POOL_CACHE_MAX        ( 64 )
+
+/* objects moved between a thread and the pool in one go */
+#define FSM_POOL_CACHE_BATCH      ( 32 )
+
+/*
+ * Pool flags
+ *
+ * FSM_POOL_HUGEPAGES backs the slabs with huge pages where the 
+ *          system has them, falling back to normal pages.
+ */
+#define FSM_POOL_HUGEPAGES        ( 0x0001 )
+
+
+/*
+ * Pool occupancy, see fsm_pool_get_stats
+ *
+ * object_size is the bytes per state machine, fsm_t and the pool's
+ *          history depth, rounded up to a cache line.
+ *
+ * slabs is the number of slabs, hugepage_slabs of them are backed
+ *          by huge pages.
+ *
+ * capacity is the number of objects in all slabs, in_use of them
+ *          are live state machines and cached of the free ones 
+ *          are held by the threads.
+ *
+ * bytes_reserved is the memory held by the slabs.
+ *
+ * occupancy is in_use as a percentage of capacity.
+ *
+ * fragmentation is the percentage of the free objects that sit in
+ *          slabs that also hold live state machines.
+ */
+typedef struct {
+    uint32_t   object_size;
+    uint32_t   slabs;
+    uint32_t   hugepage_slabs;
+    uint64_t   capacity;
+    uint64_t   in_use;
+    uint64_t   cached;
+    uint64_t   bytes_reserved;
+    uint32_t   occupancy;
+    uint32_t   fragmentation;
+} fsm_pool_stats_t;
+
+
+/*
+ * Slab of pool objects, one contiguous cache aligned block
+ */
+typedef struct {
+    void          *base;
+    uint64_t       bytes;
+    boolean_t      hugepages;
+} fsm_pool_slab_t;
+
+
+/*
+ * Object pool for state machines.  Each object holds an fsm_t and
+ * a history buffer of a fixed depth, possibly none.  Free objects 
+ * are kept on a per-thread free list first and on the shared free 
+ * list behind the lock when a thread has too many or too few, so 
+ * create and destroy normally touch neither the lock nor the 
+ * system allocator.
+ */
+#define FSM_POOL_TAG  ( 0x900150a1 )
+
+typedef struct fsm_pool_s {
+    /* for pool validation */
+    uint32_t              tag;
+    uint32_t              flags;
+
+    uint32_t              object_size;
+    uint32_t              slab_objects;
+
+    /* history entries held in each object and where they end */
+    uint32_t              history_depth;
+    uint32_t              trailer_offset;
+
+    /* per-thread free lists */
+    pthread_key_t         cache_key;
+
+    /* protects all that follows */
+    pthread_mutex_t       lock;
+
+    /* shared free list */
+    void                 *free_head;
+    uint64_t              free_count;
+
+    /* per-thread free lists, for the stats and destroy */
+    struct fsm_pool_cache_s *caches;
+
+    fsm_pool_slab_t      *slabs;
+    uint32_t              number_slabs;
+    uint32_t              max_slabs;
+} fsm_pool_t;
+
+
+/*
+ * create a pool, preallocating room for a number of state machines
+ */
+extern RC_FSM_t
+fsm_pool_create(fsm_pool_t **pool,
+                uint32_t slab_objects,
+                uint32_t initial_objects,
+                uint32_t history_depth,
+                uint32_t flags);
+
+
+/*
+ * destroy a pool and all its slabs, refused while a state machine
+ * of the pool is live
+ */
+extern RC_FSM_t
+fsm_pool_destroy(fsm_pool_t **pool);
+
+
+/*
+ * create a state machine of a class in a pool
+ */
+extern RC_FSM_t
+fsm_create_in_pool(fsm_pool_t *pool,
+                   fsm_t **fsm,
+                   fsm_class_t *fsm_class,
+                   uint32_t initial_state);
+
+
+/*
+ * return a destroyed state machine to its pool, called by 
+ * fsm_destroy
+ */
+extern void
+fsm_pool_release(fsm_pool_t *pool, fsm_t *fsm);
+
+
+/*
+ * pool occupancy and fragmentation
+ */
+extern RC_FSM_t
+fsm_pool_get_stats(fsm_pool_t *pool, fsm_pool_stats_t *stats);
+
+
+#endif  /* __FSM_POOL_H__ */
@@ -0,0 +1,120 @@
+/*------------------------------------------------------------------
+ * fsm_population.h - Finite State Machine state populations
+ *
+ * Copyright (c) 2005-2009 by Cisco Systems, Inc.
+ * All rights reserved. 
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *------------------------------------------------------------------
+ */
+
+
+
+#ifndef __FSM_POPULATION_H__
+#define __FSM_POPULATION_H__
+
+#include "fsm.h"
+
+
+/*
+ * fsm_population_enable flags, FSM_POPULATION_DWELL also keeps 
+ * the time each state machine entered its state and records how
+ * long it stayed
+ */
+#define FSM_POPULATION_DWELL      ( 0x0001 )
+
+/*
+ * Log-linear histogram of dwell times in time stamp counter ticks,
+ * every power of two split in FSM_DWELL_SUB_BUCKETS buckets, about
+ * 12% wide, over the full 64 bit range.
+ */
+#define FSM_DWELL_SUB_BITS        ( 3 )
+#define FSM_DWELL_SUB_BUCKETS     ( 1 << FSM_DWELL_SUB_BITS )
+#define FSM_DWELL_BUCKETS         ( FSM_DWELL_SUB_BUCKETS * \
+                                    (64 - FSM_DWELL_SUB_BITS + 1) )
+
+/*
+ * threads with private counters, threads numbered beyond share 
+ * one set with atomic updates
+ */
+#define FSM_POPULATION_SHARDS     ( 64 )
+
+
+/*
+ * Dwell time in a state, merged over the threads, in ticks.  A 
+ * stay is recorded when a transition leaves the state.  The 
+ * percentiles are the top of the bucket they fall in, max is exact.
+ */
+typedef struct {
+    uint64_t   count;
+    uint64_t   p50;
+    uint64_t   p99;
+    uint64_t   p999;
+    uint64_t   max;
+} fsm_dwell_stats_t;
+
+
+/*
+ * start keeping the population of each state of a class, for the
+ * state machines and stores created on it from then on
+ */
+extern RC_FSM_t
+fsm_population_enable(fsm_class_t *fsm_class, uint32_t flags);
+
+
+/*
+ * count a state machine created before the population was enabled
+ */
+extern RC_FSM_t
+fsm_population_track(fsm_t *fsm);
+
+
+/*
+ * state machines currently in a state
+ */
+extern RC_FSM_t
+fsm_population_get(fsm_class_t *fsm_class, 
+                   uint32_t state, 
+                   uint64_t *population);
+
+
+/*
+ * dwell time in a state, and zero the dwell times of a class
+ */
+extern RC_FSM_t
+fsm_dwell_get(fsm_class_t *fsm_class, 
+              uint32_t state, 
+              fsm_dwell_stats_t *stats);
+
+extern RC_FSM_t
+fsm_dwell_reset(fsm_class_t *fsm_class);
+
+
+/*
+ * show the population and dwell time of each state
+ */
+extern void
+fsm_display_population(fsm_class_t *fsm_class);
+
+
+#endif  /* __FSM_POPULATION_H__ */
+
@@ -0,0 +1,168 @@
+/*------------------------------------------------------------------
+ * fsm_session.h - Finite State Machine session table
+ *
+ * Copyright (c) 2005-2009 by Cisco Systems, Inc.
+ * All rights reserved. 
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *------------------------------------------------------------------
+ */
+
+
+
+#ifndef __FSM_SESSION_H__
+#define __FSM_SESSION_H__
+
+#include "fsm.h"
+
+
+/*
+ * Handle of a session in the table, the slot index in the low 32
+ * bits and a 32 bit generation in the high bits.  The generation 
+ * moves on when the session is removed, so a handle kept past the
+ * removal is refused rather than reaching a reused slot.  A slot 
+ * whose generation would wrap is retired instead of reused.  0 is
+ * never a handle.
+ */
+typedef uint64_t fsm_session_handle_t;
+
+#define FSM_SESSION_NULL_HANDLE   ( 0 )
+#define FSM_SESSION_INDEX_BITS    ( 32 )
+
+/* largest table */
+#define FSM_SESSION_MAX           ( 1 << 24 )
+
+
+/*
+ * Bucket of the open addressing index, four to a cache line.  The
+ * key is kept in the bucket so a lookup reads no slot, handle is
+ * FSM_SESSION_NULL_HANDLE when the bucket is empty.
+ */
+typedef struct {
+    uint64_t              key;
+    fsm_session_handle_t  handle;
+} fsm_session_bucket_t;
+
+/* slot of a session, addressed by the handle index */
+typedef struct {
+    uint64_t   key;
+    fsm_t     *fsm;
+    uint32_t   generation;
+    uint32_t   next_free;
+} fsm_session_slot_t;
+
+
+/*
+ * Session table.  Maps a user session ID, such as the 64 bit ID 
+ * carried by the protocol messages, to its state machine.  The 
+ * index is linear probing over a power of two number of buckets, 
+ * at most half full, with backward shift removal so there are no
+ * tombstones.  The sessions are held in a slot array with a free 
+ * list, slots are reused and no memory is allocated per session.
+ *
+ * The table is not locked, a table is used by one thread at a 
+ * time, as a store is.
+ */
+#define FSM_SESSION_TAG    ( 0x5e551011 )
+
+typedef struct {
+    /* for table validation */
+    uint32_t               tag;
+
+    uint32_t               capacity;
+    uint32_t               count;
+
+    fsm_session_bucket_t  *buckets;
+    uint32_t               bucket_mask;
+
+    fsm_session_slot_t    *slots;
+    uint32_t               free_slot;
+} fsm_session_table_t;
+
+
+/*
+ * create and destroy a session table of capacity sessions
+ */
+extern RC_FSM_t
+fsm_session_table_create(fsm_session_table_t **table, uint32_t capacity);
+
+extern RC_FSM_t
+fsm_session_table_destroy(fsm_session_table_t **table);
+
+
+/*
+ * add a session and its state machine, returning its handle
+ */
+extern RC_FSM_t
+fsm_session_insert(fsm_session_table_t *table,
+                   uint64_t key,
+                   fsm_t *fsm,
+                   fsm_session_handle_t *p2handle);
+
+
+/*
+ * remove a session, the handle goes stale
+ */
+extern RC_FSM_t
+fsm_session_remove(fsm_session_table_t *table, 
+                   fsm_session_handle_t handle);
+
+
+/*
+ * find the handle of a session ID
+ */
+extern RC_FSM_t
+fsm_session_lookup(fsm_session_table_t *table,
+                   uint64_t key,
+                   fsm_session_handle_t *p2handle);
+
+
+/*
+ * get the state machine of a handle, checking it is not stale
+ */
+extern RC_FSM_t
+fsm_session_get(fsm_session_table_t *table,
+                fsm_session_handle_t handle,
+                fsm_t **p2fsm);
+
+
+/*
+ * API to look up a session and drive its state machine, by ID or
+ * by handle
+ */
+extern RC_FSM_t
+fsm_session_engine(fsm_session_table_t *table,
+                   uint64_t key,
+                   uint32_t normalized_event,
+                   void *p2event_buffer,
+                   void *p2parm);
+
+extern RC_FSM_t
+fsm_session_engine_handle(fsm_session_table_t *table,
+                          fsm_session_handle_t handle,
+                          uint32_t normalized_event,
+                          void *p2event_buffer,
+                          void *p2parm);
+
+
+#endif  /* __FSM_SESSION_H__ */
+
@@ -0,0 +1,101 @@
+/*------------------------------------------------------------------
+ * fsm_stats.h - Finite State Machine transition counters
+ *
+ * Copyright (c) 2005-2009 by Cisco Systems, Inc.
+ * All rights reserved. 
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *------------------------------------------------------------------
+ */
+
+
+
+#ifndef __FSM_STATS_H__
+#define __FSM_STATS_H__
+
+#include "fsm.h"
+
+
+/* one counter per return code, RC_FSM_OK up to RC_FSM_LAST */
+#define FSM_STATS_RC       ( RC_FSM_LAST )
+
+/*
+ * threads with a private shard of counters, threads numbered 
+ * beyond share one shard with atomic increments
+ */
+#define FSM_STATS_SHARDS   ( 64 )
+
+
+/*
+ * Counters of a class, merged over the threads.
+ *
+ * cells holds one counter per (state, event) cell of the table, 
+ *          number_states x number_events, row-major by state.  
+ *          Every event in range is counted in the cell of the 
+ *          state it was delivered in, whatever the outcome.
+ *
+ * rc holds one counter per return code, indexed by RC_FSM_t.  A
+ *          NULL handler counts as RC_FSM_INVALID_EVENT_HANDLER and
+ *          an event out of range as RC_FSM_INVALID_EVENT.  
+ *          RC_FSM_STOP_PROCESSING is not counted, the state 
+ *          machine may be gone by then.
+ *
+ * total is the sum of the rc counters.
+ */
+typedef struct {
+    uint32_t   number_states;
+    uint32_t   number_events;
+    uint64_t   total;
+    uint64_t   rc[FSM_STATS_RC];
+    uint64_t  *cells;
+} fsm_stats_snapshot_t;
+
+
+/*
+ * start or stop counting the events of a class
+ */
+extern RC_FSM_t
+fsm_stats_enable(fsm_class_t *fsm_class);
+
+extern RC_FSM_t
+fsm_stats_disable(fsm_class_t *fsm_class);
+
+
+/*
+ * zero the counters of a class
+ */
+extern RC_FSM_t
+fsm_stats_reset(fsm_class_t *fsm_class);
+
+
+/*
+ * merge the counters of a class into a snapshot, and free it
+ */
+extern RC_FSM_t
+fsm_stats_snapshot(fsm_class_t *fsm_class, fsm_stats_snapshot_t *snapshot);
+
+extern void
+fsm_stats_snapshot_free(fsm_stats_snapshot_t *snapshot);
+
+
+#endif  /* __FSM_STATS_H__ */
+
@@ -0,0 +1,271 @@
+/*------------------------------------------------------------------
+ * fsm_store.h - Finite State Machine instance store
+ *
+ * Copyright (c) 2005-2009 by Cisco Systems, Inc.
+ * All rights reserved. 
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *------------------------------------------------------------------
+ */
+
+
+#ifndef __FSM_STORE_H__
+#define __FSM_STORE_H__
+
+#include "fsm.h"
+
+
+/*
+ * Compact history record kept by an instance store.  The IDs
+ * are narrowed to 16 bits to keep the side array small.
+ */
+typedef struct {
+    uint16_t   prevStateID;
+    uint16_t   stateID;
+    uint16_t   eventID;
+    uint16_t   handler_rc;
+} fsm_store_history_t;
+
+/* largest per-instance history depth, must be a power of two */
+#define FSM_STORE_MAX_HISTORY    ( 256 )
+
+/* per-instance flags */
+#define FSM_STORE_EXCEPTION      ( 0x01 )
+
+
+/*
+ * Instance store.  Holds the instances of one class in structure
+ * of arrays form, addressed by a zero based index.  The current
+ * states are kept in one dense array of narrow IDs, one byte per
+ * instance when the class has fewer than 256 states and two bytes
+ * otherwise, so that bulk processing touches as little memory as
+ * possible.  Exception states, flags and the optional history live 
+ * in separate side arrays.
+ */
+#define FSM_STORE_TAG    ( 0x5703e5a1 )
+
+typedef struct {
+    /* for store validation */
+    uint32_t       tag;
+
+    /* shared class of all instances in the store */
+    fsm_class_t   *fsm_class;
+
+    /* number of instances */
+    uint32_t       capacity;
+
+    /* bytes per state ID, 1 or 2 */
+    uint32_t       state_width;
+
+    /* hot: current state of each instance */
+    void          *states;
+
+    /* cold: exception state and flags of each instance */
+    void          *exception_states;
+    uint8_t       *flags;
+
+    /* 
+     * optional history, history_depth records per instance, 
+     * 0 when disabled 
+     */
+    uint32_t              history_depth;
+    uint8_t              *history_index;
+    fsm_store_history_t  *history;
+
+    /*
+     * counted in the state populations of the class when it kept
+     * them at create, with the state entry time of each instance
+     * for the dwell times, see fsm_population.h
+     */
+    uint32_t              population_flags;
+    uint64_t             *entry_tsc;
+
+    /*
+     * optional index of the instances by current state, doubly
+     * linked lists through side arrays, NULL until built by 
+     * fsm_store_index_states
+     */
+    uint32_t             *member_head;
+    uint32_t             *member_count;
+    uint32_t             *member_next;
+    uint32_t             *member_prev;
+} fsm_store_t;
+
+/* end of a membership list */
+#define FSM_STORE_NO_MEMBER      ( 0xffffffff )
+
+
+/*
+ * One entry of a batch of events for fsm_engine_batch
+ */
+typedef struct {
+    uint32_t   instance;
+    uint32_t   normalized_event;
+    void      *p2event_buffer;
+    void      *p2parm;
+} fsm_batch_entry_t;
+
+/* 
+ * how many entries ahead the batch engine prefetches the instance
+ * state, the transition row is prefetched half as far ahead 
+ */
+#define FSM_BATCH_PREFETCH       ( 8 )
+
+
+/*
+ * Reordering report of fsm_engine_batch_grouped
+ *
+ * entries is the number of entries processed.
+ *
+ * waves is the number of rounds the entries were split into
+ *      to keep the event order of each instance, an instance
+ *      with n entries in a chunk needs n waves.
+ *
+ * groups is the number of runs of entries with the same 
+ *      (current state, event) dispatched back to back.  The 
+ *      closer to the number of distinct cells, the better.
+ *
+ * reordered is the number of entries that were dispatched at
+ *      a different position than they were submitted.
+ */
+typedef struct {
+    uint32_t   entries;
+    uint32_t   waves;
+    uint32_t   groups;
+    uint32_t   reordered;
+} fsm_batch_stats_t;
+
+/* grouped batches are sorted in chunks of this many entries */
+#define FSM_BATCH_GROUP_MAX      ( 256 )
+
+
+/*
+ * create a store of instances, all in the initial state
+ */
+extern RC_FSM_t
+fsm_store_create(fsm_store_t **store,
+                 fsm_class_t *fsm_class,
+                 uint32_t capacity,
+                 uint32_t initial_state,
+                 uint32_t history_depth);
+
+
+/*
+ * destroy an instance store
+ */
+extern RC_FSM_t
+fsm_store_destroy(fsm_store_t **store);
+
+
+/*
+ * reset an instance of the store to a state
+ */
+extern RC_FSM_t
+fsm_store_instance_init(fsm_store_t *store,
+                        uint32_t instance,
+                        uint32_t initial_state);
+
+
+/* get instance state */
+extern RC_FSM_t
+fsm_store_get_state(fsm_store_t *store,
+                    uint32_t instance,
+                    uint32_t *p2state);
+
+
+/*
+ * allows event handler to update the next state of an instance
+ */
+extern RC_FSM_t
+fsm_store_set_exception_state(fsm_store_t *store,
+                              uint32_t instance,
+                              uint32_t exception_state);
+
+
+/*
+ * shows the history of an instance
+ */
+extern void
+fsm_store_show_history(fsm_store_t *store, uint32_t instance);
+
+
+/*
+ * API to drive an instance of the store
+ */
+extern RC_FSM_t
+fsm_store_engine(fsm_store_t *store,
+                 uint32_t instance,
+                 uint32_t normalized_event,
+                 void *p2event_buffer,
+                 void *p2parm);
+
+
+
+/*
+ * API to drive a batch of events across instances of the store
+ */
+extern RC_FSM_t
+fsm_engine_batch(fsm_store_t *store,
+                 fsm_batch_entry_t *batch,
+                 uint32_t count,
+                 RC_FSM_t *rc_out);
+
+
+/*
+ * API to drive a batch of events grouped by (state, event)
+ */
+extern RC_FSM_t
+fsm_engine_batch_grouped(fsm_store_t *store,
+                         fsm_batch_entry_t *batch,
+                         uint32_t count,
+                         RC_FSM_t *rc_out,
+                         fsm_batch_stats_t *stats);
+
+
+/*
+ * index the instances of the store by current state
+ */
+extern RC_FSM_t
+fsm_store_index_states(fsm_store_t *store);
+
+
+/* number of instances in a state, the store must be indexed */
+extern RC_FSM_t
+fsm_store_get_members(fsm_store_t *store,
+                      uint32_t state,
+                      uint32_t *p2count);
+
+
+/*
+ * API to send an event to every instance of the store in a state
+ */
+extern RC_FSM_t
+fsm_broadcast(fsm_store_t *store,
+              uint32_t state,
+              uint32_t normalized_event,
+              void *p2event_buffer,
+              void **p2parms,
+              uint32_t *p2count,
+              uint32_t *p2failed);
+
+
+#endif  /* __FSM_STORE_H__ */
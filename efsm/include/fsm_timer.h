@@ -0,0 +1,210 @@
+/*------------------------------------------------------------------
+ * fsm_timer.h - Finite State Machine timing wheel
+ *
+ * Copyright (c) 2005-2009 by Cisco Systems, Inc.
+ * All rights reserved. 
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *------------------------------------------------------------------
+ */
+
+
+
+#ifndef __FSM_TIMER_H__
+#define __FSM_TIMER_H__
+
+#include "fsm.h"
+#include "fsm_store.h"
+
+
+/*
+ * The wheel has FSM_TIMER_LEVELS levels of FSM_TIMER_SLOTS slots,
+ * level n covering delays of up to 2^(8*(n+1)) ticks.  Longer 
+ * delays are parked in the last level and re-filed as time goes.
+ */
+#define FSM_TIMER_LEVELS       ( 4 )
+#define FSM_TIMER_SLOT_BITS    ( 8 )
+#define FSM_TIMER_SLOTS        ( 1 << FSM_TIMER_SLOT_BITS )
+
+
+/*
+ * Doubly linked, circular list link.  Each slot has a list head,
+ * a timer is on at most one list.
+ */
+typedef struct fsm_timer_link_s {
+    struct fsm_timer_link_s  *next;
+    struct fsm_timer_link_s  *prev;
+} fsm_timer_link_t;
+
+
+/*
+ * Timer.  Timers are provided by the user, typically one or more
+ * per session, and are initialized once with fsm_timer_init.  On
+ * expiry the timer's normalized event is delivered to its state
+ * machine, either an fsm_t or an instance index of a store.
+ */
+typedef struct fsm_timer_s {
+    /* must be first, NULL links when the timer is not armed */
+    fsm_timer_link_t   link;
+
+    /* absolute expiry in ticks */
+    uint64_t           expires;
+
+    /* target, fsm is NULL for a store instance */
+    fsm_t             *fsm;
+    uint32_t           instance;
+
+    uint32_t           normalized_event;
+    void              *p2event_buffer;
+    void              *p2parm;
+
+    /* wheel level the timer is filed in, FSM_TIMER_LEVELS if due */
+    uint32_t           level;
+} fsm_timer_t;
+
+
+/*
+ * Hashed hierarchical timing wheel.  Time is virtual, an unsigned 
+ * tick count that is only moved forward by fsm_timer_advance, so 
+ * the wheel runs the same under test as in production.  Starting
+ * and stopping a timer is O(1), processing a tick is amortized 
+ * O(1) per timer.
+ */
+#define FSM_TIMER_WHEEL_TAG  ( 0x7133e1ee )
+
+typedef struct fsm_timer_wheel_s {
+    /* for wheel validation */
+    uint32_t           tag;
+
+    /* number of timers armed or expired and not yet delivered */
+    uint32_t           armed;
+
+    /* number of state machines attached by fsm_timer_attach */
+    uint32_t           attached;
+
+    /* current time in ticks */
+    uint64_t           now;
+
+    /* timers filed per level, lets a tick skip the empty levels */
+    uint32_t           level_count[FSM_TIMER_LEVELS];
+
+    /* timers that are due, in expiry order */
+    fsm_timer_link_t   expired;
+
+    fsm_timer_link_t   slots[FSM_TIMER_LEVELS][FSM_TIMER_SLOTS];
+} fsm_timer_wheel_t;
+
+
+/*
+ * create a timing wheel starting at a time
+ */
+extern RC_FSM_t
+fsm_timer_wheel_create(fsm_timer_wheel_t **wheel, uint64_t now);
+
+
+/*
+ * destroy a timing wheel, once no timer is armed and no state 
+ * machine is attached
+ */
+extern RC_FSM_t
+fsm_timer_wheel_destroy(fsm_timer_wheel_t **wheel);
+
+
+/*
+ * initialize a timer before first use
+ */
+extern void
+fsm_timer_init(fsm_timer_t *timer,
+               void *p2event_buffer,
+               void *p2parm);
+
+
+/*
+ * arm a timer to deliver an event to a state machine
+ */
+extern RC_FSM_t
+fsm_timer_start(fsm_timer_wheel_t *wheel,
+                fsm_timer_t *timer,
+                fsm_t *fsm,
+                uint32_t normalized_event,
+                uint64_t delay);
+
+
+/*
+ * arm a timer to deliver an event to an instance of a store
+ */
+extern RC_FSM_t
+fsm_timer_start_instance(fsm_timer_wheel_t *wheel,
+                         fsm_timer_t *timer,
+                         uint32_t instance,
+                         uint32_t normalized_event,
+                         uint64_t delay);
+
+
+/*
+ * cancel a timer, a no-op when it is not armed
+ */
+extern RC_FSM_t
+fsm_timer_stop(fsm_timer_wheel_t *wheel, fsm_timer_t *timer);
+
+
+/* TRUE when the timer is armed */
+#define fsm_timer_armed(timer)   ( (timer)->link.next != NULL )
+
+
+/*
+ * move time forward and deliver expiries to fsm_engine
+ */
+extern RC_FSM_t
+fsm_timer_advance(fsm_timer_wheel_t *wheel, uint64_t now);
+
+
+/*
+ * move time forward and return the expiries of store instances 
+ * as a batch for fsm_engine_batch
+ */
+extern RC_FSM_t
+fsm_timer_advance_batch(fsm_timer_wheel_t *wheel,
+                        uint64_t now,
+                        fsm_batch_entry_t *batch,
+                        uint32_t max_entries,
+                        uint32_t *p2count);
+
+
+/*
+ * attach a wheel to run the state timeouts of a state machine
+ */
+extern RC_FSM_t
+fsm_timer_attach(fsm_t *fsm,
+                 fsm_timer_wheel_t *wheel,
+                 void *p2event_buffer,
+                 void *p2parm);
+
+
+/*
+ * stop and detach the state timeouts of a state machine
+ */
+extern RC_FSM_t
+fsm_timer_detach(fsm_t *fsm);
+
+
+#endif  /* __FSM_TIMER_H__ */
@@ -0,0 +1,219 @@
+/*------------------------------------------------------------------
+ * fsm_trace.h - Finite State Machine transition tracing
+ *
+ * Copyright (c) 2005-2009 by Cisco Systems, Inc.
+ * All rights reserved. 
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *------------------------------------------------------------------
+ */
+
+
+
+#ifndef __FSM_TRACE_H__
+#define __FSM_TRACE_H__
+
+#include "fsm.h"
+
+
+/* default number of records in a thread ring, a power of two */
+#define FSM_TRACE_RING_RECORDS   ( 1 << 14 )
+
+/* most classes that can be named in a trace, ID 0 is unknown */
+#define FSM_TRACE_MAX_CLASSES    ( 256 )
+
+
+/*
+ * Trace record, one per event of any engine, 32 bytes.  The flight
+ * recorder writes the same records.
+ *
+ * tsc is the time stamp counter when the record was written.
+ *
+ * duration is the time stamp ticks spent in the event handler.
+ *
+ * instance is the instance ID of the state machine, see 
+ *          fsm_set_instance_id.
+ *
+ * class_id names the state and event tables in the dump.
+ *
+ * prev_state, event and next_state describe the transition, 
+ *          next_state is prev_state when the handler failed.
+ *
+ * rc is the handler return code.
+ *
+ * thread numbers the threads from 0.  The number of an exited 
+ *          thread is reused by a later one.
+ *
+ * reserved is 0 in the rings, the flight recorder uses it to spot
+ *          records that were being written at a crash.
+ */
+typedef struct {
+    uint64_t   tsc;
+    uint32_t   duration;
+    uint32_t   instance;
+    uint16_t   class_id;
+    uint16_t   prev_state;
+    uint16_t   event;
+    uint16_t   next_state;
+    uint16_t   rc;
+    uint16_t   thread;
+    uint32_t   reserved;
+} fsm_trace_record_t;
+
+
+/*
+ * Per-thread trace ring.  Only the owning thread writes, head is
+ * the free running count of records written.  exited is set when
+ * the thread has exited, the ring then goes to the next thread 
+ * that traces.
+ */
+typedef struct fsm_trace_ring_s {
+    uint64_t                  head;
+    uint32_t                  mask;
+    uint32_t                  thread;
+    boolean_t                 exited;
+    struct fsm_trace_ring_s  *next;
+    fsm_trace_record_t       *records;
+} fsm_trace_ring_t;
+
+
+/*
+ * Trace dump file, written by fsm_trace_dump and read by the 
+ * decoder in tools/.  All values are in host byte order.
+ *
+ *    fsm_trace_file_header_t
+ *    number_classes times:
+ *        fsm_trace_file_class_t
+ *        number_states strings, then number_events strings, each
+ *        a uint32_t length and the characters
+ *    number_rings times:
+ *        fsm_trace_file_ring_t
+ *        number_records fsm_trace_record_t, oldest first
+ */
+#define FSM_TRACE_FILE_MAGIC     ( 0x46534d54 )    /* "FSMT" */
+#define FSM_TRACE_FILE_VERSION   ( 1 )
+
+typedef struct {
+    uint32_t   magic;
+    uint32_t   version;
+    uint32_t   record_size;
+    uint32_t   number_classes;
+    uint32_t   number_rings;
+    uint32_t   reserved;
+
+    /* time stamp ticks per second, estimated, 0 if unknown */
+    uint64_t   tsc_hz;
+} fsm_trace_file_header_t;
+
+typedef struct {
+    uint32_t   class_id;
+    uint32_t   number_states;
+    uint32_t   number_events;
+    char       fsm_name[FSM_NAME_LEN];
+} fsm_trace_file_class_t;
+
+typedef struct {
+    uint32_t   thread;
+    uint32_t   number_records;
+    uint64_t   dropped;
+} fsm_trace_file_ring_t;
+
+
+/*
+ * tracing switch, tested by the engine on every event, one bit
+ * for the thread rings and one for the flight recorder
+ */
+#define FSM_TRACE_RINGS          ( 0x0001 )
+#define FSM_TRACE_FLIGHT         ( 0x0002 )
+
+extern uint32_t fsm_trace_enabled;
+
+
+/*
+ * enable tracing, sizing the rings of threads that trace first
+ * from here on
+ */
+extern RC_FSM_t
+fsm_trace_enable(uint32_t ring_records);
+
+
+/*
+ * disable tracing, the rings are kept for fsm_trace_dump
+ */
+extern void
+fsm_trace_disable(void);
+
+
+/*
+ * disable tracing and free the rings of all threads
+ */
+extern void
+fsm_trace_reset(void);
+
+
+/*
+ * write all rings and the class names to a file for the decoder
+ */
+extern RC_FSM_t
+fsm_trace_dump(char *path);
+
+
+/*
+ * append a record to the ring of the calling thread, called by 
+ * the engines while tracing is enabled: fsm_trace_transition by
+ * fsm_engine, fsm_trace_instance by the store, batch and instance
+ * engines, and fsm_trace_stop by all of them when a handler 
+ * returns RC_FSM_STOP_PROCESSING
+ */
+extern void
+fsm_trace_transition(fsm_t *fsm,
+                     uint32_t normalized_event,
+                     uint32_t next_state,
+                     RC_FSM_t handler_rc,
+                     uint64_t start);
+
+extern void
+fsm_trace_instance(fsm_class_t *fsm_class,
+                   uint32_t instance,
+                   uint32_t prev_state,
+                   uint32_t normalized_event,
+                   uint32_t next_state,
+                   RC_FSM_t handler_rc,
+                   uint64_t start);
+
+extern void
+fsm_trace_stop(uint32_t class_id,
+               uint32_t instance,
+               uint32_t prev_state,
+               uint32_t normalized_event,
+               uint64_t start);
+
+
+
+/*
+ * ID naming the tables of a class in traces, assigned on first use
+ */
+extern uint32_t
+fsm_trace_class_id(fsm_class_t *fsm_class);
+
+
+#endif  /* __FSM_TRACE_H__ */
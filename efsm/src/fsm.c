@@ -32,16 +32,22 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "fsm.h"
+#include "fsm_timer.h"
+#include "fsm_pool.h"
+#include "fsm_trace.h"
+#include "fsm_stats.h"
+#include "fsm_population.h"
+#include "fsm_epoch.h"
+#include "fsm_private.h"
 
 
-/*
- * These are the maximum states and events that fsm uses 
- * for sizing during create. 
- */ 
-#define FSM_MAX_STATES  ( 64 ) 
-#define FSM_MAX_EVENTS  ( 64 ) 
+static uint32_t
+fsm_sparse_count(const fsm_class_t *fsm_class,
+                 const event_tuple_t *event_ptr,
+                 const event_tuple_t **p2default);
 
 
 
@@ -72,6 +78,7 @@ fsm_display_table (fsm_t *fsm)
 {
     uint32_t  i;
     uint32_t  j;
+    uint32_t  next_state;
     state_tuple_t *state_ptr;
     event_tuple_t *event_ptr;
 
@@ -109,6 +116,38 @@ fsm_display_table (fsm_t *fsm)
         printf(" Event   /   Next State     \n");
         printf("----------------------------\n");
 
+        if (state_ptr->event_flags & FSM_EVENTS_SPARSE) {
+            /*
+             * Only the events listed, then the default of the rest
+             */
+            event_ptr = state_ptr->p2event_tuple;
+            for (; event_ptr->eventID != (uint32_t)FSM_NULL_EVENT_ID; 
+                                                           event_ptr++) {
+                if (event_ptr->eventID == (uint32_t)FSM_DEFAULT_EVENT_ID) {
+                    continue;
+                }
+                next_state = (event_ptr->next_state == 
+                              (uint32_t)FSM_SAME_STATE) ? 
+                                        i : event_ptr->next_state;
+                printf("  %u-%s / %s \n", 
+                         event_ptr->eventID,  
+                         p2event_description[event_ptr->eventID].description, 
+                         p2state_description[next_state].description);
+            }
+
+            fsm_sparse_count(fsm->fsm_class, state_ptr->p2event_tuple,
+                             (const event_tuple_t **)&event_ptr);
+            next_state = i;
+            if (event_ptr != NULL && 
+                event_ptr->next_state != (uint32_t)FSM_SAME_STATE) {
+                next_state = event_ptr->next_state;
+            }
+            printf("  default / %s \n", 
+                     p2state_description[next_state].description);
+            printf("\n");
+            continue;
+        }
+
         for (j=0; j<fsm->number_events; j++) {
 
             event_ptr = &state_ptr->p2event_tuple[j];
@@ -116,10 +155,12 @@ fsm_display_table (fsm_t *fsm)
             /*
              * Display the name of the state associated with the next state.
              */
+            next_state = (event_ptr->next_state == 
+                          (uint32_t)FSM_SAME_STATE) ? i : event_ptr->next_state;
             printf("  %u-%s / %s \n", 
                      j,  
                      p2event_description[j].description, 
-                     p2state_description[event_ptr->next_state].description);
+                     p2state_description[next_state].description);
         }
         printf("\n");
     }
@@ -128,6 +169,391 @@ fsm_display_table (fsm_t *fsm)
 }
 
 
+/* heatmap shades, coolest first, and the hottest cells listed */
+static const char fsm_heatmap_shades[] = " .:-=+*#%@";
+#define FSM_HEATMAP_LEVELS    ( sizeof(fsm_heatmap_shades) - 2 )
+#define FSM_HEATMAP_HOTTEST   ( 8 )
+
+/** 
+ * NAME
+ *    fsm_display_heatmap
+ *
+ * SYNOPSIS 
+ *    #include "fsm.h" 
+ *    void
+ *    fsm_display_heatmap(fsm_class_t *fsm_class)
+ *
+ * DESCRIPTION
+ *    Displays the event counters of a class to console as a 
+ *    heatmap of the state x event table, see fsm_stats_enable.
+ *    Each cell is shaded on a log scale up to the hottest cell,
+ *    blank when never hit.  The row totals, the hottest cells 
+ *    and the counts per return code follow.
+ *
+ * INPUT PARAMETERS
+ *    fsm_class - handle to class, fsm->fsm_class for an fsm
+ *
+ * OUTPUT PARAMETERS
+ *    none 
+ *
+ * RETURN VALUE
+ *    none 
+ * 
+ */
+void
+fsm_display_heatmap (fsm_class_t *fsm_class)
+{
+    fsm_stats_snapshot_t snapshot;
+    state_description_t *p2state_description; 
+    event_description_t *p2event_description;
+    uint64_t  count;
+    uint64_t  max;
+    uint64_t  row;
+    uint64_t  previous;
+    uint32_t  previous_cell;
+    uint32_t  hottest;
+    uint32_t  shade;
+    uint32_t  bits;
+    uint32_t  max_bits;
+    uint32_t  i;
+    uint32_t  j;
+    uint32_t  k;
+
+    if (fsm_stats_snapshot(fsm_class, &snapshot) != RC_FSM_OK) {
+        return;
+    }
+
+    p2state_description = fsm_class->state_description_table; 
+    p2event_description = fsm_class->event_description_table; 
+
+    max = 0;
+    for (i=0; i<snapshot.number_states * snapshot.number_events; i++) {
+        if (snapshot.cells[i] > max) {
+            max = snapshot.cells[i];
+        }
+    }
+    for (max_bits=0; (max >> max_bits) != 0; max_bits++) {
+        ;
+    }
+
+    printf("\nFSM: %s Heatmap \n", fsm_class->fsm_name);
+    printf("    events counted = %llu%s\n", 
+              (unsigned long long)snapshot.total,
+              fsm_class->stats_enabled ? "" : " (counting off)");
+    printf("    hottest cell = %llu, shades \"%s\" on a log scale\n", 
+              (unsigned long long)max, fsm_heatmap_shades + 1);
+    printf("\n");
+
+    /*
+     * one column per event, numbered by tens and units
+     */
+    printf("       ");
+    for (j=0; j<snapshot.number_events; j++) {
+        printf("%c", (j >= 10) ? (char)('0' + (j / 10) % 10) : ' ');
+    }
+    printf("\n State ");
+    for (j=0; j<snapshot.number_events; j++) {
+        printf("%c", (char)('0' + j % 10));
+    }
+    printf("      Total\n");
+    printf("-------");
+    for (j=0; j<snapshot.number_events; j++) {
+        printf("-");
+    }
+    printf("-----------\n");
+
+    for (i=0; i<snapshot.number_states; i++) {
+        printf(" %4u |", i);
+        row = 0;
+        for (j=0; j<snapshot.number_events; j++) {
+            count = snapshot.cells[(i * snapshot.number_events) + j];
+            row += count;
+
+            /* by the bit length of the count, the hottest darkest */
+            shade = 0;
+            if (count) {
+                for (bits=0; (count >> bits) != 0; bits++) {
+                    ;
+                }
+                shade = FSM_HEATMAP_LEVELS;
+                if (max_bits > 1) {
+                    shade = 1 + ((bits - 1) * (FSM_HEATMAP_LEVELS - 1)) / 
+                                (max_bits - 1);
+                }
+            }
+            printf("%c", fsm_heatmap_shades[shade]);
+        }
+        printf("| %10llu %s\n", (unsigned long long)row, 
+                 p2state_description[i].description);
+    }
+    printf("\n");
+
+    printf(" Event key\n");
+    for (j=0; j<snapshot.number_events; j++) {
+        printf("  %u-%s\n", j, p2event_description[j].description);
+    }
+    printf("\n");
+
+    /*
+     * the hottest cells, in descending order
+     */
+    printf(" Hottest State / Event        Count \n");
+    printf("----------------------------------------\n");
+    previous = (uint64_t)-1;
+    previous_cell = 0;
+    for (k=0; k<FSM_HEATMAP_HOTTEST; k++) {
+
+        /* highest count after the previous, lowest cell on a tie */
+        max = 0;
+        hottest = 0;
+        for (i=0; i<snapshot.number_states * snapshot.number_events; i++) {
+            count = snapshot.cells[i];
+            if (count < previous || 
+                (count == previous && i > previous_cell)) {
+                if (count > max) {
+                    max = count;
+                    hottest = i;
+                }
+            }
+        }
+        if (max == 0) {
+            break;
+        }
+        previous = max;
+        previous_cell = hottest;
+
+        printf("  %u-%s / %u-%s  %llu\n",
+                 hottest / snapshot.number_events,
+                 p2state_description[hottest / 
+                                     snapshot.number_events].description,
+                 hottest % snapshot.number_events,
+                 p2event_description[hottest % 
+                                     snapshot.number_events].description,
+                 (unsigned long long)max);
+    }
+    printf("\n");
+
+    printf(" rc          Count \n");
+    printf("-------------------\n");
+    for (j=0; j<FSM_STATS_RC; j++) {
+        if (snapshot.rc[j]) {
+            printf("  %2u  %12llu\n", j, (unsigned long long)snapshot.rc[j]);
+        }
+    }
+    printf("\n");
+
+    fsm_stats_snapshot_free(&snapshot);
+    return;
+}
+
+
+/* source of the default instance IDs */
+static uint32_t fsm_instance_count = 0;
+
+/* thread numbers, see fsm_thread_index */
+__thread uint32_t fsm_thread_number = 0;
+
+/* 
+ * numbers handed out so far, and those of exited threads waiting
+ * for reuse, protected by the lock
+ */
+static pthread_mutex_t  fsm_thread_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t         fsm_thread_count = 0;
+static uint32_t        *fsm_thread_free = NULL;
+static uint32_t         fsm_thread_number_free = 0;
+static uint32_t         fsm_thread_max_free = 0;
+
+/* hands the number of an exiting thread back */
+static pthread_once_t   fsm_thread_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t    fsm_thread_key;
+
+
+/*
+ * internal routine run as a thread exits, puts its number on the
+ * free list.  A number that does not fit is not reused.  A later
+ * destructor that asks again takes a number anew.
+ */
+static void
+fsm_thread_number_exit (void *arg)
+{
+    uint32_t *free_list;
+    uint32_t max_free;
+
+    pthread_mutex_lock(&fsm_thread_lock);
+    if (fsm_thread_number_free == fsm_thread_max_free) {
+        max_free = fsm_thread_max_free ? 2 * fsm_thread_max_free : 64;
+        free_list = (uint32_t *)realloc(fsm_thread_free, 
+                                        max_free * sizeof(uint32_t));
+        if (free_list) {
+            fsm_thread_free = free_list;
+            fsm_thread_max_free = max_free;
+        }
+    }
+    if (fsm_thread_number_free < fsm_thread_max_free) {
+        fsm_thread_free[fsm_thread_number_free++] = 
+                                    (uint32_t)(unsigned long)arg - 1;
+    }
+    pthread_mutex_unlock(&fsm_thread_lock);
+
+    fsm_thread_number = 0;
+    return;
+}
+
+static void
+fsm_thread_key_create (void)
+{
+    pthread_key_create(&fsm_thread_key, fsm_thread_number_exit);
+}
+
+
+/*
+ * Gives the calling thread a number, the lowest one free so that 
+ * the threads alive fit the per thread shards as long as they can,
+ * see fsm_thread_index
+ */
+void
+fsm_thread_number_take (void)
+{
+    uint32_t lowest;
+    uint32_t number;
+    uint32_t i;
+
+    pthread_once(&fsm_thread_key_once, fsm_thread_key_create);
+
+    pthread_mutex_lock(&fsm_thread_lock);
+    if (fsm_thread_number_free) {
+        lowest = 0;
+        for (i=1; i<fsm_thread_number_free; i++) {
+            if (fsm_thread_free[i] < fsm_thread_free[lowest]) {
+                lowest = i;
+            }
+        }
+        number = fsm_thread_free[lowest];
+        fsm_thread_free[lowest] = fsm_thread_free[--fsm_thread_number_free];
+    } else {
+        number = fsm_thread_count++;
+    }
+    pthread_mutex_unlock(&fsm_thread_lock);
+
+    fsm_thread_number = number + 1;
+    pthread_setspecific(fsm_thread_key, 
+                        (void *)(unsigned long)fsm_thread_number);
+    return;
+}
+
+
+/*
+ * internal routine to get a history ring of depth entries, the
+ * preallocated buffer when it is large enough
+ */
+static fsm_history_t *
+fsm_history_ring (fsm_t *fsm, uint32_t depth)
+{
+    fsm_history_t *ring;
+    uint32_t i;
+
+    if (depth <= fsm->history_buffer_depth) {
+        ring = fsm->history_buffer;
+    } else {
+        ring = (fsm_history_t *)malloc(depth * sizeof(fsm_history_t));
+        if (ring == NULL) {
+            return (NULL);
+        }
+    }
+
+    for (i=0; i<depth; i++) {
+        ring[i].prevStateID = FSM_NULL_STATE_ID;
+        ring[i].stateID = FSM_NULL_STATE_ID;
+        ring[i].eventID = FSM_NULL_EVENT_ID;
+        ring[i].handler_rc = RC_FSM_NULL;
+    }
+    return (ring);
+}
+
+
+/*
+ * internal routine to release the history ring
+ */
+static void
+fsm_history_release (fsm_t *fsm)
+{
+    if (fsm->history && fsm->history != fsm->history_buffer) {
+        free(fsm->history);
+    }
+    fsm->history = NULL;
+    fsm->history_mask = 0;
+    fsm->history_index = 0;
+}
+
+
+/*
+ * internal routine to validate a history policy
+ */
+static RC_FSM_t
+fsm_history_validate (fsm_history_policy_t *policy)
+{
+    if (policy == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    switch (policy->mode) {
+    case FSM_HISTORY_OFF:
+        return (RC_FSM_OK);
+
+    case FSM_HISTORY_SAMPLED:
+        if (policy->sample == 0) {
+            return (RC_FSM_INVALID_ARGUMENT);
+        }
+        /* fall through */
+    case FSM_HISTORY_ALL:
+    case FSM_HISTORY_ON_ERROR:
+        if (policy->depth == 0 || 
+            policy->depth > FSM_HISTORY_MAX_DEPTH ||
+            (policy->depth & (policy->depth - 1))) {
+            return (RC_FSM_INVALID_ARGUMENT);
+        }
+        return (RC_FSM_OK);
+
+    default:
+        return (RC_FSM_INVALID_ARGUMENT);
+    }
+}
+
+
+/*
+ * internal routine to apply a validated history policy, the
+ * recorded history is cleared
+ */
+static RC_FSM_t
+fsm_history_apply (fsm_t *fsm, fsm_history_policy_t *policy)
+{
+    fsm_history_t *ring;
+    uint32_t i;
+
+    fsm_history_release(fsm);
+
+    fsm->history_policy = *policy;
+    fsm->history_countdown = policy->sample;
+    for (i=0; i<FSM_HISTORY_LEADUP; i++) {
+        fsm->history_leadup[i].stateID = FSM_NULL_STATE_ID;
+    }
+
+    if (policy->mode == FSM_HISTORY_ALL || 
+        policy->mode == FSM_HISTORY_SAMPLED) {
+        ring = fsm_history_ring(fsm, policy->depth);
+        if (ring == NULL) {
+            fsm->history_policy.mode = FSM_HISTORY_OFF;
+            return (RC_FSM_NO_RESOURCES);
+        }
+        fsm->history = ring;
+        fsm->history_mask = policy->depth - 1;
+    } else if (policy->mode == FSM_HISTORY_ON_ERROR) {
+        fsm->history_countdown = 0;
+    }
+    return (RC_FSM_OK);
+}
+
+
 /** 
  * NAME
  *    fsm_show_history
@@ -154,6 +580,8 @@ void
 fsm_show_history (fsm_t *fsm)
 {
     uint32_t         i, j;
+    uint32_t         depth;
+    fsm_history_t  *history;
     fsm_history_t  *history_ptr;
 
     state_description_t *p2state_description; 
@@ -174,13 +602,28 @@ fsm_show_history (fsm_t *fsm)
     printf("Current State  /   Event   /  New State  /  rc  \n");
     printf("------------------------------------------------\n");
 
+    /*
+     * an on-error history that has not been promoted shows the
+     * lead-up
+     */
+    if (fsm->history) {
+        history = fsm->history;
+        depth = fsm->history_mask + 1;
+    } else if (fsm->history_policy.mode == FSM_HISTORY_ON_ERROR) {
+        history = fsm->history_leadup;
+        depth = FSM_HISTORY_LEADUP;
+    } else {
+        printf(" history off\n\n");
+        return;
+    }
+
     j = fsm->history_index;
-    for (i=0; i<FSM_HISTORY; i++) {
+    for (i=0; i<depth; i++) {
 
         /*
          * Get a local pointer to the history buffer
          */
-        history_ptr = &fsm->history[i];
+        history_ptr = &history[i];
 
         if (history_ptr->stateID == FSM_NULL_STATE_ID) {
             continue;
@@ -196,7 +639,7 @@ fsm_show_history (fsm_t *fsm)
              history_ptr->handler_rc);
 
         if (j==0) {
-            j=FSM_HISTORY;
+            j=depth;
         }
         j--;
     }
@@ -208,23 +651,25 @@ fsm_show_history (fsm_t *fsm)
 
 /** 
  * NAME
- *    fsm_get_state
+ *    fsm_set_history_policy
  *
- * SYNOPSIS
- *    #include "fsm.h"
+ * SYNOPSIS 
+ *    #include "fsm.h" 
  *    RC_FSM_t
- *    fsm_get_state(fsm_t *fsm, uint32_t*p2state)
+ *    fsm_set_history_policy(fsm_t *fsm, fsm_history_policy_t *policy)
  *
  * DESCRIPTION
- *    Function to return the current state.
+ *    Sets how the state machine records its transition history,
+ *    see fsm_history_policy_t.  The history recorded so far is
+ *    cleared and the ring is sized to the new depth.
  *
  * INPUT PARAMETERS
- *    *fsm - state machine handle
+ *    *fsm - handle of the state machine 
  *
- *    p2state - Pointer to a state variable to be updated.
+ *    *policy - history mode, depth and sample rate
  *
  * OUTPUT PARAMETERS
- *    none 
+ *    none
  *
  * RETURN VALUE
  *    RC_FSM_OK
@@ -232,8 +677,10 @@ fsm_show_history (fsm_t *fsm)
  * 
  */
 RC_FSM_t
-fsm_get_state (fsm_t *fsm, uint32_t *p2state)
+fsm_set_history_policy (fsm_t *fsm, fsm_history_policy_t *policy)
 {
+    RC_FSM_t rc;
+
     if (fsm == NULL) {
         return (RC_FSM_NULL);
     }
@@ -242,81 +689,84 @@ fsm_get_state (fsm_t *fsm, uint32_t *p2state)
         return (RC_FSM_INVALID_HANDLE);
     }
 
-    *p2state = fsm->curr_state;
-    return (RC_FSM_OK);
+    rc = fsm_history_validate(policy);
+    if (rc != RC_FSM_OK) {
+        return (rc);
+    }
+    return (fsm_history_apply(fsm, policy));
 }
 
 
 /** 
  * NAME
- *    fsm_set_exception_state
- * 
- * SYNOPSIS
- *    #include "fsm.h"
+ *    fsm_class_set_history_policy
+ *
+ * SYNOPSIS 
+ *    #include "fsm.h" 
  *    RC_FSM_t
- *    fsm_set_exception_state(fsm_t *fsm, 
- *                                uint32_t exception_state)
+ *    fsm_class_set_history_policy(fsm_class_t *fsm_class,
+ *                                 fsm_history_policy_t *policy)
  *
  * DESCRIPTION
- *    To be called from an event handler to alter
- *    the next state from the event table when an
- *    exception has been detected
+ *    Sets the history policy given to the state machines that are
+ *    created on the class from here on, see fsm_create_in_pool.
+ *    State machines already created keep their policy.
  *
  * INPUT PARAMETERS
- *    *fsm - state machine handle
+ *    *fsm_class - class handle
  *
- *    exception_state - New state to be transitioned
- *            when the event handler returns.
+ *    *policy - history mode, depth and sample rate
  *
  * OUTPUT PARAMETERS
- *    none 
- * 
+ *    none
+ *
  * RETURN VALUE
  *    RC_FSM_OK
  *    error otherwise
  * 
  */
 RC_FSM_t
-fsm_set_exception_state (fsm_t *fsm, uint32_t exception_state)
+fsm_class_set_history_policy (fsm_class_t *fsm_class, 
+                              fsm_history_policy_t *policy)
 {
-    if (fsm == NULL) {
+    RC_FSM_t rc;
+
+    if (fsm_class == NULL) {
         return (RC_FSM_NULL);
     }
 
-    if (fsm->tag != FSM_TAG) {
+    if (fsm_class->tag != FSM_CLASS_TAG) {
         return (RC_FSM_INVALID_HANDLE);
     }
 
-    /*
-     * Change the state of this FSM to the requested state.
-     */
-    if (exception_state > fsm->number_states-1) {
-        return (RC_FSM_INVALID_STATE);
+    rc = fsm_history_validate(policy);
+    if (rc != RC_FSM_OK) {
+        return (rc);
     }
-
-    fsm->exception_state = exception_state;
-    fsm->exception_state_indicator = TRUE;
+    fsm_class->history_policy = *policy;
     return (RC_FSM_OK);
 }
 
 
 /** 
  * NAME
- *    fsm_destroy
+ *    fsm_get_state
  *
  * SYNOPSIS
- *    #include "fsm.h" 
+ *    #include "fsm.h"
  *    RC_FSM_t
- *    fsm_destroy(fsm_t **fsm)
- * 
+ *    fsm_get_state(fsm_t *fsm, uint32_t*p2state)
+ *
  * DESCRIPTION
- *    Destroys the specified state machine.
+ *    Function to return the current state.
  *
  * INPUT PARAMETERS
- *    fsm - pointer to fsm handle
+ *    *fsm - state machine handle
+ *
+ *    p2state - Pointer to a state variable to be updated.
  *
  * OUTPUT PARAMETERS
- *    fsm - is nulled
+ *    none 
  *
  * RETURN VALUE
  *    RC_FSM_OK
@@ -324,26 +774,1906 @@ fsm_set_exception_state (fsm_t *fsm, uint32_t exception_state)
  * 
  */
 RC_FSM_t
-fsm_destroy (fsm_t **fsm)
+fsm_get_state (fsm_t *fsm, uint32_t *p2state)
 {
-     fsm_t *p2fsm;
-
-     if (fsm == NULL) {
-         return (RC_FSM_NULL);
-     }
+    if (fsm == NULL) {
+        return (RC_FSM_NULL);
+    }
 
-     p2fsm = *fsm;
-     if (p2fsm->tag != FSM_TAG) {
-         return (RC_FSM_INVALID_HANDLE);
-     }
+    if (fsm->tag != FSM_TAG) {
+        return (RC_FSM_INVALID_HANDLE);
+    }
 
-     free(p2fsm->history); 
-     *fsm = NULL;
+    *p2state = fsm->curr_state;
+    return (RC_FSM_OK);
+}
+
+
+/** 
+ * NAME
+ *    fsm_set_instance_id
+ *
+ * SYNOPSIS
+ *    #include "fsm.h"
+ *    RC_FSM_t
+ *    fsm_set_instance_id(fsm_t *fsm, uint32_t instance_id)
+ *
+ * DESCRIPTION
+ *    Sets the ID that identifies the state machine in traces, 
+ *    for example a session ID.  Each state machine is given a 
+ *    distinct ID when created.
+ *
+ * INPUT PARAMETERS
+ *    *fsm - state machine handle
+ *
+ *    instance_id - the new ID
+ *
+ * OUTPUT PARAMETERS
+ *    none 
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_set_instance_id (fsm_t *fsm, uint32_t instance_id)
+{
+    if (fsm == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    if (fsm->tag != FSM_TAG) {
+        return (RC_FSM_INVALID_HANDLE);
+    }
+
+    fsm->instance_id = instance_id;
+    return (RC_FSM_OK);
+}
+
+
+/** 
+ * NAME
+ *    fsm_set_exception_state
+ * 
+ * SYNOPSIS
+ *    #include "fsm.h"
+ *    RC_FSM_t
+ *    fsm_set_exception_state(fsm_t *fsm, 
+ *                                uint32_t exception_state)
+ *
+ * DESCRIPTION
+ *    To be called from an event handler to alter
+ *    the next state from the event table when an
+ *    exception has been detected
+ *
+ * INPUT PARAMETERS
+ *    *fsm - state machine handle
+ *
+ *    exception_state - New state to be transitioned
+ *            when the event handler returns.
+ *
+ * OUTPUT PARAMETERS
+ *    none 
+ * 
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_set_exception_state (fsm_t *fsm, uint32_t exception_state)
+{
+    if (fsm == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    if (fsm->tag != FSM_TAG) {
+        return (RC_FSM_INVALID_HANDLE);
+    }
+
+    /*
+     * Change the state of this FSM to the requested state.
+     */
+    if (exception_state > fsm->number_states-1) {
+        return (RC_FSM_INVALID_STATE);
+    }
+
+    fsm->exception_state = exception_state;
+    fsm->exception_state_indicator = TRUE;
+    return (RC_FSM_OK);
+}
+
+
+/** 
+ * NAME
+ *    fsm_set_event_queue
+ * 
+ * SYNOPSIS
+ *    #include "fsm.h"
+ *    RC_FSM_t
+ *    fsm_set_event_queue(fsm_t *fsm, uint32_t queue_size)
+ *
+ * DESCRIPTION
+ *    Configures the run-to-completion event queue of a state
+ *    machine, see fsm_post_event.  The size is rounded up to a 
+ *    power of two.  A size of 0 removes the queue.  Any events 
+ *    still queued are discarded.  Must not be called from an 
+ *    event handler.
+ *
+ * INPUT PARAMETERS
+ *    *fsm - state machine handle
+ *
+ *    queue_size - number of events the queue can hold
+ *
+ * OUTPUT PARAMETERS
+ *    none 
+ * 
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_set_event_queue (fsm_t *fsm, uint32_t queue_size)
+{
+    fsm_event_t *queue;
+    uint32_t size;
+
+    if (fsm == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    if (fsm->tag != FSM_TAG) {
+        return (RC_FSM_INVALID_HANDLE);
+    }
+
+    if (fsm->engine_active) {
+        return (RC_FSM_INVALID_ARGUMENT);
+    }
+
+    queue = NULL;
+    size = 0;
+    if (queue_size) {
+        if (queue_size > FSM_MAX_EVENT_QUEUE) {
+            return (RC_FSM_INVALID_ARGUMENT);
+        }
+        for (size=1; size<queue_size; size<<=1) {
+            ;
+        }
+        queue = (fsm_event_t *)malloc(size * sizeof(fsm_event_t));
+        if (queue == NULL) {
+            return (RC_FSM_NO_RESOURCES);
+        }
+    }
+
+    free(fsm->event_queue);
+    fsm->event_queue = queue;
+    fsm->event_queue_size = size;
+    fsm->event_queue_head = 0;
+    fsm->event_queue_tail = 0;
+    return (RC_FSM_OK);
+}
+
+
+/** 
+ * NAME
+ *    fsm_post_event
+ * 
+ * SYNOPSIS
+ *    #include "fsm.h"
+ *    RC_FSM_t
+ *    fsm_post_event(fsm_t *fsm, 
+ *                   uint32_t normalized_event, 
+ *                   void *p2event_buffer, 
+ *                   void *p2parm)
+ *
+ * DESCRIPTION
+ *    To be called from an event handler to raise a follow-up
+ *    event without re-entering the engine.  The event is queued
+ *    and processed by the fsm_engine call that is running, once
+ *    the current event has completed its transition.  Posted 
+ *    events are processed in order, run-to-completion.  An 
+ *    event posted outside of a handler is processed after the
+ *    event of the next fsm_engine call.
+ *
+ * INPUT PARAMETERS
+ *    *fsm - state machine handle
+ *
+ *    normalized_event - the event id to process 
+ *
+ *    *p2event_buffer - passed through to the handler
+ *
+ *    *p2parm - passed through to the handler
+ *
+ * OUTPUT PARAMETERS
+ *    none 
+ * 
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    RC_FSM_NO_RESOURCES when there is no queue or it is full
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_post_event (fsm_t *fsm, 
+                uint32_t normalized_event, 
+                void *p2event_buffer, 
+                void *p2parm)
+{
+    fsm_event_t *queued_ptr;
+
+    if (fsm == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    if (fsm->tag != FSM_TAG) {
+        return (RC_FSM_INVALID_HANDLE);
+    }
+
+    if (fsm->event_queue == NULL || 
+        fsm->event_queue_tail - fsm->event_queue_head >= 
+                                   fsm->event_queue_size) {
+        return (RC_FSM_NO_RESOURCES);
+    }
+
+    queued_ptr = &fsm->event_queue[fsm->event_queue_tail & 
+                                   (fsm->event_queue_size - 1)];
+    queued_ptr->normalized_event = normalized_event;
+    queued_ptr->p2event_buffer = p2event_buffer;
+    queued_ptr->p2parm = p2parm;
+    fsm->event_queue_tail++;
+    return (RC_FSM_OK);
+}
+
+
+/*
+ * internal routine to free a state machine taken out of use.  A 
+ * pooled state machine shares its class and goes back to the pool
+ * with its history.
+ */
+static void
+fsm_reclaim (void *object)
+{
+     fsm_t *p2fsm;
+
+     p2fsm = (fsm_t *)object;
+
+     fsm_history_release(p2fsm);
+     free(p2fsm->event_queue);
+
+     if (p2fsm->pool) {
+         p2fsm->tag = 0;
+         fsm_pool_release(p2fsm->pool, p2fsm);
+         return;
+     }
+
+     fsm_class_destroy(&p2fsm->fsm_class);
      free(p2fsm);
+     return;
+}
+
+
+/** 
+ * NAME
+ *    fsm_destroy
+ *
+ * SYNOPSIS
+ *    #include "fsm.h" 
+ *    RC_FSM_t
+ *    fsm_destroy(fsm_t **fsm)
+ * 
+ * DESCRIPTION
+ *    Destroys the specified state machine.
+ *
+ * INPUT PARAMETERS
+ *    fsm - pointer to fsm handle
+ *
+ * OUTPUT PARAMETERS
+ *    fsm - is nulled
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_destroy (fsm_t **fsm)
+{
+     fsm_t *p2fsm;
+
+     if (fsm == NULL) {
+         return (RC_FSM_NULL);
+     }
+
+     p2fsm = *fsm;
+     if (p2fsm->tag != FSM_TAG) {
+         return (RC_FSM_INVALID_HANDLE);
+     }
+
+     if (p2fsm->flags & FSM_FLAG_POPULATION) {
+         fsm_population_add(p2fsm->fsm_class, p2fsm->curr_state, -1);
+     }
+
+     fsm_timer_detach(p2fsm);
+     *fsm = NULL;
+
+     fsm_reclaim(p2fsm);
      return (RC_FSM_OK);
 }
 
 
+/** 
+ * NAME
+ *    fsm_destroy_deferred
+ *
+ * SYNOPSIS
+ *    #include "fsm.h" 
+ *    #include "fsm_epoch.h" 
+ *    RC_FSM_t
+ *    fsm_destroy_deferred(fsm_t **fsm)
+ * 
+ * DESCRIPTION
+ *    Destroys the specified state machine while other threads may
+ *    still be reading it in fsm_epoch_enter sections.  The state
+ *    machine is invalidated at once, so that fsm_get_state, 
+ *    fsm_engine and the like refuse it, and is freed, or returned
+ *    to its pool, once those sections have ended, see fsm_epoch.h.
+ *    Remove the state machine from wherever readers find it 
+ *    before calling this.
+ *
+ * INPUT PARAMETERS
+ *    fsm - pointer to fsm handle
+ *
+ * OUTPUT PARAMETERS
+ *    fsm - is nulled, unless the call fails, when the state 
+ *          machine is left valid but detached from its timer 
+ *          wheel
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_destroy_deferred (fsm_t **fsm)
+{
+     fsm_t *p2fsm;
+     RC_FSM_t rc;
+
+     if (fsm == NULL) {
+         return (RC_FSM_NULL);
+     }
+
+     p2fsm = *fsm;
+     if (p2fsm->tag != FSM_TAG) {
+         return (RC_FSM_INVALID_HANDLE);
+     }
+
+     if (p2fsm->flags & FSM_FLAG_POPULATION) {
+         fsm_population_add(p2fsm->fsm_class, p2fsm->curr_state, -1);
+     }
+
+     fsm_timer_detach(p2fsm);
+     FSM_STORE_RELEASE(&p2fsm->tag, 0);
+
+     /* on failure the caller still owns a valid state machine */
+     rc = fsm_epoch_retire(p2fsm, fsm_reclaim);
+     if (rc != RC_FSM_OK) {
+         FSM_STORE_RELEASE(&p2fsm->tag, FSM_TAG);
+         if (p2fsm->flags & FSM_FLAG_POPULATION) {
+             fsm_population_add(p2fsm->fsm_class, p2fsm->curr_state, 1);
+         }
+         return (rc);
+     }
+
+     *fsm = NULL;
+     return (RC_FSM_OK);
+}
+
+
+/*
+ * internal routine to hash a run of cells, a column when stride
+ * is the row length, to find candidate duplicates quickly
+ */
+static uint32_t
+fsm_cells_hash (const fsm_cell_t *cell_ptr, uint32_t count, 
+                uint32_t stride)
+{
+    uint32_t hash;
+    uint32_t i;
+
+    hash = 2166136261u;
+    for (i=0; i<count; i++) {
+        hash = (hash ^ cell_ptr->handler_index) * 16777619u;
+        hash = (hash ^ cell_ptr->next_state) * 16777619u;
+        cell_ptr += stride;
+    }
+    return (hash);
+}
+
+
+static boolean_t
+fsm_cells_equal (const fsm_cell_t *a, const fsm_cell_t *b, 
+                 uint32_t count, uint32_t stride)
+{
+    uint32_t i;
+
+    for (i=0; i<count; i++) {
+        if (a->handler_index != b->handler_index ||
+            a->next_state != b->next_state) {
+            return (FALSE);
+        }
+        a += stride;
+        b += stride;
+    }
+    return (TRUE);
+}
+
+
+/*
+ * internal routine to merge the events whose columns are equal in
+ * the dense rows into event classes, as a lexer generator does, 
+ * then the dense rows that are equal over the classes.  work holds
+ * 3 x (number_events + number_dense) words: the hashes, then 
+ * class_of and class_event per event and row_of and row_state per
+ * dense row, see the pointers below.
+ */
+static void
+fsm_compress_matrix (const fsm_cell_t *matrix, 
+                     uint32_t number_dense,
+                     uint32_t number_events,
+                     uint32_t *work,
+                     uint32_t *p2classes,
+                     uint32_t *p2rows)
+{
+    uint32_t number_classes;
+    uint32_t number_rows;
+    uint32_t *hash;
+    uint32_t *class_of;
+    uint32_t *class_event;
+    uint32_t *row_of;
+    uint32_t *row_state;
+    uint32_t row_hash;
+    uint32_t i;
+    uint32_t j;
+    uint32_t k;
+
+    hash = work;
+    class_of = hash + number_dense + number_events;
+    class_event = class_of + number_events;
+    row_of = class_event + number_events;
+    row_state = row_of + number_dense;
+
+    /*
+     * event classes, each column compared only with those of the
+     * classes found so far that hash the same
+     */
+    number_classes = 0;
+    for (j=0; j<number_events; j++) {
+        hash[j] = fsm_cells_hash(&matrix[j], number_dense, number_events);
+
+        for (k=0; k<number_classes; k++) {
+            if (hash[class_event[k]] == hash[j] &&
+                fsm_cells_equal(&matrix[class_event[k]], &matrix[j],
+                                number_dense, number_events)) {
+                break;
+            }
+        }
+        if (k == number_classes) {
+            class_event[number_classes++] = j;
+        }
+        class_of[j] = k;
+    }
+
+    /*
+     * rows over the event classes, the same way
+     */
+    number_rows = 0;
+    for (i=0; i<number_dense; i++) {
+        row_hash = 2166136261u;
+        for (k=0; k<number_classes; k++) {
+            row_hash = (row_hash ^ fsm_cells_hash(
+                  &matrix[(i * number_events) + class_event[k]], 1, 1)) * 
+                  16777619u;
+        }
+        hash[number_events + i] = row_hash;
+
+        for (j=0; j<number_rows; j++) {
+            if (hash[number_events + row_state[j]] != row_hash) {
+                continue;
+            }
+            for (k=0; k<number_classes; k++) {
+                if (!fsm_cells_equal(
+                     &matrix[(row_state[j] * number_events) + class_event[k]],
+                     &matrix[(i * number_events) + class_event[k]], 1, 1)) {
+                    break;
+                }
+            }
+            if (k == number_classes) {
+                break;
+            }
+        }
+        if (j == number_rows) {
+            row_state[number_rows++] = i;
+        }
+        row_of[i] = j;
+    }
+
+    *p2classes = number_classes;
+    *p2rows = number_rows;
+    return;
+}
+
+
+/*
+ * internal routine to compile one tuple into a cell, NULL for the
+ * NULL handler.  The next state is range checked and 
+ * FSM_SAME_STATE resolved, the handler goes into the handler 
+ * table once.
+ */
+static RC_FSM_t
+fsm_compile_cell (fsm_class_t *fsm_class, 
+                  const event_tuple_t *event_ptr,
+                  uint32_t state,
+                  fsm_cell_t *cell_ptr)
+{
+    uint32_t next_state;
+    uint32_t k;
+
+    if (event_ptr == NULL) {
+        cell_ptr->handler_index = FSM_NULL_HANDLER_INDEX;
+        cell_ptr->next_state = (uint16_t)state;
+        return (RC_FSM_OK);
+    }
+
+    next_state = event_ptr->next_state;
+    if (next_state == (uint32_t)FSM_SAME_STATE) {
+        next_state = state;
+    } else if (next_state > fsm_class->number_states-1) {
+        return (RC_FSM_INVALID_STATE_TABLE);
+    }
+
+    k = FSM_NULL_HANDLER_INDEX;
+    if (event_ptr->event_handler != NULL) {
+        for (k=1; k<fsm_class->number_handlers; k++) {
+            if (fsm_class->handler_table[k] == event_ptr->event_handler) {
+                break;
+            }
+        }
+        if (k == fsm_class->number_handlers) {
+            /* handler indexes are 16 bits */
+            if (k > 0xffff) {
+                return (RC_FSM_NO_RESOURCES);
+            }
+            fsm_class->handler_table[k] = event_ptr->event_handler;
+            fsm_class->number_handlers++;
+        }
+    }
+
+    cell_ptr->handler_index = (uint16_t)k;
+    cell_ptr->next_state = (uint16_t)next_state;
+    return (RC_FSM_OK);
+}
+
+
+/*
+ * internal routine to validate a sparse event table: event IDs 
+ * in range and strictly ascending, at most one default tuple,
+ * ended by FSM_NULL_EVENT_ID
+ */
+static RC_FSM_t
+fsm_sparse_validate (const event_tuple_t *event_ptr, uint32_t number_events)
+{
+    boolean_t have_default;
+    uint32_t count;
+    uint32_t last;
+
+    have_default = FALSE;
+    count = 0;
+    last = 0;
+    for (; event_ptr->eventID != (uint32_t)FSM_NULL_EVENT_ID; event_ptr++) {
+        if (event_ptr->eventID == (uint32_t)FSM_DEFAULT_EVENT_ID) {
+            if (have_default) {
+                return (RC_FSM_INVALID_EVENT_TABLE);
+            }
+            have_default = TRUE;
+            continue;
+        }
+
+        if (event_ptr->eventID > number_events-1 ||
+            (count && event_ptr->eventID <= last)) {
+            return (RC_FSM_INVALID_EVENT_TABLE);
+        }
+        last = event_ptr->eventID;
+        count++;
+    }
+    return (RC_FSM_OK);
+}
+
+
+/*
+ * internal routine to count the events listed by a sparse event
+ * table, the default tuple aside, and find the default: the 
+ * state's own, else the class default of the state table 
+ * terminator, else none
+ */
+static uint32_t
+fsm_sparse_count (const fsm_class_t *fsm_class,
+                  const event_tuple_t *event_ptr,
+                  const event_tuple_t **p2default)
+{
+    uint32_t count;
+
+    *p2default = 
+         fsm_class->state_table[fsm_class->number_states].p2event_tuple;
+
+    count = 0;
+    for (; event_ptr->eventID != (uint32_t)FSM_NULL_EVENT_ID; event_ptr++) {
+        if (event_ptr->eventID == (uint32_t)FSM_DEFAULT_EVENT_ID) {
+            *p2default = event_ptr;
+        } else {
+            count++;
+        }
+    }
+    return (count);
+}
+
+
+/*
+ * internal routine to compile the row of a state kept dense, 
+ * the events a sparse table leaves out take its default
+ */
+static RC_FSM_t
+fsm_compile_dense_row (fsm_class_t *fsm_class, 
+                       uint32_t state,
+                       fsm_cell_t *cell_ptr)
+{
+    const state_tuple_t *state_ptr;
+    const event_tuple_t *event_ptr;
+    const event_tuple_t *default_ptr;
+    fsm_cell_t default_cell;
+    uint32_t j;
+    RC_FSM_t rc;
+
+    state_ptr = &fsm_class->state_table[state];
+    event_ptr = state_ptr->p2event_tuple;
+
+    if (!(state_ptr->event_flags & FSM_EVENTS_SPARSE)) {
+        for (j=0; j<fsm_class->number_events; j++) {
+            rc = fsm_compile_cell(fsm_class, &event_ptr[j], state, 
+                                  &cell_ptr[j]);
+            if (rc != RC_FSM_OK) {
+                return (rc);
+            }
+        }
+        return (RC_FSM_OK);
+    }
+
+    fsm_sparse_count(fsm_class, event_ptr, &default_ptr);
+    rc = fsm_compile_cell(fsm_class, default_ptr, state, &default_cell);
+    if (rc != RC_FSM_OK) {
+        return (rc);
+    }
+    for (j=0; j<fsm_class->number_events; j++) {
+        cell_ptr[j] = default_cell;
+    }
+
+    for (; event_ptr->eventID != (uint32_t)FSM_NULL_EVENT_ID; event_ptr++) {
+        if (event_ptr->eventID == (uint32_t)FSM_DEFAULT_EVENT_ID) {
+            continue;
+        }
+        rc = fsm_compile_cell(fsm_class, event_ptr, state, 
+                              &cell_ptr[event_ptr->eventID]);
+        if (rc != RC_FSM_OK) {
+            return (rc);
+        }
+    }
+    return (RC_FSM_OK);
+}
+
+
+/*
+ * Layout plan of a state, made by fsm_layout_plan before the 
+ * tables are compiled.  The default cell is the state's own 
+ * default when it is declared sparse, else its most common cell.
+ * entries is the number of events off the default, shared is set
+ * when another state has a row of the same hash.
+ */
+typedef struct {
+    fsm_cell_t   default_cell;
+    uint32_t     entries;
+    boolean_t    shared;
+    boolean_t    sparse;
+} fsm_state_plan_t;
+
+
+/*
+ * internal routines to order packed cells and row hashes for qsort
+ */
+static int
+fsm_key_compare (const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+
+    return ((x > y) - (x < y));
+}
+
+static int
+fsm_hash_compare (const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return ((x > y) - (x < y));
+}
+
+
+/*
+ * internal routine to find the most common cell of a row, using
+ * keys to sort the packed cells.  Returns how many events have it.
+ */
+static uint32_t
+fsm_row_mode (const fsm_cell_t *row, 
+              uint32_t number_events,
+              uint32_t *keys,
+              fsm_cell_t *mode_ptr)
+{
+    uint32_t best;
+    uint32_t best_run;
+    uint32_t run;
+    uint32_t j;
+
+    for (j=0; j<number_events; j++) {
+        keys[j] = ((uint32_t)row[j].handler_index << 16) | row[j].next_state;
+    }
+    qsort(keys, number_events, sizeof(uint32_t), fsm_key_compare);
+
+    best = keys[0];
+    best_run = 0;
+    run = 0;
+    for (j=0; j<number_events; j++) {
+        run = (j && keys[j] == keys[j-1]) ? run + 1 : 1;
+        if (run > best_run) {
+            best_run = run;
+            best = keys[j];
+        }
+    }
+
+    mode_ptr->handler_index = (uint16_t)(best >> 16);
+    mode_ptr->next_state = (uint16_t)(best & 0xffff);
+    return (best_run);
+}
+
+
+/*
+ * internal routine to pick the layout of a state.  The per state
+ * flags override the class layout mode.  FSM_LAYOUT_AUTO keeps 
+ * every state dense while all the distinct rows fit in 
+ * FSM_LAYOUT_CACHE_BYTES, a row lookup being the fastest.  Past 
+ * that, the states that always take the same cell, and those with
+ * a row of their own and few enough events off their default, 
+ * become sorted lists, cutting the cache footprint for a short 
+ * search.  Rows shared with other states cost nothing and stay.
+ */
+static boolean_t
+fsm_layout_choose (const fsm_class_t *fsm_class,
+                   const state_tuple_t *state_ptr,
+                   const fsm_state_plan_t *plan_ptr,
+                   boolean_t rows_fit)
+{
+    boolean_t few;
+
+    few = (plan_ptr->entries * FSM_SPARSE_FRACTION <= 
+                                            fsm_class->number_events);
+
+    if (state_ptr->event_flags & FSM_LAYOUT_FORCE_DENSE) {
+        return (FALSE);
+    }
+    if (state_ptr->event_flags & FSM_LAYOUT_FORCE_SPARSE) {
+        return (TRUE);
+    }
+
+    switch (fsm_class->layout_mode) {
+    case FSM_LAYOUT_DENSE:
+        return (FALSE);
+
+    case FSM_LAYOUT_SPARSE:
+        return (TRUE);
+
+    case FSM_LAYOUT_DECLARED:
+        return ((state_ptr->event_flags & FSM_EVENTS_SPARSE) && few);
+
+    default:
+        if (rows_fit) {
+            return (FALSE);
+        }
+        return (plan_ptr->entries == 0 || (!plan_ptr->shared && few));
+    }
+}
+
+
+/*
+ * internal routine to measure each state and plan its layout.
+ * Every tuple is compiled here in state order, so the handler 
+ * indexes do not depend on the layout chosen.  row and keys hold
+ * number_events entries, hashes number_states.
+ */
+static RC_FSM_t
+fsm_layout_plan (fsm_class_t *fsm_class,
+                 fsm_state_plan_t *plan,
+                 fsm_cell_t *row,
+                 uint32_t *keys,
+                 uint64_t *hashes)
+{
+    const state_tuple_t *state_ptr;
+    const event_tuple_t *event_ptr;
+    const event_tuple_t *default_ptr;
+    fsm_cell_t cell;
+    uint32_t number_hashed;
+    uint32_t number_unique;
+    uint32_t i;
+    uint32_t j;
+    boolean_t rows_fit;
+    RC_FSM_t rc;
+
+    number_hashed = 0;
+    for (i=0; i<fsm_class->number_states; i++) {
+        state_ptr = &fsm_class->state_table[i];
+        plan[i].shared = FALSE;
+
+        if (state_ptr->event_flags & FSM_EVENTS_SPARSE) {
+            plan[i].entries = fsm_sparse_count(fsm_class, 
+                                               state_ptr->p2event_tuple,
+                                               &default_ptr);
+            rc = fsm_compile_cell(fsm_class, default_ptr, i, 
+                                  &plan[i].default_cell);
+            if (rc != RC_FSM_OK) {
+                return (rc);
+            }
+
+            event_ptr = state_ptr->p2event_tuple;
+            for (; event_ptr->eventID != (uint32_t)FSM_NULL_EVENT_ID; 
+                                                           event_ptr++) {
+                rc = fsm_compile_cell(fsm_class, event_ptr, i, &cell);
+                if (rc != RC_FSM_OK) {
+                    return (rc);
+                }
+            }
+            continue;
+        }
+
+        rc = fsm_compile_dense_row(fsm_class, i, row);
+        if (rc != RC_FSM_OK) {
+            return (rc);
+        }
+        hashes[number_hashed++] = 
+            ((uint64_t)fsm_cells_hash(row, fsm_class->number_events, 1) 
+                                                               << 32) | i;
+        plan[i].entries = fsm_class->number_events - 
+            fsm_row_mode(row, fsm_class->number_events, keys, 
+                         &plan[i].default_cell);
+    }
+
+    /* declared sparse states are taken as rows of their own */
+    qsort(hashes, number_hashed, sizeof(uint64_t), fsm_hash_compare);
+    number_unique = fsm_class->number_states - number_hashed;
+    for (j=0; j<number_hashed; j++) {
+        if (j && (hashes[j] >> 32) == (hashes[j-1] >> 32)) {
+            plan[(uint32_t)hashes[j]].shared = TRUE;
+            plan[(uint32_t)hashes[j-1]].shared = TRUE;
+        } else {
+            number_unique++;
+        }
+    }
+
+    rows_fit = ((uint64_t)number_unique * fsm_class->number_events * 
+                    sizeof(fsm_cell_t) <= FSM_LAYOUT_CACHE_BYTES);
+
+    for (i=0; i<fsm_class->number_states; i++) {
+        plan[i].sparse = fsm_layout_choose(fsm_class, 
+                                           &fsm_class->state_table[i],
+                                           &plan[i], rows_fit);
+    }
+    return (RC_FSM_OK);
+}
+
+
+/*
+ * internal routine to compile a state kept sparse into its entry
+ * and the next entries of the event and cell lists.  A state 
+ * declared sparse keeps the events it lists, any other state lists
+ * the events off its most common cell, compiled into row.
+ */
+static RC_FSM_t
+fsm_compile_sparse (fsm_class_t *fsm_class, 
+                    uint32_t state,
+                    const fsm_state_plan_t *plan_ptr,
+                    fsm_cell_t *row,
+                    fsm_sparse_state_t *sparse_ptr,
+                    uint32_t first)
+{
+    const event_tuple_t *event_ptr;
+    uint32_t j;
+    RC_FSM_t rc;
+
+    sparse_ptr->first = first;
+    sparse_ptr->count = (uint16_t)plan_ptr->entries;
+    sparse_ptr->reserved = 0;
+    sparse_ptr->default_cell = plan_ptr->default_cell;
+
+    event_ptr = fsm_class->state_table[state].p2event_tuple;
+    if (!(fsm_class->state_table[state].event_flags & FSM_EVENTS_SPARSE)) {
+        rc = fsm_compile_dense_row(fsm_class, state, row);
+        if (rc != RC_FSM_OK) {
+            return (rc);
+        }
+        for (j=0; j<fsm_class->number_events; j++) {
+            if (fsm_cells_equal(&row[j], &plan_ptr->default_cell, 1, 1)) {
+                continue;
+            }
+            fsm_class->sparse_events[first] = (uint16_t)j;
+            fsm_class->sparse_cells[first] = row[j];
+            first++;
+        }
+        return (RC_FSM_OK);
+    }
+
+    for (; event_ptr->eventID != (uint32_t)FSM_NULL_EVENT_ID; event_ptr++) {
+        if (event_ptr->eventID == (uint32_t)FSM_DEFAULT_EVENT_ID) {
+            continue;
+        }
+        fsm_class->sparse_events[first] = (uint16_t)event_ptr->eventID;
+        rc = fsm_compile_cell(fsm_class, event_ptr, state, 
+                              &fsm_class->sparse_cells[first]);
+        if (rc != RC_FSM_OK) {
+            return (rc);
+        }
+        first++;
+    }
+    return (RC_FSM_OK);
+}
+
+
+/*
+ * internal routine to compile the validated state and event
+ * tables.  Each cell packs the handler index and the next state
+ * so the engine needs a single load to dispatch once it has found
+ * the cell.  Handlers are de-duplicated into the handler table, 
+ * slot 0 is the NULL handler.  The next states are range checked
+ * here, once, rather than per event.
+ *
+ * fsm_layout_plan picks the states kept as sorted event lists,
+ * the rows of the others are compressed into event classes and
+ * shared rows.  All go in one cache aligned block:
+ *
+ *    sparse_states | rows | state_row | sparse_cells | 
+ *    event_class | sparse_events
+ *
+ * unless every state is dense and the compressed form would be no
+ * smaller than the matrix, which is then kept as it is.
+ */
+static RC_FSM_t
+fsm_compile_matrix (fsm_class_t *fsm_class)
+{
+    uint32_t number_states;
+    uint32_t number_events;
+    uint32_t number_tuples;
+    uint32_t number_dense;
+    uint32_t number_entries;
+    uint32_t number_classes;
+    uint32_t number_rows;
+    fsm_state_plan_t *plan;
+    uint64_t *hashes;
+    uint32_t *keys;
+    uint32_t *work;
+    uint32_t *dense_of;
+    uint32_t *class_of;
+    uint32_t *class_event;
+    uint32_t *row_of;
+    uint32_t *row_state;
+    const event_tuple_t *default_ptr;
+    const state_tuple_t *state_ptr;
+    fsm_cell_t *matrix;
+    fsm_cell_t *row;
+    uint32_t sparse;
+    uint32_t dense;
+    uint32_t first;
+    uint32_t i;
+    uint32_t j;
+    size_t size;
+    size_t matrix_size;
+    boolean_t keep_matrix;
+    uint8_t *block;
+    RC_FSM_t rc;
+
+    number_states = fsm_class->number_states;
+    number_events = fsm_class->number_events;
+
+    fsm_class->rows = NULL;
+    fsm_class->sparse_states = NULL;
+    fsm_class->handler_table = NULL;
+    fsm_class->number_handlers = 0;
+
+    /* bound the handlers by the tuples given */
+    number_tuples = 1;
+    for (i=0; i<number_states; i++) {
+        state_ptr = &fsm_class->state_table[i];
+
+        if (!(state_ptr->event_flags & FSM_EVENTS_SPARSE)) {
+            number_tuples += number_events;
+        } else {
+            number_tuples += fsm_sparse_count(fsm_class, 
+                                  state_ptr->p2event_tuple, &default_ptr) + 1;
+        }
+    }
+
+    if (posix_memalign((void **)&fsm_class->handler_table, FSM_CACHE_LINE,
+                       (number_tuples + 1) * sizeof(event_cb_t))) {
+        fsm_class->handler_table = NULL;
+        return (RC_FSM_NO_RESOURCES);
+    }
+    fsm_class->handler_table[FSM_NULL_HANDLER_INDEX] = NULL;
+    fsm_class->number_handlers = 1;
+
+    plan = (fsm_state_plan_t *)malloc(number_states * 
+                                      sizeof(fsm_state_plan_t));
+    hashes = (uint64_t *)malloc(number_states * sizeof(uint64_t));
+    row = (fsm_cell_t *)malloc(number_events * sizeof(fsm_cell_t));
+    keys = (uint32_t *)malloc(number_events * sizeof(uint32_t));
+    matrix = NULL;
+    work = NULL;
+    block = NULL;
+
+    rc = RC_FSM_NO_RESOURCES;
+    if (plan && hashes && row && keys) {
+        rc = fsm_layout_plan(fsm_class, plan, row, keys, hashes);
+    }
+
+    number_dense = 0;
+    number_entries = 0;
+    if (rc == RC_FSM_OK) {
+        for (i=0; i<number_states; i++) {
+            if (plan[i].sparse) {
+                number_entries += plan[i].entries;
+            } else {
+                number_dense++;
+            }
+        }
+
+        /* the dense rows, only until they are compressed */
+        matrix = (fsm_cell_t *)malloc(
+                     ((size_t)number_dense * number_events + 1) * 
+                     sizeof(fsm_cell_t));
+        work = (uint32_t *)malloc(
+                     (((size_t)3 * (number_events + number_dense)) + 
+                      number_states) * sizeof(uint32_t));
+        if (matrix == NULL || work == NULL) {
+            rc = RC_FSM_NO_RESOURCES;
+        }
+    }
+
+    if (rc == RC_FSM_OK) {
+        dense_of = work + (3 * (number_events + number_dense));
+        dense = 0;
+        for (i=0; i<number_states && rc == RC_FSM_OK; i++) {
+            if (plan[i].sparse) {
+                continue;
+            }
+            dense_of[i] = dense;
+            rc = fsm_compile_dense_row(fsm_class, i, 
+                                       &matrix[dense * number_events]);
+            dense++;
+        }
+    }
+
+    number_classes = 0;
+    number_rows = 0;
+    keep_matrix = FALSE;
+    if (rc == RC_FSM_OK) {
+        fsm_compress_matrix(matrix, number_dense, number_events, work,
+                            &number_classes, &number_rows);
+
+        size = (number_states - number_dense) * sizeof(fsm_sparse_state_t) +
+               ((size_t)number_rows * number_classes * sizeof(fsm_cell_t)) +
+               (number_states * sizeof(uint32_t)) +
+               (number_entries * sizeof(fsm_cell_t)) +
+               (number_events * sizeof(uint16_t)) +
+               (number_entries * sizeof(uint16_t));
+
+        /* compression that saves nothing only adds the index loads */
+        matrix_size = (size_t)number_states * number_events * 
+                                                      sizeof(fsm_cell_t);
+        if (number_dense == number_states && size >= matrix_size) {
+            keep_matrix = TRUE;
+            size = matrix_size;
+        }
+        size = (size + FSM_CACHE_LINE - 1) & ~(size_t)(FSM_CACHE_LINE - 1);
+
+        /* the row offsets share their word with FSM_ROW_SPARSE */
+        if ((!keep_matrix && 
+             (size_t)number_rows * number_classes >= FSM_ROW_SPARSE) ||
+            posix_memalign((void **)&block, FSM_CACHE_LINE, size)) {
+            block = NULL;
+            rc = RC_FSM_NO_RESOURCES;
+        }
+    }
+
+    if (rc == RC_FSM_OK && keep_matrix) {
+        /* every state is dense, so the matrix is in state order */
+        fsm_class->sparse_states = (fsm_sparse_state_t *)block;
+        fsm_class->rows = (fsm_cell_t *)block;
+        fsm_class->state_row = NULL;
+        fsm_class->event_class = NULL;
+        fsm_class->sparse_cells = NULL;
+        fsm_class->sparse_events = NULL;
+        memcpy(fsm_class->rows, matrix, matrix_size);
+
+        fsm_class->number_rows = number_states;
+        fsm_class->number_event_classes = number_events;
+        fsm_class->number_sparse_states = 0;
+        fsm_class->number_sparse_entries = 0;
+
+    } else if (rc == RC_FSM_OK) {
+        fsm_class->sparse_states = (fsm_sparse_state_t *)block;
+        fsm_class->rows = (fsm_cell_t *)
+                 (fsm_class->sparse_states + (number_states - number_dense));
+        fsm_class->state_row = (uint32_t *)
+                 (fsm_class->rows + ((size_t)number_rows * number_classes));
+        fsm_class->sparse_cells = (fsm_cell_t *)
+                 (fsm_class->state_row + number_states);
+        fsm_class->event_class = (uint16_t *)
+                 (fsm_class->sparse_cells + number_entries);
+        fsm_class->sparse_events = fsm_class->event_class + number_events;
+
+        fsm_class->number_rows = number_rows;
+        fsm_class->number_event_classes = number_classes;
+        fsm_class->number_sparse_states = number_states - number_dense;
+        fsm_class->number_sparse_entries = number_entries;
+
+        class_of = work + number_dense + number_events;
+        class_event = class_of + number_events;
+        row_of = class_event + number_events;
+        row_state = row_of + number_dense;
+
+        for (j=0; j<number_rows; j++) {
+            for (i=0; i<number_classes; i++) {
+                fsm_class->rows[(j * number_classes) + i] = 
+                    matrix[(row_state[j] * number_events) + class_event[i]];
+            }
+        }
+        for (j=0; j<number_events; j++) {
+            fsm_class->event_class[j] = (uint16_t)class_of[j];
+        }
+
+        sparse = 0;
+        first = 0;
+        for (i=0; i<number_states && rc == RC_FSM_OK; i++) {
+            if (!plan[i].sparse) {
+                fsm_class->state_row[i] = 
+                                row_of[dense_of[i]] * number_classes;
+                continue;
+            }
+            fsm_class->state_row[i] = FSM_ROW_SPARSE | sparse;
+            rc = fsm_compile_sparse(fsm_class, i, &plan[i], row,
+                                    &fsm_class->sparse_states[sparse], 
+                                    first);
+            first += plan[i].entries;
+            sparse++;
+        }
+    }
+
+    free(plan);
+    free(hashes);
+    free(row);
+    free(keys);
+    free(matrix);
+    free(work);
+    if (rc != RC_FSM_OK) {
+        free(block);
+        fsm_class->rows = NULL;
+        fsm_class->sparse_states = NULL;
+        free(fsm_class->handler_table);
+        fsm_class->handler_table = NULL;
+    }
+    return (rc);
+}
+
+
+/** 
+ * NAME
+ *    fsm_class_destroy
+ *
+ * SYNOPSIS
+ *    #include "fsm.h" 
+ *    RC_FSM_t
+ *    fsm_class_destroy(fsm_class_t **fsm_class)
+ * 
+ * DESCRIPTION
+ *    Destroys the specified state machine class.  The caller
+ *    must ensure that no instance still references the class.
+ *
+ * INPUT PARAMETERS
+ *    fsm_class - pointer to class handle
+ *
+ * OUTPUT PARAMETERS
+ *    fsm_class - is nulled
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_class_destroy (fsm_class_t **fsm_class)
+{
+     fsm_class_t *p2class;
+
+     if (fsm_class == NULL || *fsm_class == NULL) {
+         return (RC_FSM_NULL);
+     }
+
+     p2class = *fsm_class;
+     if (p2class->tag != FSM_CLASS_TAG) {
+         return (RC_FSM_INVALID_HANDLE);
+     }
+
+     p2class->tag = 0;
+     fsm_stats_free(p2class);
+     fsm_latency_free(p2class);
+     fsm_population_free(p2class);
+     free(p2class->sparse_states);
+     free(p2class->handler_table);
+     *fsm_class = NULL;
+     free(p2class);
+     return (RC_FSM_OK);
+}
+
+
+/** 
+ * NAME
+ *    fsm_class_get_layout
+ *
+ * SYNOPSIS
+ *    #include "fsm.h" 
+ *    RC_FSM_t
+ *    fsm_class_get_layout(fsm_class_t *fsm_class, 
+ *                         fsm_class_layout_t *layout)
+ * 
+ * DESCRIPTION
+ *    Reports how the tables of a class were compiled: the 
+ *    distinct rows and event classes kept, and the size of the
+ *    compressed table against the dense state x event matrix.
+ *
+ * INPUT PARAMETERS
+ *    fsm_class - class handle
+ *
+ *    layout - pointer to the report to fill in
+ *
+ * OUTPUT PARAMETERS
+ *    layout - is filled in
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_class_get_layout (fsm_class_t *fsm_class, fsm_class_layout_t *layout)
+{
+    if (fsm_class == NULL || layout == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    if (fsm_class->tag != FSM_CLASS_TAG) {
+        return (RC_FSM_INVALID_HANDLE);
+    }
+
+    layout->number_states = fsm_class->number_states;
+    layout->number_events = fsm_class->number_events;
+    layout->number_handlers = fsm_class->number_handlers - 1;
+    layout->number_rows = fsm_class->number_rows;
+    layout->number_event_classes = fsm_class->number_event_classes;
+
+    layout->number_sparse_states = fsm_class->number_sparse_states;
+    layout->number_sparse_entries = fsm_class->number_sparse_entries;
+    layout->layout_mode = fsm_class->layout_mode;
+
+    layout->dense_bytes = (uint64_t)fsm_class->number_states * 
+                          fsm_class->number_events * sizeof(fsm_cell_t);
+    if (fsm_class->event_class == NULL) {
+        layout->compressed_bytes = layout->dense_bytes;
+        return (RC_FSM_OK);
+    }
+    layout->compressed_bytes = 
+        ((uint64_t)fsm_class->number_rows * 
+         fsm_class->number_event_classes * sizeof(fsm_cell_t)) +
+        (fsm_class->number_states * sizeof(uint32_t)) +
+        (fsm_class->number_events * sizeof(uint16_t)) +
+        (fsm_class->number_sparse_states * sizeof(fsm_sparse_state_t)) +
+        (fsm_class->number_sparse_entries * 
+                           (sizeof(fsm_cell_t) + sizeof(uint16_t)));
+    return (RC_FSM_OK);
+}
+
+
+/* layout modes by name, for fsm_display_layout */
+static const char *fsm_layout_names[] = 
+    { "auto", "dense", "sparse", "declared" };
+
+/** 
+ * NAME
+ *    fsm_display_layout
+ *
+ * SYNOPSIS
+ *    #include "fsm.h" 
+ *    void
+ *    fsm_display_layout(fsm_class_t *fsm_class)
+ * 
+ * DESCRIPTION
+ *    Displays the compiled table of a class to console, with
+ *    the compression ratio and the events merged into each 
+ *    event class.
+ *
+ * INPUT PARAMETERS
+ *    fsm_class - class handle
+ *
+ * OUTPUT PARAMETERS
+ *    none
+ *
+ * RETURN VALUE
+ *    none
+ * 
+ */
+void
+fsm_display_layout (fsm_class_t *fsm_class)
+{
+    fsm_class_layout_t layout;
+    fsm_state_layout_t state_layout;
+    event_description_t *p2event_description;
+    uint32_t i;
+    uint32_t j;
+    uint32_t members;
+
+    if (fsm_class_get_layout(fsm_class, &layout) != RC_FSM_OK) {
+        return;
+    }
+    p2event_description = fsm_class->event_description_table;
+
+    printf("\nFSM class: %s \n", fsm_class->fsm_name);
+    printf("    states %u, events %u, handlers %u\n", 
+           layout.number_states, layout.number_events, 
+           layout.number_handlers);
+    printf("    rows %u of %u, event classes %u of %u\n",
+           layout.number_rows, layout.number_states,
+           layout.number_event_classes, layout.number_events);
+    printf("    layout %s\n", fsm_layout_names[layout.layout_mode]);
+    if (layout.number_sparse_states) {
+        printf("    sparse states %u, events listed %u\n",
+               layout.number_sparse_states, layout.number_sparse_entries);
+    }
+    printf("    dense %llu bytes, compressed %llu bytes, %u.%u%%\n",
+           (unsigned long long)layout.dense_bytes, 
+           (unsigned long long)layout.compressed_bytes,
+           (uint32_t)((layout.compressed_bytes * 100) / layout.dense_bytes),
+           (uint32_t)(((layout.compressed_bytes * 1000) / 
+                                           layout.dense_bytes) % 10));
+
+    /* the classes that merged events, of the rows */
+    for (i=0; fsm_class->event_class && i<layout.number_event_classes; i++) {
+        members = 0;
+        for (j=0; j<layout.number_events; j++) {
+            if (fsm_class->event_class[j] == i) {
+                members++;
+            }
+        }
+        if (members < 2) {
+            continue;
+        }
+
+        printf("    event class %u:", i);
+        for (j=0; j<layout.number_events; j++) {
+            if (fsm_class->event_class[j] == i) {
+                printf("%s %s", members ? "" : ",",
+                       p2event_description[j].description);
+                members = 0;
+            }
+        }
+        printf("\n");
+    }
+
+    /* the form chosen for each state */
+    for (i=0; i<layout.number_states; i++) {
+        if (fsm_class_get_state_layout(fsm_class, i, 
+                                       &state_layout) != RC_FSM_OK) {
+            break;
+        }
+        if (state_layout.layout == FSM_STATE_LAYOUT_SPARSE) {
+            printf("    %s: sparse, %u events listed, %u handlers\n",
+                   fsm_class->state_description_table[i].description,
+                   state_layout.entries, state_layout.handlers);
+        } else {
+            printf("    %s: dense, %u events off default, %u handlers,"
+                   " row shared by %u\n",
+                   fsm_class->state_description_table[i].description,
+                   state_layout.entries, state_layout.handlers,
+                   state_layout.shared);
+        }
+    }
+    printf("\n");
+    return;
+}
+
+
+/** 
+ * NAME
+ *    fsm_class_get_state_layout
+ *
+ * SYNOPSIS
+ *    #include "fsm.h" 
+ *    RC_FSM_t
+ *    fsm_class_get_state_layout(fsm_class_t *fsm_class,
+ *                               uint32_t state,
+ *                               fsm_state_layout_t *layout)
+ * 
+ * DESCRIPTION
+ *    Reports the form the class chose for a state, a row or a 
+ *    sorted event list, with the measures the choice is made on:
+ *    the events off the state's default cell, the distinct 
+ *    handlers it reaches and the states that share its row.  The
+ *    measures are taken from the compiled tables, in time linear
+ *    in the number of events.
+ *
+ * INPUT PARAMETERS
+ *    fsm_class - class handle
+ *    state - normalized state
+ *
+ * OUTPUT PARAMETERS
+ *    layout - is filled in
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_class_get_state_layout (fsm_class_t *fsm_class,
+                            uint32_t state,
+                            fsm_state_layout_t *layout)
+{
+    const fsm_sparse_state_t *sparse_ptr;
+    const fsm_cell_t *cell_ptr;
+    uint32_t *keys;
+    uint8_t *seen;
+    uint32_t row;
+    uint32_t i;
+    uint32_t j;
+
+    if (fsm_class == NULL || layout == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    if (fsm_class->tag != FSM_CLASS_TAG) {
+        return (RC_FSM_INVALID_HANDLE);
+    }
+
+    if (state > fsm_class->number_states-1) {
+        return (RC_FSM_INVALID_STATE);
+    }
+
+    keys = (uint32_t *)malloc(fsm_class->number_events * sizeof(uint32_t));
+    seen = (uint8_t *)calloc(fsm_class->number_handlers, sizeof(uint8_t));
+    if (keys == NULL || seen == NULL) {
+        free(keys);
+        free(seen);
+        return (RC_FSM_NO_RESOURCES);
+    }
+
+    layout->handlers = 0;
+    layout->shared = 0;
+    row = fsm_class->state_row ? fsm_class->state_row[state] : 0;
+
+    if (row & FSM_ROW_SPARSE) {
+        sparse_ptr = &fsm_class->sparse_states[row & ~FSM_ROW_SPARSE];
+        layout->layout = FSM_STATE_LAYOUT_SPARSE;
+        layout->entries = sparse_ptr->count;
+
+        seen[sparse_ptr->default_cell.handler_index] = 1;
+        for (j=0; j<sparse_ptr->count; j++) {
+            seen[fsm_class->sparse_cells[sparse_ptr->first + j].
+                                                     handler_index] = 1;
+        }
+    } else {
+        layout->layout = FSM_STATE_LAYOUT_DENSE;
+
+        for (j=0; j<fsm_class->number_events; j++) {
+            cell_ptr = fsm_class_cell(fsm_class, state, j);
+            keys[j] = ((uint32_t)cell_ptr->handler_index << 16) | 
+                                                    cell_ptr->next_state;
+            seen[cell_ptr->handler_index] = 1;
+        }
+
+        /* the mode of the keys, as fsm_row_mode */
+        qsort(keys, fsm_class->number_events, sizeof(uint32_t), 
+              fsm_key_compare);
+        layout->entries = fsm_class->number_events;
+        for (j=0, i=0; j<fsm_class->number_events; j++) {
+            i = (j && keys[j] == keys[j-1]) ? i + 1 : 1;
+            if (fsm_class->number_events - i < layout->entries) {
+                layout->entries = fsm_class->number_events - i;
+            }
+        }
+
+        for (i=0; fsm_class->state_row && i<fsm_class->number_states; i++) {
+            if (i != state && fsm_class->state_row[i] == row) {
+                layout->shared++;
+            }
+        }
+    }
+
+    for (j=FSM_NULL_HANDLER_INDEX+1; j<fsm_class->number_handlers; j++) {
+        layout->handlers += seen[j];
+    }
+
+    free(keys);
+    free(seen);
+    return (RC_FSM_OK);
+}
+
+
+/** 
+ * NAME
+ *    fsm_class_set_layout
+ *
+ * SYNOPSIS
+ *    #include "fsm.h" 
+ *    RC_FSM_t
+ *    fsm_class_set_layout(fsm_class_t *fsm_class, uint32_t layout_mode)
+ * 
+ * DESCRIPTION
+ *    Recompiles the tables of a class in the layout mode given,
+ *    overriding the FSM_LAYOUT_AUTO choice of fsm_class_create.  
+ *    The handler indexes do not change, so the counters of 
+ *    fsm_stats and fsm_latency stay valid.  No thread may be
+ *    running the class, as for fsm_class_destroy.  On error the
+ *    class keeps its tables.
+ *
+ * INPUT PARAMETERS
+ *    fsm_class - class handle
+ *    layout_mode - FSM_LAYOUT_AUTO, FSM_LAYOUT_DENSE, 
+ *                  FSM_LAYOUT_SPARSE or FSM_LAYOUT_DECLARED
+ *
+ * OUTPUT PARAMETERS
+ *    none
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_class_set_layout (fsm_class_t *fsm_class, uint32_t layout_mode)
+{
+    fsm_class_t saved;
+    RC_FSM_t rc;
+
+    if (fsm_class == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    if (fsm_class->tag != FSM_CLASS_TAG) {
+        return (RC_FSM_INVALID_HANDLE);
+    }
+
+    if (layout_mode > FSM_LAYOUT_DECLARED) {
+        return (RC_FSM_INVALID_ARGUMENT);
+    }
+
+    saved = *fsm_class;
+    fsm_class->layout_mode = layout_mode;
+    rc = fsm_compile_matrix(fsm_class);
+    if (rc != RC_FSM_OK) {
+        *fsm_class = saved;
+        return (rc);
+    }
+
+    free(saved.sparse_states);
+    free(saved.handler_table);
+    return (RC_FSM_OK);
+}
+
+
+/** 
+ * NAME
+ *    fsm_class_create
+ *
+ * SYNOPSIS
+ *    #include "fsm.h" 
+ *    RC_FSM_t
+ *    fsm_class_create(fsm_class_t **fsm_class,
+ *                     char *name,
+ *                     state_description_t *state_description_table,
+ *                     event_description_t *event_description_table,
+ *                     state_tuple_t *state_table) 
+ *
+ * DESCRIPTION
+ *    Validates the user description and state tables and 
+ *    compiles them into a state machine class.  The class is
+ *    read-only once built and can be shared by any number of
+ *    instances, see fsm_instance_init.  The user tables must 
+ *    remain valid for the life of the class.
+ *
+ * INPUT PARAMETERS
+ *    fsm_class          pointer to class handle to be returned
+ *                       once created
+ *
+ *    name               pointer to fsm name
+ *
+ *    state_description_table
+ *                       Pointer to the user table which
+ *                       provides a description of each state. 
+ * 
+ *    event_description_table
+ *                       Pointer to the user table which
+ *                       provides a description of each event. 
+ * 
+ *    state_table        Pointer to user defined state
+ *                       table.  The state table is indexed
+ *                       by the normalized state ID, 0, 1, ...
+ *                       Each state table tuple must reference
+ *                       an event table.
+ *
+ * OUTPUT PARAMETERS
+ *     none   
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_class_create (fsm_class_t **fsm_class,
+                  char *name,
+                  state_description_t *state_description_table,
+                  event_description_t *event_description_table,
+                  state_tuple_t *state_table)  
+{
+    fsm_class_t *temp_class;
+    uint32_t i;
+    uint32_t j;
+    state_tuple_t *state_ptr;
+    event_tuple_t *event_ptr;
+    RC_FSM_t rc;
+
+
+    if (fsm_class == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    if (state_description_table == NULL) {
+        return (RC_FSM_INVALID_STATE_TABLE);
+    }
+
+    if (event_description_table == NULL) {
+        return (RC_FSM_INVALID_EVENT_TABLE);
+    }
+
+    if (state_table == NULL) {
+        return (RC_FSM_INVALID_STATE_TABLE);
+    }
+
+
+    /*
+     * allocate memory to manage the class
+     */
+    temp_class = (fsm_class_t *)malloc( sizeof(fsm_class_t) );
+    if (temp_class == NULL) {
+        return (RC_FSM_NO_RESOURCES);
+    }
+
+    /*
+     * default a name if needed
+     */
+    if (name) {
+        strncpy(temp_class->fsm_name, name, FSM_NAME_LEN);
+    } else {
+        strncpy(temp_class->fsm_name, "State Machine", FSM_NAME_LEN);
+    }
+
+    temp_class->tag = FSM_CLASS_TAG;    /* for sanity checks */
+
+    /* save the event description table */ 
+    temp_class->state_description_table = state_description_table;
+    temp_class->event_description_table = event_description_table;
+
+    /* save the pointer to the state table */
+    temp_class->state_table = state_table;
+
+    /* named when first traced */
+    temp_class->trace_class_id = 0;
+    temp_class->stats = NULL;
+    temp_class->stats_enabled = FALSE;
+    temp_class->latency = NULL;
+    temp_class->population = NULL;
+
+    /* record all by default */
+    temp_class->history_policy.mode = FSM_HISTORY_ALL;
+    temp_class->history_policy.depth = FSM_HISTORY;
+    temp_class->history_policy.sample = 1;
+
+    /* chosen per state */
+    temp_class->layout_mode = FSM_LAYOUT_AUTO;
+
+    /*
+     * Find the size of the state table
+     */ 
+    temp_class->number_states = 0;
+    for (i=0; i<FSM_MAX_STATES; i++) {
+        if (state_description_table[i].state_id != FSM_NULL_STATE_ID)  { 
+            if (state_description_table[i].state_id == i && 
+                state_table[i].state_id == i && 
+                state_table[i].p2event_tuple!= NULL)  {
+                temp_class->number_states++;
+            } else {
+                free(temp_class); 
+                return (RC_FSM_INVALID_STATE_TABLE);
+            }   
+        } else { 
+            break;
+        }
+    }
+    if (temp_class->number_states < 1 ||  
+        temp_class->number_states > FSM_MAX_STATES-1) { 
+        free(temp_class); 
+        return (RC_FSM_INVALID_STATE_TABLE);
+    } 
+
+    /*
+     * Find the size of the event table
+     */ 
+    temp_class->number_events = 0;
+    for (i=0; i<FSM_MAX_EVENTS; i++) {
+        if (event_description_table[i].event_id == FSM_NULL_EVENT_ID)  {
+            break;
+        }
+
+        if (event_description_table[i].event_id != i)  {
+            free(temp_class); 
+            return (RC_FSM_INVALID_EVENT_TABLE); 
+        }
+        temp_class->number_events++;
+    }
+    if (temp_class->number_events < 1 ||  
+        temp_class->number_events > FSM_MAX_EVENTS-1) { 
+        free(temp_class); 
+        return (RC_FSM_INVALID_EVENT_TABLE);
+    } 
+
+    /*
+     * Now verify the state table - event table relationships and
+     * that the IDs are normalized.   
+     */
+    for (i=0; i<temp_class->number_states; i++) {
+        state_ptr = &temp_class->state_table[i];
+
+        event_ptr = state_ptr->p2event_tuple;
+
+        if (state_ptr->event_flags & FSM_EVENTS_SPARSE) {
+            if (fsm_sparse_validate(event_ptr, 
+                                    temp_class->number_events) != RC_FSM_OK) {
+                free(temp_class); 
+                return (RC_FSM_INVALID_EVENT_TABLE);
+            }
+        } else {
+            for (j=0; j<temp_class->number_events; j++) {
+                if (j != event_ptr[j].eventID) {
+                    free(temp_class); 
+                    return (RC_FSM_INVALID_EVENT_TABLE);
+                }
+            }
+        }
+
+        if ((state_ptr->event_flags & FSM_LAYOUT_FORCE_DENSE) &&
+            (state_ptr->event_flags & FSM_LAYOUT_FORCE_SPARSE)) {
+            free(temp_class); 
+            return (RC_FSM_INVALID_STATE_TABLE);
+        }
+
+        if (state_ptr->timeout && 
+            state_ptr->timeout_event > temp_class->number_events-1) {
+            free(temp_class); 
+            return (RC_FSM_INVALID_STATE_TABLE);
+        }
+    }
+
+    /* the terminator may carry the default of the sparse states */
+    event_ptr = state_table[temp_class->number_states].p2event_tuple;
+    if (event_ptr != NULL && 
+        event_ptr->eventID != (uint32_t)FSM_DEFAULT_EVENT_ID) {
+        free(temp_class); 
+        return (RC_FSM_INVALID_EVENT_TABLE);
+    }
+
+    /*
+     * compile the validated tables into the dispatch matrix
+     */
+    rc = fsm_compile_matrix(temp_class);
+    if (rc != RC_FSM_OK) {
+        free(temp_class);
+        return (rc);
+    }
+
+    /* return handle to the user */
+    *fsm_class = temp_class;
+    return (RC_FSM_OK);
+}
+
+
+/*
+ * internal routine to initialize a state machine on a validated
+ * class, shared by fsm_create and fsm_create_in_pool.  The 
+ * optional history buffer holds history_depth entries and is 
+ * used when the history policy of the class fits.
+ */
+RC_FSM_t
+fsm_init (fsm_t *fsm, 
+          fsm_class_t *fsm_class, 
+          uint32_t initial_state,
+          fsm_history_t *history,
+          uint32_t history_depth)
+{
+    RC_FSM_t rc;
+
+    fsm->tag = FSM_TAG;    /* for sanity cchecks */
+
+    fsm->curr_state    = initial_state;
+    fsm->next_state    = initial_state;
+    fsm->exception_state_indicator = FALSE;
+    fsm->flags = 0;
+    fsm->instance_id = FSM_FETCH_ADD(&fsm_instance_count, 1);
+
+    fsm->fsm_class = fsm_class;
+    memcpy(fsm->fsm_name, fsm_class->fsm_name, FSM_NAME_LEN);
+    fsm->number_states = fsm_class->number_states;
+    fsm->number_events = fsm_class->number_events;
+
+    fsm->state_description_table = fsm_class->state_description_table;
+    fsm->event_description_table = fsm_class->event_description_table;
+    fsm->state_table = fsm_class->state_table;
+
+    fsm->event_queue = NULL;
+    fsm->event_queue_size = 0;
+    fsm->event_queue_head = 0;
+    fsm->event_queue_tail = 0;
+    fsm->engine_active = FALSE;
+
+    fsm->timer_wheel = NULL;
+    fsm->state_timer = NULL;
+    fsm->state_entry_tsc = 0;
+
+    /*
+     * initialize history as the class says
+     */
+    fsm->history = NULL;
+    fsm->history_buffer = history;
+    fsm->history_buffer_depth = history ? history_depth : 0;
+    rc = fsm_history_apply(fsm, &fsm_class->history_policy);
+    if (rc != RC_FSM_OK) {
+        return (rc);
+    }
+
+    /*
+     * counted in the state populations when the class keeps them,
+     * last, as a failed init is freed without being untracked
+     */
+    if (fsm_class->population) {
+        fsm_population_track(fsm);
+    }
+    return (RC_FSM_OK);
+}
+
+
 /** 
  * NAME
  *    fsm_create
@@ -360,7 +2690,11 @@ fsm_destroy (fsm_t **fsm)
  *
  * DESCRIPTION
  *    Creates and initializes a state machine. The
- *    initial state is specified by the user.
+ *    initial state is specified by the user.  The state
+ *    and event tables are validated and compiled into a
+ *    private class, see fsm_class_create, which drives the
+ *    engine.  A next state that is out of range is rejected
+ *    here.
  *
  * INPUT PARAMETERS
  *    fsm                pointer to fsm handle to be returned
@@ -405,228 +2739,656 @@ fsm_create (fsm_t **fsm,
             state_tuple_t *state_table)  
 {
     fsm_t *temp_fsm;
-    uint32_t i;
-    uint32_t j;
-    state_tuple_t *state_ptr;
-    event_tuple_t *event_ptr;
+    RC_FSM_t rc;
 
 
     if (fsm == NULL) {
         return (RC_FSM_NULL);
     }
 
-    if (state_description_table == NULL) {
-        return (RC_FSM_INVALID_STATE_TABLE);
+    /*
+     * allocate memory to manage state machine
+     */
+    temp_fsm = (fsm_t *)malloc( sizeof(fsm_t) );
+    if (temp_fsm == NULL) {
+        return (RC_FSM_NO_RESOURCES);
     }
 
-    if (event_description_table == NULL) {
-        return (RC_FSM_INVALID_EVENT_TABLE);
+    /*
+     * validate and compile the tables
+     */
+    rc = fsm_class_create(&temp_fsm->fsm_class,
+                          name,
+                          state_description_table,
+                          event_description_table,
+                          state_table);
+    if (rc != RC_FSM_OK) {
+        free(temp_fsm);
+        return (rc);
     }
 
-    if (state_table == NULL) {
-        return (RC_FSM_INVALID_STATE_TABLE);
+    /*
+     * check zero based range for state
+     */
+    if (initial_state > temp_fsm->fsm_class->number_states-1) {
+        fsm_class_destroy(&temp_fsm->fsm_class);
+        free(temp_fsm); 
+        return (RC_FSM_INVALID_STATE);
+    }
+
+    /*
+     * initialize, allocating memory for history
+     */ 
+    rc = fsm_init(temp_fsm, temp_fsm->fsm_class, initial_state, NULL, 0);
+    if (rc != RC_FSM_OK) {
+        fsm_class_destroy(&temp_fsm->fsm_class);
+        free(temp_fsm);
+        return (rc);
+    }
+    temp_fsm->pool = NULL;
+
+    /* return handle to the user */
+    *fsm = temp_fsm;
+    return (RC_FSM_OK);
+}
+
+
+/*
+ * internal routine to record a transition in the history ring
+ */
+static inline void
+fsm_history_store (fsm_history_t *history_ptr,
+                   uint32_t prev_state,
+                   uint32_t normalized_event,
+                   uint32_t next_state,
+                   RC_FSM_t handler_rc)
+{
+    history_ptr->prevStateID = prev_state;
+    history_ptr->stateID = next_state;
+    history_ptr->eventID = normalized_event;
+    history_ptr->handler_rc = handler_rc;
+}
+
+
+/*
+ * internal routine to promote an on-error history to the full
+ * ring, seeded with the lead-up.  The ring stays unallocated if
+ * memory is short, the lead-up is still kept.
+ */
+static void
+fsm_history_promote (fsm_t *fsm)
+{
+    fsm_history_t *ring;
+    uint32_t depth;
+    uint32_t i;
+
+    depth = fsm->history_policy.depth;
+    ring = fsm_history_ring(fsm, depth);
+    if (ring == NULL) {
+        return;
+    }
+
+    /* oldest lead-up entry first */
+    fsm->history = ring;
+    fsm->history_mask = depth - 1;
+    fsm->history_index = 0;
+    for (i=1; i<=FSM_HISTORY_LEADUP; i++) {
+        if (fsm->history_leadup[(fsm->history_countdown + i) & 
+                            (FSM_HISTORY_LEADUP - 1)].stateID == 
+                                                  FSM_NULL_STATE_ID) {
+            continue;
+        }
+        fsm->history_index = (fsm->history_index+1) & fsm->history_mask;
+        fsm->history[fsm->history_index] = 
+            fsm->history_leadup[(fsm->history_countdown + i) & 
+                                (FSM_HISTORY_LEADUP - 1)];
+    }
+}
+
+
+/*
+ * internal routine to count an event, record a state transition 
+ * history as the history policy says, and to trace it when start
+ * is set
+ */
+static void
+fsm_record_history (fsm_t *fsm,
+                   uint32_t normalized_event,
+                   uint32_t nextState,
+                   RC_FSM_t handler_rc,
+                   uint64_t start)
+{
+    if (fsm->fsm_class->stats_enabled) {
+        fsm_stats_count(fsm->fsm_class, fsm->curr_state, 
+                        normalized_event, handler_rc);
+    }
+
+    /*
+     * the state only changes on RC_FSM_OK from a handler
+     */
+    if (start) {
+        fsm_trace_transition(fsm, 
+                             normalized_event, 
+                             handler_rc == RC_FSM_OK ? 
+                                   nextState : fsm->curr_state,
+                             handler_rc, 
+                             start);
+    }
+
+    switch (fsm->history_policy.mode) {
+    case FSM_HISTORY_OFF:
+        return;
+
+    case FSM_HISTORY_SAMPLED:
+        if (--fsm->history_countdown) {
+            return;
+        }
+        fsm->history_countdown = fsm->history_policy.sample;
+        break;
+
+    case FSM_HISTORY_ON_ERROR:
+        if (fsm->history) {
+            break;
+        }
+
+        /*
+         * not yet promoted, history_countdown indexes the lead-up
+         */
+        fsm->history_countdown = (fsm->history_countdown+1) & 
+                                 (FSM_HISTORY_LEADUP - 1);
+        fsm_history_store(&fsm->history_leadup[fsm->history_countdown],
+                          fsm->curr_state, normalized_event, 
+                          nextState, handler_rc);
+
+        if (handler_rc != RC_FSM_OK && 
+            handler_rc != RC_FSM_INVALID_EVENT_HANDLER) {
+            fsm_history_promote(fsm);
+        }
+        return;
+
+    default:
+        break;
+    }
+
+    /*
+     * get next index to record a little history
+     */
+    fsm->history_index = (fsm->history_index+1) & fsm->history_mask;
+
+    fsm_history_store(&fsm->history[fsm->history_index],
+                      fsm->curr_state, normalized_event, 
+                      nextState, handler_rc);
+    return;
+}
+
+
+/*
+ * internal routine to run the state timeouts on a transition.
+ * Leaving a state cancels its timer, entering a state with a 
+ * timeout arms it.  Staying in the same state keeps the running
+ * timer unless the state asks for a re-arm.
+ */
+static void
+fsm_state_timer_transition (fsm_t *fsm, 
+                            uint32_t prev_state, 
+                            uint32_t next_state)
+{
+    state_tuple_t *state_ptr;
+
+    state_ptr = &fsm->state_table[next_state];
+
+    if (prev_state == next_state) {
+        if (state_ptr->timeout == 0 ||
+            !(state_ptr->timeout_flags & FSM_TIMEOUT_REARM)) {
+            return;
+        }
+    } else if (state_ptr->timeout == 0) {
+        fsm_timer_stop(fsm->timer_wheel, fsm->state_timer);
+        return;
+    }
+
+    /* a start restarts the timer of the previous state */
+    fsm_timer_start(fsm->timer_wheel, 
+                    fsm->state_timer, 
+                    fsm,
+                    state_ptr->timeout_event,
+                    state_ptr->timeout);
+    return;
+}
+
+
+/*
+ * internal routine to process one event, the handle has been
+ * validated by the caller
+ */
+static RC_FSM_t
+fsm_engine_process (fsm_t *fsm, 
+                    uint32_t normalized_event, 
+                    void *p2event_buffer, 
+                    void *p2parm)
+{
+    fsm_cell_t          cell;
+    event_cb_t          event_handler;
+    RC_FSM_t            rc;
+    uint64_t            start;
+    uint64_t            handler_start;
+    uint32_t            trace_class_id;
+    uint32_t            trace_instance;
+    uint32_t            trace_state;
+
+    /* time stamp for the trace, tracing is off when 0 */
+    start = 0;
+    if (fsm_trace_enabled) {
+        start = fsm_tsc();
+    }
+
+    /*
+     * verify that "event id" is valid: [0-(number_events-1)]
+     */
+    if (normalized_event > fsm->number_events-1) {
+        fsm_record_history(fsm, normalized_event, 
+                           fsm->curr_state, RC_FSM_INVALID_EVENT, start);
+        return (RC_FSM_INVALID_EVENT);
+    }
+
+    /*
+     * Index into the compiled rows to get the cell holding
+     * the handler index and the next state.  The current state
+     * is always in range, so no further checks are needed.
+     */
+    cell = fsm_class_lookup(fsm->fsm_class, 
+                            fsm->curr_state, 
+                            normalized_event);
+
+    /*
+     * If the handler was NULL then we have a quiet event ,
+     * no processing possible.
+     */
+    event_handler = fsm->fsm_class->handler_table[cell.handler_index];
+    if (event_handler == NULL) {
+        fsm_record_history(fsm, 
+                           normalized_event, 
+                           cell.next_state,
+                           RC_FSM_INVALID_EVENT_HANDLER,
+                           start);
+        return (RC_FSM_OK);
+    }
+
+    /*
+     * A handler that stops processing may end the state machine,
+     * and with it the class, so what its trace needs is read 
+     * before the call.
+     */
+    trace_class_id = 0;
+    trace_instance = 0;
+    trace_state = 0;
+    if (start) {
+        trace_class_id = fsm_trace_class_id(fsm->fsm_class);
+        trace_instance = fsm->instance_id;
+        trace_state = fsm->curr_state;
+    }
+
+    /*
+     * Time the handler when asked.  The flag is read before the
+     * call as the handler may end the state machine.
+     */
+    if (fsm->flags & FSM_FLAG_LATENCY) {
+        handler_start = fsm_tsc();
+        rc = (*event_handler)(p2event_buffer, p2parm);
+        if (rc != RC_FSM_STOP_PROCESSING) {
+            fsm_latency_record(fsm->fsm_class, cell.handler_index, 
+                               fsm_tsc() - handler_start);
+        }
+    } else {
+        rc = (*event_handler)(p2event_buffer, p2parm);
+    }
+
+    /*
+     * Event handler wants to stop processing events. There is no access
+     * to the fsm data structure in case the state machine has ended. 
+     */
+    if (rc == RC_FSM_STOP_PROCESSING) {
+        if (start) {
+            fsm_trace_stop(trace_class_id, trace_instance, trace_state,
+                           normalized_event, start);
+        }
+        return (rc);
+    }
+
+    /*
+     * If the return code is not OK, simply record the
+     * result without a state change.  
+     */
+    if (rc != RC_FSM_OK) {
+        fsm_record_history(fsm, normalized_event, 
+                               cell.next_state, rc, start);
+        return (rc);
+    }
+
+    /*
+     * If the exception state indicator is set, use the exception
+     * state provided by the event handler.  This is an unexpected
+     * state transition.  Else use the event table next state.
+     *
+     * Both were range checked before we got here, the table
+     * next states by fsm_create and the exception state by
+     * fsm_set_exception_state.
+     */
+    if (fsm->exception_state_indicator) {
+        /*
+         * event handler detected an exception to the state transition 
+         */
+        fsm->exception_state_indicator = FALSE;
+        fsm->next_state = fsm->exception_state;
+
+    } else {
+        /*
+         * we have a valid event table transition
+         */
+        fsm->next_state = cell.next_state;
+    }
+
+    /* record a bit of history. */
+    fsm_record_history(fsm, 
+                       normalized_event, 
+                       fsm->next_state, 
+                       rc,
+                       start);
+
+    /*
+     * run the state timeouts
+     */
+    if (fsm->state_timer) {
+        fsm_state_timer_transition(fsm, fsm->curr_state, fsm->next_state);
     }
 
+    /*
+     * move to the population of the next state, recording the 
+     * stay when the entry time is kept
+     */
+    if ((fsm->flags & FSM_FLAG_POPULATION) && 
+        fsm->next_state != fsm->curr_state) {
+        fsm_population_move(fsm->fsm_class, 
+                            fsm->curr_state, 
+                            fsm->next_state,
+                            (fsm->flags & FSM_FLAG_DWELL) ? 
+                                     &fsm->state_entry_tsc : NULL);
+    }
+
+    /*
+     * and update the current state completing the transition
+     */
+    fsm->curr_state = fsm->next_state;
+    return (rc);
+}
+
+
+/** 
+ * NAME
+ *    fsm_engine
+ *
+ * SYNOPSIS
+ *    #include "fsm.h" 
+ *    RC_FSM_t
+ *    fsm_engine(fsm_t *fsm, 
+ *               uint32_t normalized_event,  
+ *               void *p2event_buffer, 
+ *               void *p2parm)
+ *
+ * DESCRIPTION
+ *    Drives a state machine defined by normalized event 
+ *    and a states.
+ *
+ * INPUT PARAMETERS
+ *    *fsm             state machine handle
+ *
+ *    normalized_event the event id to process 
+ *
+ *    *p2event         pointer to the raw event which
+ *                     is driving the event. This is 
+ *                     passed through to the handler.  
+ *
+ *    *p2parm          pointer parameter that is simply
+ *                     passed through to each event
+ *                     handler.
+ *
+ * OUTPUT PARAMETERS
+ *    none 
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_engine (fsm_t *fsm, 
+            uint32_t normalized_event, 
+            void *p2event_buffer, 
+            void *p2parm)
+{
+    fsm_event_t        *queued_ptr;
+    RC_FSM_t            rc;
+    RC_FSM_t            queued_rc;
 
     /*
-     * allocate memory to manage state machine
+     * verify pointers & handles are valid
      */
-    temp_fsm = (fsm_t *)malloc( sizeof(fsm_t) );
-    if (temp_fsm == NULL) {
-        return (RC_FSM_NO_RESOURCES);
+    if (fsm == NULL) {
+        return (RC_FSM_NULL);
     }
 
-    /*
-     * default a name if needed
-     */
-    if (name) {
-        strncpy(temp_fsm->fsm_name, name, FSM_NAME_LEN);
-    } else {
-        strncpy(temp_fsm->fsm_name, "State Machine", FSM_NAME_LEN);
+    if (fsm->tag != FSM_TAG) {
+        return (RC_FSM_INVALID_HANDLE);
     }
 
     /*
-     * initialize fsm config parms
+     * Without an event queue, or when called from a handler, 
+     * simply process the event.  The outermost call does the
+     * draining.
      */
-    temp_fsm->tag = FSM_TAG;    /* for sanity cchecks */
-
-    temp_fsm->curr_state    = initial_state;
-    temp_fsm->next_state    = initial_state;
-    temp_fsm->exception_state_indicator = FALSE;
-
-    /* save the event description table */ 
-    temp_fsm->state_description_table = state_description_table;
-    temp_fsm->event_description_table = event_description_table;
+    if (fsm->event_queue == NULL || fsm->engine_active) {
+        return (fsm_engine_process(fsm, 
+                                   normalized_event, 
+                                   p2event_buffer, 
+                                   p2parm));
+    }
 
-    /* save the pointer to the state table */
-    temp_fsm->state_table = state_table;
+    fsm->engine_active = TRUE;
 
-    /*
-     * Find the size of the state table
-     */ 
-    temp_fsm->number_states = 0;
-    for (i=0; i<FSM_MAX_STATES; i++) {
-        if (state_description_table[i].state_id != FSM_NULL_STATE_ID)  { 
-#if 0
-            printf("%u  %u  %u \n", 
-                i,  
-                state_description_table[i].state_id, 
-                state_table[i].state_id); 
-#endif
-            if (state_description_table[i].state_id == i && 
-                state_table[i].state_id == i && 
-                state_table[i].p2event_tuple!= NULL)  {
-                temp_fsm->number_states++;
-            } else {
-                free(temp_fsm); 
-                return (RC_FSM_INVALID_STATE_TABLE);
-            }   
-        } else { 
-            break;
-        }
+    rc = fsm_engine_process(fsm, 
+                            normalized_event, 
+                            p2event_buffer, 
+                            p2parm);
+    if (rc == RC_FSM_STOP_PROCESSING) {
+        return (rc);
     }
-    if (temp_fsm->number_states < 1 ||  
-        temp_fsm->number_states > FSM_MAX_STATES-1) { 
-        free(temp_fsm); 
-        return (RC_FSM_INVALID_STATE_TABLE);
-    } 
-#if 0 
-    printf("number states=%u \n", temp_fsm->number_states);
-#endif
 
     /*
-     * check zero based range for state
+     * Run to completion: drain the events posted by the handlers,
+     * including those posted while draining.  The result of each
+     * posted event is recorded in the history.
      */
-    if (initial_state > temp_fsm->number_states-1) {
-        free(temp_fsm); 
-        return (RC_FSM_INVALID_STATE);
-    }
-
-
-    /*
-     * Find the size of the event table
-     */ 
-    temp_fsm->number_events = 0;
-    for (i=0; i<FSM_MAX_EVENTS; i++) {
-        if (event_description_table[i].event_id == FSM_NULL_EVENT_ID)  {
-            break;
+    while (fsm->event_queue_head != fsm->event_queue_tail) {
+
+        queued_ptr = &fsm->event_queue[fsm->event_queue_head & 
+                                       (fsm->event_queue_size - 1)];
+        fsm->event_queue_head++;
+
+        queued_rc = fsm_engine_process(fsm, 
+                                       queued_ptr->normalized_event, 
+                                       queued_ptr->p2event_buffer, 
+                                       queued_ptr->p2parm);
+        if (queued_rc == RC_FSM_STOP_PROCESSING) {
+            return (queued_rc);
         }
-#if 0 
-        printf(" %u event_id=%u \n",
-                i,
-                event_description_table[i].event_id);
-#endif
-
-        if (event_description_table[i].event_id != i)  {
-            free(temp_fsm); 
-            return (RC_FSM_INVALID_EVENT_TABLE); 
-        }
-        temp_fsm->number_events++;
     }
-    if (temp_fsm->number_events < 1 ||  
-        temp_fsm->number_events > FSM_MAX_EVENTS-1) { 
-        free(temp_fsm); 
-        return (RC_FSM_INVALID_EVENT_TABLE);
-    } 
-#if 0 
-    printf("number events=%u \n", temp_fsm->number_events);
-#endif
+    fsm->engine_active = FALSE;
+    return (rc);
+}
 
-    /*
-     * Now verify the state table - event table relationships and
-     * that the IDs are normalized.   
-     */
-    for (i=0; i<temp_fsm->number_states; i++) {
-        state_ptr = &temp_fsm->state_table[i];
 
-        event_ptr = state_ptr->p2event_tuple;
 
-        for (j=0; j<temp_fsm->number_events; j++) {
-#if 0 
-            printf(" %u eventID=%u \n",
-                   j,
-                   event_ptr[j].eventID);
-#endif
-            if (j != event_ptr[j].eventID) {
-                free(temp_fsm); 
-                return (RC_FSM_INVALID_EVENT_TABLE);
-            }
-        }
+
+/** 
+ * NAME
+ *    fsm_instance_init
+ *
+ * SYNOPSIS
+ *    #include "fsm.h" 
+ *    RC_FSM_t
+ *    fsm_instance_init(fsm_instance_t *instance,
+ *                      fsm_class_t *fsm_class,
+ *                      uint32_t initial_state)
+ *
+ * DESCRIPTION
+ *    Initializes a lightweight instance of a state machine
+ *    class in user provided memory.  No validation of the 
+ *    tables or memory allocation takes place, the class has
+ *    done that once for all of its instances.
+ *
+ * INPUT PARAMETERS
+ *    instance           pointer to the instance to initialize
+ *
+ *    fsm_class          class handle from fsm_class_create
+ *
+ *    initial_state      Initial start state
+ *
+ * OUTPUT PARAMETERS
+ *     none   
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_instance_init (fsm_instance_t *instance,
+                   fsm_class_t *fsm_class,
+                   uint32_t initial_state)
+{
+    if (instance == NULL || fsm_class == NULL) {
+        return (RC_FSM_NULL);
     }
 
-    /*
-     * allocate memory for history
-     */ 
-    temp_fsm->history = malloc(FSM_HISTORY * sizeof(fsm_history_t));
-    if (temp_fsm->history == NULL) {
-        free(temp_fsm);
-        return (RC_FSM_NO_RESOURCES);
+    if (fsm_class->tag != FSM_CLASS_TAG) {
+        return (RC_FSM_INVALID_HANDLE);
     }
 
-    /*
-     * initialize history buffer
-     */
-    temp_fsm->history_index = 0;
-    for (i=0; i<FSM_HISTORY; i++) {
-        temp_fsm->history[i].prevStateID = FSM_NULL_STATE_ID;
-        temp_fsm->history[i].stateID = FSM_NULL_STATE_ID;
-        temp_fsm->history[i].eventID = FSM_NULL_EVENT_ID;
-        temp_fsm->history[i].handler_rc = RC_FSM_NULL;
+    if (initial_state > fsm_class->number_states-1) {
+        return (RC_FSM_INVALID_STATE);
     }
 
-    /* return handle to the user */
-    *fsm = temp_fsm;
+    instance->fsm_class = fsm_class;
+    instance->curr_state = (uint16_t)initial_state;
+    instance->exception_state = (uint16_t)initial_state;
+    instance->flags = 0;
     return (RC_FSM_OK);
 }
 
 
-/*
- * internal routine to record a state transition history
+/** 
+ * NAME
+ *    fsm_instance_get_state
+ *
+ * SYNOPSIS
+ *    #include "fsm.h"
+ *    RC_FSM_t
+ *    fsm_instance_get_state(fsm_instance_t *instance, 
+ *                           uint32_t *p2state)
+ *
+ * DESCRIPTION
+ *    Function to return the current state of an instance.
+ *
+ * INPUT PARAMETERS
+ *    instance - instance handle
+ *
+ *    p2state - Pointer to a state variable to be updated.
+ *
+ * OUTPUT PARAMETERS
+ *    none 
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    error otherwise
+ * 
  */
-static void
-fsm_record_history (fsm_t *fsm,
-                   uint32_t normalized_event,
-                   uint32_t nextState,
-                   RC_FSM_t handler_rc)
+RC_FSM_t
+fsm_instance_get_state (fsm_instance_t *instance, uint32_t *p2state)
 {
-    fsm_history_t   *history_ptr;
+    if (instance == NULL || instance->fsm_class == NULL) {
+        return (RC_FSM_NULL);
+    }
 
-    /*
-     * get next index to record a little history
-     */
-    fsm->history_index = (fsm->history_index+1)%FSM_HISTORY;
+    *p2state = instance->curr_state;
+    return (RC_FSM_OK);
+}
 
-    /*
-     * Get a local pointer to the history buffer to populate
-     */
-    history_ptr = &fsm->history[fsm->history_index];
 
-    history_ptr->prevStateID = fsm->curr_state;
-    history_ptr->stateID = nextState;
-    history_ptr->eventID = normalized_event;
-    history_ptr->handler_rc = handler_rc;
-    return;
+/** 
+ * NAME
+ *    fsm_instance_set_exception_state
+ * 
+ * SYNOPSIS
+ *    #include "fsm.h"
+ *    RC_FSM_t
+ *    fsm_instance_set_exception_state(fsm_instance_t *instance, 
+ *                                     uint32_t exception_state)
+ *
+ * DESCRIPTION
+ *    To be called from an event handler to alter the next
+ *    state of an instance when an exception has been detected.
+ *
+ * INPUT PARAMETERS
+ *    instance - instance handle
+ *
+ *    exception_state - New state to be transitioned
+ *            when the event handler returns.
+ *
+ * OUTPUT PARAMETERS
+ *    none 
+ * 
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_instance_set_exception_state (fsm_instance_t *instance,
+                                  uint32_t exception_state)
+{
+    if (instance == NULL || instance->fsm_class == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    if (exception_state > instance->fsm_class->number_states-1) {
+        return (RC_FSM_INVALID_STATE);
+    }
+
+    instance->exception_state = (uint16_t)exception_state;
+    instance->flags |= FSM_INSTANCE_EXCEPTION;
+    return (RC_FSM_OK);
 }
 
 
 /** 
  * NAME
- *    fsm_engine
+ *    fsm_instance_engine
  *
  * SYNOPSIS
  *    #include "fsm.h" 
  *    RC_FSM_t
- *    fsm_engine(fsm_t *fsm, 
- *               uint32_t normalized_event,  
- *               void *p2event_buffer, 
- *               void *p2parm)
+ *    fsm_instance_engine(fsm_instance_t *instance, 
+ *                        uint32_t normalized_event,  
+ *                        void *p2event_buffer, 
+ *                        void *p2parm)
  *
  * DESCRIPTION
- *    Drives a state machine defined by normalized event 
- *    and a states.
+ *    Drives a lightweight instance with a normalized event. 
+ *    The processing is that of fsm_engine except that no
+ *    history is recorded.
  *
  * INPUT PARAMETERS
- *    *fsm             state machine handle
+ *    instance         instance handle
  *
  *    normalized_event the event id to process 
  *
@@ -647,120 +3409,105 @@ fsm_record_history (fsm_t *fsm,
  * 
  */
 RC_FSM_t
-fsm_engine (fsm_t *fsm, 
-            uint32_t normalized_event, 
-            void *p2event_buffer, 
-            void *p2parm)
+fsm_instance_engine (fsm_instance_t *instance, 
+                     uint32_t normalized_event, 
+                     void *p2event_buffer, 
+                     void *p2parm)
 {
-    event_tuple_t      *event_ptr;
+    fsm_class_t        *fsm_class;
+    fsm_cell_t          cell;
     event_cb_t          event_handler;
+    uint32_t            curr_state;
+    uint32_t            next_state;
+    uint32_t            trace_class_id;
     RC_FSM_t            rc;
+    uint64_t            start;
 
-    /*
-     * verify pointers & handles are valid
-     */
-    if (fsm == NULL) {
+    if (instance == NULL) {
         return (RC_FSM_NULL);
     }
 
-    if (fsm->tag != FSM_TAG) {
+    fsm_class = instance->fsm_class;
+    if (fsm_class == NULL || fsm_class->tag != FSM_CLASS_TAG) {
         return (RC_FSM_INVALID_HANDLE);
     }
 
-    /*
-     * verify that "event id" is valid: [0-(number_events-1)]
-     */
-    if (normalized_event > fsm->number_events-1) {
-        fsm_record_history(fsm, normalized_event, 
-                           fsm->curr_state, RC_FSM_INVALID_EVENT);
+    /* time stamp for the trace, tracing is off when 0 */
+    start = 0;
+    trace_class_id = 0;
+    if (fsm_trace_enabled) {
+        start = fsm_tsc();
+        trace_class_id = fsm_trace_class_id(fsm_class);
+    }
+
+    curr_state = instance->curr_state;
+
+    if (normalized_event > fsm_class->number_events-1) {
+        if (fsm_class->stats_enabled) {
+            fsm_stats_count(fsm_class, curr_state,
+                            normalized_event, RC_FSM_INVALID_EVENT);
+        }
+        if (start) {
+            fsm_trace_instance(fsm_class, 0, curr_state, normalized_event,
+                               curr_state, RC_FSM_INVALID_EVENT, start);
+        }
         return (RC_FSM_INVALID_EVENT);
     }
 
-    /*
-     * Index into the state table to get to the event table
-     * so we can get the next state and the event handler.
-     */
-    event_ptr = 
-         &fsm->state_table[fsm->curr_state].p2event_tuple[normalized_event];
+    cell = fsm_class_lookup(fsm_class, curr_state, normalized_event);
 
-    /*
-     * If the handler was NULL then we have a quiet event ,
-     * no processing possible.
-     */
-    event_handler = event_ptr->event_handler;
+    event_handler = fsm_class->handler_table[cell.handler_index];
     if (event_handler == NULL) {
-        fsm_record_history(fsm, 
-                           normalized_event, 
-                           event_ptr->next_state,
-                           RC_FSM_INVALID_EVENT_HANDLER);
+        if (fsm_class->stats_enabled) {
+            fsm_stats_count(fsm_class, curr_state,
+                            normalized_event, 
+                            RC_FSM_INVALID_EVENT_HANDLER);
+        }
+        if (start) {
+            fsm_trace_instance(fsm_class, 0, curr_state, normalized_event,
+                               curr_state, RC_FSM_INVALID_EVENT_HANDLER, 
+                               start);
+        }
         return (RC_FSM_OK);
     }
 
     rc = (*event_handler)(p2event_buffer, p2parm);
 
     /*
-     * Event handler wants to stop processing events. There is no access
-     * to the fsm data structure in case the state machine has ended. 
+     * no state change on error, and no access at all once the
+     * handler has asked to stop processing 
      */
     if (rc == RC_FSM_STOP_PROCESSING) {
+        if (start) {
+            fsm_trace_stop(trace_class_id, 0, curr_state, 
+                           normalized_event, start);
+        }
         return (rc);
     }
 
-    /*
-     * If the return code is not OK, simply record the
-     * result without a state change.  
-     */
+    if (fsm_class->stats_enabled) {
+        fsm_stats_count(fsm_class, curr_state, normalized_event, rc);
+    }
+
     if (rc != RC_FSM_OK) {
-        fsm_record_history(fsm, normalized_event, 
-                               event_ptr->next_state, rc);
+        if (start) {
+            fsm_trace_instance(fsm_class, 0, curr_state, normalized_event,
+                               curr_state, rc, start);
+        }
         return (rc);
     }
 
-    /*
-     * If the exception state indicator is set, use the exception
-     * state provided by the event handler.  This is an unexpected
-     * state transition.  Else use the event table next state.
-     */
-    if (fsm->exception_state_indicator) {
-        /*
-         * event handler detected an exception to the state transition 
-         */
-        fsm->exception_state_indicator = FALSE;
-        fsm->next_state = fsm->exception_state;
-
+    if (instance->flags & FSM_INSTANCE_EXCEPTION) {
+        instance->flags &= ~FSM_INSTANCE_EXCEPTION;
+        next_state = instance->exception_state;
     } else {
-        /*
-         * we have a valid event table transition
-         */
-        fsm->next_state = event_ptr->next_state;
+        next_state = cell.next_state;
     }
 
-    /*
-     * Validate the next state from the event table
-     * knowing that the event id is 0,1,2,...
-     * Then use the event id to directly index into the state
-     * table to set the next state.
-     */
-    if (fsm->next_state > (fsm->number_states-1)) {
-        fsm_record_history(fsm, 
-                           normalized_event, 
-                           fsm->next_state,
-                           RC_FSM_INVALID_STATE);
-        rc = RC_FSM_INVALID_STATE;
-
-    } else { 
-
-        /* record a bit of history. */
-        fsm_record_history(fsm, 
-                           normalized_event, 
-                           fsm->next_state, 
-                           rc);
-
-        /*
-         * and update the current state completing the transition
-         */
-        fsm->curr_state = fsm->next_state;
-    } 
+    if (start) {
+        fsm_trace_instance(fsm_class, 0, curr_state, normalized_event,
+                           next_state, rc, start);
+    }
+    instance->curr_state = next_state;
     return (rc);
 }
-
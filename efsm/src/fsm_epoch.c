@@ -0,0 +1,490 @@
+/*------------------------------------------------------------------
+ * fsm_epoch.c -- Finite State Machine epoch based reclamation
+ *
+ * Copyright (c) 2005-2009 by Cisco Systems, Inc.
+ * All rights reserved. 
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *------------------------------------------------------------------
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "fsm.h"
+#include "fsm_epoch.h"
+#include "fsm_private.h"
+
+
+/*
+ * Object waiting for two epochs on a retire list
+ */
+typedef struct fsm_epoch_node_s {
+    void                      *object;
+    fsm_epoch_reclaim_t        reclaim;
+    uint64_t                   epoch;
+    struct fsm_epoch_node_s   *next;
+} fsm_epoch_node_t;
+
+
+/*
+ * Per thread record.  local is the global epoch the thread saw on
+ * entering its outermost section, 0 outside, and is written only
+ * by the thread.  Records are on a list that is only ever added 
+ * to, those of exited threads are reused.  Each record has its own
+ * cache line.
+ */
+typedef struct fsm_epoch_thread_s {
+    uint64_t                     local;
+    uint32_t                     nesting;
+    uint32_t                     retired;
+    fsm_epoch_node_t            *limbo;
+    boolean_t                    in_use;
+    struct fsm_epoch_thread_s   *next;
+} fsm_epoch_thread_t;
+
+
+static uint64_t              fsm_epoch_global = 1;
+
+static pthread_mutex_t       fsm_epoch_lock = PTHREAD_MUTEX_INITIALIZER;
+static fsm_epoch_thread_t   *fsm_epoch_threads = NULL;
+static fsm_epoch_node_t     *fsm_epoch_orphans = NULL;
+
+static pthread_once_t        fsm_epoch_once = PTHREAD_ONCE_INIT;
+static pthread_key_t         fsm_epoch_key;
+
+static __thread fsm_epoch_thread_t  *fsm_epoch_self = NULL;
+
+
+
+/*
+ * internal routine run at thread exit, hands the retire list of 
+ * the thread to the orphans and frees the record for reuse
+ */
+static void
+fsm_epoch_thread_exit (void *arg)
+{
+    fsm_epoch_thread_t *self;
+    fsm_epoch_node_t *node;
+
+    self = (fsm_epoch_thread_t *)arg;
+
+    pthread_mutex_lock(&fsm_epoch_lock);
+    while (self->limbo) {
+        node = self->limbo;
+        self->limbo = node->next;
+        node->next = fsm_epoch_orphans;
+        fsm_epoch_orphans = node;
+    }
+    self->nesting = 0;
+    self->retired = 0;
+    FSM_STORE_RELEASE(&self->local, 0);
+    self->in_use = FALSE;
+    pthread_mutex_unlock(&fsm_epoch_lock);
+    return;
+}
+
+
+static void
+fsm_epoch_key_create (void)
+{
+    pthread_key_create(&fsm_epoch_key, fsm_epoch_thread_exit);
+    return;
+}
+
+
+/*
+ * internal routine to get the record of the calling thread, made
+ * or reused on its first call
+ */
+static fsm_epoch_thread_t *
+fsm_epoch_thread (void)
+{
+    fsm_epoch_thread_t *self;
+    size_t size;
+
+    if (fsm_epoch_self) {
+        return (fsm_epoch_self);
+    }
+
+    pthread_once(&fsm_epoch_once, fsm_epoch_key_create);
+
+    pthread_mutex_lock(&fsm_epoch_lock);
+    for (self = fsm_epoch_threads; self; self = self->next) {
+        if (!self->in_use) {
+            break;
+        }
+    }
+
+    if (self == NULL) {
+        size = (sizeof(fsm_epoch_thread_t) + FSM_CACHE_LINE - 1) & 
+               ~(size_t)(FSM_CACHE_LINE - 1);
+        if (posix_memalign((void **)&self, FSM_CACHE_LINE, size)) {
+            pthread_mutex_unlock(&fsm_epoch_lock);
+            return (NULL);
+        }
+        memset(self, 0, size);
+        self->next = fsm_epoch_threads;
+        FSM_STORE_RELEASE(&fsm_epoch_threads, self);
+    }
+
+    self->local = 0;
+    self->nesting = 0;
+    self->retired = 0;
+    self->limbo = NULL;
+    self->in_use = TRUE;
+    pthread_mutex_unlock(&fsm_epoch_lock);
+
+    pthread_setspecific(fsm_epoch_key, self);
+    fsm_epoch_self = self;
+    return (self);
+}
+
+
+/*
+ * internal routine to move the global epoch on by one when every
+ * thread in a section has seen the current one
+ */
+static void
+fsm_epoch_advance (void)
+{
+    fsm_epoch_thread_t *thread;
+    uint64_t global;
+    uint64_t local;
+
+    global = FSM_LOAD_ACQUIRE(&fsm_epoch_global);
+    FSM_FENCE();
+
+    for (thread = FSM_LOAD_ACQUIRE(&fsm_epoch_threads); 
+         thread; 
+         thread = thread->next) {
+        local = FSM_LOAD_ACQUIRE(&thread->local);
+        if (local != 0 && local != global) {
+            return;
+        }
+    }
+
+    FSM_CAS(&fsm_epoch_global, &global, global + 1);
+    return;
+}
+
+
+/*
+ * internal routine to reclaim the objects of a list that are two
+ * epochs old, returning the rest
+ */
+static fsm_epoch_node_t *
+fsm_epoch_reclaim_list (fsm_epoch_node_t *list, uint64_t global)
+{
+    fsm_epoch_node_t *keep;
+    fsm_epoch_node_t *node;
+
+    keep = NULL;
+    while (list) {
+        node = list;
+        list = node->next;
+
+        if (node->epoch + 2 <= global) {
+            (*node->reclaim)(node->object);
+            free(node);
+        } else {
+            node->next = keep;
+            keep = node;
+        }
+    }
+    return (keep);
+}
+
+
+/** 
+ * NAME
+ *    fsm_epoch_enter
+ *
+ * SYNOPSIS
+ *    #include "fsm_epoch.h" 
+ *    void
+ *    fsm_epoch_enter(void)
+ *
+ * DESCRIPTION
+ *    Starts a read-side section of the calling thread.  Until the
+ *    matching fsm_epoch_exit, no state machine destroyed with 
+ *    fsm_destroy_deferred, nor object retired with 
+ *    fsm_epoch_retire, after the section began is freed, so 
+ *    pointers read in the section stay valid to the end of it.  A
+ *    destroyed state machine has a tag of 0 and is refused by the
+ *    fsm calls.  Sections nest, keep them short as they hold back
+ *    reclamation for all threads.
+ *
+ * INPUT PARAMETERS
+ *    none
+ *
+ * OUTPUT PARAMETERS
+ *    none
+ *
+ * RETURN VALUE
+ *    none
+ * 
+ */
+void
+fsm_epoch_enter (void)
+{
+    fsm_epoch_thread_t *self;
+    uint64_t global;
+
+    self = fsm_epoch_thread();
+    if (self == NULL) {
+        return;
+    }
+
+    if (self->nesting++) {
+        return;
+    }
+
+    /*
+     * publish the epoch, then check it did not move on before the
+     * advancing thread could see it
+     */
+    do {
+        global = FSM_LOAD_RELAXED(&fsm_epoch_global);
+        FSM_STORE_RELAXED(&self->local, global);
+        FSM_FENCE();
+    } while (FSM_LOAD_RELAXED(&fsm_epoch_global) != global);
+    return;
+}
+
+
+/** 
+ * NAME
+ *    fsm_epoch_exit
+ *
+ * SYNOPSIS
+ *    #include "fsm_epoch.h" 
+ *    void
+ *    fsm_epoch_exit(void)
+ *
+ * DESCRIPTION
+ *    Ends a read-side section of the calling thread, see 
+ *    fsm_epoch_enter.
+ *
+ * INPUT PARAMETERS
+ *    none
+ *
+ * OUTPUT PARAMETERS
+ *    none
+ *
+ * RETURN VALUE
+ *    none
+ * 
+ */
+void
+fsm_epoch_exit (void)
+{
+    fsm_epoch_thread_t *self;
+
+    self = fsm_epoch_self;
+    if (self == NULL || self->nesting == 0) {
+        return;
+    }
+
+    if (--self->nesting == 0) {
+        FSM_STORE_RELEASE(&self->local, 0);
+    }
+    return;
+}
+
+
+/** 
+ * NAME
+ *    fsm_epoch_retire
+ *
+ * SYNOPSIS
+ *    #include "fsm_epoch.h" 
+ *    RC_FSM_t
+ *    fsm_epoch_retire(void *object, fsm_epoch_reclaim_t reclaim)
+ *
+ * DESCRIPTION
+ *    Hands over an object that readers may still hold, once it 
+ *    can no longer be found by new readers.  reclaim(object) is 
+ *    called by a later fsm_epoch_poll, fsm_epoch_retire or 
+ *    fsm_epoch_drain call once every read-side section that 
+ *    might have seen the object has ended.  Every 
+ *    FSM_EPOCH_POLL retires the calling thread polls.
+ *
+ * INPUT PARAMETERS
+ *    object           object to reclaim
+ *
+ *    reclaim          routine that frees it
+ *
+ * OUTPUT PARAMETERS
+ *    none
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_epoch_retire (void *object, fsm_epoch_reclaim_t reclaim)
+{
+    fsm_epoch_thread_t *self;
+    fsm_epoch_node_t *node;
+
+    if (object == NULL || reclaim == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    self = fsm_epoch_thread();
+    node = (fsm_epoch_node_t *)malloc(sizeof(fsm_epoch_node_t));
+    if (self == NULL || node == NULL) {
+        free(node);
+        return (RC_FSM_NO_RESOURCES);
+    }
+
+    /* the epoch read after the object was unlinked */
+    FSM_FENCE();
+    node->object = object;
+    node->reclaim = reclaim;
+    node->epoch = FSM_LOAD_RELAXED(&fsm_epoch_global);
+    node->next = self->limbo;
+    self->limbo = node;
+
+    if (++self->retired >= FSM_EPOCH_POLL) {
+        fsm_epoch_poll();
+    }
+    return (RC_FSM_OK);
+}
+
+
+/** 
+ * NAME
+ *    fsm_epoch_poll
+ *
+ * SYNOPSIS
+ *    #include "fsm_epoch.h" 
+ *    void
+ *    fsm_epoch_poll(void)
+ *
+ * DESCRIPTION
+ *    Moves the global epoch on if every thread in a section has 
+ *    seen it, then reclaims the objects retired by the calling 
+ *    thread, and by threads that have exited, that are two 
+ *    epochs old.  Never waits.  A thread that retires few objects
+ *    calls this now and then, say from its event loop.
+ *
+ * INPUT PARAMETERS
+ *    none
+ *
+ * OUTPUT PARAMETERS
+ *    none
+ *
+ * RETURN VALUE
+ *    none
+ * 
+ */
+void
+fsm_epoch_poll (void)
+{
+    fsm_epoch_thread_t *self;
+    fsm_epoch_node_t *orphans;
+    fsm_epoch_node_t *node;
+    uint64_t global;
+
+    self = fsm_epoch_thread();
+    if (self == NULL) {
+        return;
+    }
+    self->retired = 0;
+
+    fsm_epoch_advance();
+    global = FSM_LOAD_ACQUIRE(&fsm_epoch_global);
+
+    self->limbo = fsm_epoch_reclaim_list(self->limbo, global);
+
+    /* adopt what exited threads left */
+    if (FSM_LOAD_RELAXED(&fsm_epoch_orphans)) {
+        pthread_mutex_lock(&fsm_epoch_lock);
+        orphans = fsm_epoch_orphans;
+        fsm_epoch_orphans = NULL;
+        pthread_mutex_unlock(&fsm_epoch_lock);
+
+        orphans = fsm_epoch_reclaim_list(orphans, global);
+        while (orphans) {
+            node = orphans;
+            orphans = node->next;
+            node->next = self->limbo;
+            self->limbo = node;
+        }
+    }
+    return;
+}
+
+
+/** 
+ * NAME
+ *    fsm_epoch_drain
+ *
+ * SYNOPSIS
+ *    #include "fsm_epoch.h" 
+ *    void
+ *    fsm_epoch_drain(void)
+ *
+ * DESCRIPTION
+ *    Reclaims every object retired by the calling thread and by 
+ *    threads that have exited, waiting as long as it takes for 
+ *    the readers to leave their sections, as at shutdown.  Must 
+ *    not be called in a section, it then only polls.
+ *
+ * INPUT PARAMETERS
+ *    none
+ *
+ * OUTPUT PARAMETERS
+ *    none
+ *
+ * RETURN VALUE
+ *    none
+ * 
+ */
+void
+fsm_epoch_drain (void)
+{
+    fsm_epoch_thread_t *self;
+
+    self = fsm_epoch_thread();
+    if (self == NULL) {
+        return;
+    }
+
+    fsm_epoch_poll();
+    if (self->nesting) {
+        return;
+    }
+
+    while (self->limbo || FSM_LOAD_RELAXED(&fsm_epoch_orphans)) {
+        sched_yield();
+        fsm_epoch_poll();
+    }
+    return;
+}
+
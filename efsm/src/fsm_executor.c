@@ -0,0 +1,523 @@
+/*------------------------------------------------------------------
+ * fsm_executor.c -- Finite State Machine multi-core executor
+ *
+ * Copyright (c) 2005-2009 by Cisco Systems, Inc.
+ * All rights reserved. 
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *------------------------------------------------------------------
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "fsm.h"
+#include "fsm_mailbox.h"
+#include "fsm_executor.h"
+#include "fsm_private.h"
+
+
+
+/*
+ * internal routine to pick the home worker of a mailbox, a hash
+ * of its state machine so a machine always starts out on the 
+ * same worker
+ */
+static uint32_t
+fsm_executor_home (fsm_executor_t *executor, fsm_mailbox_t *mailbox)
+{
+    unsigned long key;
+
+    key = (unsigned long)mailbox->fsm;
+    key ^= key >> 17;
+    key *= 0x9e3779b1UL;
+    key ^= key >> 15;
+    return ((uint32_t)(key % executor->number_workers));
+}
+
+
+/*
+ * internal routine to append a mailbox to a worker run-queue
+ */
+static void
+fsm_worker_push (fsm_worker_t *worker, fsm_mailbox_t *mailbox)
+{
+    fsm_executor_t *executor = worker->executor;
+
+    mailbox->next_scheduled = NULL;
+
+    pthread_mutex_lock(&worker->lock);
+    if (worker->run_tail) {
+        worker->run_tail->next_scheduled = mailbox;
+    } else {
+        worker->run_head = mailbox;
+    }
+    worker->run_tail = mailbox;
+    FSM_FETCH_ADD(&worker->run_length, 1);
+    pthread_mutex_unlock(&worker->lock);
+
+    /*
+     * the run length is counted before looking for sleepers, 
+     * pairs with the fence in fsm_worker_sleep so no wake-up 
+     * is lost
+     */
+    FSM_FENCE();
+    if (FSM_LOAD_RELAXED(&executor->sleepers)) {
+        pthread_mutex_lock(&executor->idle_lock);
+        pthread_cond_signal(&executor->idle_cond);
+        pthread_mutex_unlock(&executor->idle_lock);
+    }
+    return;
+}
+
+
+/*
+ * internal routine to take the first mailbox of a worker 
+ * run-queue, NULL when empty
+ */
+static fsm_mailbox_t *
+fsm_worker_pop (fsm_worker_t *worker)
+{
+    fsm_mailbox_t *mailbox;
+
+    pthread_mutex_lock(&worker->lock);
+    mailbox = worker->run_head;
+    if (mailbox) {
+        worker->run_head = mailbox->next_scheduled;
+        if (worker->run_head == NULL) {
+            worker->run_tail = NULL;
+        }
+        FSM_FETCH_ADD(&worker->run_length, (uint32_t)-1);
+    }
+    pthread_mutex_unlock(&worker->lock);
+    return (mailbox);
+}
+
+
+/*
+ * internal routine for an idle worker to steal a whole mailbox 
+ * from the busiest looking of the other workers.  Only mailboxes
+ * are stolen, never single events, so the event order of each 
+ * state machine holds.
+ */
+static fsm_mailbox_t *
+fsm_worker_steal (fsm_worker_t *worker)
+{
+    fsm_executor_t *executor = worker->executor;
+    fsm_worker_t *victim;
+    uint32_t best_length;
+    uint32_t best;
+    uint32_t length;
+    uint32_t i;
+
+    best = worker->index;
+    best_length = 0;
+    for (i=1; i<executor->number_workers; i++) {
+        victim = &executor->workers[(worker->index + i) % 
+                                    executor->number_workers];
+        length = FSM_LOAD_RELAXED(&victim->run_length);
+        if (length > best_length) {
+            best_length = length;
+            best = victim->index;
+        }
+    }
+
+    if (best == worker->index) {
+        return (NULL);
+    }
+    return (fsm_worker_pop(&executor->workers[best]));
+}
+
+
+/*
+ * internal routine to sum the run lengths of all the workers, 
+ * read only by a worker about to sleep so the busy path touches 
+ * nothing shared beyond its own run-queue
+ */
+static uint32_t
+fsm_executor_pending (fsm_executor_t *executor)
+{
+    uint32_t pending;
+    uint32_t i;
+
+    pending = 0;
+    for (i=0; i<executor->number_workers; i++) {
+        pending += FSM_LOAD_RELAXED(&executor->workers[i].run_length);
+    }
+    return (pending);
+}
+
+
+/*
+ * internal routine to park an idle worker until work arrives
+ */
+static void
+fsm_worker_sleep (fsm_worker_t *worker)
+{
+    fsm_executor_t *executor = worker->executor;
+
+    FSM_STORE_RELAXED(&worker->stats.sleeps, worker->stats.sleeps + 1);
+
+    pthread_mutex_lock(&executor->idle_lock);
+    FSM_FETCH_ADD(&executor->sleepers, 1);
+    FSM_FENCE();
+    if (fsm_executor_pending(executor) == 0 &&
+        FSM_LOAD_RELAXED(&executor->running)) {
+        pthread_cond_wait(&executor->idle_cond, &executor->idle_lock);
+    }
+    FSM_FETCH_ADD(&executor->sleepers, (uint32_t)-1);
+    pthread_mutex_unlock(&executor->idle_lock);
+    return;
+}
+
+
+/*
+ * worker thread
+ */
+static void *
+fsm_worker_main (void *arg)
+{
+    fsm_worker_t *worker = (fsm_worker_t *)arg;
+    fsm_executor_t *executor = worker->executor;
+    fsm_mailbox_t *mailbox;
+    boolean_t reschedule;
+    uint32_t drained;
+    RC_FSM_t rc;
+
+    while (FSM_LOAD_ACQUIRE(&executor->running)) {
+
+        mailbox = fsm_worker_pop(worker);
+        if (mailbox == NULL) {
+            mailbox = fsm_worker_steal(worker);
+            if (mailbox) {
+                FSM_STORE_RELAXED(&worker->stats.steals, 
+                                  worker->stats.steals + 1);
+            }
+        }
+
+        if (mailbox == NULL) {
+            fsm_worker_sleep(worker);
+            continue;
+        }
+
+        rc = fsm_mailbox_drain(mailbox, executor->quantum, 
+                               &reschedule, &drained);
+
+        FSM_STORE_RELAXED(&worker->stats.drains, worker->stats.drains + 1);
+        FSM_STORE_RELAXED(&worker->stats.events, 
+                          worker->stats.events + drained);
+
+        /*
+         * The quantum ran out, go to the back of our own queue so
+         * the other mailboxes get a turn.  After a stop the state 
+         * machine is gone and the mailbox is left to its owner.
+         */
+        if (reschedule && rc != RC_FSM_STOP_PROCESSING) {
+            fsm_worker_push(worker, mailbox);
+        }
+    }
+    return (NULL);
+}
+
+
+/** 
+ * NAME
+ *    fsm_executor_create
+ *
+ * SYNOPSIS
+ *    #include "fsm_executor.h" 
+ *    RC_FSM_t
+ *    fsm_executor_create(fsm_executor_t **executor,
+ *                        uint32_t number_workers,
+ *                        uint32_t quantum)
+ *
+ * DESCRIPTION
+ *    Creates an executor and starts its worker threads.  Events
+ *    are given to the executor with fsm_executor_post.
+ *
+ * INPUT PARAMETERS
+ *    executor           pointer to executor handle to be returned
+ *                       once created
+ *
+ *    number_workers     number of worker threads
+ *
+ *    quantum            most events drained from one mailbox 
+ *                       before the worker moves on, 0 for the
+ *                       default FSM_EXECUTOR_QUANTUM
+ *
+ * OUTPUT PARAMETERS
+ *     none   
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_executor_create (fsm_executor_t **executor,
+                     uint32_t number_workers,
+                     uint32_t quantum)
+{
+    fsm_executor_t *temp_executor;
+    fsm_worker_t *worker;
+    uint32_t i;
+
+    if (executor == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    if (number_workers == 0 || number_workers > FSM_EXECUTOR_MAX_WORKERS) {
+        return (RC_FSM_INVALID_ARGUMENT);
+    }
+
+    temp_executor = (fsm_executor_t *)calloc(1, sizeof(fsm_executor_t));
+    if (temp_executor == NULL) {
+        return (RC_FSM_NO_RESOURCES);
+    }
+
+    if (posix_memalign((void **)&temp_executor->workers, FSM_CACHE_LINE,
+                       number_workers * sizeof(fsm_worker_t))) {
+        free(temp_executor);
+        return (RC_FSM_NO_RESOURCES);
+    }
+    memset(temp_executor->workers, 0, number_workers * sizeof(fsm_worker_t));
+
+    temp_executor->tag = FSM_EXECUTOR_TAG;
+    temp_executor->number_workers = number_workers;
+    temp_executor->quantum = quantum ? quantum : FSM_EXECUTOR_QUANTUM;
+    temp_executor->running = TRUE;
+    pthread_mutex_init(&temp_executor->idle_lock, NULL);
+    pthread_cond_init(&temp_executor->idle_cond, NULL);
+
+    for (i=0; i<number_workers; i++) {
+        worker = &temp_executor->workers[i];
+        pthread_mutex_init(&worker->lock, NULL);
+        worker->index = i;
+        worker->executor = temp_executor;
+    }
+
+    for (i=0; i<number_workers; i++) {
+        worker = &temp_executor->workers[i];
+        if (pthread_create(&worker->thread, NULL, fsm_worker_main, worker)) {
+            temp_executor->number_workers = i;
+            fsm_executor_destroy(&temp_executor);
+            return (RC_FSM_NO_RESOURCES);
+        }
+    }
+
+    /* return handle to the user */
+    *executor = temp_executor;
+    return (RC_FSM_OK);
+}
+
+
+/** 
+ * NAME
+ *    fsm_executor_destroy
+ *
+ * SYNOPSIS
+ *    #include "fsm_executor.h" 
+ *    RC_FSM_t
+ *    fsm_executor_destroy(fsm_executor_t **executor)
+ * 
+ * DESCRIPTION
+ *    Stops and joins the worker threads and destroys the 
+ *    executor.  A drain in progress completes, mailboxes still
+ *    on the run-queues are left with their events and their
+ *    scheduled flag set.  The mailboxes and state machines are
+ *    not destroyed.
+ *
+ * INPUT PARAMETERS
+ *    executor - pointer to executor handle
+ *
+ * OUTPUT PARAMETERS
+ *    executor - is nulled
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_executor_destroy (fsm_executor_t **executor)
+{
+    fsm_executor_t *p2executor;
+    uint32_t i;
+
+    if (executor == NULL || *executor == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    p2executor = *executor;
+    if (p2executor->tag != FSM_EXECUTOR_TAG) {
+        return (RC_FSM_INVALID_HANDLE);
+    }
+
+    pthread_mutex_lock(&p2executor->idle_lock);
+    FSM_STORE_RELEASE(&p2executor->running, FALSE);
+    pthread_cond_broadcast(&p2executor->idle_cond);
+    pthread_mutex_unlock(&p2executor->idle_lock);
+
+    for (i=0; i<p2executor->number_workers; i++) {
+        pthread_join(p2executor->workers[i].thread, NULL);
+        pthread_mutex_destroy(&p2executor->workers[i].lock);
+    }
+
+    pthread_mutex_destroy(&p2executor->idle_lock);
+    pthread_cond_destroy(&p2executor->idle_cond);
+
+    p2executor->tag = 0;
+    free(p2executor->workers);
+    *executor = NULL;
+    free(p2executor);
+    return (RC_FSM_OK);
+}
+
+
+/** 
+ * NAME
+ *    fsm_executor_post
+ *
+ * SYNOPSIS
+ *    #include "fsm_executor.h" 
+ *    RC_FSM_t
+ *    fsm_executor_post(fsm_executor_t *executor,
+ *                      fsm_mailbox_t *mailbox,
+ *                      uint32_t normalized_event,
+ *                      void *p2event_buffer,
+ *                      void *p2parm)
+ *
+ * DESCRIPTION
+ *    Posts an event to the mailbox of a state machine, from any
+ *    thread, and schedules the mailbox on its home worker when 
+ *    it was idle.  The mailbox must only be drained by the 
+ *    executor.
+ *
+ * INPUT PARAMETERS
+ *    executor         executor handle
+ *
+ *    mailbox          mailbox of the state machine
+ *
+ *    normalized_event the event id to process 
+ *
+ *    *p2event_buffer  passed through to the handler
+ *
+ *    *p2parm          passed through to the handler
+ *
+ * OUTPUT PARAMETERS
+ *    none
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    RC_FSM_NO_RESOURCES when the mailbox is full
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_executor_post (fsm_executor_t *executor,
+                   fsm_mailbox_t *mailbox,
+                   uint32_t normalized_event,
+                   void *p2event_buffer,
+                   void *p2parm)
+{
+    boolean_t schedule;
+    RC_FSM_t rc;
+
+    if (executor == NULL || mailbox == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    if (executor->tag != FSM_EXECUTOR_TAG) {
+        return (RC_FSM_INVALID_HANDLE);
+    }
+
+    rc = fsm_mailbox_post(mailbox, 
+                          normalized_event, 
+                          p2event_buffer, 
+                          p2parm, 
+                          &schedule);
+    if (rc != RC_FSM_OK) {
+        return (rc);
+    }
+
+    if (schedule) {
+        fsm_worker_push(&executor->workers[fsm_executor_home(executor, 
+                                                             mailbox)],
+                        mailbox);
+    }
+    return (RC_FSM_OK);
+}
+
+
+/** 
+ * NAME
+ *    fsm_executor_get_stats
+ *
+ * SYNOPSIS
+ *    #include "fsm_executor.h" 
+ *    RC_FSM_t
+ *    fsm_executor_get_stats(fsm_executor_t *executor,
+ *                           uint32_t worker,
+ *                           fsm_worker_stats_t *stats)
+ *
+ * DESCRIPTION
+ *    Returns the counters of a worker.  The values are a 
+ *    snapshot and may be slightly stale.
+ *
+ * INPUT PARAMETERS
+ *    executor         executor handle
+ *
+ *    worker           index of the worker
+ *
+ * OUTPUT PARAMETERS
+ *    stats            counters
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_executor_get_stats (fsm_executor_t *executor,
+                        uint32_t worker,
+                        fsm_worker_stats_t *stats)
+{
+    fsm_worker_t *worker_ptr;
+
+    if (executor == NULL || stats == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    if (executor->tag != FSM_EXECUTOR_TAG || 
+        worker >= executor->number_workers) {
+        return (RC_FSM_INVALID_HANDLE);
+    }
+
+    worker_ptr = &executor->workers[worker];
+    stats->drains = FSM_LOAD_RELAXED(&worker_ptr->stats.drains);
+    stats->events = FSM_LOAD_RELAXED(&worker_ptr->stats.events);
+    stats->steals = FSM_LOAD_RELAXED(&worker_ptr->stats.steals);
+    stats->sleeps = FSM_LOAD_RELAXED(&worker_ptr->stats.sleeps);
+    return (RC_FSM_OK);
+}
@@ -0,0 +1,413 @@
+/*------------------------------------------------------------------
+ * fsm_flight.c -- Finite State Machine flight recorder
+ *
+ * Copyright (c) 2005-2009 by Cisco Systems, Inc.
+ * All rights reserved. 
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *------------------------------------------------------------------
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "fsm.h"
+#include "fsm_trace.h"
+#include "fsm_flight.h"
+#include "fsm_private.h"
+
+
+/* protects opening, closing and the class names */
+static pthread_mutex_t      fsm_flight_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* the mapped file */
+static void                *fsm_flight_base = NULL;
+static uint64_t             fsm_flight_size = 0;
+static fsm_flight_header_t *fsm_flight_header = NULL;
+static fsm_flight_region_t *fsm_flight_regions = NULL;
+static fsm_trace_record_t  *fsm_flight_records = NULL;
+static uint32_t             fsm_flight_mask = 0;
+
+/* classes whose names are in the file */
+static uint32_t    fsm_flight_named[FSM_TRACE_MAX_CLASSES / 32];
+
+
+
+/*
+ * internal routine to append a string to the names of the file
+ */
+static boolean_t
+fsm_flight_put_string (char *names, uint32_t *p2used, char *string)
+{
+    uint32_t length;
+
+    length = string ? (uint32_t)strlen(string) : 0;
+    if (*p2used + sizeof(length) + length > fsm_flight_header->names_size) {
+        return (FALSE);
+    }
+
+    memcpy(names + *p2used, &length, sizeof(length));
+    memcpy(names + *p2used + sizeof(length), string, length);
+    *p2used += sizeof(length) + length;
+    return (TRUE);
+}
+
+
+/*
+ * internal routine to write the names of a class to the file the
+ * first time the class is recorded
+ */
+static void
+fsm_flight_name_class (fsm_class_t *fsm_class, uint32_t class_id)
+{
+    fsm_trace_file_class_t file_class;
+    char *names;
+    uint32_t used;
+    uint32_t i;
+
+    pthread_mutex_lock(&fsm_flight_lock);
+
+    if (fsm_flight_header == NULL ||
+        (fsm_flight_named[class_id / 32] & (1u << (class_id % 32)))) {
+        pthread_mutex_unlock(&fsm_flight_lock);
+        return;
+    }
+
+    names = (char *)fsm_flight_base + fsm_flight_header->names_offset;
+    used = fsm_flight_header->names_used;
+
+    memset(&file_class, 0, sizeof(file_class));
+    file_class.class_id = class_id;
+    file_class.number_states = fsm_class->number_states;
+    file_class.number_events = fsm_class->number_events;
+    memcpy(file_class.fsm_name, fsm_class->fsm_name, FSM_NAME_LEN);
+
+    /*
+     * a class that does not fit is left unnamed
+     */
+    if (used + sizeof(file_class) <= fsm_flight_header->names_size) {
+        memcpy(names + used, &file_class, sizeof(file_class));
+        used += sizeof(file_class);
+
+        for (i=0; i<fsm_class->number_states; i++) {
+            if (!fsm_flight_put_string(names, &used, 
+                     fsm_class->state_description_table[i].description)) {
+                break;
+            }
+        }
+        for (i=0; i<fsm_class->number_events; i++) {
+            if (!fsm_flight_put_string(names, &used, 
+                     fsm_class->event_description_table[i].description)) {
+                break;
+            }
+        }
+
+        /* the entry only counts once complete */
+        if (i == fsm_class->number_events) {
+            FSM_STORE_RELEASE(&fsm_flight_header->names_used, used);
+        }
+    }
+
+    FSM_STORE_RELAXED(&fsm_flight_named[class_id / 32], 
+                      fsm_flight_named[class_id / 32] | 
+                                          (1u << (class_id % 32)));
+    pthread_mutex_unlock(&fsm_flight_lock);
+    return;
+}
+
+
+/** 
+ * NAME
+ *    fsm_flight_record
+ *
+ * SYNOPSIS
+ *    #include "fsm_flight.h" 
+ *    void
+ *    fsm_flight_record(fsm_class_t *fsm_class, 
+ *                      fsm_trace_record_t *record)
+ *
+ * DESCRIPTION
+ *    Writes a record to the next slot of the region of the 
+ *    calling thread.  The slot is claimed with an atomic add on
+ *    the head of that region, which only the threads mapped to
+ *    the region share.  The record is then stored into the 
+ *    mapping and marked complete last.  There is no system call.
+ *
+ * INPUT PARAMETERS
+ *    fsm_class        class of the state machine, NULL when it
+ *                     may be gone, the class is then named by a
+ *                     later record
+ *
+ *    record           the record, as traced
+ *
+ * OUTPUT PARAMETERS
+ *     none   
+ *
+ * RETURN VALUE
+ *     none   
+ * 
+ */
+void
+fsm_flight_record (fsm_class_t *fsm_class, fsm_trace_record_t *record)
+{
+    fsm_flight_region_t *region;
+    fsm_trace_record_t *slot;
+    uint32_t class_id;
+    uint32_t number;
+    uint64_t index;
+
+    class_id = record->class_id;
+    if (class_id && fsm_class &&
+        !(FSM_LOAD_RELAXED(&fsm_flight_named[class_id / 32]) & 
+                                       (1u << (class_id % 32)))) {
+        fsm_flight_name_class(fsm_class, class_id);
+    }
+
+    number = record->thread % FSM_FLIGHT_REGIONS;
+    region = &fsm_flight_regions[number];
+    index = FSM_FETCH_ADD(&region->head, 1);
+    slot = &fsm_flight_records[(uint64_t)number * (fsm_flight_mask + 1) +
+                               (index & fsm_flight_mask)];
+
+    slot->tsc = record->tsc;
+    slot->duration = record->duration;
+    slot->instance = record->instance;
+    slot->class_id = record->class_id;
+    slot->prev_state = record->prev_state;
+    slot->event = record->event;
+    slot->next_state = record->next_state;
+    slot->rc = record->rc;
+    slot->thread = record->thread;
+    FSM_STORE_RELEASE(&slot->reserved, (uint32_t)(index + 1));
+    return;
+}
+
+
+/*
+ * internal routine to estimate the time stamp rate
+ */
+static uint64_t
+fsm_flight_calibrate (void)
+{
+    struct timespec start_time;
+    struct timespec end_time;
+    struct timespec pause;
+    uint64_t start_tsc;
+    uint64_t end_tsc;
+    uint64_t elapsed;
+
+    pause.tv_sec = 0;
+    pause.tv_nsec = 10000000;
+
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    start_tsc = fsm_tsc();
+    nanosleep(&pause, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    end_tsc = fsm_tsc();
+
+    elapsed = (uint64_t)(end_time.tv_sec - start_time.tv_sec) * 
+                                                      1000000000ULL +
+              end_time.tv_nsec - start_time.tv_nsec;
+    if (elapsed == 0) {
+        return (0);
+    }
+    return ((uint64_t)((double)(end_tsc - start_tsc) * 1e9 / 
+                       (double)elapsed));
+}
+
+
+/** 
+ * NAME
+ *    fsm_flight_recorder_open
+ *
+ * SYNOPSIS
+ *    #include "fsm_flight.h" 
+ *    RC_FSM_t
+ *    fsm_flight_recorder_open(char *path, uint64_t size)
+ *
+ * DESCRIPTION
+ *    Creates, or truncates, a file of about size bytes, maps it
+ *    shared and starts recording every fsm_engine event into it,
+ *    overwriting the oldest records once it is full.  The 
+ *    records survive a crash of the process, read them with 
+ *    tools/fsm_flight_dump.  A recorder that is already open is
+ *    closed first.  Opening takes about 10 msec to calibrate the
+ *    time stamps.
+ *
+ * INPUT PARAMETERS
+ *    path             file to record to
+ *
+ *    size             file size in bytes, each of the 
+ *                     FSM_FLIGHT_REGIONS record rings is the 
+ *                     largest power of two of records that fits
+ *
+ * OUTPUT PARAMETERS
+ *     none   
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_flight_recorder_open (char *path, uint64_t size)
+{
+    fsm_flight_header_t *header;
+    struct timespec now_time;
+    uint64_t number_records;
+    uint64_t records_offset;
+    uint64_t total;
+    void *base;
+    int fd;
+
+    if (path == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    records_offset = FSM_FLIGHT_HEADER_SIZE + FSM_FLIGHT_NAMES_SIZE +
+                     FSM_FLIGHT_REGIONS * sizeof(fsm_flight_region_t);
+    if (size < records_offset + FSM_FLIGHT_REGIONS * 
+               FSM_FLIGHT_MIN_RECORDS * sizeof(fsm_trace_record_t)) {
+        return (RC_FSM_INVALID_ARGUMENT);
+    }
+
+    number_records = FSM_FLIGHT_MIN_RECORDS;
+    while (FSM_FLIGHT_REGIONS * number_records * 2 * 
+                              sizeof(fsm_trace_record_t) <= 
+           size - records_offset &&
+           number_records < 0x80000000ULL / FSM_FLIGHT_REGIONS) {
+        number_records *= 2;
+    }
+    total = records_offset + FSM_FLIGHT_REGIONS * number_records * 
+                             sizeof(fsm_trace_record_t);
+
+    fsm_flight_recorder_close();
+
+    fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return (RC_FSM_NO_RESOURCES);
+    }
+
+    if (ftruncate(fd, (off_t)total)) {
+        close(fd);
+        return (RC_FSM_NO_RESOURCES);
+    }
+
+    base = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return (RC_FSM_NO_RESOURCES);
+    }
+
+    header = (fsm_flight_header_t *)base;
+    memset(header, 0, sizeof(fsm_flight_header_t));
+    header->record_size = sizeof(fsm_trace_record_t);
+    header->number_records = (uint32_t)number_records;
+    header->names_offset = FSM_FLIGHT_HEADER_SIZE;
+    header->names_size = FSM_FLIGHT_NAMES_SIZE;
+    header->names_used = 0;
+    header->number_regions = FSM_FLIGHT_REGIONS;
+    header->regions_offset = FSM_FLIGHT_HEADER_SIZE + FSM_FLIGHT_NAMES_SIZE;
+    header->records_offset = (uint32_t)records_offset;
+    header->tsc_hz = fsm_flight_calibrate();
+
+    clock_gettime(CLOCK_REALTIME, &now_time);
+    header->open_tsc = fsm_tsc();
+    header->open_time = (uint64_t)now_time.tv_sec * 1000000000ULL + 
+                        now_time.tv_nsec;
+    header->pid = (uint32_t)getpid();
+    header->closed = 0;
+    header->version = FSM_FLIGHT_VERSION;
+    header->magic = FSM_FLIGHT_MAGIC;
+
+    pthread_mutex_lock(&fsm_flight_lock);
+    fsm_flight_base = base;
+    fsm_flight_size = total;
+    fsm_flight_header = header;
+    fsm_flight_regions = (fsm_flight_region_t *)((char *)base + 
+                                                header->regions_offset);
+    fsm_flight_records = (fsm_trace_record_t *)((char *)base + 
+                                               header->records_offset);
+    fsm_flight_mask = (uint32_t)(number_records - 1);
+    memset(fsm_flight_named, 0, sizeof(fsm_flight_named));
+    pthread_mutex_unlock(&fsm_flight_lock);
+
+    FSM_FETCH_OR(&fsm_trace_enabled, FSM_TRACE_FLIGHT);
+    return (RC_FSM_OK);
+}
+
+
+/** 
+ * NAME
+ *    fsm_flight_recorder_close
+ *
+ * SYNOPSIS
+ *    #include "fsm_flight.h" 
+ *    RC_FSM_t
+ *    fsm_flight_recorder_close(void)
+ *
+ * DESCRIPTION
+ *    Stops recording, marks the file as closed cleanly and unmaps
+ *    it.  No fsm_engine call may be running when the recorder is
+ *    closed.
+ *
+ * INPUT PARAMETERS
+ *     none   
+ *
+ * OUTPUT PARAMETERS
+ *     none   
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_flight_recorder_close (void)
+{
+    FSM_FETCH_AND(&fsm_trace_enabled, ~FSM_TRACE_FLIGHT);
+
+    pthread_mutex_lock(&fsm_flight_lock);
+    if (fsm_flight_header == NULL) {
+        pthread_mutex_unlock(&fsm_flight_lock);
+        return (RC_FSM_NULL);
+    }
+
+    fsm_flight_header->closed = 1;
+    msync(fsm_flight_base, fsm_flight_size, MS_SYNC);
+    munmap(fsm_flight_base, fsm_flight_size);
+
+    fsm_flight_base = NULL;
+    fsm_flight_size = 0;
+    fsm_flight_header = NULL;
+    fsm_flight_regions = NULL;
+    fsm_flight_records = NULL;
+    fsm_flight_mask = 0;
+    pthread_mutex_unlock(&fsm_flight_lock);
+    return (RC_FSM_OK);
+}
@@ -0,0 +1,560 @@
+/*------------------------------------------------------------------
+ * fsm_latency.c -- Finite State Machine handler latency histograms
+ *
+ * Copyright (c) 2005-2009 by Cisco Systems, Inc.
+ * All rights reserved. 
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *------------------------------------------------------------------
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fsm.h"
+#include "fsm_latency.h"
+#include "fsm_private.h"
+
+
+/*
+ * Histograms of a class, one per compiled handler, indexed by the
+ * handler index of the cells.  A histogram is FSM_LATENCY_BUCKETS
+ * counters followed by the maximum, padded to whole cache lines.  
+ * As for the event counters, each thread below FSM_LATENCY_SHARDS 
+ * makes and solely writes its own set on its first timed event, the
+ * other threads share one set with atomics.
+ */
+#define FSM_LATENCY_MAX      ( FSM_LATENCY_BUCKETS )
+
+typedef struct fsm_latency_s {
+    uint32_t   number_handlers;
+    uint32_t   histogram_counters;
+    uint64_t  *shards[FSM_LATENCY_SHARDS];
+    uint64_t  *shared;
+} fsm_latency_t;
+
+
+/*
+ * internal routine to find the bucket of a duration
+ */
+static inline uint32_t
+fsm_latency_bucket (uint64_t ticks)
+{
+    if (ticks > 0xffffffffULL) {
+        return (FSM_LATENCY_BUCKETS - 1);
+    }
+    return (fsm_log_bucket(ticks, FSM_LATENCY_SUB_BITS));
+}
+
+
+/*
+ * internal routine to make a zeroed set of histograms
+ */
+static uint64_t *
+fsm_latency_shard_create (fsm_latency_t *latency)
+{
+    uint64_t *shard;
+    size_t size;
+
+    size = (size_t)latency->number_handlers * 
+           latency->histogram_counters * sizeof(uint64_t);
+    if (posix_memalign((void **)&shard, FSM_CACHE_LINE, size)) {
+        return (NULL);
+    }
+    memset(shard, 0, size);
+    return (shard);
+}
+
+
+/*
+ * internal routine, see fsm_private.h.  Called by fsm_engine when
+ * FSM_FLAG_LATENCY is set, once the handler has returned.
+ */
+void
+fsm_latency_record (fsm_class_t *fsm_class, 
+                    uint32_t handler_index, 
+                    uint64_t ticks)
+{
+    fsm_latency_t *latency;
+    uint64_t *histogram;
+    uint64_t max;
+    uint32_t thread;
+
+    latency = FSM_LOAD_ACQUIRE(&fsm_class->latency);
+    if (latency == NULL) {
+        return;
+    }
+
+    thread = fsm_thread_index();
+    if (thread >= FSM_LATENCY_SHARDS) {
+        histogram = &latency->shared[handler_index * 
+                                     latency->histogram_counters];
+        FSM_FETCH_ADD(&histogram[fsm_latency_bucket(ticks)], 1);
+        max = FSM_LOAD_RELAXED(&histogram[FSM_LATENCY_MAX]);
+        while (ticks > max) {
+            if (FSM_CAS(&histogram[FSM_LATENCY_MAX], &max, ticks)) {
+                break;
+            }
+        }
+        return;
+    }
+
+    histogram = latency->shards[thread];
+    if (histogram == NULL) {
+        histogram = fsm_latency_shard_create(latency);
+        if (histogram == NULL) {
+            return;
+        }
+        FSM_STORE_RELEASE(&latency->shards[thread], histogram);
+    }
+    histogram += handler_index * latency->histogram_counters;
+
+    /* only this thread writes, relaxed for whole values to readers */
+    FSM_STORE_RELAXED(&histogram[fsm_latency_bucket(ticks)],
+             FSM_LOAD_RELAXED(&histogram[fsm_latency_bucket(ticks)]) + 1);
+    if (ticks > FSM_LOAD_RELAXED(&histogram[FSM_LATENCY_MAX])) {
+        FSM_STORE_RELAXED(&histogram[FSM_LATENCY_MAX], ticks);
+    }
+    return;
+}
+
+
+/*
+ * internal routine, see fsm_private.h.  Called by 
+ * fsm_class_destroy once no thread runs the class.
+ */
+void
+fsm_latency_free (fsm_class_t *fsm_class)
+{
+    fsm_latency_t *latency;
+    uint32_t i;
+
+    latency = fsm_class->latency;
+    if (latency == NULL) {
+        return;
+    }
+
+    for (i=0; i<FSM_LATENCY_SHARDS; i++) {
+        free(latency->shards[i]);
+    }
+    free(latency->shared);
+    free(latency);
+    fsm_class->latency = NULL;
+    return;
+}
+
+
+/** 
+ * NAME
+ *    fsm_latency_enable
+ *
+ * SYNOPSIS
+ *    #include "fsm_latency.h" 
+ *    RC_FSM_t
+ *    fsm_latency_enable(fsm_t *fsm)
+ *
+ * DESCRIPTION
+ *    Starts timing the event handlers called by fsm_engine for
+ *    the state machine, by setting FSM_FLAG_LATENCY in fsm->flags.
+ *    The handler durations, in time stamp counter ticks, go in 
+ *    the histograms of the state machine class, allocated on the 
+ *    first call and kept until the class is destroyed.  The state
+ *    machines of fsm_create each have a class of their own, those
+ *    of a pool share the class of the pool and its histograms.
+ *
+ *    While FSM_FLAG_LATENCY is clear, the engine pays one test of
+ *    fsm->flags.
+ *
+ * INPUT PARAMETERS
+ *    fsm            fsm handle
+ *
+ * OUTPUT PARAMETERS
+ *    none
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_latency_enable (fsm_t *fsm)
+{
+    fsm_class_t *fsm_class;
+    fsm_latency_t *latency;
+    fsm_latency_t *expected;
+    uint32_t counters;
+
+    if (fsm == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    if (fsm->tag != FSM_TAG) {
+        return (RC_FSM_INVALID_HANDLE);
+    }
+
+    fsm_class = fsm->fsm_class;
+    if (FSM_LOAD_ACQUIRE(&fsm_class->latency) == NULL) {
+        latency = (fsm_latency_t *)calloc(1, sizeof(fsm_latency_t));
+        if (latency == NULL) {
+            return (RC_FSM_NO_RESOURCES);
+        }
+
+        /* whole cache lines per histogram, index 0 for the NULL handler */
+        latency->number_handlers = fsm_class->number_handlers;
+        counters = FSM_LATENCY_MAX + 1;
+        counters = (counters + (FSM_CACHE_LINE/sizeof(uint64_t)) - 1) & 
+                   ~((FSM_CACHE_LINE/sizeof(uint64_t)) - 1);
+        latency->histogram_counters = counters;
+
+        latency->shared = fsm_latency_shard_create(latency);
+        if (latency->shared == NULL) {
+            free(latency);
+            return (RC_FSM_NO_RESOURCES);
+        }
+
+        /* first enable wins */
+        expected = NULL;
+        if (!FSM_CAS(&fsm_class->latency, &expected, latency)) {
+            free(latency->shared);
+            free(latency);
+        }
+    }
+
+    fsm->flags |= FSM_FLAG_LATENCY;
+    return (RC_FSM_OK);
+}
+
+
+/** 
+ * NAME
+ *    fsm_latency_disable
+ *
+ * SYNOPSIS
+ *    #include "fsm_latency.h" 
+ *    RC_FSM_t
+ *    fsm_latency_disable(fsm_t *fsm)
+ *
+ * DESCRIPTION
+ *    Stops timing the event handlers of the state machine.  The 
+ *    histograms of the class keep their values.
+ *
+ * INPUT PARAMETERS
+ *    fsm            fsm handle
+ *
+ * OUTPUT PARAMETERS
+ *    none
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_latency_disable (fsm_t *fsm)
+{
+    if (fsm == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    if (fsm->tag != FSM_TAG) {
+        return (RC_FSM_INVALID_HANDLE);
+    }
+
+    fsm->flags &= ~FSM_FLAG_LATENCY;
+    return (RC_FSM_OK);
+}
+
+
+/*
+ * internal routine to merge the histogram of a handler index and
+ * read the percentiles from it
+ */
+static RC_FSM_t
+fsm_latency_merge (fsm_class_t *fsm_class, 
+                   uint32_t handler_index,
+                   fsm_latency_stats_t *stats)
+{
+    fsm_latency_t *latency;
+    uint64_t *buckets;
+    uint64_t *histogram;
+    uint64_t max;
+    uint64_t seen;
+    uint32_t i;
+    uint32_t j;
+
+    memset(stats, 0, sizeof(fsm_latency_stats_t));
+
+    latency = FSM_LOAD_ACQUIRE(&fsm_class->latency);
+    if (latency == NULL) {
+        return (RC_FSM_OK);
+    }
+
+    buckets = (uint64_t *)calloc(FSM_LATENCY_BUCKETS, sizeof(uint64_t));
+    if (buckets == NULL) {
+        return (RC_FSM_NO_RESOURCES);
+    }
+
+    for (i=0; i<=FSM_LATENCY_SHARDS; i++) {
+        if (i == FSM_LATENCY_SHARDS) {
+            histogram = latency->shared;
+        } else {
+            histogram = FSM_LOAD_ACQUIRE(&latency->shards[i]);
+        }
+        if (histogram == NULL) {
+            continue;
+        }
+        histogram += handler_index * latency->histogram_counters;
+
+        for (j=0; j<FSM_LATENCY_BUCKETS; j++) {
+            buckets[j] += FSM_LOAD_RELAXED(&histogram[j]);
+        }
+        max = FSM_LOAD_RELAXED(&histogram[FSM_LATENCY_MAX]);
+        if (max > stats->max) {
+            stats->max = max;
+        }
+    }
+
+    for (j=0; j<FSM_LATENCY_BUCKETS; j++) {
+        stats->count += buckets[j];
+    }
+
+    seen = 0;
+    for (j=0; j<FSM_LATENCY_BUCKETS && stats->count; j++) {
+        if (buckets[j] == 0) {
+            continue;
+        }
+        seen += buckets[j];
+        if (stats->p50 == 0 && seen * 2 >= stats->count) {
+            stats->p50 = fsm_log_bucket_top(j, FSM_LATENCY_SUB_BITS);
+        }
+        if (stats->p99 == 0 && seen * 100 >= stats->count * 99) {
+            stats->p99 = fsm_log_bucket_top(j, FSM_LATENCY_SUB_BITS);
+        }
+        if (stats->p999 == 0 && seen * 1000 >= stats->count * 999) {
+            stats->p999 = fsm_log_bucket_top(j, FSM_LATENCY_SUB_BITS);
+        }
+    }
+
+    /* the top of a bucket can be above the exact maximum */
+    if (stats->p50 > stats->max) {
+        stats->p50 = stats->max;
+    }
+    if (stats->p99 > stats->max) {
+        stats->p99 = stats->max;
+    }
+    if (stats->p999 > stats->max) {
+        stats->p999 = stats->max;
+    }
+
+    free(buckets);
+    return (RC_FSM_OK);
+}
+
+
+/** 
+ * NAME
+ *    fsm_latency_get
+ *
+ * SYNOPSIS
+ *    #include "fsm_latency.h" 
+ *    RC_FSM_t
+ *    fsm_latency_get(fsm_class_t *fsm_class, 
+ *                    event_cb_t event_handler, 
+ *                    fsm_latency_stats_t *stats)
+ *
+ * DESCRIPTION
+ *    Merges the histograms of all threads for an event handler of
+ *    the class and returns the sample count, median, 99th and 
+ *    99.9th percentiles and maximum, in time stamp counter ticks.
+ *    A handler shared by several cells has one histogram.  A 
+ *    class that was never timed gives zeroes.
+ *
+ * INPUT PARAMETERS
+ *    fsm_class      class handle, fsm->fsm_class for an fsm
+ *
+ *    event_handler  the handler, as given in the event tables
+ *
+ *    stats          pointer to the latency to fill
+ *
+ * OUTPUT PARAMETERS
+ *    stats          the merged latency
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    RC_FSM_INVALID_EVENT_HANDLER when the class has no such handler
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_latency_get (fsm_class_t *fsm_class, 
+                 event_cb_t event_handler, 
+                 fsm_latency_stats_t *stats)
+{
+    uint32_t i;
+
+    if (fsm_class == NULL || event_handler == NULL || stats == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    if (fsm_class->tag != FSM_CLASS_TAG) {
+        return (RC_FSM_INVALID_HANDLE);
+    }
+
+    for (i=1; i<fsm_class->number_handlers; i++) {
+        if (fsm_class->handler_table[i] == event_handler) {
+            return (fsm_latency_merge(fsm_class, i, stats));
+        }
+    }
+    return (RC_FSM_INVALID_EVENT_HANDLER);
+}
+
+
+/** 
+ * NAME
+ *    fsm_latency_get_cell
+ *
+ * SYNOPSIS
+ *    #include "fsm_latency.h" 
+ *    RC_FSM_t
+ *    fsm_latency_get_cell(fsm_class_t *fsm_class, 
+ *                         uint32_t state,
+ *                         uint32_t normalized_event,
+ *                         fsm_latency_stats_t *stats)
+ *
+ * DESCRIPTION
+ *    As fsm_latency_get, for the handler of a (state, event) cell
+ *    of the table.
+ *
+ * INPUT PARAMETERS
+ *    fsm_class          class handle, fsm->fsm_class for an fsm
+ *
+ *    state              normalized state
+ *
+ *    normalized_event   normalized event
+ *
+ *    stats              pointer to the latency to fill
+ *
+ * OUTPUT PARAMETERS
+ *    stats              the merged latency
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    RC_FSM_INVALID_EVENT_HANDLER when the cell has no handler
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_latency_get_cell (fsm_class_t *fsm_class, 
+                      uint32_t state,
+                      uint32_t normalized_event,
+                      fsm_latency_stats_t *stats)
+{
+    fsm_cell_t cell;
+
+    if (fsm_class == NULL || stats == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    if (fsm_class->tag != FSM_CLASS_TAG) {
+        return (RC_FSM_INVALID_HANDLE);
+    }
+
+    if (state >= fsm_class->number_states) {
+        return (RC_FSM_INVALID_STATE);
+    }
+
+    if (normalized_event >= fsm_class->number_events) {
+        return (RC_FSM_INVALID_EVENT);
+    }
+
+    cell = fsm_class_lookup(fsm_class, state, normalized_event);
+    if (cell.handler_index == FSM_NULL_HANDLER_INDEX) {
+        return (RC_FSM_INVALID_EVENT_HANDLER);
+    }
+    return (fsm_latency_merge(fsm_class, cell.handler_index, stats));
+}
+
+
+/** 
+ * NAME
+ *    fsm_latency_reset
+ *
+ * SYNOPSIS
+ *    #include "fsm_latency.h" 
+ *    RC_FSM_t
+ *    fsm_latency_reset(fsm_class_t *fsm_class)
+ *
+ * DESCRIPTION
+ *    Zeroes the histograms of the class.  Samples recorded by
+ *    other threads while the reset runs may survive it.
+ *
+ * INPUT PARAMETERS
+ *    fsm_class      class handle
+ *
+ * OUTPUT PARAMETERS
+ *    none
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_latency_reset (fsm_class_t *fsm_class)
+{
+    fsm_latency_t *latency;
+    uint64_t *shard;
+    uint32_t counters;
+    uint32_t i;
+    uint32_t j;
+
+    if (fsm_class == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    if (fsm_class->tag != FSM_CLASS_TAG) {
+        return (RC_FSM_INVALID_HANDLE);
+    }
+
+    latency = FSM_LOAD_ACQUIRE(&fsm_class->latency);
+    if (latency == NULL) {
+        return (RC_FSM_OK);
+    }
+
+    counters = latency->number_handlers * latency->histogram_counters;
+    for (i=0; i<=FSM_LATENCY_SHARDS; i++) {
+        if (i == FSM_LATENCY_SHARDS) {
+            shard = latency->shared;
+        } else {
+            shard = FSM_LOAD_ACQUIRE(&latency->shards[i]);
+        }
+        if (shard == NULL) {
+            continue;
+        }
+        for (j=0; j<counters; j++) {
+            FSM_STORE_RELAXED(&shard[j], 0);
+        }
+    }
+    return (RC_FSM_OK);
+}
+
@@ -0,0 +1,513 @@
+/*------------------------------------------------------------------
+ * fsm_mailbox.c -- Finite State Machine lock-free mailbox
+ *
+ * Copyright (c) 2005-2009 by Cisco Systems, Inc.
+ * All rights reserved. 
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *------------------------------------------------------------------
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fsm.h"
+#include "fsm_mailbox.h"
+#include "fsm_private.h"
+
+
+/* largest mailbox */
+#define FSM_MAX_MAILBOX   ( 1 << 20 )
+
+
+
+/** 
+ * NAME
+ *    fsm_mailbox_create
+ *
+ * SYNOPSIS
+ *    #include "fsm_mailbox.h" 
+ *    RC_FSM_t
+ *    fsm_mailbox_create(fsm_mailbox_t **mailbox,
+ *                       fsm_t *fsm,
+ *                       uint32_t size)
+ *
+ * DESCRIPTION
+ *    Creates a lock-free mailbox for a state machine.  The size
+ *    is rounded up to a power of two.
+ *
+ * INPUT PARAMETERS
+ *    mailbox            pointer to mailbox handle to be returned
+ *                       once created
+ *
+ *    fsm                state machine driven by the mailbox
+ *
+ *    size               number of events the mailbox can hold
+ *
+ * OUTPUT PARAMETERS
+ *     none   
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_mailbox_create (fsm_mailbox_t **mailbox, 
+                    fsm_t *fsm, 
+                    uint32_t size)
+{
+    fsm_mailbox_t *temp_mailbox;
+    uint32_t i;
+
+    if (mailbox == NULL || fsm == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    if (fsm->tag != FSM_TAG) {
+        return (RC_FSM_INVALID_HANDLE);
+    }
+
+    if (size == 0 || size > FSM_MAX_MAILBOX) {
+        return (RC_FSM_INVALID_ARGUMENT);
+    }
+
+    if (posix_memalign((void **)&temp_mailbox, FSM_CACHE_LINE,
+                       sizeof(fsm_mailbox_t))) {
+        return (RC_FSM_NO_RESOURCES);
+    }
+    memset(temp_mailbox, 0, sizeof(fsm_mailbox_t));
+
+    for (temp_mailbox->size=1; temp_mailbox->size<size; ) {
+        temp_mailbox->size <<= 1;
+    }
+
+    temp_mailbox->slots = (fsm_mailbox_slot_t *)
+               malloc(temp_mailbox->size * sizeof(fsm_mailbox_slot_t));
+    if (temp_mailbox->slots == NULL) {
+        free(temp_mailbox);
+        return (RC_FSM_NO_RESOURCES);
+    }
+
+    /*
+     * slot i is free for the producer of ticket i
+     */
+    for (i=0; i<temp_mailbox->size; i++) {
+        temp_mailbox->slots[i].sequence = i;
+    }
+
+    temp_mailbox->fsm = fsm;
+    temp_mailbox->tag = FSM_MAILBOX_TAG;
+
+    /* return handle to the user */
+    *mailbox = temp_mailbox;
+    return (RC_FSM_OK);
+}
+
+
+/** 
+ * NAME
+ *    fsm_mailbox_destroy
+ *
+ * SYNOPSIS
+ *    #include "fsm_mailbox.h" 
+ *    RC_FSM_t
+ *    fsm_mailbox_destroy(fsm_mailbox_t **mailbox)
+ * 
+ * DESCRIPTION
+ *    Destroys the specified mailbox, any events still in the 
+ *    mailbox are discarded.  The state machine is not destroyed.
+ *
+ * INPUT PARAMETERS
+ *    mailbox - pointer to mailbox handle
+ *
+ * OUTPUT PARAMETERS
+ *    mailbox - is nulled
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_mailbox_destroy (fsm_mailbox_t **mailbox)
+{
+    fsm_mailbox_t *p2mailbox;
+
+    if (mailbox == NULL || *mailbox == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    p2mailbox = *mailbox;
+    if (p2mailbox->tag != FSM_MAILBOX_TAG) {
+        return (RC_FSM_INVALID_HANDLE);
+    }
+
+    p2mailbox->tag = 0;
+    free(p2mailbox->slots);
+    *mailbox = NULL;
+    free(p2mailbox);
+    return (RC_FSM_OK);
+}
+
+
+/** 
+ * NAME
+ *    fsm_mailbox_post
+ *
+ * SYNOPSIS
+ *    #include "fsm_mailbox.h" 
+ *    RC_FSM_t
+ *    fsm_mailbox_post(fsm_mailbox_t *mailbox,
+ *                     uint32_t normalized_event,
+ *                     void *p2event_buffer,
+ *                     void *p2parm,
+ *                     boolean_t *p2schedule)
+ *
+ * DESCRIPTION
+ *    Posts an event to the mailbox.  May be called by any number
+ *    of threads at once and never blocks, a full mailbox fails 
+ *    the post.  
+ *
+ *    When the post finds the mailbox idle, the caller now holds
+ *    the scheduled flag and must arrange for exactly one call of
+ *    fsm_mailbox_drain, directly or by handing the mailbox to a
+ *    worker thread.
+ *
+ * INPUT PARAMETERS
+ *    mailbox          mailbox handle
+ *
+ *    normalized_event the event id to process 
+ *
+ *    *p2event_buffer  passed through to the handler
+ *
+ *    *p2parm          passed through to the handler
+ *
+ * OUTPUT PARAMETERS
+ *    p2schedule       TRUE when the caller must schedule a drain
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    RC_FSM_NO_RESOURCES when the mailbox is full
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_mailbox_post (fsm_mailbox_t *mailbox,
+                  uint32_t normalized_event,
+                  void *p2event_buffer,
+                  void *p2parm,
+                  boolean_t *p2schedule)
+{
+    fsm_mailbox_slot_t *slot_ptr;
+    uint32_t ticket;
+    uint32_t sequence;
+    uint32_t idle;
+    int32_t  diff;
+
+    if (mailbox == NULL || p2schedule == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    if (mailbox->tag != FSM_MAILBOX_TAG) {
+        return (RC_FSM_INVALID_HANDLE);
+    }
+
+    *p2schedule = FALSE;
+
+    /*
+     * claim a ticket for a free slot
+     */
+    ticket = FSM_LOAD_RELAXED(&mailbox->tail);
+    for (;;) {
+        slot_ptr = &mailbox->slots[ticket & (mailbox->size - 1)];
+        sequence = FSM_LOAD_ACQUIRE(&slot_ptr->sequence);
+        diff = (int32_t)(sequence - ticket);
+
+        if (diff == 0) {
+            if (FSM_CAS(&mailbox->tail, &ticket, ticket + 1)) {
+                break;
+            }
+        } else if (diff < 0) {
+            /* the consumer has not freed this slot yet - full */
+            FSM_FETCH_ADD(&mailbox->post_failures, 1);
+            return (RC_FSM_NO_RESOURCES);
+        } else {
+            ticket = FSM_LOAD_RELAXED(&mailbox->tail);
+        }
+    }
+
+    slot_ptr->normalized_event = normalized_event;
+    slot_ptr->p2event_buffer = p2event_buffer;
+    slot_ptr->p2parm = p2parm;
+    FSM_STORE_RELEASE(&slot_ptr->sequence, ticket + 1);
+    FSM_FETCH_ADD(&mailbox->posted, 1);
+
+    /*
+     * Publish before looking at the flag, pairs with the fence 
+     * in fsm_mailbox_drain so an event is never left behind.
+     */
+    FSM_FENCE();
+    idle = 0;
+    if (FSM_LOAD_RELAXED(&mailbox->scheduled) == 0 &&
+        FSM_CAS(&mailbox->scheduled, &idle, 1)) {
+        *p2schedule = TRUE;
+    }
+    return (RC_FSM_OK);
+}
+
+
+/*
+ * internal routine, TRUE when an event is ready for the consumer.
+ * Also called just after the scheduled flag is given back, when
+ * the next consumer may already be moving head, so head is loaded
+ * atomically and only once.
+ */
+static boolean_t
+fsm_mailbox_ready (fsm_mailbox_t *mailbox)
+{
+    fsm_mailbox_slot_t *slot_ptr;
+    uint32_t head;
+
+    head = FSM_LOAD_RELAXED(&mailbox->head);
+    slot_ptr = &mailbox->slots[head & (mailbox->size - 1)];
+    return ((int32_t)(FSM_LOAD_ACQUIRE(&slot_ptr->sequence) - 
+                      (head + 1)) >= 0);
+}
+
+
+/*
+ * internal routine to count a drain of events, only the consumer
+ * writes the counters and it must do so before it gives the 
+ * scheduled flag back, the next consumer acquires them with it
+ */
+static void
+fsm_mailbox_account (fsm_mailbox_t *mailbox, uint32_t events)
+{
+    uint32_t bucket;
+
+    if (events == 0) {
+        return;
+    }
+
+    for (bucket=0; bucket<FSM_MAILBOX_BATCH_BUCKETS-1; bucket++) {
+        if (events <= (1u << bucket)) {
+            break;
+        }
+    }
+    FSM_STORE_RELAXED(&mailbox->drain_batch[bucket], 
+                      mailbox->drain_batch[bucket] + 1);
+    FSM_STORE_RELAXED(&mailbox->drains, mailbox->drains + 1);
+    FSM_STORE_RELAXED(&mailbox->drained, mailbox->drained + events);
+    if (events > mailbox->max_drain) {
+        FSM_STORE_RELAXED(&mailbox->max_drain, events);
+    }
+}
+
+
+/** 
+ * NAME
+ *    fsm_mailbox_drain
+ *
+ * SYNOPSIS
+ *    #include "fsm_mailbox.h" 
+ *    RC_FSM_t
+ *    fsm_mailbox_drain(fsm_mailbox_t *mailbox,
+ *                      uint32_t max_events,
+ *                      boolean_t *p2reschedule,
+ *                      uint32_t *p2drained)
+ *
+ * DESCRIPTION
+ *    Processes the events of the mailbox with fsm_engine, in 
+ *    the order they were posted.  Must only be called by the 
+ *    thread that holds the scheduled flag.
+ *
+ *    The drain stops after max_events events, or when the 
+ *    mailbox is empty.  When it stops because the mailbox is
+ *    empty the scheduled flag is released, unless an event 
+ *    raced in, in which case the flag is kept.  Whenever the 
+ *    caller still holds the flag on return, p2reschedule is set
+ *    and the caller must drain again later.
+ *
+ * INPUT PARAMETERS
+ *    mailbox          mailbox handle
+ *
+ *    max_events       most events to process, 0 for no limit
+ *
+ * OUTPUT PARAMETERS
+ *    p2reschedule     TRUE when the caller must schedule a 
+ *                     further drain
+ *
+ *    p2drained        number of events processed.  Once the
+ *                     flag is released another thread may drain
+ *                     the mailbox, so use this count rather than
+ *                     the mailbox counters.
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    RC_FSM_STOP_PROCESSING when a handler asked to stop, the
+ *         state machine must no longer be accessed
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_mailbox_drain (fsm_mailbox_t *mailbox,
+                   uint32_t max_events,
+                   boolean_t *p2reschedule,
+                   uint32_t *p2drained)
+{
+    fsm_mailbox_slot_t *slot_ptr;
+    uint32_t normalized_event;
+    void *p2event_buffer;
+    void *p2parm;
+    uint32_t count;
+    uint32_t counted;
+    uint32_t idle;
+    RC_FSM_t rc;
+
+    if (mailbox == NULL || p2reschedule == NULL || p2drained == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    if (mailbox->tag != FSM_MAILBOX_TAG) {
+        return (RC_FSM_INVALID_HANDLE);
+    }
+
+    *p2reschedule = FALSE;
+    *p2drained = 0;
+    rc = RC_FSM_OK;
+    count = 0;
+    counted = 0;
+
+    for (;;) {
+
+        while ((max_events == 0 || count < max_events) &&
+               fsm_mailbox_ready(mailbox)) {
+
+            slot_ptr = &mailbox->slots[mailbox->head & (mailbox->size - 1)];
+            normalized_event = slot_ptr->normalized_event;
+            p2event_buffer = slot_ptr->p2event_buffer;
+            p2parm = slot_ptr->p2parm;
+
+            /* hand the slot back to the producers */
+            FSM_STORE_RELEASE(&slot_ptr->sequence, 
+                              mailbox->head + mailbox->size);
+            FSM_STORE_RELAXED(&mailbox->head, mailbox->head + 1);
+            count++;
+
+            rc = fsm_engine(mailbox->fsm, 
+                            normalized_event, 
+                            p2event_buffer, 
+                            p2parm);
+            if (rc == RC_FSM_STOP_PROCESSING) {
+                break;
+            }
+        }
+
+        if (rc == RC_FSM_STOP_PROCESSING ||
+            (max_events && count >= max_events)) {
+            fsm_mailbox_account(mailbox, count - counted);
+            *p2reschedule = TRUE;
+            break;
+        }
+
+        /*
+         * Empty, give the flag back.  Then look again, a producer
+         * that published before seeing the flag released expects 
+         * us to pick its event up.  The counters go first, they
+         * belong to whoever holds the flag.
+         */
+        fsm_mailbox_account(mailbox, count - counted);
+        counted = count;
+        FSM_STORE_RELEASE(&mailbox->scheduled, 0);
+        FSM_FENCE();
+        if (!fsm_mailbox_ready(mailbox)) {
+            break;
+        }
+        idle = 0;
+        if (!FSM_CAS(&mailbox->scheduled, &idle, 1)) {
+            /* a producer took the flag and will schedule a drain */
+            break;
+        }
+    }
+
+    *p2drained = count;
+    if (rc == RC_FSM_STOP_PROCESSING) {
+        return (rc);
+    }
+    return (RC_FSM_OK);
+}
+
+
+/** 
+ * NAME
+ *    fsm_mailbox_get_stats
+ *
+ * SYNOPSIS
+ *    #include "fsm_mailbox.h" 
+ *    RC_FSM_t
+ *    fsm_mailbox_get_stats(fsm_mailbox_t *mailbox,
+ *                          fsm_mailbox_stats_t *stats)
+ *
+ * DESCRIPTION
+ *    Returns the mailbox depth and counters.  May be called by
+ *    any thread, the values are a snapshot and may be slightly 
+ *    stale.
+ *
+ * INPUT PARAMETERS
+ *    mailbox          mailbox handle
+ *
+ * OUTPUT PARAMETERS
+ *    stats            counters
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_mailbox_get_stats (fsm_mailbox_t *mailbox,
+                       fsm_mailbox_stats_t *stats)
+{
+    uint32_t i;
+
+    if (mailbox == NULL || stats == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    if (mailbox->tag != FSM_MAILBOX_TAG) {
+        return (RC_FSM_INVALID_HANDLE);
+    }
+
+    stats->depth = FSM_LOAD_RELAXED(&mailbox->tail) - 
+                   FSM_LOAD_RELAXED(&mailbox->head);
+    stats->posted = FSM_LOAD_RELAXED(&mailbox->posted);
+    stats->post_failures = FSM_LOAD_RELAXED(&mailbox->post_failures);
+    stats->drains = FSM_LOAD_RELAXED(&mailbox->drains);
+    stats->drained = FSM_LOAD_RELAXED(&mailbox->drained);
+    stats->max_drain = FSM_LOAD_RELAXED(&mailbox->max_drain);
+    for (i=0; i<FSM_MAILBOX_BATCH_BUCKETS; i++) {
+        stats->drain_batch[i] = FSM_LOAD_RELAXED(&mailbox->drain_batch[i]);
+    }
+    return (RC_FSM_OK);
+}
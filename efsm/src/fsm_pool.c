@@ -0,0 +1,718 @@
+/*------------------------------------------------------------------
+ * fsm_pool.c -- Finite State Machine object pool
+ *
+ * Copyright (c) 2005-2009 by Cisco Systems, Inc.
+ * All rights reserved. 
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *------------------------------------------------------------------
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "fsm.h"
+#include "fsm_pool.h"
+#include "fsm_private.h"
+
+
+/* huge page size assumed when rounding hugepage slabs */
+#define FSM_POOL_HUGEPAGE_SIZE   ( 2 * 1024 * 1024 )
+
+
+/*
+ * Pool object layout: the fsm_t, a history buffer of the pool's
+ * history depth and a trailer used by the pool, rounded up to a 
+ * cache line.  The fsm_t is first so it starts on a cache line.
+ */
+typedef struct {
+    /* next free object while on a free list */
+    void      *next;
+
+    /* set while the object is a live state machine */
+    uint32_t   in_use;
+
+    /* slab holding the object */
+    uint32_t   slab;
+} fsm_pool_trailer_t;
+
+#define FSM_POOL_ROUND(x, a)      ( ((x) + (a) - 1) & ~((a) - 1) )
+
+#define FSM_POOL_HISTORY_OFFSET   FSM_POOL_ROUND(sizeof(fsm_t), 8)
+
+
+
+/*
+ * Per-thread free list of a pool
+ */
+typedef struct fsm_pool_cache_s {
+    fsm_pool_t               *pool;
+    void                     *head;
+    uint32_t                  count;
+
+    /* on the pool list of caches */
+    struct fsm_pool_cache_s  *next;
+    struct fsm_pool_cache_s  *prev;
+} fsm_pool_cache_t;
+
+
+static inline fsm_pool_trailer_t *
+fsm_pool_trailer (fsm_pool_t *pool, void *object)
+{
+    return ((fsm_pool_trailer_t *)((char *)object + 
+                                   pool->trailer_offset));
+}
+
+
+/*
+ * internal routine to move up to count objects from one free list
+ * to another, returns the number moved
+ */
+static uint32_t
+fsm_pool_move (fsm_pool_t *pool, void **from, void **to, uint32_t count)
+{
+    fsm_pool_trailer_t *trailer;
+    void *object;
+    uint32_t moved;
+
+    for (moved=0; moved<count && *from; moved++) {
+        object = *from;
+        trailer = fsm_pool_trailer(pool, object);
+        *from = trailer->next;
+        trailer->next = *to;
+        *to = object;
+    }
+    return (moved);
+}
+
+
+/*
+ * internal routine to add a slab to the shared free list, called
+ * with the lock held
+ */
+static RC_FSM_t
+fsm_pool_grow (fsm_pool_t *pool)
+{
+    fsm_pool_slab_t *slabs;
+    fsm_pool_slab_t *slab;
+    fsm_pool_trailer_t *trailer;
+    uint64_t bytes;
+    uint64_t count;
+    uint64_t i;
+    char *object;
+
+    if (pool->number_slabs == pool->max_slabs) {
+        slabs = (fsm_pool_slab_t *)realloc(pool->slabs,
+                    2 * pool->max_slabs * sizeof(fsm_pool_slab_t));
+        if (slabs == NULL) {
+            return (RC_FSM_NO_RESOURCES);
+        }
+        pool->slabs = slabs;
+        pool->max_slabs *= 2;
+    }
+
+    slab = &pool->slabs[pool->number_slabs];
+    bytes = (uint64_t)pool->slab_objects * pool->object_size;
+    slab->base = NULL;
+    slab->hugepages = FALSE;
+
+#ifdef MAP_HUGETLB
+    if (pool->flags & FSM_POOL_HUGEPAGES) {
+        bytes = FSM_POOL_ROUND(bytes, (uint64_t)FSM_POOL_HUGEPAGE_SIZE);
+        slab->base = mmap(NULL, bytes, PROT_READ | PROT_WRITE, 
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, 
+                          -1, 0);
+        if (slab->base == MAP_FAILED) {
+            slab->base = NULL;
+        } else {
+            slab->hugepages = TRUE;
+        }
+    }
+#endif
+
+    if (slab->base == NULL) {
+        if (posix_memalign(&slab->base, FSM_CACHE_LINE, bytes)) {
+            return (RC_FSM_NO_RESOURCES);
+        }
+#ifdef MADV_HUGEPAGE
+        if (pool->flags & FSM_POOL_HUGEPAGES) {
+            madvise(slab->base, bytes, MADV_HUGEPAGE);
+        }
+#endif
+    }
+    slab->bytes = bytes;
+
+    /*
+     * push the objects last to first so the free list hands them
+     * out in address order
+     */
+    count = bytes / pool->object_size;
+    for (i=count; i>0; i--) {
+        object = (char *)slab->base + (i - 1) * pool->object_size;
+        trailer = fsm_pool_trailer(pool, object);
+        trailer->in_use = 0;
+        trailer->slab = pool->number_slabs;
+        trailer->next = pool->free_head;
+        pool->free_head = object;
+    }
+    pool->free_count += count;
+    pool->number_slabs++;
+    return (RC_FSM_OK);
+}
+
+
+/*
+ * internal routine to count the live state machines of a slab,
+ * called with the lock held
+ */
+static uint64_t
+fsm_pool_slab_live (fsm_pool_t *pool, fsm_pool_slab_t *slab)
+{
+    uint64_t count;
+    uint64_t live;
+    uint64_t i;
+
+    count = slab->bytes / pool->object_size;
+    live = 0;
+    for (i=0; i<count; i++) {
+        live += FSM_LOAD_RELAXED(&fsm_pool_trailer(pool, 
+                    (char *)slab->base + i * pool->object_size)->in_use);
+    }
+    return (live);
+}
+
+
+/*
+ * internal routine run at thread exit to hand the free objects
+ * of the thread back to the pool
+ */
+static void
+fsm_pool_cache_exit (void *arg)
+{
+    fsm_pool_cache_t *cache = (fsm_pool_cache_t *)arg;
+    fsm_pool_t *pool = cache->pool;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->free_count += fsm_pool_move(pool, &cache->head, &pool->free_head, 
+                                      cache->count);
+    if (cache->prev) {
+        cache->prev->next = cache->next;
+    } else {
+        pool->caches = cache->next;
+    }
+    if (cache->next) {
+        cache->next->prev = cache->prev;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    free(cache);
+    return;
+}
+
+
+/*
+ * internal routine to get the free list of the calling thread,
+ * made on the first call from a thread
+ */
+static fsm_pool_cache_t *
+fsm_pool_cache (fsm_pool_t *pool)
+{
+    fsm_pool_cache_t *cache;
+
+    cache = (fsm_pool_cache_t *)pthread_getspecific(pool->cache_key);
+    if (cache) {
+        return (cache);
+    }
+
+    cache = (fsm_pool_cache_t *)malloc(sizeof(fsm_pool_cache_t));
+    if (cache == NULL) {
+        return (NULL);
+    }
+    cache->pool = pool;
+    cache->head = NULL;
+    cache->count = 0;
+    cache->prev = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    cache->next = pool->caches;
+    if (pool->caches) {
+        pool->caches->prev = cache;
+    }
+    pool->caches = cache;
+    pthread_mutex_unlock(&pool->lock);
+
+    if (pthread_setspecific(pool->cache_key, cache)) {
+        fsm_pool_cache_exit(cache);
+        return (NULL);
+    }
+    return (cache);
+}
+
+
+/** 
+ * NAME
+ *    fsm_pool_create
+ *
+ * SYNOPSIS
+ *    #include "fsm_pool.h" 
+ *    RC_FSM_t
+ *    fsm_pool_create(fsm_pool_t **pool,
+ *                    uint32_t slab_objects,
+ *                    uint32_t initial_objects,
+ *                    uint32_t history_depth,
+ *                    uint32_t flags)
+ *
+ * DESCRIPTION
+ *    Creates a pool of state machine objects.  Memory is taken
+ *    from the system a slab at a time and is only returned when
+ *    the pool is destroyed.  Preallocating for the expected 
+ *    number of sessions keeps the system allocator out of 
+ *    fsm_create_in_pool altogether.
+ *
+ * INPUT PARAMETERS
+ *    pool               pointer to pool handle to be returned
+ *                       once created
+ *
+ *    slab_objects       state machines per slab, 0 for 
+ *                       FSM_POOL_SLAB_OBJECTS
+ *
+ *    initial_objects    state machines to preallocate
+ *
+ *    history_depth      history entries held in each object, 0
+ *                       for none.  A state machine whose history
+ *                       policy needs a deeper ring allocates it.
+ *
+ *    flags              FSM_POOL_HUGEPAGES or 0
+ *
+ * OUTPUT PARAMETERS
+ *     none   
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_pool_create (fsm_pool_t **pool,
+                 uint32_t slab_objects,
+                 uint32_t initial_objects,
+                 uint32_t history_depth,
+                 uint32_t flags)
+{
+    fsm_pool_t *temp_pool;
+
+    if (pool == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    if (slab_objects == 0) {
+        slab_objects = FSM_POOL_SLAB_OBJECTS;
+    }
+
+    if (history_depth > FSM_HISTORY_MAX_DEPTH) {
+        return (RC_FSM_INVALID_ARGUMENT);
+    }
+
+    if (posix_memalign((void **)&temp_pool, FSM_CACHE_LINE, 
+                       sizeof(fsm_pool_t))) {
+        return (RC_FSM_NO_RESOURCES);
+    }
+    memset(temp_pool, 0, sizeof(fsm_pool_t));
+
+    temp_pool->max_slabs = 4;
+    temp_pool->slabs = (fsm_pool_slab_t *)malloc(temp_pool->max_slabs * 
+                                                sizeof(fsm_pool_slab_t));
+    if (temp_pool->slabs == NULL) {
+        free(temp_pool);
+        return (RC_FSM_NO_RESOURCES);
+    }
+
+    if (pthread_key_create(&temp_pool->cache_key, fsm_pool_cache_exit)) {
+        free(temp_pool->slabs);
+        free(temp_pool);
+        return (RC_FSM_NO_RESOURCES);
+    }
+    pthread_mutex_init(&temp_pool->lock, NULL);
+
+    temp_pool->tag = FSM_POOL_TAG;
+    temp_pool->flags = flags;
+    temp_pool->history_depth = history_depth;
+    temp_pool->trailer_offset = 
+        FSM_POOL_ROUND(FSM_POOL_HISTORY_OFFSET + 
+                       history_depth * sizeof(fsm_history_t), 8);
+    temp_pool->object_size = 
+        FSM_POOL_ROUND(temp_pool->trailer_offset + 
+                       sizeof(fsm_pool_trailer_t), FSM_CACHE_LINE);
+    temp_pool->slab_objects = slab_objects;
+
+    while (temp_pool->free_count < initial_objects) {
+        if (fsm_pool_grow(temp_pool) != RC_FSM_OK) {
+            fsm_pool_destroy(&temp_pool);
+            return (RC_FSM_NO_RESOURCES);
+        }
+    }
+
+    /* return handle to the user */
+    *pool = temp_pool;
+    return (RC_FSM_OK);
+}
+
+
+/** 
+ * NAME
+ *    fsm_pool_destroy
+ *
+ * SYNOPSIS
+ *    #include "fsm_pool.h" 
+ *    RC_FSM_t
+ *    fsm_pool_destroy(fsm_pool_t **pool)
+ * 
+ * DESCRIPTION
+ *    Destroys the specified pool and releases all its memory.  
+ *    All state machines of the pool must have been destroyed, 
+ *    the pool is refused and left as it is while any is live.
+ *
+ * INPUT PARAMETERS
+ *    pool - pointer to pool handle
+ *
+ * OUTPUT PARAMETERS
+ *    pool - is nulled
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    RC_FSM_INVALID_ARGUMENT while a state machine is live
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_pool_destroy (fsm_pool_t **pool)
+{
+    fsm_pool_t *p2pool;
+    fsm_pool_cache_t *cache;
+    uint32_t i;
+
+    if (pool == NULL || *pool == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    p2pool = *pool;
+    if (p2pool->tag != FSM_POOL_TAG) {
+        return (RC_FSM_INVALID_HANDLE);
+    }
+
+    /*
+     * the slabs hold the live state machines, freeing them would
+     * leave those dangling
+     */
+    pthread_mutex_lock(&p2pool->lock);
+    for (i=0; i<p2pool->number_slabs; i++) {
+        if (fsm_pool_slab_live(p2pool, &p2pool->slabs[i])) {
+            pthread_mutex_unlock(&p2pool->lock);
+            return (RC_FSM_INVALID_ARGUMENT);
+        }
+    }
+    pthread_mutex_unlock(&p2pool->lock);
+
+    p2pool->tag = 0;
+    pthread_key_delete(p2pool->cache_key);
+
+    while (p2pool->caches) {
+        cache = p2pool->caches;
+        p2pool->caches = cache->next;
+        free(cache);
+    }
+
+    for (i=0; i<p2pool->number_slabs; i++) {
+        if (p2pool->slabs[i].hugepages) {
+            munmap(p2pool->slabs[i].base, p2pool->slabs[i].bytes);
+        } else {
+            free(p2pool->slabs[i].base);
+        }
+    }
+
+    pthread_mutex_destroy(&p2pool->lock);
+    free(p2pool->slabs);
+    *pool = NULL;
+    free(p2pool);
+    return (RC_FSM_OK);
+}
+
+
+/** 
+ * NAME
+ *    fsm_create_in_pool
+ *
+ * SYNOPSIS
+ *    #include "fsm_pool.h" 
+ *    RC_FSM_t
+ *    fsm_create_in_pool(fsm_pool_t *pool,
+ *                       fsm_t **fsm,
+ *                       fsm_class_t *fsm_class,
+ *                       uint32_t initial_state)
+ *
+ * DESCRIPTION
+ *    Creates and initializes a state machine of a class with the
+ *    fsm_t and its history taken from a pool.  The tables have 
+ *    been validated once by fsm_class_create, so this does no 
+ *    table checks and, while the thread or the pool has free 
+ *    objects, no memory allocation.  The history policy is that
+ *    of the class, see fsm_class_set_history_policy, a ring that
+ *    does not fit the pool object is allocated.  The class is 
+ *    shared, it is not destroyed with the state machine.  
+ *    fsm_destroy returns the state machine to the pool, from any
+ *    thread.
+ *
+ * INPUT PARAMETERS
+ *    pool               pool handle
+ *
+ *    fsm                pointer to fsm handle to be returned
+ *                       once created
+ *
+ *    fsm_class          class handle
+ *
+ *    initial_state      Initial start state
+ *
+ * OUTPUT PARAMETERS
+ *     none   
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_create_in_pool (fsm_pool_t *pool,
+                    fsm_t **fsm,
+                    fsm_class_t *fsm_class,
+                    uint32_t initial_state)
+{
+    fsm_pool_cache_t *cache;
+    fsm_t *temp_fsm;
+    uint32_t moved;
+    RC_FSM_t rc;
+
+    if (pool == NULL || fsm == NULL || fsm_class == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    if (pool->tag != FSM_POOL_TAG || fsm_class->tag != FSM_CLASS_TAG) {
+        return (RC_FSM_INVALID_HANDLE);
+    }
+
+    if (initial_state > fsm_class->number_states-1) {
+        return (RC_FSM_INVALID_STATE);
+    }
+
+    cache = fsm_pool_cache(pool);
+    if (cache == NULL) {
+        return (RC_FSM_NO_RESOURCES);
+    }
+
+    /*
+     * refill the thread free list from the pool, adding a slab 
+     * when the pool has run dry
+     */
+    if (cache->head == NULL) {
+        pthread_mutex_lock(&pool->lock);
+        if (pool->free_head == NULL && fsm_pool_grow(pool) != RC_FSM_OK) {
+            pthread_mutex_unlock(&pool->lock);
+            return (RC_FSM_NO_RESOURCES);
+        }
+        moved = fsm_pool_move(pool, &pool->free_head, &cache->head,
+                              FSM_POOL_CACHE_BATCH);
+        pool->free_count -= moved;
+        pthread_mutex_unlock(&pool->lock);
+        FSM_STORE_RELAXED(&cache->count, cache->count + moved);
+    }
+
+    temp_fsm = (fsm_t *)cache->head;
+    cache->head = fsm_pool_trailer(pool, temp_fsm)->next;
+    FSM_STORE_RELAXED(&cache->count, cache->count - 1);
+    FSM_STORE_RELAXED(&fsm_pool_trailer(pool, temp_fsm)->in_use, 1);
+    temp_fsm->pool = pool;
+
+    rc = fsm_init(temp_fsm, 
+                  fsm_class, 
+                  initial_state,
+                  (fsm_history_t *)((char *)temp_fsm + 
+                                    FSM_POOL_HISTORY_OFFSET),
+                  pool->history_depth);
+    if (rc != RC_FSM_OK) {
+        fsm_pool_release(pool, temp_fsm);
+        return (rc);
+    }
+
+    /* return handle to the user */
+    *fsm = temp_fsm;
+    return (RC_FSM_OK);
+}
+
+
+/** 
+ * NAME
+ *    fsm_pool_release
+ *
+ * SYNOPSIS
+ *    #include "fsm_pool.h" 
+ *    void
+ *    fsm_pool_release(fsm_pool_t *pool, fsm_t *fsm)
+ *
+ * DESCRIPTION
+ *    Returns the memory of a state machine to the free list of
+ *    the calling thread, handing a batch back to the pool when
+ *    the thread holds too many.  Called by fsm_destroy, not by
+ *    the user.
+ *
+ * INPUT PARAMETERS
+ *    pool             pool handle
+ *
+ *    fsm              destroyed state machine
+ *
+ * OUTPUT PARAMETERS
+ *     none   
+ *
+ * RETURN VALUE
+ *     none   
+ * 
+ */
+void
+fsm_pool_release (fsm_pool_t *pool, fsm_t *fsm)
+{
+    fsm_pool_cache_t *cache;
+    fsm_pool_trailer_t *trailer;
+
+    trailer = fsm_pool_trailer(pool, fsm);
+    FSM_STORE_RELAXED(&trailer->in_use, 0);
+
+    cache = fsm_pool_cache(pool);
+    if (cache == NULL) {
+        pthread_mutex_lock(&pool->lock);
+        trailer->next = pool->free_head;
+        pool->free_head = fsm;
+        pool->free_count++;
+        pthread_mutex_unlock(&pool->lock);
+        return;
+    }
+
+    trailer->next = cache->head;
+    cache->head = fsm;
+    FSM_STORE_RELAXED(&cache->count, cache->count + 1);
+
+    if (cache->count > FSM_POOL_CACHE_MAX) {
+        pthread_mutex_lock(&pool->lock);
+        pool->free_count += fsm_pool_move(pool, &cache->head, &pool->free_head,
+                                          FSM_POOL_CACHE_BATCH);
+        pthread_mutex_unlock(&pool->lock);
+        FSM_STORE_RELAXED(&cache->count, 
+                          cache->count - FSM_POOL_CACHE_BATCH);
+    }
+    return;
+}
+
+
+/** 
+ * NAME
+ *    fsm_pool_get_stats
+ *
+ * SYNOPSIS
+ *    #include "fsm_pool.h" 
+ *    RC_FSM_t
+ *    fsm_pool_get_stats(fsm_pool_t *pool, fsm_pool_stats_t *stats)
+ *
+ * DESCRIPTION
+ *    Returns the occupancy and fragmentation of a pool.  The 
+ *    slabs are walked, so this is meant for monitoring rather 
+ *    than the hot path.  The figures are a snapshot while other
+ *    threads create and destroy.
+ *
+ * INPUT PARAMETERS
+ *    pool             pool handle
+ *
+ * OUTPUT PARAMETERS
+ *    stats            pool stats
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_pool_get_stats (fsm_pool_t *pool, fsm_pool_stats_t *stats)
+{
+    fsm_pool_cache_t *cache;
+    fsm_pool_slab_t *slab;
+    uint64_t count;
+    uint64_t live;
+    uint64_t stranded;
+    uint32_t j;
+
+    if (pool == NULL || stats == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    if (pool->tag != FSM_POOL_TAG) {
+        return (RC_FSM_INVALID_HANDLE);
+    }
+
+    memset(stats, 0, sizeof(fsm_pool_stats_t));
+    stats->object_size = pool->object_size;
+    stranded = 0;
+
+    pthread_mutex_lock(&pool->lock);
+
+    for (j=0; j<pool->number_slabs; j++) {
+        slab = &pool->slabs[j];
+        count = slab->bytes / pool->object_size;
+        live = fsm_pool_slab_live(pool, slab);
+
+        /* free objects held back by live neighbours */
+        if (live) {
+            stranded += count - live;
+        }
+
+        stats->slabs++;
+        if (slab->hugepages) {
+            stats->hugepage_slabs++;
+        }
+        stats->capacity += count;
+        stats->in_use += live;
+        stats->bytes_reserved += slab->bytes;
+    }
+
+    for (cache=pool->caches; cache; cache=cache->next) {
+        stats->cached += FSM_LOAD_RELAXED(&cache->count);
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+
+    if (stats->capacity) {
+        stats->occupancy = (uint32_t)((stats->in_use * 100) / 
+                                      stats->capacity);
+    }
+    if (stats->capacity > stats->in_use) {
+        stats->fragmentation = (uint32_t)((stranded * 100) / 
+                                     (stats->capacity - stats->in_use));
+    }
+    return (RC_FSM_OK);
+}
@@ -0,0 +1,729 @@
+/*------------------------------------------------------------------
+ * fsm_population.c -- Finite State Machine state populations
+ *
+ * Copyright (c) 2005-2009 by Cisco Systems, Inc.
+ * All rights reserved. 
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *------------------------------------------------------------------
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fsm.h"
+#include "fsm_population.h"
+#include "fsm_private.h"
+
+
+/*
+ * Population of a class.  A shard holds a signed count per state,
+ * kept modulo 2^64 so that the shards of the threads that entered
+ * and left a state add up, followed, with FSM_POPULATION_DWELL, by
+ * a dwell histogram per state of FSM_DWELL_BUCKETS counters and 
+ * the maximum.  Each part is padded to whole cache lines.  As for
+ * the event counters, each thread below FSM_POPULATION_SHARDS 
+ * makes and solely writes its own shard, the other threads share
+ * one with atomics.
+ */
+#define FSM_DWELL_MAX    ( FSM_DWELL_BUCKETS )
+
+typedef struct fsm_population_s {
+    uint32_t   flags;
+    uint32_t   number_states;
+    uint32_t   population_counters;
+    uint32_t   histogram_counters;
+    uint32_t   shard_counters;
+    uint64_t  *shards[FSM_POPULATION_SHARDS];
+    uint64_t  *shared;
+} fsm_population_t;
+
+
+/* counters rounded up to whole cache lines */
+#define FSM_POPULATION_LINES(n)                                     \
+        (((n) + (FSM_CACHE_LINE/sizeof(uint64_t)) - 1) &            \
+          ~((FSM_CACHE_LINE/sizeof(uint64_t)) - 1))
+
+
+/*
+ * internal routine to make a zeroed shard
+ */
+static uint64_t *
+fsm_population_shard_create (fsm_population_t *population)
+{
+    uint64_t *shard;
+
+    if (posix_memalign((void **)&shard, FSM_CACHE_LINE, 
+                       population->shard_counters * sizeof(uint64_t))) {
+        return (NULL);
+    }
+    memset(shard, 0, population->shard_counters * sizeof(uint64_t));
+    return (shard);
+}
+
+
+/*
+ * internal routine to get the shard of the calling thread, sets 
+ * shared when it is the shard of all the threads beyond the last
+ */
+static uint64_t *
+fsm_population_shard (fsm_population_t *population, boolean_t *shared)
+{
+    uint64_t *shard;
+    uint32_t thread;
+
+    thread = fsm_thread_index();
+    if (thread >= FSM_POPULATION_SHARDS) {
+        *shared = TRUE;
+        return (population->shared);
+    }
+
+    *shared = FALSE;
+    shard = population->shards[thread];
+    if (shard == NULL) {
+        shard = fsm_population_shard_create(population);
+        if (shard == NULL) {
+            return (NULL);
+        }
+        FSM_STORE_RELEASE(&population->shards[thread], shard);
+    }
+    return (shard);
+}
+
+
+/*
+ * internal routine to add to a counter of a shard
+ */
+static inline void
+fsm_population_counter_add (uint64_t *counter, 
+                            uint64_t delta, 
+                            boolean_t shared)
+{
+    if (shared) {
+        FSM_FETCH_ADD(counter, delta);
+    } else {
+        FSM_STORE_RELAXED(counter, FSM_LOAD_RELAXED(counter) + delta);
+    }
+}
+
+
+/*
+ * internal routine, see fsm_private.h.  Called on create and 
+ * destroy of the counted state machines and stores.
+ */
+void
+fsm_population_add (fsm_class_t *fsm_class, uint32_t state, int64_t delta)
+{
+    fsm_population_t *population;
+    uint64_t *shard;
+    boolean_t shared;
+
+    population = FSM_LOAD_ACQUIRE(&fsm_class->population);
+    if (population == NULL) {
+        return;
+    }
+
+    shard = fsm_population_shard(population, &shared);
+    if (shard == NULL) {
+        return;
+    }
+    fsm_population_counter_add(&shard[state], (uint64_t)delta, shared);
+    return;
+}
+
+
+/*
+ * internal routine, see fsm_private.h.  Called by the engines on
+ * a transition of a counted state machine to another state.  When
+ * entry_tsc is given, the stay in prev_state is recorded and the
+ * entry time reset.
+ */
+void
+fsm_population_move (fsm_class_t *fsm_class, 
+                     uint32_t prev_state, 
+                     uint32_t next_state,
+                     uint64_t *entry_tsc)
+{
+    fsm_population_t *population;
+    uint64_t *shard;
+    uint64_t *histogram;
+    uint64_t now;
+    uint64_t dwell;
+    uint64_t max;
+    boolean_t shared;
+
+    population = FSM_LOAD_ACQUIRE(&fsm_class->population);
+    if (population == NULL) {
+        return;
+    }
+
+    shard = fsm_population_shard(population, &shared);
+    if (shard == NULL) {
+        return;
+    }
+    fsm_population_counter_add(&shard[prev_state], (uint64_t)-1, shared);
+    fsm_population_counter_add(&shard[next_state], 1, shared);
+
+    if (entry_tsc == NULL || !(population->flags & FSM_POPULATION_DWELL)) {
+        return;
+    }
+
+    now = fsm_tsc();
+    dwell = now - *entry_tsc;
+    *entry_tsc = now;
+
+    histogram = &shard[population->population_counters + 
+                       (prev_state * population->histogram_counters)];
+    fsm_population_counter_add(
+                    &histogram[fsm_log_bucket(dwell, FSM_DWELL_SUB_BITS)], 
+                    1, shared);
+
+    max = FSM_LOAD_RELAXED(&histogram[FSM_DWELL_MAX]);
+    if (shared) {
+        while (dwell > max) {
+            if (FSM_CAS(&histogram[FSM_DWELL_MAX], &max, dwell)) {
+                break;
+            }
+        }
+    } else if (dwell > max) {
+        FSM_STORE_RELAXED(&histogram[FSM_DWELL_MAX], dwell);
+    }
+    return;
+}
+
+
+/*
+ * internal routine, see fsm_private.h.  Called by 
+ * fsm_class_destroy once no thread runs the class.
+ */
+void
+fsm_population_free (fsm_class_t *fsm_class)
+{
+    fsm_population_t *population;
+    uint32_t i;
+
+    population = fsm_class->population;
+    if (population == NULL) {
+        return;
+    }
+
+    for (i=0; i<FSM_POPULATION_SHARDS; i++) {
+        free(population->shards[i]);
+    }
+    free(population->shared);
+    free(population);
+    fsm_class->population = NULL;
+    return;
+}
+
+
+/*
+ * internal routine to get the population flags of a class, 0 when
+ * the population is not kept
+ */
+uint32_t
+fsm_population_flags (fsm_class_t *fsm_class)
+{
+    fsm_population_t *population;
+
+    population = FSM_LOAD_ACQUIRE(&fsm_class->population);
+    if (population == NULL) {
+        return (0);
+    }
+    return (FSM_POPULATION_ON | population->flags);
+}
+
+
+/** 
+ * NAME
+ *    fsm_population_enable
+ *
+ * SYNOPSIS
+ *    #include "fsm_population.h" 
+ *    RC_FSM_t
+ *    fsm_population_enable(fsm_class_t *fsm_class, uint32_t flags)
+ *
+ * DESCRIPTION
+ *    Starts keeping the number of state machines in each state of
+ *    the class.  The state machines created on the class from then
+ *    on, with fsm_create_in_pool, and the instances of the stores 
+ *    created on it, are counted when created, on each transition
+ *    to another state and when destroyed, in O(1) and without a
+ *    lock.  See fsm_population_track for the state machines that
+ *    already exist.  Lightweight instances are not counted, they
+ *    are never destroyed.
+ *
+ *    With FSM_POPULATION_DWELL, the counted state machines also 
+ *    keep the time stamp counter value when they entered their 
+ *    state, and each transition to another state records the stay
+ *    in a dwell time histogram of the state left.
+ *
+ *    The flags of the first call stay for the life of the class.
+ *
+ * INPUT PARAMETERS
+ *    fsm_class      class handle
+ *
+ *    flags          0 or FSM_POPULATION_DWELL
+ *
+ * OUTPUT PARAMETERS
+ *    none
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_population_enable (fsm_class_t *fsm_class, uint32_t flags)
+{
+    fsm_population_t *population;
+    fsm_population_t *expected;
+
+    if (fsm_class == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    if (fsm_class->tag != FSM_CLASS_TAG) {
+        return (RC_FSM_INVALID_HANDLE);
+    }
+
+    if (FSM_LOAD_ACQUIRE(&fsm_class->population)) {
+        return (RC_FSM_OK);
+    }
+
+    population = (fsm_population_t *)calloc(1, sizeof(fsm_population_t));
+    if (population == NULL) {
+        return (RC_FSM_NO_RESOURCES);
+    }
+
+    population->flags = flags & FSM_POPULATION_DWELL;
+    population->number_states = fsm_class->number_states;
+    population->population_counters = 
+                     FSM_POPULATION_LINES(fsm_class->number_states);
+    population->histogram_counters = 
+                     FSM_POPULATION_LINES(FSM_DWELL_MAX + 1);
+    population->shard_counters = population->population_counters;
+    if (population->flags & FSM_POPULATION_DWELL) {
+        population->shard_counters += fsm_class->number_states * 
+                                      population->histogram_counters;
+    }
+
+    population->shared = fsm_population_shard_create(population);
+    if (population->shared == NULL) {
+        free(population);
+        return (RC_FSM_NO_RESOURCES);
+    }
+
+    /* first enable wins */
+    expected = NULL;
+    if (!FSM_CAS(&fsm_class->population, &expected, population)) {
+        free(population->shared);
+        free(population);
+    }
+    return (RC_FSM_OK);
+}
+
+
+/** 
+ * NAME
+ *    fsm_population_track
+ *
+ * SYNOPSIS
+ *    #include "fsm_population.h" 
+ *    RC_FSM_t
+ *    fsm_population_track(fsm_t *fsm)
+ *
+ * DESCRIPTION
+ *    Counts a state machine that was created before the population
+ *    of its class was enabled, from its current state.  For the 
+ *    state machines of fsm_create, which each have a class of 
+ *    their own, call fsm_population_enable(fsm->fsm_class, flags)
+ *    and then this.  A state machine already counted is left as is.
+ *
+ * INPUT PARAMETERS
+ *    fsm            fsm handle
+ *
+ * OUTPUT PARAMETERS
+ *    none
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    RC_FSM_INVALID_HANDLE when the class population is not kept
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_population_track (fsm_t *fsm)
+{
+    uint32_t flags;
+
+    if (fsm == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    if (fsm->tag != FSM_TAG) {
+        return (RC_FSM_INVALID_HANDLE);
+    }
+
+    if (fsm->flags & FSM_FLAG_POPULATION) {
+        return (RC_FSM_OK);
+    }
+
+    flags = fsm_population_flags(fsm->fsm_class);
+    if (flags == 0) {
+        return (RC_FSM_INVALID_HANDLE);
+    }
+
+    fsm->flags |= FSM_FLAG_POPULATION;
+    if (flags & FSM_POPULATION_DWELL) {
+        fsm->flags |= FSM_FLAG_DWELL;
+        fsm->state_entry_tsc = fsm_tsc();
+    }
+    fsm_population_add(fsm->fsm_class, fsm->curr_state, 1);
+    return (RC_FSM_OK);
+}
+
+
+/** 
+ * NAME
+ *    fsm_population_get
+ *
+ * SYNOPSIS
+ *    #include "fsm_population.h" 
+ *    RC_FSM_t
+ *    fsm_population_get(fsm_class_t *fsm_class, 
+ *                       uint32_t state, 
+ *                       uint64_t *population)
+ *
+ * DESCRIPTION
+ *    Returns the number of counted state machines in a state, 
+ *    summed over the threads.  The threads keep counting while
+ *    it is read, a state machine in transition may be seen in 
+ *    both states or in neither.
+ *
+ * INPUT PARAMETERS
+ *    fsm_class      class handle
+ *
+ *    state          normalized state
+ *
+ *    population     pointer to the count to return
+ *
+ * OUTPUT PARAMETERS
+ *    population     state machines in the state
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_population_get (fsm_class_t *fsm_class, 
+                    uint32_t state, 
+                    uint64_t *population)
+{
+    fsm_population_t *p2population;
+    uint64_t *shard;
+    uint64_t sum;
+    uint32_t i;
+
+    if (fsm_class == NULL || population == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    if (fsm_class->tag != FSM_CLASS_TAG) {
+        return (RC_FSM_INVALID_HANDLE);
+    }
+
+    if (state >= fsm_class->number_states) {
+        return (RC_FSM_INVALID_STATE);
+    }
+
+    *population = 0;
+    p2population = FSM_LOAD_ACQUIRE(&fsm_class->population);
+    if (p2population == NULL) {
+        return (RC_FSM_OK);
+    }
+
+    sum = 0;
+    for (i=0; i<=FSM_POPULATION_SHARDS; i++) {
+        if (i == FSM_POPULATION_SHARDS) {
+            shard = p2population->shared;
+        } else {
+            shard = FSM_LOAD_ACQUIRE(&p2population->shards[i]);
+        }
+        if (shard) {
+            sum += FSM_LOAD_RELAXED(&shard[state]);
+        }
+    }
+
+    /* a transition caught half way can make it briefly negative */
+    if ((int64_t)sum > 0) {
+        *population = sum;
+    }
+    return (RC_FSM_OK);
+}
+
+
+/** 
+ * NAME
+ *    fsm_dwell_get
+ *
+ * SYNOPSIS
+ *    #include "fsm_population.h" 
+ *    RC_FSM_t
+ *    fsm_dwell_get(fsm_class_t *fsm_class, 
+ *                  uint32_t state, 
+ *                  fsm_dwell_stats_t *stats)
+ *
+ * DESCRIPTION
+ *    Merges the dwell histograms of all threads for a state and 
+ *    returns the number of stays recorded, the median, 99th and 
+ *    99.9th percentiles and maximum, in time stamp counter ticks.
+ *    Gives zeroes unless the population is kept with 
+ *    FSM_POPULATION_DWELL.
+ *
+ * INPUT PARAMETERS
+ *    fsm_class      class handle
+ *
+ *    state          normalized state
+ *
+ *    stats          pointer to the dwell time to fill
+ *
+ * OUTPUT PARAMETERS
+ *    stats          the merged dwell time
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_dwell_get (fsm_class_t *fsm_class, 
+               uint32_t state, 
+               fsm_dwell_stats_t *stats)
+{
+    fsm_population_t *population;
+    uint64_t buckets[FSM_DWELL_BUCKETS];
+    uint64_t *histogram;
+    uint64_t max;
+    uint64_t seen;
+    uint32_t i;
+    uint32_t j;
+
+    if (fsm_class == NULL || stats == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    if (fsm_class->tag != FSM_CLASS_TAG) {
+        return (RC_FSM_INVALID_HANDLE);
+    }
+
+    if (state >= fsm_class->number_states) {
+        return (RC_FSM_INVALID_STATE);
+    }
+
+    memset(stats, 0, sizeof(fsm_dwell_stats_t));
+    population = FSM_LOAD_ACQUIRE(&fsm_class->population);
+    if (population == NULL || 
+        !(population->flags & FSM_POPULATION_DWELL)) {
+        return (RC_FSM_OK);
+    }
+
+    memset(buckets, 0, sizeof(buckets));
+    for (i=0; i<=FSM_POPULATION_SHARDS; i++) {
+        if (i == FSM_POPULATION_SHARDS) {
+            histogram = population->shared;
+        } else {
+            histogram = FSM_LOAD_ACQUIRE(&population->shards[i]);
+        }
+        if (histogram == NULL) {
+            continue;
+        }
+        histogram += population->population_counters + 
+                     (state * population->histogram_counters);
+
+        for (j=0; j<FSM_DWELL_BUCKETS; j++) {
+            buckets[j] += FSM_LOAD_RELAXED(&histogram[j]);
+        }
+        max = FSM_LOAD_RELAXED(&histogram[FSM_DWELL_MAX]);
+        if (max > stats->max) {
+            stats->max = max;
+        }
+    }
+
+    for (j=0; j<FSM_DWELL_BUCKETS; j++) {
+        stats->count += buckets[j];
+    }
+
+    seen = 0;
+    for (j=0; j<FSM_DWELL_BUCKETS && stats->count; j++) {
+        if (buckets[j] == 0) {
+            continue;
+        }
+        seen += buckets[j];
+        if (stats->p50 == 0 && seen * 2 >= stats->count) {
+            stats->p50 = fsm_log_bucket_top(j, FSM_DWELL_SUB_BITS);
+        }
+        if (stats->p99 == 0 && seen * 100 >= stats->count * 99) {
+            stats->p99 = fsm_log_bucket_top(j, FSM_DWELL_SUB_BITS);
+        }
+        if (stats->p999 == 0 && seen * 1000 >= stats->count * 999) {
+            stats->p999 = fsm_log_bucket_top(j, FSM_DWELL_SUB_BITS);
+        }
+    }
+
+    /* the top of a bucket can be above the exact maximum */
+    if (stats->p50 > stats->max) {
+        stats->p50 = stats->max;
+    }
+    if (stats->p99 > stats->max) {
+        stats->p99 = stats->max;
+    }
+    if (stats->p999 > stats->max) {
+        stats->p999 = stats->max;
+    }
+    return (RC_FSM_OK);
+}
+
+
+/** 
+ * NAME
+ *    fsm_dwell_reset
+ *
+ * SYNOPSIS
+ *    #include "fsm_population.h" 
+ *    RC_FSM_t
+ *    fsm_dwell_reset(fsm_class_t *fsm_class)
+ *
+ * DESCRIPTION
+ *    Zeroes the dwell histograms of the class, the populations are
+ *    kept.  Stays recorded by other threads while the reset runs
+ *    may survive it.
+ *
+ * INPUT PARAMETERS
+ *    fsm_class      class handle
+ *
+ * OUTPUT PARAMETERS
+ *    none
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_dwell_reset (fsm_class_t *fsm_class)
+{
+    fsm_population_t *population;
+    uint64_t *shard;
+    uint32_t i;
+    uint32_t j;
+
+    if (fsm_class == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    if (fsm_class->tag != FSM_CLASS_TAG) {
+        return (RC_FSM_INVALID_HANDLE);
+    }
+
+    population = FSM_LOAD_ACQUIRE(&fsm_class->population);
+    if (population == NULL) {
+        return (RC_FSM_OK);
+    }
+
+    for (i=0; i<=FSM_POPULATION_SHARDS; i++) {
+        if (i == FSM_POPULATION_SHARDS) {
+            shard = population->shared;
+        } else {
+            shard = FSM_LOAD_ACQUIRE(&population->shards[i]);
+        }
+        if (shard == NULL) {
+            continue;
+        }
+        for (j=population->population_counters; 
+             j<population->shard_counters; j++) {
+            FSM_STORE_RELAXED(&shard[j], 0);
+        }
+    }
+    return (RC_FSM_OK);
+}
+
+
+/** 
+ * NAME
+ *    fsm_display_population
+ *
+ * SYNOPSIS 
+ *    #include "fsm_population.h" 
+ *    void
+ *    fsm_display_population(fsm_class_t *fsm_class)
+ *
+ * DESCRIPTION
+ *    Displays the population of each state of the class to 
+ *    console, with the dwell times when they are kept.
+ *
+ * INPUT PARAMETERS
+ *    fsm_class - handle to class
+ *
+ * OUTPUT PARAMETERS
+ *    none 
+ *
+ * RETURN VALUE
+ *    none 
+ * 
+ */
+void
+fsm_display_population (fsm_class_t *fsm_class)
+{
+    fsm_dwell_stats_t dwell;
+    uint64_t population;
+    uint32_t i;
+
+    if (fsm_class == NULL || fsm_class->tag != FSM_CLASS_TAG) {
+        return;
+    }
+
+    printf("\nFSM: %s Population \n", fsm_class->fsm_name);
+    printf(" State                  Population   Stays   "
+           "Dwell p50 / p99 / max ticks\n");
+    printf("------------------------------------------------"
+           "---------------------------\n");
+
+    for (i=0; i<fsm_class->number_states; i++) {
+        fsm_population_get(fsm_class, i, &population);
+        fsm_dwell_get(fsm_class, i, &dwell);
+
+        printf("  %u-%-20s %10llu %7llu   %llu / %llu / %llu\n",
+                 i,
+                 fsm_class->state_description_table[i].description,
+                 (unsigned long long)population,
+                 (unsigned long long)dwell.count,
+                 (unsigned long long)dwell.p50,
+                 (unsigned long long)dwell.p99,
+                 (unsigned long long)dwell.max);
+    }
+    printf("\n");
+    return;
+}
+
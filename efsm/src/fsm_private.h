@@ -0,0 +1,324 @@
+/*------------------------------------------------------------------
+ * fsm_private.h - Finite State Machine internal definitions
+ *
+ * Copyright (c) 2005-2009 by Cisco Systems, Inc.
+ * All rights reserved. 
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *------------------------------------------------------------------
+ */
+
+#ifndef __FSM_PRIVATE_H__
+#define __FSM_PRIVATE_H__
+
+#include <time.h>
+
+#include "fsm.h"
+
+
+/* largest run-to-completion event queue */
+#define FSM_MAX_EVENT_QUEUE  ( 1 << 16 )
+
+
+/*
+ * Software prefetch hint for read, a no-op where the compiler
+ * does not provide one.
+ */
+#if defined(__GNUC__)
+#define FSM_PREFETCH(addr)   __builtin_prefetch((addr), 0, 3)
+#else
+#define FSM_PREFETCH(addr)
+#endif
+
+
+/*
+ * Atomic operations used by the lock-free parts of the library,
+ * mapped onto the compiler builtins.
+ */
+#define FSM_LOAD_RELAXED(p)        __atomic_load_n((p), __ATOMIC_RELAXED)
+#define FSM_LOAD_ACQUIRE(p)        __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define FSM_STORE_RELAXED(p, v)    __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#define FSM_STORE_RELEASE(p, v)    __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define FSM_FETCH_ADD(p, v)        __atomic_fetch_add((p), (v), __ATOMIC_RELAXED)
+#define FSM_FETCH_OR(p, v)         __atomic_fetch_or((p), (v), __ATOMIC_RELAXED)
+#define FSM_FETCH_AND(p, v)        __atomic_fetch_and((p), (v), __ATOMIC_RELAXED)
+#define FSM_CAS(p, p2expected, desired)                             \
+        __atomic_compare_exchange_n((p), (p2expected), (desired), 0, \
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+#define FSM_FENCE()                __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+
+/*
+ * Time stamp counter, the cheapest clock the processor has.  The
+ * rate is not known here, see fsm_trace_dump.
+ */
+static inline uint64_t
+fsm_tsc (void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    uint32_t lo;
+    uint32_t hi;
+
+    __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+    return (((uint64_t)hi << 32) | lo);
+#elif defined(__aarch64__)
+    uint64_t ticks;
+
+    __asm__ __volatile__ ("mrs %0, cntvct_el0" : "=r" (ticks));
+    return (ticks);
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+#endif
+}
+
+
+/*
+ * Number of the calling thread, from 0, the lowest number free
+ * when the thread first asked.  The number goes back for reuse 
+ * when the thread exits, so the numbers stay below the count of
+ * threads alive at once.  Shared by the trace records and the 
+ * per thread counter shards, see fsm.c.
+ */
+extern __thread uint32_t  fsm_thread_number;
+
+extern void
+fsm_thread_number_take(void);
+
+static inline uint32_t
+fsm_thread_index (void)
+{
+    if (fsm_thread_number == 0) {
+        fsm_thread_number_take();
+    }
+    return (fsm_thread_number - 1);
+}
+
+
+/*
+ * Log-linear histogram buckets.  Values below 2^sub_bits have a
+ * bucket each, above that every power of two is split in 
+ * 2^sub_bits buckets.  A full 64 bit range takes 
+ * 2^sub_bits * (64 - sub_bits + 1) buckets.
+ */
+static inline uint32_t
+fsm_log_bucket (uint64_t value, uint32_t sub_bits)
+{
+    uint32_t shift;
+
+    if (value < (1ULL << sub_bits)) {
+        return ((uint32_t)value);
+    }
+
+    shift = (63 - __builtin_clzll(value)) - sub_bits;
+    return ((shift << sub_bits) + (uint32_t)(value >> shift));
+}
+
+/* highest value that goes in a bucket */
+static inline uint64_t
+fsm_log_bucket_top (uint32_t bucket, uint32_t sub_bits)
+{
+    uint32_t shift;
+    uint64_t sub;
+
+    if (bucket < (2U << sub_bits)) {
+        return (bucket);
+    }
+
+    shift = (bucket >> sub_bits) - 1;
+    sub = (1ULL << sub_bits) + (bucket & ((1U << sub_bits) - 1));
+    return (((sub + 1) << shift) - 1);
+}
+
+
+/*
+ * Count one event in the shard of the calling thread, called by
+ * the engines while stats_enabled is set, and free the counters
+ * of a class that is destroyed, see fsm_stats.c
+ */
+extern void
+fsm_stats_count(fsm_class_t *fsm_class, 
+                uint32_t state, 
+                uint32_t normalized_event, 
+                RC_FSM_t handler_rc);
+
+extern void
+fsm_stats_free(fsm_class_t *fsm_class);
+
+
+/*
+ * Record the duration of a handler of a class in the histogram of
+ * the calling thread, called by fsm_engine while FSM_FLAG_LATENCY
+ * is set, and free the histograms of a class that is destroyed, 
+ * see fsm_latency.c
+ */
+extern void
+fsm_latency_record(fsm_class_t *fsm_class, 
+                   uint32_t handler_index, 
+                   uint64_t ticks);
+
+extern void
+fsm_latency_free(fsm_class_t *fsm_class);
+
+
+/*
+ * Keep the state populations of a class, see fsm_population.c.
+ * The flags are 0 while the population is not kept, otherwise 
+ * FSM_POPULATION_ON with the fsm_population_enable flags.
+ */
+#define FSM_POPULATION_ON    ( 0x8000 )
+
+extern uint32_t
+fsm_population_flags(fsm_class_t *fsm_class);
+
+extern void
+fsm_population_add(fsm_class_t *fsm_class, uint32_t state, int64_t delta);
+
+extern void
+fsm_population_move(fsm_class_t *fsm_class, 
+                    uint32_t prev_state, 
+                    uint32_t next_state,
+                    uint64_t *entry_tsc);
+
+extern void
+fsm_population_free(fsm_class_t *fsm_class);
+
+
+/*
+ * Initialize a state machine on a validated class, see fsm.c
+ */
+extern RC_FSM_t
+fsm_init(fsm_t *fsm, 
+         fsm_class_t *fsm_class, 
+         uint32_t initial_state,
+         fsm_history_t *history,
+         uint32_t history_depth);
+
+
+/*
+ * Layout selection, see fsm_layout_choose in fsm.c.  A state is
+ * only kept as a sorted event list by choice when at most 1 in 
+ * FSM_SPARSE_FRACTION of the events are off its default, and
+ * FSM_LAYOUT_AUTO keeps all the states dense while their distinct
+ * rows fit in FSM_LAYOUT_CACHE_BYTES, half a first level cache.
+ */
+#define FSM_SPARSE_FRACTION    ( 4 )
+#define FSM_LAYOUT_CACHE_BYTES ( 16 * 1024 )
+
+
+/*
+ * Look up an event in the sorted list of a sparse state, 
+ * branch free so the search does not mispredict, the state's
+ * default cell when it is not listed.
+ */
+static inline const fsm_cell_t *
+fsm_sparse_cell (const fsm_class_t *fsm_class,
+                 uint32_t row,
+                 uint32_t normalized_event)
+{
+    const fsm_sparse_state_t *sparse_ptr;
+    const uint16_t *events;
+    const uint16_t *base;
+    uint32_t n;
+    uint32_t half;
+
+    sparse_ptr = &fsm_class->sparse_states[row & ~FSM_ROW_SPARSE];
+    events = &fsm_class->sparse_events[sparse_ptr->first];
+
+    base = events;
+    n = sparse_ptr->count;
+    while (n > 1) {
+        half = n / 2;
+        base = (base[half] <= normalized_event) ? base + half : base;
+        n -= half;
+    }
+
+    if (sparse_ptr->count && *base == normalized_event) {
+        return (&fsm_class->sparse_cells[sparse_ptr->first + 
+                                         (base - events)]);
+    }
+    return (&sparse_ptr->default_cell);
+}
+
+
+/*
+ * Look up the compiled cell for an event in a state.  Both 
+ * the state and the event must be in range.  Shared by the
+ * engines so they all dispatch the same way.
+ */
+static inline const fsm_cell_t *
+fsm_class_cell (const fsm_class_t *fsm_class,
+                uint32_t state,
+                uint32_t normalized_event)
+{
+    uint32_t row;
+
+    if (fsm_class->event_class == NULL) {
+        return (&fsm_class->rows[(state * fsm_class->number_events) + 
+                                 normalized_event]);
+    }
+
+    row = fsm_class->state_row[state];
+    if (row & FSM_ROW_SPARSE) {
+        return (fsm_sparse_cell(fsm_class, row, normalized_event));
+    }
+    return (&fsm_class->rows[row + 
+                             fsm_class->event_class[normalized_event]]);
+}
+
+static inline fsm_cell_t
+fsm_class_lookup (const fsm_class_t *fsm_class,
+                  uint32_t state,
+                  uint32_t normalized_event)
+{
+    return (*fsm_class_cell(fsm_class, state, normalized_event));
+}
+
+
+
+/*
+ * Narrow state ID accessors for the instance store arrays, the
+ * width is 1 or 2 bytes as chosen when the store was created.
+ */
+static inline uint32_t
+fsm_store_load_id (const void *array, uint32_t width, uint32_t index)
+{
+    if (width == 1) {
+        return (((const uint8_t *)array)[index]);
+    }
+    return (((const uint16_t *)array)[index]);
+}
+
+static inline void
+fsm_store_save_id (void *array, uint32_t width, uint32_t index, uint32_t id)
+{
+    if (width == 1) {
+        ((uint8_t *)array)[index] = (uint8_t)id;
+    } else {
+        ((uint16_t *)array)[index] = (uint16_t)id;
+    }
+}
+
+
+#endif  /* __FSM_PRIVATE_H__ */
@@ -0,0 +1,635 @@
+/*------------------------------------------------------------------
+ * fsm_session.c -- Finite State Machine session table
+ *
+ * Copyright (c) 2005-2009 by Cisco Systems, Inc.
+ * All rights reserved. 
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *------------------------------------------------------------------
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fsm.h"
+#include "fsm_session.h"
+#include "fsm_private.h"
+
+
+/* end of the free slot list */
+#define FSM_SESSION_NO_SLOT    ( 0xffffffff )
+
+
+/*
+ * internal routine to hash a session ID, the 64 bit finalizer of
+ * splitmix64, so that sequential IDs spread over the buckets
+ */
+static inline uint32_t
+fsm_session_hash (uint64_t key)
+{
+    key ^= key >> 30;
+    key *= 0xbf58476d1ce4e5b9ULL;
+    key ^= key >> 27;
+    key *= 0x94d049bb133111ebULL;
+    key ^= key >> 31;
+    return ((uint32_t)key);
+}
+
+
+/*
+ * internal routine to get the slot of a handle, NULL when the 
+ * handle is stale or was never handed out
+ */
+static inline fsm_session_slot_t *
+fsm_session_slot (fsm_session_table_t *table, fsm_session_handle_t handle)
+{
+    fsm_session_slot_t *slot;
+    uint32_t index;
+
+    index = (uint32_t)handle;
+    if (index >= table->capacity) {
+        return (NULL);
+    }
+
+    slot = &table->slots[index];
+    if (slot->fsm == NULL || 
+        slot->generation != (uint32_t)(handle >> FSM_SESSION_INDEX_BITS)) {
+        return (NULL);
+    }
+    return (slot);
+}
+
+
+/** 
+ * NAME
+ *    fsm_session_table_create
+ *
+ * SYNOPSIS
+ *    #include "fsm_session.h" 
+ *    RC_FSM_t
+ *    fsm_session_table_create(fsm_session_table_t **table, 
+ *                             uint32_t capacity)
+ *
+ * DESCRIPTION
+ *    Creates a session table for up to capacity sessions.  The 
+ *    buckets and the slots are all allocated here, 16 bytes per 
+ *    bucket with at least two buckets per session, and 24 bytes 
+ *    per slot.
+ *
+ * INPUT PARAMETERS
+ *    table            pointer to the table handle to return
+ *
+ *    capacity         most sessions at once, up to FSM_SESSION_MAX
+ *
+ * OUTPUT PARAMETERS
+ *    table            the table handle
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_session_table_create (fsm_session_table_t **table, uint32_t capacity)
+{
+    fsm_session_table_t *temp_table;
+    uint32_t buckets;
+    uint32_t i;
+
+    if (table == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    if (capacity == 0 || capacity > FSM_SESSION_MAX) {
+        return (RC_FSM_INVALID_ARGUMENT);
+    }
+
+    temp_table = (fsm_session_table_t *)calloc(1, 
+                                          sizeof(fsm_session_table_t));
+    if (temp_table == NULL) {
+        return (RC_FSM_NO_RESOURCES);
+    }
+
+    temp_table->tag = FSM_SESSION_TAG;
+    temp_table->capacity = capacity;
+
+    /* at most half full */
+    buckets = 8;
+    while (buckets < 2 * capacity) {
+        buckets <<= 1;
+    }
+    temp_table->bucket_mask = buckets - 1;
+
+    if (posix_memalign((void **)&temp_table->buckets, FSM_CACHE_LINE, 
+                       buckets * sizeof(fsm_session_bucket_t))) {
+        temp_table->buckets = NULL;
+    }
+    temp_table->slots = (fsm_session_slot_t *)
+                        malloc(capacity * sizeof(fsm_session_slot_t));
+
+    if (temp_table->buckets == NULL || temp_table->slots == NULL) {
+        fsm_session_table_destroy(&temp_table);
+        return (RC_FSM_NO_RESOURCES);
+    }
+
+    memset(temp_table->buckets, 0, buckets * sizeof(fsm_session_bucket_t));
+
+    for (i=0; i<capacity; i++) {
+        temp_table->slots[i].key = 0;
+        temp_table->slots[i].fsm = NULL;
+        temp_table->slots[i].generation = 1;
+        temp_table->slots[i].next_free = 
+                        (i + 1 < capacity) ? i + 1 : FSM_SESSION_NO_SLOT;
+    }
+    temp_table->free_slot = 0;
+
+    *table = temp_table;
+    return (RC_FSM_OK);
+}
+
+
+/** 
+ * NAME
+ *    fsm_session_table_destroy
+ *
+ * SYNOPSIS
+ *    #include "fsm_session.h" 
+ *    RC_FSM_t
+ *    fsm_session_table_destroy(fsm_session_table_t **table)
+ *
+ * DESCRIPTION
+ *    Destroys a session table.  The state machines of the sessions
+ *    still in the table are left alone.
+ *
+ * INPUT PARAMETERS
+ *    table            pointer to the table handle
+ *
+ * OUTPUT PARAMETERS
+ *    table            is nulled
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_session_table_destroy (fsm_session_table_t **table)
+{
+    fsm_session_table_t *p2table;
+
+    if (table == NULL || *table == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    p2table = *table;
+    if (p2table->tag != FSM_SESSION_TAG) {
+        return (RC_FSM_INVALID_HANDLE);
+    }
+
+    p2table->tag = 0;
+    free(p2table->buckets);
+    free(p2table->slots);
+    *table = NULL;
+    free(p2table);
+    return (RC_FSM_OK);
+}
+
+
+/** 
+ * NAME
+ *    fsm_session_insert
+ *
+ * SYNOPSIS
+ *    #include "fsm_session.h" 
+ *    RC_FSM_t
+ *    fsm_session_insert(fsm_session_table_t *table,
+ *                       uint64_t key,
+ *                       fsm_t *fsm,
+ *                       fsm_session_handle_t *p2handle)
+ *
+ * DESCRIPTION
+ *    Adds a session ID and its state machine to the table and 
+ *    returns the handle of the session.  No memory is allocated.
+ *
+ * INPUT PARAMETERS
+ *    table            table handle
+ *
+ *    key              user session ID
+ *
+ *    fsm              state machine of the session
+ *
+ * OUTPUT PARAMETERS
+ *    p2handle         handle of the session, may be NULL
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    RC_FSM_INVALID_HANDLE  the session ID is already in the table
+ *    RC_FSM_NO_RESOURCES    the table is full
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_session_insert (fsm_session_table_t *table,
+                    uint64_t key,
+                    fsm_t *fsm,
+                    fsm_session_handle_t *p2handle)
+{
+    fsm_session_bucket_t *bucket;
+    fsm_session_slot_t *slot;
+    uint32_t index;
+    uint32_t i;
+
+    if (table == NULL || fsm == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    if (table->tag != FSM_SESSION_TAG || fsm->tag != FSM_TAG) {
+        return (RC_FSM_INVALID_HANDLE);
+    }
+
+    if (table->free_slot == FSM_SESSION_NO_SLOT) {
+        return (RC_FSM_NO_RESOURCES);
+    }
+
+    /*
+     * probe to the first empty bucket, refusing a duplicate ID
+     */
+    i = fsm_session_hash(key) & table->bucket_mask;
+    for (;;) {
+        bucket = &table->buckets[i];
+        if (bucket->handle == FSM_SESSION_NULL_HANDLE) {
+            break;
+        }
+        if (bucket->key == key) {
+            return (RC_FSM_INVALID_HANDLE);
+        }
+        i = (i + 1) & table->bucket_mask;
+    }
+
+    index = table->free_slot;
+    slot = &table->slots[index];
+    table->free_slot = slot->next_free;
+
+    slot->key = key;
+    slot->fsm = fsm;
+
+    bucket->key = key;
+    bucket->handle = ((fsm_session_handle_t)slot->generation << 
+                                    FSM_SESSION_INDEX_BITS) | index;
+    table->count++;
+
+    if (p2handle) {
+        *p2handle = bucket->handle;
+    }
+    return (RC_FSM_OK);
+}
+
+
+/** 
+ * NAME
+ *    fsm_session_remove
+ *
+ * SYNOPSIS
+ *    #include "fsm_session.h" 
+ *    RC_FSM_t
+ *    fsm_session_remove(fsm_session_table_t *table, 
+ *                       fsm_session_handle_t handle)
+ *
+ * DESCRIPTION
+ *    Removes a session from the table.  The handle, and any copy
+ *    of it, is stale from then on.  A handler that ends its state
+ *    machine and returns RC_FSM_STOP_PROCESSING removes the 
+ *    session first, so later messages for it are refused instead
+ *    of reaching freed memory.
+ *
+ *    The buckets after the removed one are shifted back into the
+ *    gap, so the probe sequences stay short without tombstones.
+ *
+ * INPUT PARAMETERS
+ *    table            table handle
+ *
+ *    handle           handle of the session
+ *
+ * OUTPUT PARAMETERS
+ *    none
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    RC_FSM_INVALID_HANDLE  the handle is stale
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_session_remove (fsm_session_table_t *table, 
+                    fsm_session_handle_t handle)
+{
+    fsm_session_slot_t *slot;
+    uint32_t hole;
+    uint32_t home;
+    uint32_t i;
+
+    if (table == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    if (table->tag != FSM_SESSION_TAG) {
+        return (RC_FSM_INVALID_HANDLE);
+    }
+
+    slot = fsm_session_slot(table, handle);
+    if (slot == NULL) {
+        return (RC_FSM_INVALID_HANDLE);
+    }
+
+    /* the bucket is on the probe sequence of the ID */
+    hole = fsm_session_hash(slot->key) & table->bucket_mask;
+    while (table->buckets[hole].handle != handle) {
+        hole = (hole + 1) & table->bucket_mask;
+    }
+
+    /*
+     * shift back each following bucket that may move to the hole
+     * without being placed before its home bucket
+     */
+    i = hole;
+    for (;;) {
+        i = (i + 1) & table->bucket_mask;
+        if (table->buckets[i].handle == FSM_SESSION_NULL_HANDLE) {
+            break;
+        }
+
+        home = fsm_session_hash(table->buckets[i].key) & table->bucket_mask;
+        if (((i - home) & table->bucket_mask) >= 
+            ((i - hole) & table->bucket_mask)) {
+            table->buckets[hole] = table->buckets[i];
+            hole = i;
+        }
+    }
+    table->buckets[hole].handle = FSM_SESSION_NULL_HANDLE;
+
+    /*
+     * A new generation for the next session of the slot.  Once 
+     * the generation would wrap, the old handles could match 
+     * again, so the slot is retired and the table holds one 
+     * session less.
+     */
+    slot->fsm = NULL;
+    slot->generation++;
+    if (slot->generation != 0) {
+        slot->next_free = table->free_slot;
+        table->free_slot = (uint32_t)handle;
+    }
+    table->count--;
+    return (RC_FSM_OK);
+}
+
+
+/** 
+ * NAME
+ *    fsm_session_lookup
+ *
+ * SYNOPSIS
+ *    #include "fsm_session.h" 
+ *    RC_FSM_t
+ *    fsm_session_lookup(fsm_session_table_t *table,
+ *                       uint64_t key,
+ *                       fsm_session_handle_t *p2handle)
+ *
+ * DESCRIPTION
+ *    Finds the handle of a session ID.  The probe reads only the
+ *    buckets, normally one cache line.
+ *
+ * INPUT PARAMETERS
+ *    table            table handle
+ *
+ *    key              user session ID
+ *
+ * OUTPUT PARAMETERS
+ *    p2handle         handle of the session
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    RC_FSM_INVALID_HANDLE  no such session
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_session_lookup (fsm_session_table_t *table,
+                    uint64_t key,
+                    fsm_session_handle_t *p2handle)
+{
+    fsm_session_bucket_t *bucket;
+    uint32_t i;
+
+    if (table == NULL || p2handle == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    if (table->tag != FSM_SESSION_TAG) {
+        return (RC_FSM_INVALID_HANDLE);
+    }
+
+    i = fsm_session_hash(key) & table->bucket_mask;
+    for (;;) {
+        bucket = &table->buckets[i];
+        if (bucket->handle == FSM_SESSION_NULL_HANDLE) {
+            return (RC_FSM_INVALID_HANDLE);
+        }
+        if (bucket->key == key) {
+            *p2handle = bucket->handle;
+            return (RC_FSM_OK);
+        }
+        i = (i + 1) & table->bucket_mask;
+    }
+}
+
+
+/** 
+ * NAME
+ *    fsm_session_get
+ *
+ * SYNOPSIS
+ *    #include "fsm_session.h" 
+ *    RC_FSM_t
+ *    fsm_session_get(fsm_session_table_t *table,
+ *                    fsm_session_handle_t handle,
+ *                    fsm_t **p2fsm)
+ *
+ * DESCRIPTION
+ *    Returns the state machine of a session handle, in O(1).  A 
+ *    handle of a session that has been removed is refused, even 
+ *    when its slot holds a new session.
+ *
+ * INPUT PARAMETERS
+ *    table            table handle
+ *
+ *    handle           handle of the session
+ *
+ * OUTPUT PARAMETERS
+ *    p2fsm            state machine of the session
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    RC_FSM_INVALID_HANDLE  the handle is stale
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_session_get (fsm_session_table_t *table,
+                 fsm_session_handle_t handle,
+                 fsm_t **p2fsm)
+{
+    fsm_session_slot_t *slot;
+
+    if (table == NULL || p2fsm == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    if (table->tag != FSM_SESSION_TAG) {
+        return (RC_FSM_INVALID_HANDLE);
+    }
+
+    slot = fsm_session_slot(table, handle);
+    if (slot == NULL) {
+        return (RC_FSM_INVALID_HANDLE);
+    }
+
+    *p2fsm = slot->fsm;
+    return (RC_FSM_OK);
+}
+
+
+/** 
+ * NAME
+ *    fsm_session_engine
+ *
+ * SYNOPSIS
+ *    #include "fsm_session.h" 
+ *    RC_FSM_t
+ *    fsm_session_engine(fsm_session_table_t *table,
+ *                       uint64_t key,
+ *                       uint32_t normalized_event,
+ *                       void *p2event_buffer,
+ *                       void *p2parm)
+ *
+ * DESCRIPTION
+ *    Looks up a session ID and drives its state machine with 
+ *    fsm_engine, in one call.
+ *
+ * INPUT PARAMETERS
+ *    table              table handle
+ *
+ *    key                user session ID
+ *
+ *    normalized_event   normalized event
+ *
+ *    p2event_buffer     passed to the event handler
+ *
+ *    p2parm             passed to the event handler
+ *
+ * OUTPUT PARAMETERS
+ *    none
+ *
+ * RETURN VALUE
+ *    return code of fsm_engine
+ *    RC_FSM_INVALID_HANDLE  no such session
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_session_engine (fsm_session_table_t *table,
+                    uint64_t key,
+                    uint32_t normalized_event,
+                    void *p2event_buffer,
+                    void *p2parm)
+{
+    fsm_session_handle_t handle;
+    RC_FSM_t rc;
+
+    rc = fsm_session_lookup(table, key, &handle);
+    if (rc != RC_FSM_OK) {
+        return (rc);
+    }
+
+    return (fsm_engine(table->slots[(uint32_t)handle].fsm,
+                       normalized_event, 
+                       p2event_buffer, 
+                       p2parm));
+}
+
+
+/** 
+ * NAME
+ *    fsm_session_engine_handle
+ *
+ * SYNOPSIS
+ *    #include "fsm_session.h" 
+ *    RC_FSM_t
+ *    fsm_session_engine_handle(fsm_session_table_t *table,
+ *                              fsm_session_handle_t handle,
+ *                              uint32_t normalized_event,
+ *                              void *p2event_buffer,
+ *                              void *p2parm)
+ *
+ * DESCRIPTION
+ *    Checks a session handle and drives its state machine with 
+ *    fsm_engine, in one call.  A stale handle is refused.
+ *
+ * INPUT PARAMETERS
+ *    table              table handle
+ *
+ *    handle             handle of the session
+ *
+ *    normalized_event   normalized event
+ *
+ *    p2event_buffer     passed to the event handler
+ *
+ *    p2parm             passed to the event handler
+ *
+ * OUTPUT PARAMETERS
+ *    none
+ *
+ * RETURN VALUE
+ *    return code of fsm_engine
+ *    RC_FSM_INVALID_HANDLE  the handle is stale
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_session_engine_handle (fsm_session_table_t *table,
+                           fsm_session_handle_t handle,
+                           uint32_t normalized_event,
+                           void *p2event_buffer,
+                           void *p2parm)
+{
+    fsm_t *fsm;
+    RC_FSM_t rc;
+
+    rc = fsm_session_get(table, handle, &fsm);
+    if (rc != RC_FSM_OK) {
+        return (rc);
+    }
+
+    return (fsm_engine(fsm, normalized_event, p2event_buffer, p2parm));
+}
+
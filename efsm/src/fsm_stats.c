@@ -0,0 +1,462 @@
+/*------------------------------------------------------------------
+ * fsm_stats.c -- Finite State Machine transition counters
+ *
+ * Copyright (c) 2005-2009 by Cisco Systems, Inc.
+ * All rights reserved. 
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *------------------------------------------------------------------
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fsm.h"
+#include "fsm_stats.h"
+#include "fsm_private.h"
+
+
+/*
+ * Counters of a class.  A shard is one array of FSM_STATS_RC
+ * return code counters followed by the cell counters, padded to
+ * whole cache lines so no two threads write the same line.  Each
+ * thread numbered below FSM_STATS_SHARDS makes its own shard on
+ * its first event and is the only writer of it, until it exits and
+ * its number, shard included, passes to a later thread.  The 
+ * other threads share one shard with atomic increments.  Readers 
+ * merge.
+ */
+typedef struct fsm_stats_s {
+    uint32_t   number_cells;
+    uint32_t   shard_counters;
+    uint64_t  *shards[FSM_STATS_SHARDS];
+    uint64_t  *shared;
+} fsm_stats_t;
+
+
+/*
+ * internal routine to make a zeroed shard
+ */
+static uint64_t *
+fsm_stats_shard_create (fsm_stats_t *stats)
+{
+    uint64_t *shard;
+
+    if (posix_memalign((void **)&shard, FSM_CACHE_LINE, 
+                       stats->shard_counters * sizeof(uint64_t))) {
+        return (NULL);
+    }
+    memset(shard, 0, stats->shard_counters * sizeof(uint64_t));
+    return (shard);
+}
+
+
+/*
+ * internal routine to count in a shard only the calling thread
+ * writes, relaxed so a concurrent reader sees whole values
+ */
+static inline void
+fsm_stats_increment (uint64_t *counter)
+{
+    FSM_STORE_RELAXED(counter, FSM_LOAD_RELAXED(counter) + 1);
+}
+
+
+/*
+ * internal routine, see fsm_private.h.  Called by the engines
+ * only while stats_enabled is set.
+ */
+void
+fsm_stats_count (fsm_class_t *fsm_class, 
+                 uint32_t state, 
+                 uint32_t normalized_event, 
+                 RC_FSM_t handler_rc)
+{
+    fsm_stats_t *stats;
+    uint64_t *shard;
+    uint32_t thread;
+
+    stats = FSM_LOAD_ACQUIRE(&fsm_class->stats);
+    if (stats == NULL) {
+        return;
+    }
+
+    thread = fsm_thread_index();
+    if (thread >= FSM_STATS_SHARDS) {
+        shard = stats->shared;
+        if ((uint32_t)handler_rc < FSM_STATS_RC) {
+            FSM_FETCH_ADD(&shard[handler_rc], 1);
+        }
+        if (normalized_event < fsm_class->number_events) {
+            FSM_FETCH_ADD(&shard[FSM_STATS_RC + 
+                   (state * fsm_class->number_events) + normalized_event], 
+                          1);
+        }
+        return;
+    }
+
+    shard = stats->shards[thread];
+    if (shard == NULL) {
+        shard = fsm_stats_shard_create(stats);
+        if (shard == NULL) {
+            return;
+        }
+        FSM_STORE_RELEASE(&stats->shards[thread], shard);
+    }
+
+    if ((uint32_t)handler_rc < FSM_STATS_RC) {
+        fsm_stats_increment(&shard[handler_rc]);
+    }
+    if (normalized_event < fsm_class->number_events) {
+        fsm_stats_increment(&shard[FSM_STATS_RC + 
+                   (state * fsm_class->number_events) + normalized_event]);
+    }
+    return;
+}
+
+
+/*
+ * internal routine, see fsm_private.h.  Called by 
+ * fsm_class_destroy once no thread runs the class.
+ */
+void
+fsm_stats_free (fsm_class_t *fsm_class)
+{
+    fsm_stats_t *stats;
+    uint32_t i;
+
+    stats = fsm_class->stats;
+    if (stats == NULL) {
+        return;
+    }
+
+    for (i=0; i<FSM_STATS_SHARDS; i++) {
+        free(stats->shards[i]);
+    }
+    free(stats->shared);
+    free(stats);
+    fsm_class->stats = NULL;
+    fsm_class->stats_enabled = FALSE;
+    return;
+}
+
+
+/** 
+ * NAME
+ *    fsm_stats_enable
+ *
+ * SYNOPSIS
+ *    #include "fsm_stats.h" 
+ *    RC_FSM_t
+ *    fsm_stats_enable(fsm_class_t *fsm_class)
+ *
+ * DESCRIPTION
+ *    Starts counting the events of every state machine, instance
+ *    and store of the class, per (state, event) cell and per 
+ *    return code.  The counters are allocated on the first call
+ *    and kept until the class is destroyed, so counting can be 
+ *    turned on and off at any time.  The state machines of 
+ *    fsm_create each have a class of their own, fsm->fsm_class.
+ *
+ *    While off, the engines pay one test of stats_enabled.
+ *
+ * INPUT PARAMETERS
+ *    fsm_class      class handle
+ *
+ * OUTPUT PARAMETERS
+ *    none
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_stats_enable (fsm_class_t *fsm_class)
+{
+    fsm_stats_t *stats;
+    fsm_stats_t *expected;
+    uint32_t counters;
+
+    if (fsm_class == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    if (fsm_class->tag != FSM_CLASS_TAG) {
+        return (RC_FSM_INVALID_HANDLE);
+    }
+
+    if (FSM_LOAD_ACQUIRE(&fsm_class->stats) == NULL) {
+        stats = (fsm_stats_t *)calloc(1, sizeof(fsm_stats_t));
+        if (stats == NULL) {
+            return (RC_FSM_NO_RESOURCES);
+        }
+
+        /* whole cache lines of counters */
+        stats->number_cells = fsm_class->number_states * 
+                              fsm_class->number_events;
+        counters = FSM_STATS_RC + stats->number_cells;
+        counters = (counters + (FSM_CACHE_LINE/sizeof(uint64_t)) - 1) & 
+                   ~((FSM_CACHE_LINE/sizeof(uint64_t)) - 1);
+        stats->shard_counters = counters;
+
+        stats->shared = fsm_stats_shard_create(stats);
+        if (stats->shared == NULL) {
+            free(stats);
+            return (RC_FSM_NO_RESOURCES);
+        }
+
+        /* first enable wins */
+        expected = NULL;
+        if (!FSM_CAS(&fsm_class->stats, &expected, stats)) {
+            free(stats->shared);
+            free(stats);
+        }
+    }
+
+    FSM_STORE_RELEASE(&fsm_class->stats_enabled, TRUE);
+    return (RC_FSM_OK);
+}
+
+
+/** 
+ * NAME
+ *    fsm_stats_disable
+ *
+ * SYNOPSIS
+ *    #include "fsm_stats.h" 
+ *    RC_FSM_t
+ *    fsm_stats_disable(fsm_class_t *fsm_class)
+ *
+ * DESCRIPTION
+ *    Stops counting the events of the class.  The counters keep 
+ *    their values for fsm_stats_snapshot.
+ *
+ * INPUT PARAMETERS
+ *    fsm_class      class handle
+ *
+ * OUTPUT PARAMETERS
+ *    none
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_stats_disable (fsm_class_t *fsm_class)
+{
+    if (fsm_class == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    if (fsm_class->tag != FSM_CLASS_TAG) {
+        return (RC_FSM_INVALID_HANDLE);
+    }
+
+    FSM_STORE_RELEASE(&fsm_class->stats_enabled, FALSE);
+    return (RC_FSM_OK);
+}
+
+
+/** 
+ * NAME
+ *    fsm_stats_reset
+ *
+ * SYNOPSIS
+ *    #include "fsm_stats.h" 
+ *    RC_FSM_t
+ *    fsm_stats_reset(fsm_class_t *fsm_class)
+ *
+ * DESCRIPTION
+ *    Zeroes the counters of the class.  Events counted by other 
+ *    threads while the reset runs may survive it.
+ *
+ * INPUT PARAMETERS
+ *    fsm_class      class handle
+ *
+ * OUTPUT PARAMETERS
+ *    none
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_stats_reset (fsm_class_t *fsm_class)
+{
+    fsm_stats_t *stats;
+    uint64_t *shard;
+    uint32_t i;
+    uint32_t j;
+
+    if (fsm_class == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    if (fsm_class->tag != FSM_CLASS_TAG) {
+        return (RC_FSM_INVALID_HANDLE);
+    }
+
+    stats = FSM_LOAD_ACQUIRE(&fsm_class->stats);
+    if (stats == NULL) {
+        return (RC_FSM_OK);
+    }
+
+    for (i=0; i<=FSM_STATS_SHARDS; i++) {
+        if (i == FSM_STATS_SHARDS) {
+            shard = stats->shared;
+        } else {
+            shard = FSM_LOAD_ACQUIRE(&stats->shards[i]);
+        }
+        if (shard == NULL) {
+            continue;
+        }
+        for (j=0; j<stats->shard_counters; j++) {
+            FSM_STORE_RELAXED(&shard[j], 0);
+        }
+    }
+    return (RC_FSM_OK);
+}
+
+
+/** 
+ * NAME
+ *    fsm_stats_snapshot
+ *
+ * SYNOPSIS
+ *    #include "fsm_stats.h" 
+ *    RC_FSM_t
+ *    fsm_stats_snapshot(fsm_class_t *fsm_class, 
+ *                       fsm_stats_snapshot_t *snapshot)
+ *
+ * DESCRIPTION
+ *    Merges the counters of all threads into a snapshot.  The 
+ *    threads keep counting while it is taken, each counter is 
+ *    read whole but the snapshot is not one instant.  The cell
+ *    matrix is allocated, release it with fsm_stats_snapshot_free.
+ *    A class that never counted gives all zeroes.
+ *
+ * INPUT PARAMETERS
+ *    fsm_class      class handle
+ *
+ *    snapshot       pointer to the snapshot to fill
+ *
+ * OUTPUT PARAMETERS
+ *    snapshot       the merged counters
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_stats_snapshot (fsm_class_t *fsm_class, fsm_stats_snapshot_t *snapshot)
+{
+    fsm_stats_t *stats;
+    uint64_t *shard;
+    uint32_t number_cells;
+    uint32_t i;
+    uint32_t j;
+
+    if (fsm_class == NULL || snapshot == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    if (fsm_class->tag != FSM_CLASS_TAG) {
+        return (RC_FSM_INVALID_HANDLE);
+    }
+
+    number_cells = fsm_class->number_states * fsm_class->number_events;
+
+    memset(snapshot, 0, sizeof(fsm_stats_snapshot_t));
+    snapshot->number_states = fsm_class->number_states;
+    snapshot->number_events = fsm_class->number_events;
+    snapshot->cells = (uint64_t *)calloc(number_cells, sizeof(uint64_t));
+    if (snapshot->cells == NULL) {
+        return (RC_FSM_NO_RESOURCES);
+    }
+
+    stats = FSM_LOAD_ACQUIRE(&fsm_class->stats);
+    if (stats == NULL) {
+        return (RC_FSM_OK);
+    }
+
+    for (i=0; i<=FSM_STATS_SHARDS; i++) {
+        if (i == FSM_STATS_SHARDS) {
+            shard = stats->shared;
+        } else {
+            shard = FSM_LOAD_ACQUIRE(&stats->shards[i]);
+        }
+        if (shard == NULL) {
+            continue;
+        }
+        for (j=0; j<FSM_STATS_RC; j++) {
+            snapshot->rc[j] += FSM_LOAD_RELAXED(&shard[j]);
+        }
+        for (j=0; j<number_cells; j++) {
+            snapshot->cells[j] += FSM_LOAD_RELAXED(&shard[FSM_STATS_RC + j]);
+        }
+    }
+
+    for (j=0; j<FSM_STATS_RC; j++) {
+        snapshot->total += snapshot->rc[j];
+    }
+    return (RC_FSM_OK);
+}
+
+
+/** 
+ * NAME
+ *    fsm_stats_snapshot_free
+ *
+ * SYNOPSIS
+ *    #include "fsm_stats.h" 
+ *    void
+ *    fsm_stats_snapshot_free(fsm_stats_snapshot_t *snapshot)
+ *
+ * DESCRIPTION
+ *    Releases the cell matrix of a snapshot.
+ *
+ * INPUT PARAMETERS
+ *    snapshot       pointer to the snapshot
+ *
+ * OUTPUT PARAMETERS
+ *    none
+ *
+ * RETURN VALUE
+ *    none
+ * 
+ */
+void
+fsm_stats_snapshot_free (fsm_stats_snapshot_t *snapshot)
+{
+    if (snapshot == NULL) {
+        return;
+    }
+    free(snapshot->cells);
+    snapshot->cells = NULL;
+    return;
+}
+
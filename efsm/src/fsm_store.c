@@ -0,0 +1,1432 @@
+/*------------------------------------------------------------------
+ * fsm_store.c -- Finite State Machine instance store
+ *
+ * Copyright (c) 2005-2009 by Cisco Systems, Inc.
+ * All rights reserved. 
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *------------------------------------------------------------------
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fsm.h"
+#include "fsm_store.h"
+#include "fsm_population.h"
+#include "fsm_trace.h"
+#include "fsm_private.h"
+
+
+/* largest array size, as SIZE_MAX */
+#define FSM_STORE_SIZE_MAX    ( (size_t)-1 )
+
+
+/*
+ * internal routines to unlink an instance from the membership list
+ * of its state and to link it at the head of the list of another
+ */
+static inline void
+fsm_store_member_unlink (fsm_store_t *store, 
+                         uint32_t instance, 
+                         uint32_t state)
+{
+    uint32_t next;
+    uint32_t prev;
+
+    next = store->member_next[instance];
+    prev = store->member_prev[instance];
+
+    if (prev == FSM_STORE_NO_MEMBER) {
+        store->member_head[state] = next;
+    } else {
+        store->member_next[prev] = next;
+    }
+    if (next != FSM_STORE_NO_MEMBER) {
+        store->member_prev[next] = prev;
+    }
+    store->member_count[state]--;
+}
+
+static inline void
+fsm_store_member_link (fsm_store_t *store, 
+                       uint32_t instance, 
+                       uint32_t state)
+{
+    uint32_t head;
+
+    head = store->member_head[state];
+    store->member_next[instance] = head;
+    store->member_prev[instance] = FSM_STORE_NO_MEMBER;
+    if (head != FSM_STORE_NO_MEMBER) {
+        store->member_prev[head] = instance;
+    }
+    store->member_head[state] = instance;
+    store->member_count[state]++;
+}
+
+
+/*
+ * internal routine to take the instances of a store that is
+ * destroyed out of the state populations
+ */
+static void
+fsm_store_population_release (fsm_store_t *store)
+{
+    uint32_t *counts;
+    uint32_t i;
+
+    counts = (uint32_t *)calloc(store->fsm_class->number_states, 
+                                sizeof(uint32_t));
+    if (counts == NULL) {
+        return;
+    }
+
+    for (i=0; i<store->capacity; i++) {
+        counts[fsm_store_load_id(store->states, store->state_width, i)]++;
+    }
+    for (i=0; i<store->fsm_class->number_states; i++) {
+        if (counts[i]) {
+            fsm_population_add(store->fsm_class, i, -(int64_t)counts[i]);
+        }
+    }
+    free(counts);
+    return;
+}
+
+
+/*
+ * internal routine to count an event, to record the state 
+ * transition in the history of an instance, when the store has 
+ * one, and to trace it when start is set
+ */
+static void
+fsm_store_record_history (fsm_store_t *store,
+                          uint32_t instance,
+                          uint32_t prev_state,
+                          uint32_t normalized_event,
+                          uint32_t next_state,
+                          RC_FSM_t handler_rc,
+                          uint64_t start)
+{
+    fsm_store_history_t *history_ptr;
+    uint32_t index;
+
+    if (store->fsm_class->stats_enabled) {
+        fsm_stats_count(store->fsm_class, prev_state, 
+                        normalized_event, handler_rc);
+    }
+
+    /*
+     * the state only changes on RC_FSM_OK from a handler
+     */
+    if (start) {
+        fsm_trace_instance(store->fsm_class, 
+                           instance, 
+                           prev_state,
+                           normalized_event, 
+                           handler_rc == RC_FSM_OK ? 
+                                 next_state : prev_state,
+                           handler_rc, 
+                           start);
+    }
+
+    if (store->history_depth == 0) {
+        return;
+    }
+
+    index = (store->history_index[instance] + 1) & 
+                                  (store->history_depth - 1);
+    store->history_index[instance] = (uint8_t)index;
+
+    history_ptr = &store->history[((size_t)instance * store->history_depth) + 
+                                   index];
+    history_ptr->prevStateID = (uint16_t)prev_state;
+    history_ptr->stateID = (uint16_t)next_state;
+    history_ptr->eventID = (uint16_t)normalized_event;
+    history_ptr->handler_rc = (uint16_t)handler_rc;
+    return;
+}
+
+
+/** 
+ * NAME
+ *    fsm_store_instance_init
+ *
+ * SYNOPSIS
+ *    #include "fsm_store.h" 
+ *    RC_FSM_t
+ *    fsm_store_instance_init(fsm_store_t *store,
+ *                            uint32_t instance,
+ *                            uint32_t initial_state)
+ *
+ * DESCRIPTION
+ *    Resets an instance of the store to the specified state
+ *    and clears its flags and history.
+ *
+ * INPUT PARAMETERS
+ *    store              store handle
+ *
+ *    instance           index of the instance
+ *
+ *    initial_state      Initial start state
+ *
+ * OUTPUT PARAMETERS
+ *     none   
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_store_instance_init (fsm_store_t *store,
+                         uint32_t instance,
+                         uint32_t initial_state)
+{
+    uint32_t i;
+    fsm_store_history_t *history_ptr;
+
+    if (store == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    if (store->tag != FSM_STORE_TAG || instance >= store->capacity) {
+        return (RC_FSM_INVALID_HANDLE);
+    }
+
+    if (initial_state > store->fsm_class->number_states-1) {
+        return (RC_FSM_INVALID_STATE);
+    }
+
+    /* a new session, the stay of the old one ends */
+    if (store->population_flags) {
+        fsm_population_move(store->fsm_class,
+                            fsm_store_load_id(store->states, 
+                                              store->state_width, 
+                                              instance),
+                            initial_state,
+                            store->entry_tsc ? 
+                                   &store->entry_tsc[instance] : NULL);
+    }
+
+    if (store->member_head) {
+        fsm_store_member_unlink(store, instance, 
+                                fsm_store_load_id(store->states, 
+                                                  store->state_width, 
+                                                  instance));
+        fsm_store_member_link(store, instance, initial_state);
+    }
+
+    fsm_store_save_id(store->states, store->state_width, 
+                      instance, initial_state);
+    fsm_store_save_id(store->exception_states, store->state_width, 
+                      instance, initial_state);
+    store->flags[instance] = 0;
+
+    if (store->history_depth) {
+        store->history_index[instance] = 0;
+        history_ptr = &store->history[(size_t)instance * store->history_depth];
+        for (i=0; i<store->history_depth; i++) {
+            history_ptr[i].prevStateID = (uint16_t)FSM_NULL_STATE_ID;
+            history_ptr[i].stateID = (uint16_t)FSM_NULL_STATE_ID;
+            history_ptr[i].eventID = (uint16_t)FSM_NULL_EVENT_ID;
+            history_ptr[i].handler_rc = RC_FSM_NULL;
+        }
+    }
+    return (RC_FSM_OK);
+}
+
+
+/** 
+ * NAME
+ *    fsm_store_destroy
+ *
+ * SYNOPSIS
+ *    #include "fsm_store.h" 
+ *    RC_FSM_t
+ *    fsm_store_destroy(fsm_store_t **store)
+ * 
+ * DESCRIPTION
+ *    Destroys the specified instance store.  The class is
+ *    not destroyed.
+ *
+ * INPUT PARAMETERS
+ *    store - pointer to store handle
+ *
+ * OUTPUT PARAMETERS
+ *    store - is nulled
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_store_destroy (fsm_store_t **store)
+{
+    fsm_store_t *p2store;
+
+    if (store == NULL || *store == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    p2store = *store;
+    if (p2store->tag != FSM_STORE_TAG) {
+        return (RC_FSM_INVALID_HANDLE);
+    }
+
+    p2store->tag = 0;
+    if (p2store->population_flags) {
+        fsm_store_population_release(p2store);
+    }
+
+    free(p2store->states);
+    free(p2store->exception_states);
+    free(p2store->flags);
+    free(p2store->history_index);
+    free(p2store->history);
+    free(p2store->entry_tsc);
+    free(p2store->member_head);
+    free(p2store->member_count);
+    free(p2store->member_next);
+    free(p2store->member_prev);
+    *store = NULL;
+    free(p2store);
+    return (RC_FSM_OK);
+}
+
+
+/** 
+ * NAME
+ *    fsm_store_create
+ *
+ * SYNOPSIS
+ *    #include "fsm_store.h" 
+ *    RC_FSM_t
+ *    fsm_store_create(fsm_store_t **store,
+ *                     fsm_class_t *fsm_class,
+ *                     uint32_t capacity,
+ *                     uint32_t initial_state,
+ *                     uint32_t history_depth)
+ *
+ * DESCRIPTION
+ *    Creates a store of capacity instances of a class, all in
+ *    the initial state.  The width of the state IDs is picked
+ *    from the number of states of the class.  The state array
+ *    is cache line aligned.
+ *
+ * INPUT PARAMETERS
+ *    store              pointer to store handle to be returned
+ *                       once created
+ *
+ *    fsm_class          class handle from fsm_class_create
+ *
+ *    capacity           number of instances
+ *
+ *    initial_state      Initial start state of all instances
+ *
+ *    history_depth      number of history records kept per
+ *                       instance, a power of two up to 
+ *                       FSM_STORE_MAX_HISTORY, or 0 for none
+ *
+ * OUTPUT PARAMETERS
+ *     none   
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_store_create (fsm_store_t **store,
+                  fsm_class_t *fsm_class,
+                  uint32_t capacity,
+                  uint32_t initial_state,
+                  uint32_t history_depth)
+{
+    fsm_store_t *temp_store;
+    uint32_t i;
+
+    if (store == NULL || fsm_class == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    if (fsm_class->tag != FSM_CLASS_TAG) {
+        return (RC_FSM_INVALID_HANDLE);
+    }
+
+    if (initial_state > fsm_class->number_states-1) {
+        return (RC_FSM_INVALID_STATE);
+    }
+
+    if (capacity == 0 ||
+        history_depth > FSM_STORE_MAX_HISTORY ||
+        (history_depth & (history_depth - 1)) != 0) {
+        return (RC_FSM_INVALID_ARGUMENT);
+    }
+
+    /*
+     * every array size must fit a size_t, the history being the
+     * largest, and the dwell times of 8 bytes per instance
+     */
+    if ((size_t)capacity > FSM_STORE_SIZE_MAX / sizeof(uint64_t) ||
+        (history_depth && 
+         (size_t)capacity > FSM_STORE_SIZE_MAX / 
+                      (history_depth * sizeof(fsm_store_history_t)))) {
+        return (RC_FSM_NO_RESOURCES);
+    }
+
+    temp_store = (fsm_store_t *)calloc(1, sizeof(fsm_store_t));
+    if (temp_store == NULL) {
+        return (RC_FSM_NO_RESOURCES);
+    }
+
+    temp_store->tag = FSM_STORE_TAG;
+    temp_store->fsm_class = fsm_class;
+    temp_store->capacity = capacity;
+    temp_store->history_depth = history_depth;
+
+    /*
+     * narrowest state ID that holds every state of the class
+     */
+    if (fsm_class->number_states <= UINT8_MAX) {
+        temp_store->state_width = sizeof(uint8_t);
+    } else {
+        temp_store->state_width = sizeof(uint16_t);
+    }
+
+    if (posix_memalign(&temp_store->states, FSM_CACHE_LINE,
+                       (size_t)capacity * temp_store->state_width)) {
+        temp_store->states = NULL;
+    }
+    temp_store->exception_states = 
+                     malloc((size_t)capacity * temp_store->state_width);
+    temp_store->flags = 
+                     (uint8_t *)malloc((size_t)capacity * sizeof(uint8_t));
+
+    if (history_depth) {
+        temp_store->history_index = 
+                     (uint8_t *)malloc((size_t)capacity * sizeof(uint8_t));
+        temp_store->history = (fsm_store_history_t *)
+              malloc((size_t)capacity * history_depth * 
+                                          sizeof(fsm_store_history_t));
+    }
+
+    if (temp_store->states == NULL ||
+        temp_store->exception_states == NULL ||
+        temp_store->flags == NULL ||
+        (history_depth && 
+          (temp_store->history_index == NULL || 
+           temp_store->history == NULL))) {
+        fsm_store_destroy(&temp_store);
+        return (RC_FSM_NO_RESOURCES);
+    }
+
+    for (i=0; i<capacity; i++) {
+        fsm_store_instance_init(temp_store, i, initial_state);
+    }
+
+    /*
+     * all the instances enter the initial state at once
+     */
+    temp_store->population_flags = fsm_population_flags(fsm_class);
+    if (temp_store->population_flags & FSM_POPULATION_DWELL) {
+        temp_store->entry_tsc = 
+                    (uint64_t *)malloc((size_t)capacity * sizeof(uint64_t));
+        if (temp_store->entry_tsc == NULL) {
+            temp_store->population_flags = 0;
+            fsm_store_destroy(&temp_store);
+            return (RC_FSM_NO_RESOURCES);
+        }
+        temp_store->entry_tsc[0] = fsm_tsc();
+        for (i=1; i<capacity; i++) {
+            temp_store->entry_tsc[i] = temp_store->entry_tsc[0];
+        }
+    }
+    if (temp_store->population_flags) {
+        fsm_population_add(fsm_class, initial_state, capacity);
+    }
+
+    /* return handle to the user */
+    *store = temp_store;
+    return (RC_FSM_OK);
+}
+
+
+/** 
+ * NAME
+ *    fsm_store_get_state
+ *
+ * SYNOPSIS
+ *    #include "fsm_store.h"
+ *    RC_FSM_t
+ *    fsm_store_get_state(fsm_store_t *store, 
+ *                        uint32_t instance,
+ *                        uint32_t *p2state)
+ *
+ * DESCRIPTION
+ *    Function to return the current state of an instance.
+ *
+ * INPUT PARAMETERS
+ *    store - store handle
+ *
+ *    instance - index of the instance
+ *
+ *    p2state - Pointer to a state variable to be updated.
+ *
+ * OUTPUT PARAMETERS
+ *    none 
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_store_get_state (fsm_store_t *store, 
+                     uint32_t instance, 
+                     uint32_t *p2state)
+{
+    if (store == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    if (store->tag != FSM_STORE_TAG || instance >= store->capacity) {
+        return (RC_FSM_INVALID_HANDLE);
+    }
+
+    *p2state = fsm_store_load_id(store->states, store->state_width, instance);
+    return (RC_FSM_OK);
+}
+
+
+/** 
+ * NAME
+ *    fsm_store_set_exception_state
+ * 
+ * SYNOPSIS
+ *    #include "fsm_store.h"
+ *    RC_FSM_t
+ *    fsm_store_set_exception_state(fsm_store_t *store, 
+ *                                  uint32_t instance,
+ *                                  uint32_t exception_state)
+ *
+ * DESCRIPTION
+ *    To be called from an event handler to alter the next
+ *    state of an instance when an exception has been detected.
+ *
+ * INPUT PARAMETERS
+ *    store - store handle
+ *
+ *    instance - index of the instance
+ *
+ *    exception_state - New state to be transitioned
+ *            when the event handler returns.
+ *
+ * OUTPUT PARAMETERS
+ *    none 
+ * 
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_store_set_exception_state (fsm_store_t *store,
+                               uint32_t instance,
+                               uint32_t exception_state)
+{
+    if (store == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    if (store->tag != FSM_STORE_TAG || instance >= store->capacity) {
+        return (RC_FSM_INVALID_HANDLE);
+    }
+
+    if (exception_state > store->fsm_class->number_states-1) {
+        return (RC_FSM_INVALID_STATE);
+    }
+
+    fsm_store_save_id(store->exception_states, store->state_width, 
+                      instance, exception_state);
+    store->flags[instance] |= FSM_STORE_EXCEPTION;
+    return (RC_FSM_OK);
+}
+
+
+/** 
+ * NAME
+ *    fsm_store_show_history
+ *
+ * SYNOPSIS 
+ *    #include "fsm_store.h' 
+ *    void
+ *    fsm_store_show_history(fsm_store_t *store, uint32_t instance)
+ *
+ * DESCRIPTION
+ *    Displays history of the state transitions of an instance. 
+ *
+ * INPUT PARAMETERS
+ *    store - store handle
+ *
+ *    instance - index of the instance
+ *
+ * OUTPUT PARAMETERS
+ *    none
+ *
+ * RETURN VALUE
+ *    none
+ * 
+ */
+void
+fsm_store_show_history (fsm_store_t *store, uint32_t instance)
+{
+    uint32_t i;
+    fsm_store_history_t *history_ptr;
+
+    state_description_t *p2state_description; 
+    event_description_t *p2event_description;
+
+    if (store == NULL) {
+        return;
+    }
+
+    if (store->tag != FSM_STORE_TAG || instance >= store->capacity) {
+        return;
+    }
+
+    p2state_description = store->fsm_class->state_description_table; 
+    p2event_description = store->fsm_class->event_description_table; 
+
+    printf("\nFSM: %s Instance %u History \n", 
+             store->fsm_class->fsm_name, instance);
+    printf("Current State  /   Event   /  New State  /  rc  \n");
+    printf("------------------------------------------------\n");
+
+    for (i=0; i<store->history_depth; i++) {
+
+        /*
+         * oldest record first, the one after the last written
+         */
+        history_ptr = &store->history[
+             ((size_t)instance * store->history_depth) + 
+             ((store->history_index[instance] + 1 + i) & 
+                                    (store->history_depth - 1))];
+
+        if (history_ptr->stateID == (uint16_t)FSM_NULL_STATE_ID) {
+            continue;
+        }
+
+        printf(" %u-%s  /  %u-%s  /  %u-%s  /  %u\n",
+             history_ptr->prevStateID,
+             p2state_description[history_ptr->prevStateID].description,
+             history_ptr->eventID, 
+             (history_ptr->eventID < store->fsm_class->number_events) ?
+                 p2event_description[history_ptr->eventID].description : 
+                 "Invalid Event",
+             history_ptr->stateID,
+             p2state_description[history_ptr->stateID].description,
+             history_ptr->handler_rc);
+    }
+
+    printf("\n");
+    return;
+}
+
+
+/*
+ * internal routine to dispatch an event to an instance, the 
+ * store and the instance index have already been validated
+ */
+static inline RC_FSM_t
+fsm_store_dispatch (fsm_store_t *store, 
+                    uint32_t instance,
+                    uint32_t normalized_event, 
+                    void *p2event_buffer, 
+                    void *p2parm)
+{
+    fsm_class_t        *fsm_class;
+    fsm_cell_t          cell;
+    event_cb_t          event_handler;
+    uint32_t            curr_state;
+    uint32_t            next_state;
+    RC_FSM_t            rc;
+    uint64_t            start;
+
+    /* time stamp for the trace, tracing is off when 0 */
+    start = 0;
+    if (fsm_trace_enabled) {
+        start = fsm_tsc();
+    }
+
+    fsm_class = store->fsm_class;
+    curr_state = fsm_store_load_id(store->states, 
+                                   store->state_width, 
+                                   instance);
+
+    if (normalized_event > fsm_class->number_events-1) {
+        fsm_store_record_history(store, instance, curr_state,
+                                 normalized_event, curr_state,
+                                 RC_FSM_INVALID_EVENT, start);
+        return (RC_FSM_INVALID_EVENT);
+    }
+
+    cell = fsm_class_lookup(fsm_class, curr_state, normalized_event);
+
+    event_handler = fsm_class->handler_table[cell.handler_index];
+    if (event_handler == NULL) {
+        fsm_store_record_history(store, instance, curr_state,
+                                 normalized_event, cell.next_state,
+                                 RC_FSM_INVALID_EVENT_HANDLER, start);
+        return (RC_FSM_OK);
+    }
+
+    rc = (*event_handler)(p2event_buffer, p2parm);
+
+    if (rc == RC_FSM_STOP_PROCESSING) {
+        if (start) {
+            fsm_trace_stop(fsm_trace_class_id(fsm_class), instance, 
+                           curr_state, normalized_event, start);
+        }
+        return (rc);
+    }
+
+    if (rc != RC_FSM_OK) {
+        fsm_store_record_history(store, instance, curr_state,
+                                 normalized_event, cell.next_state, rc, 
+                                 start);
+        return (rc);
+    }
+
+    if (store->flags[instance] & FSM_STORE_EXCEPTION) {
+        store->flags[instance] &= ~FSM_STORE_EXCEPTION;
+        next_state = fsm_store_load_id(store->exception_states, 
+                                       store->state_width, 
+                                       instance);
+    } else {
+        next_state = cell.next_state;
+    }
+
+    fsm_store_record_history(store, instance, curr_state,
+                             normalized_event, next_state, rc, start);
+
+    if (next_state != curr_state) {
+        if (store->population_flags) {
+            fsm_population_move(fsm_class, curr_state, next_state,
+                                store->entry_tsc ? 
+                                       &store->entry_tsc[instance] : NULL);
+        }
+        if (store->member_head) {
+            fsm_store_member_unlink(store, instance, curr_state);
+            fsm_store_member_link(store, instance, next_state);
+        }
+    }
+
+    fsm_store_save_id(store->states, store->state_width, 
+                      instance, next_state);
+    return (rc);
+}
+
+
+/** 
+ * NAME
+ *    fsm_store_engine
+ *
+ * SYNOPSIS
+ *    #include "fsm_store.h" 
+ *    RC_FSM_t
+ *    fsm_store_engine(fsm_store_t *store, 
+ *                     uint32_t instance,
+ *                     uint32_t normalized_event,  
+ *                     void *p2event_buffer, 
+ *                     void *p2parm)
+ *
+ * DESCRIPTION
+ *    Drives an instance of the store with a normalized event.
+ *    The processing is that of fsm_engine.
+ *
+ * INPUT PARAMETERS
+ *    store            store handle
+ *
+ *    instance         index of the instance
+ *
+ *    normalized_event the event id to process 
+ *
+ *    *p2event         pointer to the raw event which
+ *                     is driving the event. This is 
+ *                     passed through to the handler.  
+ *
+ *    *p2parm          pointer parameter that is simply
+ *                     passed through to each event
+ *                     handler.
+ *
+ * OUTPUT PARAMETERS
+ *    none 
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_store_engine (fsm_store_t *store, 
+                  uint32_t instance,
+                  uint32_t normalized_event, 
+                  void *p2event_buffer, 
+                  void *p2parm)
+{
+    if (store == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    if (store->tag != FSM_STORE_TAG || instance >= store->capacity) {
+        return (RC_FSM_INVALID_HANDLE);
+    }
+
+    return (fsm_store_dispatch(store, 
+                               instance, 
+                               normalized_event, 
+                               p2event_buffer, 
+                               p2parm));
+}
+
+
+/** 
+ * NAME
+ *    fsm_engine_batch
+ *
+ * SYNOPSIS
+ *    #include "fsm_store.h" 
+ *    RC_FSM_t
+ *    fsm_engine_batch(fsm_store_t *store, 
+ *                     fsm_batch_entry_t *batch,
+ *                     uint32_t count,
+ *                     RC_FSM_t *rc_out)
+ *
+ * DESCRIPTION
+ *    Drives a batch of events across instances of the store in
+ *    one call.  The entries are processed in order, exactly as 
+ *    if fsm_store_engine had been called for each.  While an
+ *    entry is processed, the instance state of the entry 
+ *    FSM_BATCH_PREFETCH ahead and the transition row of the 
+ *    entry half as far ahead are prefetched, so the cache misses
+ *    overlap with the handlers rather than stall the dispatch.
+ *
+ * INPUT PARAMETERS
+ *    store            store handle
+ *
+ *    batch            array of count entries, each holding the 
+ *                     instance index, the normalized event and 
+ *                     the pointers passed through to the handler
+ *
+ *    count            number of entries
+ *
+ * OUTPUT PARAMETERS
+ *    rc_out           array of count return codes, one per entry,
+ *                     as fsm_store_engine would have returned
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK        the batch was processed, see rc_out
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_engine_batch (fsm_store_t *store, 
+                  fsm_batch_entry_t *batch,
+                  uint32_t count,
+                  RC_FSM_t *rc_out)
+{
+    fsm_class_t        *fsm_class;
+    fsm_batch_entry_t  *entry_ptr;
+    uint32_t            state;
+    uint32_t            i;
+
+    if (store == NULL || batch == NULL || rc_out == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    if (store->tag != FSM_STORE_TAG) {
+        return (RC_FSM_INVALID_HANDLE);
+    }
+
+    fsm_class = store->fsm_class;
+
+    /*
+     * prime the pipeline with the instance states of the 
+     * first entries 
+     */
+    for (i=0; i<count && i<FSM_BATCH_PREFETCH; i++) {
+        if (batch[i].instance < store->capacity) {
+            FSM_PREFETCH((uint8_t *)store->states + 
+                         ((size_t)batch[i].instance * store->state_width));
+        }
+    }
+
+    for (i=0; i<count; i++) {
+
+        /*
+         * the instance state for a later entry 
+         */
+        if (i + FSM_BATCH_PREFETCH < count) {
+            entry_ptr = &batch[i + FSM_BATCH_PREFETCH];
+            if (entry_ptr->instance < store->capacity) {
+                FSM_PREFETCH((uint8_t *)store->states + 
+                             ((size_t)entry_ptr->instance * 
+                                                 store->state_width));
+            }
+        }
+
+        /*
+         * and the transition cell for a nearer one, its state 
+         * was prefetched on an earlier iteration 
+         */
+        if (i + (FSM_BATCH_PREFETCH/2) < count) {
+            entry_ptr = &batch[i + (FSM_BATCH_PREFETCH/2)];
+            if (entry_ptr->instance < store->capacity &&
+                entry_ptr->normalized_event < fsm_class->number_events) {
+                state = fsm_store_load_id(store->states, 
+                                          store->state_width,
+                                          entry_ptr->instance);
+                FSM_PREFETCH(fsm_class_cell(fsm_class, state, 
+                                        entry_ptr->normalized_event));
+            }
+        }
+
+        entry_ptr = &batch[i];
+        if (entry_ptr->instance >= store->capacity) {
+            rc_out[i] = RC_FSM_INVALID_HANDLE;
+            continue;
+        }
+
+        rc_out[i] = fsm_store_dispatch(store, 
+                                       entry_ptr->instance, 
+                                       entry_ptr->normalized_event, 
+                                       entry_ptr->p2event_buffer, 
+                                       entry_ptr->p2parm);
+    }
+    return (RC_FSM_OK);
+}
+
+
+/*
+ * qsort comparator of the grouped batch sort keys
+ */
+static int
+fsm_batch_key_compare (const void *a, const void *b)
+{
+    uint64_t key_a = *(const uint64_t *)a;
+    uint64_t key_b = *(const uint64_t *)b;
+
+    if (key_a < key_b) {
+        return (-1);
+    }
+    return (key_a > key_b);
+}
+
+
+/*
+ * internal routine to run one chunk of a grouped batch, at most
+ * FSM_BATCH_GROUP_MAX entries
+ */
+static void
+fsm_batch_group_chunk (fsm_store_t *store,
+                       fsm_batch_entry_t *batch,
+                       uint32_t count,
+                       RC_FSM_t *rc_out,
+                       fsm_batch_stats_t *stats)
+{
+    uint64_t   keys[FSM_BATCH_GROUP_MAX];
+    uint16_t   by_wave[FSM_BATCH_GROUP_MAX];
+    uint16_t   wave_start[FSM_BATCH_GROUP_MAX + 1];
+    uint8_t    wave[FSM_BATCH_GROUP_MAX];
+    uint32_t   number_waves;
+    uint32_t   executed;
+    uint32_t   state;
+    uint32_t   event;
+    uint32_t   pos;
+    uint32_t   prev_cell;
+    uint32_t   w;
+    uint32_t   i;
+    uint32_t   n;
+
+    /*
+     * Number each entry with its occurrence among the entries of
+     * the same instance.  Sorting by (instance, position) lines
+     * them up, the k-th entry of an instance goes in wave k.  A
+     * wave holds at most one entry per instance, so it can be 
+     * freely reordered, and running the waves in turn keeps the
+     * event order of every instance.
+     */
+    for (i=0; i<count; i++) {
+        keys[i] = ((uint64_t)batch[i].instance << 16) | i;
+    }
+    qsort(keys, count, sizeof(uint64_t), fsm_batch_key_compare);
+
+    number_waves = 0;
+    for (i=0; i<count; i++) {
+        pos = (uint32_t)(keys[i] & 0xffff);
+        if (i > 0 && (keys[i] >> 16) == (keys[i-1] >> 16)) {
+            w = wave[(uint32_t)(keys[i-1] & 0xffff)] + 1;
+        } else {
+            w = 0;
+        }
+        wave[pos] = (uint8_t)w;
+        if (w + 1 > number_waves) {
+            number_waves = w + 1;
+        }
+    }
+
+    /*
+     * bucket the positions by wave, in submission order
+     */
+    memset(wave_start, 0, sizeof(wave_start));
+    for (i=0; i<count; i++) {
+        wave_start[wave[i] + 1]++;
+    }
+    for (w=0; w<number_waves; w++) {
+        wave_start[w + 1] += wave_start[w];
+    }
+    for (i=0; i<count; i++) {
+        by_wave[wave_start[wave[i]]++] = (uint16_t)i;
+    }
+    for (w=number_waves; w>0; w--) {
+        wave_start[w] = wave_start[w-1];
+    }
+    wave_start[0] = 0;
+
+    executed = 0;
+    for (w=0; w<number_waves; w++) {
+
+        /*
+         * sort the wave by the (state, event) cell of each entry,
+         * the states are current as the wave starts
+         */
+        n = 0;
+        for (i=wave_start[w]; i<wave_start[w+1]; i++) {
+            pos = by_wave[i];
+            if (batch[pos].instance < store->capacity) {
+                state = fsm_store_load_id(store->states, 
+                                          store->state_width,
+                                          batch[pos].instance);
+            } else {
+                state = 0xffff;
+            }
+            event = batch[pos].normalized_event;
+            if (event > 0xffff) {
+                event = 0xffff;
+            }
+            keys[n++] = ((uint64_t)state << 32) | 
+                        ((uint64_t)event << 16) | pos;
+        }
+        qsort(keys, n, sizeof(uint64_t), fsm_batch_key_compare);
+
+        prev_cell = 0xffffffff;
+        for (i=0; i<n; i++) {
+            pos = (uint32_t)(keys[i] & 0xffff);
+
+            if ((uint32_t)(keys[i] >> 16) != prev_cell) {
+                prev_cell = (uint32_t)(keys[i] >> 16);
+                stats->groups++;
+            }
+            if (pos != executed) {
+                stats->reordered++;
+            }
+            executed++;
+
+            if (batch[pos].instance >= store->capacity) {
+                rc_out[pos] = RC_FSM_INVALID_HANDLE;
+                continue;
+            }
+
+            rc_out[pos] = fsm_store_dispatch(store, 
+                                             batch[pos].instance, 
+                                             batch[pos].normalized_event, 
+                                             batch[pos].p2event_buffer, 
+                                             batch[pos].p2parm);
+        }
+    }
+
+    stats->entries += count;
+    stats->waves += number_waves;
+    return;
+}
+
+
+/** 
+ * NAME
+ *    fsm_engine_batch_grouped
+ *
+ * SYNOPSIS
+ *    #include "fsm_store.h" 
+ *    RC_FSM_t
+ *    fsm_engine_batch_grouped(fsm_store_t *store, 
+ *                             fsm_batch_entry_t *batch,
+ *                             uint32_t count,
+ *                             RC_FSM_t *rc_out,
+ *                             fsm_batch_stats_t *stats)
+ *
+ * DESCRIPTION
+ *    Drives a batch of events across instances of the store,
+ *    reordered by (current state, event) so that the entries 
+ *    that run the same handler are dispatched back to back.  
+ *    The events of each instance are still processed in the 
+ *    order submitted.  The batch is sorted in chunks of 
+ *    FSM_BATCH_GROUP_MAX entries, the chunks run in order.
+ *
+ *    The sort is not free.  Compare the stats with the plain
+ *    in-order fsm_engine_batch to judge whether it pays off for
+ *    a given traffic mix.
+ *
+ * INPUT PARAMETERS
+ *    store            store handle
+ *
+ *    batch            array of count entries
+ *
+ *    count            number of entries
+ *
+ * OUTPUT PARAMETERS
+ *    rc_out           array of count return codes, one per entry
+ *                     at the position of the entry
+ *
+ *    stats            reordering report, may be NULL
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK        the batch was processed, see rc_out
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_engine_batch_grouped (fsm_store_t *store, 
+                          fsm_batch_entry_t *batch,
+                          uint32_t count,
+                          RC_FSM_t *rc_out,
+                          fsm_batch_stats_t *stats)
+{
+    fsm_batch_stats_t  local_stats;
+    uint32_t           chunk;
+    uint32_t           i;
+
+    if (store == NULL || batch == NULL || rc_out == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    if (store->tag != FSM_STORE_TAG) {
+        return (RC_FSM_INVALID_HANDLE);
+    }
+
+    if (stats == NULL) {
+        stats = &local_stats;
+    }
+    memset(stats, 0, sizeof(fsm_batch_stats_t));
+
+    for (i=0; i<count; i+=chunk) {
+        chunk = count - i;
+        if (chunk > FSM_BATCH_GROUP_MAX) {
+            chunk = FSM_BATCH_GROUP_MAX;
+        }
+        fsm_batch_group_chunk(store, &batch[i], chunk, &rc_out[i], stats);
+    }
+    return (RC_FSM_OK);
+}
+
+
+/** 
+ * NAME
+ *    fsm_store_index_states
+ *
+ * SYNOPSIS
+ *    #include "fsm_store.h" 
+ *    RC_FSM_t
+ *    fsm_store_index_states(fsm_store_t *store)
+ *
+ * DESCRIPTION
+ *    Builds an index of the instances of the store by current 
+ *    state, one list per state linked through side arrays, 8 
+ *    bytes per instance.  From then on the store engines keep
+ *    the index up to date in O(1) on each transition to another
+ *    state and on fsm_store_instance_init, so that fsm_broadcast
+ *    and fsm_store_get_members cost O(members of the state) 
+ *    rather than O(capacity).  Building the index is a single 
+ *    pass over the store, a second call does nothing.
+ *
+ * INPUT PARAMETERS
+ *    store            store handle
+ *
+ * OUTPUT PARAMETERS
+ *    none
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_store_index_states (fsm_store_t *store)
+{
+    uint32_t number_states;
+    uint32_t i;
+
+    if (store == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    if (store->tag != FSM_STORE_TAG) {
+        return (RC_FSM_INVALID_HANDLE);
+    }
+
+    if (store->member_head) {
+        return (RC_FSM_OK);
+    }
+
+    number_states = store->fsm_class->number_states;
+    store->member_count = (uint32_t *)calloc(number_states, 
+                                             sizeof(uint32_t));
+    store->member_next = (uint32_t *)malloc((size_t)store->capacity * 
+                                            sizeof(uint32_t));
+    store->member_prev = (uint32_t *)malloc((size_t)store->capacity * 
+                                            sizeof(uint32_t));
+    store->member_head = (uint32_t *)malloc(number_states * 
+                                            sizeof(uint32_t));
+    if (store->member_count == NULL || 
+        store->member_next == NULL ||
+        store->member_prev == NULL ||
+        store->member_head == NULL) {
+        free(store->member_count);
+        free(store->member_next);
+        free(store->member_prev);
+        free(store->member_head);
+        store->member_count = NULL;
+        store->member_next = NULL;
+        store->member_prev = NULL;
+        store->member_head = NULL;
+        return (RC_FSM_NO_RESOURCES);
+    }
+
+    for (i=0; i<number_states; i++) {
+        store->member_head[i] = FSM_STORE_NO_MEMBER;
+    }
+
+    /* backwards so that each list runs in instance order */
+    for (i=store->capacity; i>0; i--) {
+        fsm_store_member_link(store, i-1, 
+                              fsm_store_load_id(store->states, 
+                                                store->state_width, 
+                                                i-1));
+    }
+    return (RC_FSM_OK);
+}
+
+
+/** 
+ * NAME
+ *    fsm_store_get_members
+ *
+ * SYNOPSIS
+ *    #include "fsm_store.h" 
+ *    RC_FSM_t
+ *    fsm_store_get_members(fsm_store_t *store,
+ *                          uint32_t state,
+ *                          uint32_t *p2count)
+ *
+ * DESCRIPTION
+ *    Returns the number of instances of the store in a state, in
+ *    O(1).  The store must be indexed, see fsm_store_index_states.
+ *
+ * INPUT PARAMETERS
+ *    store            store handle
+ *
+ *    state            normalized state
+ *
+ * OUTPUT PARAMETERS
+ *    p2count          instances in the state
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_store_get_members (fsm_store_t *store,
+                       uint32_t state,
+                       uint32_t *p2count)
+{
+    if (store == NULL || p2count == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    if (store->tag != FSM_STORE_TAG || store->member_head == NULL) {
+        return (RC_FSM_INVALID_HANDLE);
+    }
+
+    if (state > store->fsm_class->number_states-1) {
+        return (RC_FSM_INVALID_STATE);
+    }
+
+    *p2count = store->member_count[state];
+    return (RC_FSM_OK);
+}
+
+
+/** 
+ * NAME
+ *    fsm_broadcast
+ *
+ * SYNOPSIS
+ *    #include "fsm_store.h" 
+ *    RC_FSM_t
+ *    fsm_broadcast(fsm_store_t *store,
+ *                  uint32_t state,
+ *                  uint32_t normalized_event,
+ *                  void *p2event_buffer,
+ *                  void **p2parms,
+ *                  uint32_t *p2count,
+ *                  uint32_t *p2failed)
+ *
+ * DESCRIPTION
+ *    Sends an event to every instance of the store that is in a
+ *    state, such as a terminate event to all the established 
+ *    sessions on shutdown.  The members are taken from the state
+ *    index, see fsm_store_index_states, when the call starts and
+ *    driven through fsm_engine_batch in chunks of 
+ *    FSM_BATCH_GROUP_MAX entries, so the cost is O(members) 
+ *    whatever the capacity of the store.  Instances that enter 
+ *    the state during the broadcast do not get the event.
+ *
+ *    Every member gets the same p2event_buffer, and its own 
+ *    entry of p2parms as p2parm, typically the per-session 
+ *    context the application keeps alongside the store.
+ *
+ * INPUT PARAMETERS
+ *    store              store handle
+ *
+ *    state              normalized state of the members
+ *
+ *    normalized_event   event to send
+ *
+ *    p2event_buffer     passed to each event handler
+ *
+ *    p2parms            array indexed by instance, p2parms[i]
+ *                       is passed to the handler of instance i.
+ *                       NULL to pass NULL to every handler.
+ *
+ * OUTPUT PARAMETERS
+ *    p2count            instances the event was sent to, may be
+ *                       NULL
+ *
+ *    p2failed           instances whose handler did not return
+ *                       RC_FSM_OK, may be NULL
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK          the event was sent to all members
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_broadcast (fsm_store_t *store,
+               uint32_t state,
+               uint32_t normalized_event,
+               void *p2event_buffer,
+               void **p2parms,
+               uint32_t *p2count,
+               uint32_t *p2failed)
+{
+    fsm_batch_entry_t batch[FSM_BATCH_GROUP_MAX];
+    RC_FSM_t rc_out[FSM_BATCH_GROUP_MAX];
+    uint32_t *members;
+    uint32_t count;
+    uint32_t failed;
+    uint32_t member;
+    uint32_t chunk;
+    uint32_t i;
+    uint32_t j;
+
+    if (store == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    if (store->tag != FSM_STORE_TAG || store->member_head == NULL) {
+        return (RC_FSM_INVALID_HANDLE);
+    }
+
+    if (state > store->fsm_class->number_states-1) {
+        return (RC_FSM_INVALID_STATE);
+    }
+
+    if (normalized_event > store->fsm_class->number_events-1) {
+        return (RC_FSM_INVALID_EVENT);
+    }
+
+    /*
+     * the members at the start, the lists change as they are
+     * dispatched
+     */
+    count = store->member_count[state];
+    failed = 0;
+    members = NULL;
+    if (count) {
+        members = (uint32_t *)malloc(count * sizeof(uint32_t));
+        if (members == NULL) {
+            return (RC_FSM_NO_RESOURCES);
+        }
+    }
+
+    member = store->member_head[state];
+    for (i=0; i<count; i++) {
+        members[i] = member;
+        member = store->member_next[member];
+    }
+
+    for (i=0; i<count; i+=chunk) {
+        chunk = count - i;
+        if (chunk > FSM_BATCH_GROUP_MAX) {
+            chunk = FSM_BATCH_GROUP_MAX;
+        }
+
+        for (j=0; j<chunk; j++) {
+            batch[j].instance = members[i + j];
+            batch[j].normalized_event = normalized_event;
+            batch[j].p2event_buffer = p2event_buffer;
+            batch[j].p2parm = p2parms ? p2parms[members[i + j]] : NULL;
+        }
+
+        fsm_engine_batch(store, batch, chunk, rc_out);
+
+        for (j=0; j<chunk; j++) {
+            if (rc_out[j] != RC_FSM_OK) {
+                failed++;
+            }
+        }
+    }
+    free(members);
+
+    if (p2count) {
+        *p2count = count;
+    }
+    if (p2failed) {
+        *p2failed = failed;
+    }
+    return (RC_FSM_OK);
+}
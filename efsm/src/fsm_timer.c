@@ -0,0 +1,877 @@
+/*------------------------------------------------------------------
+ * fsm_timer.c -- Finite State Machine timing wheel
+ *
+ * Copyright (c) 2005-2009 by Cisco Systems, Inc.
+ * All rights reserved. 
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *------------------------------------------------------------------
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fsm.h"
+#include "fsm_store.h"
+#include "fsm_timer.h"
+#include "fsm_private.h"
+
+
+#define FSM_TIMER_SLOT_MASK   ( FSM_TIMER_SLOTS - 1 )
+
+/* last tick, a timer clamped to it never expires */
+#define FSM_TIMER_NEVER       ( (uint64_t)-1 )
+
+
+
+/*
+ * internal list routines
+ */
+static inline void
+fsm_timer_list_init (fsm_timer_link_t *head)
+{
+    head->next = head;
+    head->prev = head;
+}
+
+static inline void
+fsm_timer_list_append (fsm_timer_link_t *head, fsm_timer_link_t *link)
+{
+    link->next = head;
+    link->prev = head->prev;
+    head->prev->next = link;
+    head->prev = link;
+}
+
+static inline void
+fsm_timer_list_unlink (fsm_timer_link_t *link)
+{
+    link->prev->next = link->next;
+    link->next->prev = link->prev;
+    link->next = NULL;
+    link->prev = NULL;
+}
+
+/* moves all of src to the tail of dst */
+static inline void
+fsm_timer_list_splice (fsm_timer_link_t *dst, fsm_timer_link_t *src)
+{
+    if (src->next == src) {
+        return;
+    }
+    src->next->prev = dst->prev;
+    dst->prev->next = src->next;
+    src->prev->next = dst;
+    dst->prev = src->prev;
+    fsm_timer_list_init(src);
+}
+
+
+/*
+ * internal routine to file an armed timer in the slot that
+ * matches its distance from now.  A timer that is already due 
+ * goes straight to the expired list.
+ */
+static void
+fsm_timer_file (fsm_timer_wheel_t *wheel, fsm_timer_t *timer)
+{
+    uint64_t expires = timer->expires;
+    uint64_t delta;
+    uint32_t level;
+    uint32_t slot;
+
+    if (expires <= wheel->now) {
+        timer->level = FSM_TIMER_LEVELS;
+        fsm_timer_list_append(&wheel->expired, &timer->link);
+        return;
+    }
+
+    delta = expires - wheel->now;
+    for (level=0; level<FSM_TIMER_LEVELS; level++) {
+        if (delta < ((uint64_t)1 << (FSM_TIMER_SLOT_BITS * (level + 1)))) {
+            break;
+        }
+    }
+
+    if (level == FSM_TIMER_LEVELS) {
+        /* beyond the wheel, park it in the farthest slot */
+        level = FSM_TIMER_LEVELS - 1;
+        slot = (uint32_t)((wheel->now >> (FSM_TIMER_SLOT_BITS * level)) + 
+                          FSM_TIMER_SLOT_MASK) & FSM_TIMER_SLOT_MASK;
+    } else {
+        slot = (uint32_t)(expires >> (FSM_TIMER_SLOT_BITS * level)) & 
+                                                  FSM_TIMER_SLOT_MASK;
+    }
+
+    timer->level = level;
+    wheel->level_count[level]++;
+    fsm_timer_list_append(&wheel->slots[level][slot], &timer->link);
+    return;
+}
+
+
+/*
+ * internal routine to take a timer off the wheel
+ */
+static void
+fsm_timer_remove (fsm_timer_wheel_t *wheel, fsm_timer_t *timer)
+{
+    if (timer->level < FSM_TIMER_LEVELS) {
+        wheel->level_count[timer->level]--;
+    }
+    fsm_timer_list_unlink(&timer->link);
+    return;
+}
+
+
+/*
+ * internal routine to move a due level 0 slot to the expired list
+ */
+static void
+fsm_timer_expire_slot (fsm_timer_wheel_t *wheel, fsm_timer_link_t *head)
+{
+    fsm_timer_link_t *link;
+
+    for (link=head->next; link!=head; link=link->next) {
+        ((fsm_timer_t *)link)->level = FSM_TIMER_LEVELS;
+        wheel->level_count[0]--;
+    }
+    fsm_timer_list_splice(&wheel->expired, head);
+    return;
+}
+
+
+/*
+ * internal routine to move time forward a tick at a time, 
+ * cascading the upper levels down as their slots come due and
+ * collecting the due timers on the expired list
+ */
+static void
+fsm_timer_tick_to (fsm_timer_wheel_t *wheel, uint64_t now)
+{
+    fsm_timer_link_t cascade;
+    fsm_timer_link_t *link;
+    uint64_t boundary;
+    uint32_t level;
+    uint32_t top;
+    uint32_t slot;
+
+    while (wheel->now < now) {
+
+        /*
+         * Skip the ticks up to the next wrap of the lowest level 
+         * that has timers, nothing can come due before then.
+         */
+        for (level=0; level<FSM_TIMER_LEVELS; level++) {
+            if (wheel->level_count[level]) {
+                break;
+            }
+        }
+        if (level == FSM_TIMER_LEVELS) {
+            wheel->now = now;
+            break;
+        }
+        if (level > 0) {
+            boundary = ((wheel->now >> (FSM_TIMER_SLOT_BITS * level)) + 1) <<
+                                            (FSM_TIMER_SLOT_BITS * level);
+            if (boundary > now) {
+                wheel->now = now;
+                break;
+            }
+            wheel->now = boundary - 1;
+        }
+
+        wheel->now++;
+
+        /*
+         * on a level 0 wrap, re-file the due slot of each upper 
+         * level whose lower bits have all wrapped, highest first
+         */
+        if ((wheel->now & FSM_TIMER_SLOT_MASK) == 0) {
+            top = 1;
+            while (top < FSM_TIMER_LEVELS - 1 &&
+                   ((wheel->now >> (FSM_TIMER_SLOT_BITS * top)) & 
+                                         FSM_TIMER_SLOT_MASK) == 0) {
+                top++;
+            }
+
+            for (level=top; level>0; level--) {
+                slot = (uint32_t)(wheel->now >> 
+                                  (FSM_TIMER_SLOT_BITS * level)) & 
+                                                   FSM_TIMER_SLOT_MASK;
+                fsm_timer_list_init(&cascade);
+                fsm_timer_list_splice(&cascade, &wheel->slots[level][slot]);
+                while (cascade.next != &cascade) {
+                    link = cascade.next;
+                    fsm_timer_remove(wheel, (fsm_timer_t *)link);
+                    fsm_timer_file(wheel, (fsm_timer_t *)link);
+                }
+            }
+        }
+
+        fsm_timer_expire_slot(wheel, 
+                  &wheel->slots[0][wheel->now & FSM_TIMER_SLOT_MASK]);
+    }
+    return;
+}
+
+
+/** 
+ * NAME
+ *    fsm_timer_wheel_create
+ *
+ * SYNOPSIS
+ *    #include "fsm_timer.h" 
+ *    RC_FSM_t
+ *    fsm_timer_wheel_create(fsm_timer_wheel_t **wheel, uint64_t now)
+ *
+ * DESCRIPTION
+ *    Creates a timing wheel.  The unit of a tick is up to the
+ *    user, time only moves with fsm_timer_advance.
+ *
+ * INPUT PARAMETERS
+ *    wheel              pointer to wheel handle to be returned
+ *                       once created
+ *
+ *    now                starting time in ticks
+ *
+ * OUTPUT PARAMETERS
+ *     none   
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_timer_wheel_create (fsm_timer_wheel_t **wheel, uint64_t now)
+{
+    fsm_timer_wheel_t *temp_wheel;
+    uint32_t level;
+    uint32_t slot;
+
+    if (wheel == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    temp_wheel = (fsm_timer_wheel_t *)malloc(sizeof(fsm_timer_wheel_t));
+    if (temp_wheel == NULL) {
+        return (RC_FSM_NO_RESOURCES);
+    }
+
+    temp_wheel->tag = FSM_TIMER_WHEEL_TAG;
+    temp_wheel->armed = 0;
+    temp_wheel->attached = 0;
+    temp_wheel->now = now;
+    memset(temp_wheel->level_count, 0, sizeof(temp_wheel->level_count));
+    fsm_timer_list_init(&temp_wheel->expired);
+    for (level=0; level<FSM_TIMER_LEVELS; level++) {
+        for (slot=0; slot<FSM_TIMER_SLOTS; slot++) {
+            fsm_timer_list_init(&temp_wheel->slots[level][slot]);
+        }
+    }
+
+    /* return handle to the user */
+    *wheel = temp_wheel;
+    return (RC_FSM_OK);
+}
+
+
+/** 
+ * NAME
+ *    fsm_timer_wheel_destroy
+ *
+ * SYNOPSIS
+ *    #include "fsm_timer.h" 
+ *    RC_FSM_t
+ *    fsm_timer_wheel_destroy(fsm_timer_wheel_t **wheel)
+ * 
+ * DESCRIPTION
+ *    Destroys the specified timing wheel.  The wheel is refused 
+ *    while a timer is armed or a state machine is attached, as 
+ *    they would be left pointing at it.  Stop the timers and 
+ *    call fsm_timer_detach first.
+ *
+ * INPUT PARAMETERS
+ *    wheel - pointer to wheel handle
+ *
+ * OUTPUT PARAMETERS
+ *    wheel - is nulled
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    RC_FSM_INVALID_ARGUMENT when timers are armed or state 
+ *         machines attached, the wheel is kept
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_timer_wheel_destroy (fsm_timer_wheel_t **wheel)
+{
+    fsm_timer_wheel_t *p2wheel;
+
+    if (wheel == NULL || *wheel == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    p2wheel = *wheel;
+    if (p2wheel->tag != FSM_TIMER_WHEEL_TAG) {
+        return (RC_FSM_INVALID_HANDLE);
+    }
+
+    if (p2wheel->armed || p2wheel->attached) {
+        return (RC_FSM_INVALID_ARGUMENT);
+    }
+
+    p2wheel->tag = 0;
+    *wheel = NULL;
+    free(p2wheel);
+    return (RC_FSM_OK);
+}
+
+
+/** 
+ * NAME
+ *    fsm_timer_init
+ *
+ * SYNOPSIS
+ *    #include "fsm_timer.h" 
+ *    void
+ *    fsm_timer_init(fsm_timer_t *timer,
+ *                   void *p2event_buffer,
+ *                   void *p2parm)
+ *
+ * DESCRIPTION
+ *    Initializes a timer, not armed.  The pointers are passed 
+ *    through to the event handler on each expiry.
+ *
+ * INPUT PARAMETERS
+ *    timer            timer to initialize
+ *
+ *    *p2event_buffer  passed through to the handler
+ *
+ *    *p2parm          passed through to the handler
+ *
+ * OUTPUT PARAMETERS
+ *     none   
+ *
+ * RETURN VALUE
+ *     none   
+ * 
+ */
+void
+fsm_timer_init (fsm_timer_t *timer,
+                void *p2event_buffer,
+                void *p2parm)
+{
+    if (timer == NULL) {
+        return;
+    }
+
+    memset(timer, 0, sizeof(fsm_timer_t));
+    timer->p2event_buffer = p2event_buffer;
+    timer->p2parm = p2parm;
+    return;
+}
+
+
+/** 
+ * NAME
+ *    fsm_timer_stop
+ *
+ * SYNOPSIS
+ *    #include "fsm_timer.h" 
+ *    RC_FSM_t
+ *    fsm_timer_stop(fsm_timer_wheel_t *wheel, fsm_timer_t *timer)
+ *
+ * DESCRIPTION
+ *    Cancels a timer in O(1).  Stopping a timer that is not 
+ *    armed, or that has expired and not yet been delivered, is
+ *    fine, the latter is then not delivered.
+ *
+ * INPUT PARAMETERS
+ *    wheel            wheel handle
+ *
+ *    timer            timer to cancel
+ *
+ * OUTPUT PARAMETERS
+ *     none   
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_timer_stop (fsm_timer_wheel_t *wheel, fsm_timer_t *timer)
+{
+    if (wheel == NULL || timer == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    if (wheel->tag != FSM_TIMER_WHEEL_TAG) {
+        return (RC_FSM_INVALID_HANDLE);
+    }
+
+    if (fsm_timer_armed(timer)) {
+        fsm_timer_remove(wheel, timer);
+        wheel->armed--;
+    }
+    return (RC_FSM_OK);
+}
+
+
+/*
+ * internal routine to (re)arm a timer whose target has been set
+ */
+static void
+fsm_timer_arm (fsm_timer_wheel_t *wheel, 
+               fsm_timer_t *timer, 
+               uint32_t normalized_event,
+               uint64_t delay)
+{
+    if (fsm_timer_armed(timer)) {
+        fsm_timer_remove(wheel, timer);
+        wheel->armed--;
+    }
+
+    /* a delay of 0 expires on the next tick */
+    if (delay == 0) {
+        delay = 1;
+    }
+
+    /* a delay past the last tick would wrap, clamp it instead */
+    if (delay > FSM_TIMER_NEVER - wheel->now) {
+        delay = FSM_TIMER_NEVER - wheel->now;
+    }
+
+    timer->normalized_event = normalized_event;
+    timer->expires = wheel->now + delay;
+    fsm_timer_file(wheel, timer);
+    wheel->armed++;
+    return;
+}
+
+
+/** 
+ * NAME
+ *    fsm_timer_start
+ *
+ * SYNOPSIS
+ *    #include "fsm_timer.h" 
+ *    RC_FSM_t
+ *    fsm_timer_start(fsm_timer_wheel_t *wheel,
+ *                    fsm_timer_t *timer,
+ *                    fsm_t *fsm,
+ *                    uint32_t normalized_event,
+ *                    uint64_t delay)
+ *
+ * DESCRIPTION
+ *    Arms a timer in O(1) to deliver a normalized event to a 
+ *    state machine delay ticks from now.  A timer that is 
+ *    already armed is restarted.
+ *
+ * INPUT PARAMETERS
+ *    wheel            wheel handle
+ *
+ *    timer            initialized timer
+ *
+ *    fsm              state machine the event is delivered to
+ *
+ *    normalized_event the event id delivered on expiry
+ *
+ *    delay            ticks from now, at least 1, a delay past
+ *                     the last tick is clamped to it
+ *
+ * OUTPUT PARAMETERS
+ *     none   
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_timer_start (fsm_timer_wheel_t *wheel,
+                 fsm_timer_t *timer,
+                 fsm_t *fsm,
+                 uint32_t normalized_event,
+                 uint64_t delay)
+{
+    if (wheel == NULL || timer == NULL || fsm == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    if (wheel->tag != FSM_TIMER_WHEEL_TAG) {
+        return (RC_FSM_INVALID_HANDLE);
+    }
+
+    timer->fsm = fsm;
+    timer->instance = 0;
+    fsm_timer_arm(wheel, timer, normalized_event, delay);
+    return (RC_FSM_OK);
+}
+
+
+/** 
+ * NAME
+ *    fsm_timer_start_instance
+ *
+ * SYNOPSIS
+ *    #include "fsm_timer.h" 
+ *    RC_FSM_t
+ *    fsm_timer_start_instance(fsm_timer_wheel_t *wheel,
+ *                             fsm_timer_t *timer,
+ *                             uint32_t instance,
+ *                             uint32_t normalized_event,
+ *                             uint64_t delay)
+ *
+ * DESCRIPTION
+ *    Arms a timer in O(1) to deliver a normalized event to an
+ *    instance of a store delay ticks from now, see 
+ *    fsm_timer_advance_batch.  A timer that is already armed is
+ *    restarted.
+ *
+ * INPUT PARAMETERS
+ *    wheel            wheel handle
+ *
+ *    timer            initialized timer
+ *
+ *    instance         index of the store instance
+ *
+ *    normalized_event the event id delivered on expiry
+ *
+ *    delay            ticks from now, at least 1, a delay past
+ *                     the last tick is clamped to it
+ *
+ * OUTPUT PARAMETERS
+ *     none   
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_timer_start_instance (fsm_timer_wheel_t *wheel,
+                          fsm_timer_t *timer,
+                          uint32_t instance,
+                          uint32_t normalized_event,
+                          uint64_t delay)
+{
+    if (wheel == NULL || timer == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    if (wheel->tag != FSM_TIMER_WHEEL_TAG) {
+        return (RC_FSM_INVALID_HANDLE);
+    }
+
+    timer->fsm = NULL;
+    timer->instance = instance;
+    fsm_timer_arm(wheel, timer, normalized_event, delay);
+    return (RC_FSM_OK);
+}
+
+
+/** 
+ * NAME
+ *    fsm_timer_advance
+ *
+ * SYNOPSIS
+ *    #include "fsm_timer.h" 
+ *    RC_FSM_t
+ *    fsm_timer_advance(fsm_timer_wheel_t *wheel, uint64_t now)
+ *
+ * DESCRIPTION
+ *    Moves the wheel time forward to now and delivers the event
+ *    of each expired fsm_t timer with fsm_engine, in expiry 
+ *    order.  A handler may start and stop timers, including the
+ *    one that expired.  Expired store instance timers are kept
+ *    for fsm_timer_advance_batch.
+ *
+ * INPUT PARAMETERS
+ *    wheel            wheel handle
+ *
+ *    now              new time in ticks, earlier times are 
+ *                     ignored
+ *
+ * OUTPUT PARAMETERS
+ *     none   
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_timer_advance (fsm_timer_wheel_t *wheel, uint64_t now)
+{
+    fsm_timer_link_t pending;
+    fsm_timer_t *timer;
+
+    if (wheel == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    if (wheel->tag != FSM_TIMER_WHEEL_TAG) {
+        return (RC_FSM_INVALID_HANDLE);
+    }
+
+    fsm_timer_tick_to(wheel, now);
+
+    /*
+     * Work from a private list, the handlers may start and stop
+     * timers.  Instance timers go back on the expired list.
+     */
+    fsm_timer_list_init(&pending);
+    fsm_timer_list_splice(&pending, &wheel->expired);
+
+    while (pending.next != &pending) {
+        timer = (fsm_timer_t *)pending.next;
+        fsm_timer_list_unlink(&timer->link);
+
+        if (timer->fsm == NULL) {
+            fsm_timer_list_append(&wheel->expired, &timer->link);
+            continue;
+        }
+
+        wheel->armed--;
+        fsm_engine(timer->fsm, 
+                   timer->normalized_event, 
+                   timer->p2event_buffer, 
+                   timer->p2parm);
+    }
+    return (RC_FSM_OK);
+}
+
+
+/** 
+ * NAME
+ *    fsm_timer_advance_batch
+ *
+ * SYNOPSIS
+ *    #include "fsm_timer.h" 
+ *    RC_FSM_t
+ *    fsm_timer_advance_batch(fsm_timer_wheel_t *wheel,
+ *                            uint64_t now,
+ *                            fsm_batch_entry_t *batch,
+ *                            uint32_t max_entries,
+ *                            uint32_t *p2count)
+ *
+ * DESCRIPTION
+ *    Moves the wheel time forward to now and returns the expired
+ *    store instance timers as batch entries, in expiry order, 
+ *    ready for fsm_engine_batch.  Expired fsm_t timers are 
+ *    delivered with fsm_engine on the way.  When the batch is 
+ *    full the remaining expiries are kept, call again with the
+ *    same time to collect them.
+ *
+ * INPUT PARAMETERS
+ *    wheel            wheel handle
+ *
+ *    now              new time in ticks
+ *
+ *    batch            array of max_entries entries
+ *
+ *    max_entries      size of the batch
+ *
+ * OUTPUT PARAMETERS
+ *    p2count          number of entries returned, less than 
+ *                     max_entries once all expiries are returned
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_timer_advance_batch (fsm_timer_wheel_t *wheel,
+                         uint64_t now,
+                         fsm_batch_entry_t *batch,
+                         uint32_t max_entries,
+                         uint32_t *p2count)
+{
+    fsm_timer_t *timer;
+    uint32_t count;
+
+    if (wheel == NULL || batch == NULL || p2count == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    if (wheel->tag != FSM_TIMER_WHEEL_TAG) {
+        return (RC_FSM_INVALID_HANDLE);
+    }
+
+    fsm_timer_tick_to(wheel, now);
+
+    count = 0;
+    while (count < max_entries && wheel->expired.next != &wheel->expired) {
+        timer = (fsm_timer_t *)wheel->expired.next;
+        fsm_timer_list_unlink(&timer->link);
+        wheel->armed--;
+
+        if (timer->fsm) {
+            fsm_engine(timer->fsm, 
+                       timer->normalized_event, 
+                       timer->p2event_buffer, 
+                       timer->p2parm);
+            continue;
+        }
+
+        batch[count].instance = timer->instance;
+        batch[count].normalized_event = timer->normalized_event;
+        batch[count].p2event_buffer = timer->p2event_buffer;
+        batch[count].p2parm = timer->p2parm;
+        count++;
+    }
+
+    *p2count = count;
+    return (RC_FSM_OK);
+}
+
+
+/** 
+ * NAME
+ *    fsm_timer_attach
+ *
+ * SYNOPSIS
+ *    #include "fsm_timer.h" 
+ *    RC_FSM_t
+ *    fsm_timer_attach(fsm_t *fsm,
+ *                     fsm_timer_wheel_t *wheel,
+ *                     void *p2event_buffer,
+ *                     void *p2parm)
+ *
+ * DESCRIPTION
+ *    Attaches a timing wheel to run the state timeouts of the
+ *    state table.  From here on fsm_engine arms the state timer
+ *    on entry to a state with a timeout and cancels it on exit.
+ *    If the current state has a timeout it is armed now.  
+ *    Attaching again moves the state machine to the new wheel.
+ *
+ * INPUT PARAMETERS
+ *    fsm              state machine handle
+ *
+ *    wheel            wheel handle
+ *
+ *    *p2event_buffer  passed through to the handler of each
+ *                     timeout event
+ *
+ *    *p2parm          passed through to the handler of each
+ *                     timeout event
+ *
+ * OUTPUT PARAMETERS
+ *     none   
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_timer_attach (fsm_t *fsm,
+                  fsm_timer_wheel_t *wheel,
+                  void *p2event_buffer,
+                  void *p2parm)
+{
+    state_tuple_t *state_ptr;
+
+    if (fsm == NULL || wheel == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    if (fsm->tag != FSM_TAG || wheel->tag != FSM_TIMER_WHEEL_TAG) {
+        return (RC_FSM_INVALID_HANDLE);
+    }
+
+    if (fsm->state_timer == NULL) {
+        fsm->state_timer = (fsm_timer_t *)malloc(sizeof(fsm_timer_t));
+        if (fsm->state_timer == NULL) {
+            return (RC_FSM_NO_RESOURCES);
+        }
+    } else {
+        fsm_timer_stop(fsm->timer_wheel, fsm->state_timer);
+        fsm->timer_wheel->attached--;
+    }
+
+    fsm_timer_init(fsm->state_timer, p2event_buffer, p2parm);
+    fsm->timer_wheel = wheel;
+    wheel->attached++;
+
+    state_ptr = &fsm->state_table[fsm->curr_state];
+    if (state_ptr->timeout) {
+        fsm_timer_start(wheel, 
+                        fsm->state_timer, 
+                        fsm, 
+                        state_ptr->timeout_event,
+                        state_ptr->timeout);
+    }
+    return (RC_FSM_OK);
+}
+
+
+/** 
+ * NAME
+ *    fsm_timer_detach
+ *
+ * SYNOPSIS
+ *    #include "fsm_timer.h" 
+ *    RC_FSM_t
+ *    fsm_timer_detach(fsm_t *fsm)
+ *
+ * DESCRIPTION
+ *    Cancels the state timer and detaches the timing wheel, the
+ *    state timeouts are no longer run.  fsm_destroy detaches.
+ *
+ * INPUT PARAMETERS
+ *    fsm              state machine handle
+ *
+ * OUTPUT PARAMETERS
+ *     none   
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_timer_detach (fsm_t *fsm)
+{
+    if (fsm == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    if (fsm->tag != FSM_TAG) {
+        return (RC_FSM_INVALID_HANDLE);
+    }
+
+    if (fsm->state_timer) {
+        fsm_timer_stop(fsm->timer_wheel, fsm->state_timer);
+        fsm->timer_wheel->attached--;
+        free(fsm->state_timer);
+    }
+    fsm->state_timer = NULL;
+    fsm->timer_wheel = NULL;
+    return (RC_FSM_OK);
+}
@@ -0,0 +1,725 @@
+/*------------------------------------------------------------------
+ * fsm_trace.c -- Finite State Machine transition tracing
+ *
+ * Copyright (c) 2005-2009 by Cisco Systems, Inc.
+ * All rights reserved. 
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *------------------------------------------------------------------
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "fsm.h"
+#include "fsm_trace.h"
+#include "fsm_flight.h"
+#include "fsm_private.h"
+
+
+uint32_t fsm_trace_enabled = 0;
+
+
+/*
+ * Tables named in the trace.  The description tables are the
+ * user's and are expected to live as long as the process.
+ */
+typedef struct {
+    char                  fsm_name[FSM_NAME_LEN];
+    uint32_t              number_states;
+    uint32_t              number_events;
+    state_description_t  *state_description_table;
+    event_description_t  *event_description_table;
+} fsm_trace_class_t;
+
+
+/* protects all that follows */
+static pthread_mutex_t    fsm_trace_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t           fsm_trace_ring_records = FSM_TRACE_RING_RECORDS;
+static fsm_trace_ring_t  *fsm_trace_rings = NULL;
+static uint32_t           fsm_trace_number_rings = 0;
+
+static fsm_trace_class_t  fsm_trace_classes[FSM_TRACE_MAX_CLASSES];
+static uint32_t           fsm_trace_number_classes = 1;
+
+/* time stamp and clock when enabled, to estimate the tsc rate */
+static uint64_t           fsm_trace_start_tsc = 0;
+static struct timespec    fsm_trace_start_time;
+
+/* bumped by fsm_trace_reset, rings of an older one are gone */
+static uint32_t           fsm_trace_generation = 0;
+
+/* hands the ring of an exiting thread back for reuse */
+static pthread_once_t     fsm_trace_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t      fsm_trace_key;
+
+/* ring of the calling thread, and the generation it belongs to */
+static __thread fsm_trace_ring_t  *fsm_trace_ring = NULL;
+static __thread uint32_t           fsm_trace_ring_generation = 0;
+
+
+/*
+ * internal routine run as a thread exits, marks its ring free for
+ * the next thread that traces.  The records stay for 
+ * fsm_trace_dump until then.  The ring may already be gone after
+ * fsm_trace_reset, so it is looked up first.
+ */
+static void
+fsm_trace_ring_exit (void *arg)
+{
+    fsm_trace_ring_t *ring;
+
+    pthread_mutex_lock(&fsm_trace_lock);
+    for (ring=fsm_trace_rings; ring; ring=ring->next) {
+        if (ring == (fsm_trace_ring_t *)arg) {
+            ring->exited = TRUE;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&fsm_trace_lock);
+    return;
+}
+
+static void
+fsm_trace_key_create (void)
+{
+    pthread_key_create(&fsm_trace_key, fsm_trace_ring_exit);
+}
+
+
+
+/*
+ * internal routine to make the ring of the calling thread on its
+ * first traced event
+ */
+static fsm_trace_ring_t *
+fsm_trace_ring_create (void)
+{
+    fsm_trace_ring_t *ring;
+
+    pthread_once(&fsm_trace_key_once, fsm_trace_key_create);
+
+    pthread_mutex_lock(&fsm_trace_lock);
+
+    /* the ring of an exited thread of the same size, if any */
+    for (ring=fsm_trace_rings; ring; ring=ring->next) {
+        if (ring->exited && ring->mask == fsm_trace_ring_records - 1) {
+            break;
+        }
+    }
+
+    if (ring == NULL) {
+        ring = (fsm_trace_ring_t *)malloc(sizeof(fsm_trace_ring_t));
+        if (ring == NULL) {
+            pthread_mutex_unlock(&fsm_trace_lock);
+            return (NULL);
+        }
+        if (posix_memalign((void **)&ring->records, FSM_CACHE_LINE,
+                   fsm_trace_ring_records * sizeof(fsm_trace_record_t))) {
+            pthread_mutex_unlock(&fsm_trace_lock);
+            free(ring);
+            return (NULL);
+        }
+        ring->mask = fsm_trace_ring_records - 1;
+        ring->next = fsm_trace_rings;
+        fsm_trace_rings = ring;
+        fsm_trace_number_rings++;
+    }
+    ring->head = 0;
+    ring->exited = FALSE;
+    ring->thread = fsm_thread_index();
+    fsm_trace_ring_generation = fsm_trace_generation;
+    pthread_mutex_unlock(&fsm_trace_lock);
+
+    pthread_setspecific(fsm_trace_key, ring);
+    fsm_trace_ring = ring;
+    return (ring);
+}
+
+
+/** 
+ * NAME
+ *    fsm_trace_class_id
+ *
+ * SYNOPSIS
+ *    #include "fsm_trace.h" 
+ *    uint32_t
+ *    fsm_trace_class_id(fsm_class_t *fsm_class)
+ *
+ * DESCRIPTION
+ *    Names the tables of a class in traces and returns the ID, 
+ *    done once per class.  Classes of the same name built from 
+ *    the same description tables, as for each fsm_create, share
+ *    one ID.
+ *
+ * INPUT PARAMETERS
+ *    fsm_class        class handle
+ *
+ * OUTPUT PARAMETERS
+ *     none   
+ *
+ * RETURN VALUE
+ *    the class ID, 0 once FSM_TRACE_MAX_CLASSES are named
+ * 
+ */
+uint32_t
+fsm_trace_class_id (fsm_class_t *fsm_class)
+{
+    fsm_trace_class_t *trace_class;
+    uint32_t id;
+
+    id = FSM_LOAD_RELAXED(&fsm_class->trace_class_id);
+    if (id) {
+        return (id);
+    }
+
+    pthread_mutex_lock(&fsm_trace_lock);
+
+    for (id=1; id<fsm_trace_number_classes; id++) {
+        trace_class = &fsm_trace_classes[id];
+        if (trace_class->state_description_table == 
+                              fsm_class->state_description_table &&
+            trace_class->event_description_table == 
+                              fsm_class->event_description_table &&
+            !strncmp(trace_class->fsm_name, fsm_class->fsm_name, 
+                     FSM_NAME_LEN)) {
+            break;
+        }
+    }
+
+    if (id == fsm_trace_number_classes) {
+        if (id == FSM_TRACE_MAX_CLASSES) {
+            pthread_mutex_unlock(&fsm_trace_lock);
+            return (0);
+        }
+
+        trace_class = &fsm_trace_classes[id];
+        memcpy(trace_class->fsm_name, fsm_class->fsm_name, FSM_NAME_LEN);
+        trace_class->number_states = fsm_class->number_states;
+        trace_class->number_events = fsm_class->number_events;
+        trace_class->state_description_table = 
+                                    fsm_class->state_description_table;
+        trace_class->event_description_table = 
+                                    fsm_class->event_description_table;
+        fsm_trace_number_classes++;
+    }
+
+    FSM_STORE_RELAXED(&fsm_class->trace_class_id, id);
+    pthread_mutex_unlock(&fsm_trace_lock);
+    return (id);
+}
+
+
+/*
+ * internal routine to append a record to the ring of the calling
+ * thread and to the flight recorder, fsm_class is NULL when the 
+ * class may be gone
+ */
+static void
+fsm_trace_write (fsm_class_t *fsm_class, fsm_trace_record_t *record)
+{
+    fsm_trace_ring_t *ring;
+    uint32_t enabled;
+
+    enabled = FSM_LOAD_RELAXED(&fsm_trace_enabled);
+
+    if (enabled & FSM_TRACE_RINGS) {
+        ring = fsm_trace_ring;
+        if (ring == NULL || fsm_trace_ring_generation != 
+                            FSM_LOAD_RELAXED(&fsm_trace_generation)) {
+            ring = fsm_trace_ring_create();
+        }
+        if (ring) {
+            ring->records[ring->head & ring->mask] = *record;
+
+            /* publish for fsm_trace_dump */
+            FSM_STORE_RELEASE(&ring->head, ring->head + 1);
+        }
+    }
+
+    if (enabled & FSM_TRACE_FLIGHT) {
+        fsm_flight_record(fsm_class, record);
+    }
+    return;
+}
+
+
+/** 
+ * NAME
+ *    fsm_trace_instance
+ *
+ * SYNOPSIS
+ *    #include "fsm_trace.h" 
+ *    void
+ *    fsm_trace_instance(fsm_class_t *fsm_class,
+ *                       uint32_t instance,
+ *                       uint32_t prev_state,
+ *                       uint32_t normalized_event,
+ *                       uint32_t next_state,
+ *                       RC_FSM_t handler_rc,
+ *                       uint64_t start)
+ *
+ * DESCRIPTION
+ *    Appends a record to the trace ring of the calling thread, 
+ *    overwriting the oldest once the ring is full, and to the 
+ *    flight recorder when open.  Called by the engines once the
+ *    handler has run.  No lock is taken once the thread has its
+ *    ring and the class its ID.
+ *
+ * INPUT PARAMETERS
+ *    fsm_class        class of the state machine
+ *
+ *    instance         instance ID of an fsm_t, the index of a 
+ *                     store instance, 0 for an fsm_instance_t
+ *
+ *    prev_state       the state the event was processed in
+ *
+ *    normalized_event the event processed
+ *
+ *    next_state       the resulting state
+ *
+ *    handler_rc       the handler return code
+ *
+ *    start            time stamp taken before the handler ran
+ *
+ * OUTPUT PARAMETERS
+ *     none   
+ *
+ * RETURN VALUE
+ *     none   
+ * 
+ */
+void
+fsm_trace_instance (fsm_class_t *fsm_class,
+                    uint32_t instance,
+                    uint32_t prev_state,
+                    uint32_t normalized_event,
+                    uint32_t next_state,
+                    RC_FSM_t handler_rc,
+                    uint64_t start)
+{
+    fsm_trace_record_t record;
+
+    record.tsc = fsm_tsc();
+    record.duration = (uint32_t)(record.tsc - start);
+    record.instance = instance;
+    record.class_id = (uint16_t)fsm_trace_class_id(fsm_class);
+    record.prev_state = (uint16_t)prev_state;
+    record.event = (uint16_t)normalized_event;
+    record.next_state = (uint16_t)next_state;
+    record.rc = (uint16_t)handler_rc;
+    record.thread = (uint16_t)fsm_thread_index();
+    record.reserved = 0;
+
+    fsm_trace_write(fsm_class, &record);
+    return;
+}
+
+
+/** 
+ * NAME
+ *    fsm_trace_transition
+ *
+ * SYNOPSIS
+ *    #include "fsm_trace.h" 
+ *    void
+ *    fsm_trace_transition(fsm_t *fsm,
+ *                         uint32_t normalized_event,
+ *                         uint32_t next_state,
+ *                         RC_FSM_t handler_rc,
+ *                         uint64_t start)
+ *
+ * DESCRIPTION
+ *    Traces an event of a state machine, see fsm_trace_instance.
+ *    Called by fsm_engine before the current state is updated.
+ *
+ * INPUT PARAMETERS
+ *    fsm              state machine handle
+ *
+ *    normalized_event the event processed
+ *
+ *    next_state       the resulting state
+ *
+ *    handler_rc       the handler return code
+ *
+ *    start            time stamp taken before the handler ran
+ *
+ * OUTPUT PARAMETERS
+ *     none   
+ *
+ * RETURN VALUE
+ *     none   
+ * 
+ */
+void
+fsm_trace_transition (fsm_t *fsm,
+                      uint32_t normalized_event,
+                      uint32_t next_state,
+                      RC_FSM_t handler_rc,
+                      uint64_t start)
+{
+    fsm_trace_instance(fsm->fsm_class, 
+                       fsm->instance_id, 
+                       fsm->curr_state,
+                       normalized_event, 
+                       next_state, 
+                       handler_rc, 
+                       start);
+    return;
+}
+
+
+/** 
+ * NAME
+ *    fsm_trace_stop
+ *
+ * SYNOPSIS
+ *    #include "fsm_trace.h" 
+ *    void
+ *    fsm_trace_stop(uint32_t class_id,
+ *                   uint32_t instance,
+ *                   uint32_t prev_state,
+ *                   uint32_t normalized_event,
+ *                   uint64_t start)
+ *
+ * DESCRIPTION
+ *    Traces an event whose handler returned 
+ *    RC_FSM_STOP_PROCESSING.  The state machine, and with 
+ *    fsm_create its class, may be gone by then, so the engine 
+ *    reads what the record needs before the handler runs.  The
+ *    state is recorded as unchanged.
+ *
+ * INPUT PARAMETERS
+ *    class_id         trace ID of the class, see 
+ *                     fsm_trace_class_id
+ *
+ *    instance         as for fsm_trace_instance
+ *
+ *    prev_state       the state the event was processed in
+ *
+ *    normalized_event the event processed
+ *
+ *    start            time stamp taken before the handler ran
+ *
+ * OUTPUT PARAMETERS
+ *     none   
+ *
+ * RETURN VALUE
+ *     none   
+ * 
+ */
+void
+fsm_trace_stop (uint32_t class_id,
+                uint32_t instance,
+                uint32_t prev_state,
+                uint32_t normalized_event,
+                uint64_t start)
+{
+    fsm_trace_record_t record;
+
+    record.tsc = fsm_tsc();
+    record.duration = (uint32_t)(record.tsc - start);
+    record.instance = instance;
+    record.class_id = (uint16_t)class_id;
+    record.prev_state = (uint16_t)prev_state;
+    record.event = (uint16_t)normalized_event;
+    record.next_state = (uint16_t)prev_state;
+    record.rc = (uint16_t)RC_FSM_STOP_PROCESSING;
+    record.thread = (uint16_t)fsm_thread_index();
+    record.reserved = 0;
+
+    fsm_trace_write(NULL, &record);
+    return;
+}
+
+
+/** 
+ * NAME
+ *    fsm_trace_enable
+ *
+ * SYNOPSIS
+ *    #include "fsm_trace.h" 
+ *    RC_FSM_t
+ *    fsm_trace_enable(uint32_t ring_records)
+ *
+ * DESCRIPTION
+ *    Enables tracing of every event of fsm_engine, the store and
+ *    batch engines and fsm_instance_engine.  Each thread 
+ *    writes to its own ring, made on its first traced event, so 
+ *    the engine takes no lock.  While tracing is disabled the 
+ *    engine only tests fsm_trace_enabled.
+ *
+ * INPUT PARAMETERS
+ *    ring_records     records per thread ring, a power of two, 
+ *                     0 for FSM_TRACE_RING_RECORDS.  Rings that
+ *                     already exist keep their size.
+ *
+ * OUTPUT PARAMETERS
+ *     none   
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_trace_enable (uint32_t ring_records)
+{
+    if (ring_records == 0) {
+        ring_records = FSM_TRACE_RING_RECORDS;
+    }
+
+    if (ring_records & (ring_records - 1)) {
+        return (RC_FSM_INVALID_ARGUMENT);
+    }
+
+    pthread_mutex_lock(&fsm_trace_lock);
+    fsm_trace_ring_records = ring_records;
+    if (fsm_trace_start_tsc == 0) {
+        clock_gettime(CLOCK_MONOTONIC, &fsm_trace_start_time);
+        fsm_trace_start_tsc = fsm_tsc();
+    }
+    pthread_mutex_unlock(&fsm_trace_lock);
+
+    FSM_FETCH_OR(&fsm_trace_enabled, FSM_TRACE_RINGS);
+    return (RC_FSM_OK);
+}
+
+
+/** 
+ * NAME
+ *    fsm_trace_disable
+ *
+ * SYNOPSIS
+ *    #include "fsm_trace.h" 
+ *    void
+ *    fsm_trace_disable(void)
+ *
+ * DESCRIPTION
+ *    Disables tracing.  The rings are kept for fsm_trace_dump.
+ *
+ * INPUT PARAMETERS
+ *     none   
+ *
+ * OUTPUT PARAMETERS
+ *     none   
+ *
+ * RETURN VALUE
+ *     none   
+ * 
+ */
+void
+fsm_trace_disable (void)
+{
+    FSM_FETCH_AND(&fsm_trace_enabled, ~FSM_TRACE_RINGS);
+    return;
+}
+
+
+/** 
+ * NAME
+ *    fsm_trace_reset
+ *
+ * SYNOPSIS
+ *    #include "fsm_trace.h" 
+ *    void
+ *    fsm_trace_reset(void)
+ *
+ * DESCRIPTION
+ *    Disables tracing and frees the rings of all threads, once 
+ *    they have been dumped.  The next traced event of a thread 
+ *    makes it a new ring.  No thread may be in the engine while 
+ *    this runs.  The ring of an exited thread is otherwise kept 
+ *    for the dump and reused by the next thread that traces, so
+ *    the rings never outnumber the threads alive at once.
+ *
+ * INPUT PARAMETERS
+ *     none   
+ *
+ * OUTPUT PARAMETERS
+ *     none   
+ *
+ * RETURN VALUE
+ *     none   
+ * 
+ */
+void
+fsm_trace_reset (void)
+{
+    fsm_trace_ring_t *ring;
+
+    fsm_trace_disable();
+
+    pthread_mutex_lock(&fsm_trace_lock);
+    while (fsm_trace_rings) {
+        ring = fsm_trace_rings;
+        fsm_trace_rings = ring->next;
+        free(ring->records);
+        free(ring);
+    }
+    fsm_trace_number_rings = 0;
+    FSM_STORE_RELAXED(&fsm_trace_generation, fsm_trace_generation + 1);
+    pthread_mutex_unlock(&fsm_trace_lock);
+    return;
+}
+
+
+/*
+ * internal routine to write a description string to the dump
+ */
+static void
+fsm_trace_write_string (FILE *fp, char *string)
+{
+    uint32_t length;
+
+    length = string ? (uint32_t)strlen(string) : 0;
+    fwrite(&length, sizeof(length), 1, fp);
+    if (length) {
+        fwrite(string, 1, length, fp);
+    }
+}
+
+
+/** 
+ * NAME
+ *    fsm_trace_dump
+ *
+ * SYNOPSIS
+ *    #include "fsm_trace.h" 
+ *    RC_FSM_t
+ *    fsm_trace_dump(char *path)
+ *
+ * DESCRIPTION
+ *    Writes the trace rings of all threads, with the names of 
+ *    the states and events of the traced classes, to a file for
+ *    the offline decoder, tools/fsm_trace_decode.  Records being
+ *    written while the dump runs may be torn, dump once tracing
+ *    is disabled or the traced threads are quiet.
+ *
+ * INPUT PARAMETERS
+ *    path             file to write
+ *
+ * OUTPUT PARAMETERS
+ *     none   
+ *
+ * RETURN VALUE
+ *    RC_FSM_OK
+ *    error otherwise
+ * 
+ */
+RC_FSM_t
+fsm_trace_dump (char *path)
+{
+    fsm_trace_file_header_t header;
+    fsm_trace_file_class_t file_class;
+    fsm_trace_file_ring_t file_ring;
+    fsm_trace_class_t *trace_class;
+    fsm_trace_ring_t *ring;
+    struct timespec now_time;
+    uint64_t now_tsc;
+    uint64_t elapsed;
+    uint64_t head;
+    uint64_t first;
+    uint64_t i;
+    uint32_t id;
+    FILE *fp;
+
+    if (path == NULL) {
+        return (RC_FSM_NULL);
+    }
+
+    fp = fopen(path, "wb");
+    if (fp == NULL) {
+        return (RC_FSM_NO_RESOURCES);
+    }
+
+    pthread_mutex_lock(&fsm_trace_lock);
+
+    memset(&header, 0, sizeof(header));
+    header.magic = FSM_TRACE_FILE_MAGIC;
+    header.version = FSM_TRACE_FILE_VERSION;
+    header.record_size = sizeof(fsm_trace_record_t);
+    header.number_classes = fsm_trace_number_classes - 1;
+    header.number_rings = fsm_trace_number_rings;
+
+    /*
+     * estimate the time stamp rate over the time since enabled
+     */
+    if (fsm_trace_start_tsc) {
+        clock_gettime(CLOCK_MONOTONIC, &now_time);
+        now_tsc = fsm_tsc();
+        elapsed = (uint64_t)(now_time.tv_sec - 
+                             fsm_trace_start_time.tv_sec) * 1000000000ULL +
+                  now_time.tv_nsec - fsm_trace_start_time.tv_nsec;
+        if (elapsed > 1000000) {
+            header.tsc_hz = (uint64_t)((double)(now_tsc - 
+                     fsm_trace_start_tsc) * 1e9 / (double)elapsed);
+        }
+    }
+    fwrite(&header, sizeof(header), 1, fp);
+
+    for (id=1; id<fsm_trace_number_classes; id++) {
+        trace_class = &fsm_trace_classes[id];
+
+        memset(&file_class, 0, sizeof(file_class));
+        file_class.class_id = id;
+        file_class.number_states = trace_class->number_states;
+        file_class.number_events = trace_class->number_events;
+        memcpy(file_class.fsm_name, trace_class->fsm_name, FSM_NAME_LEN);
+        fwrite(&file_class, sizeof(file_class), 1, fp);
+
+        for (i=0; i<trace_class->number_states; i++) {
+            fsm_trace_write_string(fp, 
+                     trace_class->state_description_table[i].description);
+        }
+        for (i=0; i<trace_class->number_events; i++) {
+            fsm_trace_write_string(fp, 
+                     trace_class->event_description_table[i].description);
+        }
+    }
+
+    for (ring=fsm_trace_rings; ring; ring=ring->next) {
+        head = FSM_LOAD_ACQUIRE(&ring->head);
+        first = (head > ring->mask + 1) ? head - (ring->mask + 1) : 0;
+
+        file_ring.thread = ring->thread;
+        file_ring.number_records = (uint32_t)(head - first);
+        file_ring.dropped = first;
+        fwrite(&file_ring, sizeof(file_ring), 1, fp);
+
+        for (i=first; i<head; i++) {
+            fwrite(&ring->records[i & ring->mask], 
+                   sizeof(fsm_trace_record_t), 1, fp);
+        }
+    }
+
+    pthread_mutex_unlock(&fsm_trace_lock);
+
+    if (fclose(fp)) {
+        return (RC_FSM_NO_RESOURCES);
+    }
+    return (RC_FSM_OK);
+}
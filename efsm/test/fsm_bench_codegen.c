@@ -0,0 +1,167 @@
+/*------------------------------------------------------------------
+ * fsm_bench_codegen.c -- generated engines against the generic engine
+ *
+ * Copyright (c) 2005-2009 by Cisco Systems, Inc.
+ * All rights reserved. 
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *------------------------------------------------------------------
+ */
+
+/*
+ * Drives the demo session state machine with the same random 
+ * event stream through fsm_engine, fsm_instance_engine and the
+ * switch and computed goto engines tools/fsm_codegen generated 
+ * from demo_session.fsm, and prints the time per event of each.
+ *
+ *    fsm_bench_codegen [number of events]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "fsm.h"
+#include "demo_session_fsm.h"
+#include "fsm_bench_handlers.h"
+#include "demo_session_switch.h"
+#include "demo_session_goto.h"
+
+
+#define BENCH_STREAM       ( 4096 )
+#define BENCH_EVENTS       ( 20000000 )
+
+
+typedef RC_FSM_t (*bench_engine_t)(fsm_instance_t *instance,
+                                   uint32_t normalized_event,
+                                   void *p2event_buffer,
+                                   void *p2parm);
+
+static uint32_t  stream[BENCH_STREAM];
+
+
+static double
+elapsed_ns (struct timespec *start)
+{
+    struct timespec end;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return ((end.tv_sec - start->tv_sec) * 1e9 + 
+            (end.tv_nsec - start->tv_nsec));
+}
+
+
+static void
+report (const char *engine, double ns, uint64_t number_events, 
+        double base_ns, bench_context_t *context, uint32_t state)
+{
+    printf("%-22s %8.2f ns/event  %5.2fx   state %u  handled %llu"
+           "  ignored %llu\n", 
+           engine, ns / number_events, base_ns / ns, state,
+           (unsigned long long)context->handled, 
+           (unsigned long long)context->ignored);
+    return;
+}
+
+
+static double
+bench_instance (const char *engine_name, bench_engine_t engine, 
+                fsm_class_t *fsm_class, uint64_t number_events, 
+                double base_ns)
+{
+    fsm_instance_t instance;
+    bench_context_t context;
+    struct timespec start;
+    uint64_t i;
+    double ns;
+
+    fsm_instance_init(&instance, fsm_class, idle_s);
+    context.handled = 0;
+    context.ignored = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < number_events; i++) {
+        (*engine)(&instance, stream[i & (BENCH_STREAM - 1)], 
+                  NULL, &context);
+    }
+    ns = elapsed_ns(&start);
+
+    report(engine_name, ns, number_events, base_ns ? base_ns : ns, 
+           &context, instance.curr_state);
+    return (ns);
+}
+
+
+int 
+main (int argc, char **argv)
+{
+    fsm_class_t *fsm_class;
+    fsm_t *fsm;
+    bench_context_t context;
+    struct timespec start;
+    uint64_t number_events;
+    uint64_t i;
+    uint32_t seed;
+    uint32_t state;
+    double base_ns;
+
+    number_events = BENCH_EVENTS;
+    if (argc > 1) {
+        number_events = strtoull(argv[1], NULL, 0);
+    }
+
+    seed = 2009;
+    for (i = 0; i < BENCH_STREAM; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        stream[i] = seed % (term_ack_e + 1);
+    }
+
+    if (demo_session_switch_create(&fsm, idle_s) != RC_FSM_OK ||
+        demo_session_switch_class_create(&fsm_class) != RC_FSM_OK) {
+        printf("failed to create the state machine\n");
+        return (1);
+    }
+
+    context.handled = 0;
+    context.ignored = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < number_events; i++) {
+        fsm_engine(fsm, stream[i & (BENCH_STREAM - 1)], NULL, &context);
+    }
+    base_ns = elapsed_ns(&start);
+    fsm_get_state(fsm, &state);
+    report("fsm_engine", base_ns, number_events, base_ns, 
+           &context, state);
+
+    bench_instance("fsm_instance_engine", fsm_instance_engine, 
+                   fsm_class, number_events, base_ns);
+    bench_instance("generated switch", demo_session_switch_engine, 
+                   fsm_class, number_events, base_ns);
+    bench_instance("generated goto", demo_session_goto_engine, 
+                   fsm_class, number_events, base_ns);
+
+    fsm_destroy(&fsm);
+    fsm_class_destroy(&fsm_class);
+    return (0);
+}
@@ -0,0 +1,293 @@
+/*------------------------------------------------------------------
+ * fsm_bench_executor.c -- executor throughput over worker counts
+ *
+ * Copyright (c) 2005-2009 by Cisco Systems, Inc.
+ * All rights reserved. 
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *------------------------------------------------------------------
+ */
+
+/*
+ * Posts events from a few producer threads to the mailboxes of
+ * many state machines on an executor, for each worker count, and
+ * prints the events per second, the speed up over one worker and
+ * the number of mailboxes stolen.  Each state machine checks that
+ * its events arrive in the order they were posted.
+ *
+ *    fsm_bench_executor [number of events] [worker count ...]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "fsm.h"
+#include "fsm_mailbox.h"
+#include "fsm_executor.h"
+
+
+#define BENCH_MACHINES     ( 1024 )
+#define BENCH_MAILBOX      ( 256 )
+#define BENCH_PRODUCERS    ( 2 )
+#define BENCH_EVENTS       ( 4000000 )
+
+/* loop iterations of a handler, roughly a small protocol action */
+#define BENCH_WORK         ( 64 )
+
+enum { bench_state, bench_states };
+enum { bench_event, bench_events };
+
+
+/*
+ * per state machine context, written only by the worker that
+ * drains its mailbox
+ */
+typedef struct {
+    uint64_t   handled;
+    uint64_t   last;
+    uint64_t   out_of_order;
+    uint8_t    pad[FSM_CACHE_LINE];
+} bench_machine_t;
+
+static bench_machine_t   machines[BENCH_MACHINES];
+static fsm_t            *fsm_table[BENCH_MACHINES];
+static fsm_mailbox_t    *mailbox_table[BENCH_MACHINES];
+static fsm_executor_t   *executor;
+static uint64_t          events_per_producer;
+
+
+static RC_FSM_t
+bench_handler (void *p2event, void *p2parm)
+{
+    bench_machine_t *machine = (bench_machine_t *)p2parm;
+    uint64_t sequence = (uint64_t)(unsigned long)p2event;
+    volatile uint32_t work;
+
+    for (work = 0; work < BENCH_WORK; work++) {
+        ;
+    }
+    if (sequence != machine->last + 1) {
+        machine->out_of_order++;
+    }
+    machine->last = sequence;
+    machine->handled++;
+    return (RC_FSM_OK);
+}
+
+static event_tuple_t bench_event_table[] =
+    { { bench_event, bench_handler, bench_state } };
+
+static state_tuple_t bench_state_table[] =
+    { { bench_state, bench_event_table },
+      { FSM_NULL_STATE_ID, NULL } };
+
+static state_description_t bench_state_description[] =
+    { { bench_state, "state" },
+      { FSM_NULL_STATE_ID, NULL } };
+
+static event_description_t bench_event_description[] =
+    { { bench_event, "event" },
+      { FSM_NULL_EVENT_ID, NULL } };
+
+
+/*
+ * Each producer posts to its own share of the machines, so the
+ * sequence of a machine has a single writer.  A full mailbox is
+ * retried after a yield.
+ */
+static void *
+bench_producer (void *arg)
+{
+    uint64_t sequence[BENCH_MACHINES / BENCH_PRODUCERS];
+    uint32_t producer = (uint32_t)(unsigned long)arg;
+    uint32_t seed;
+    uint32_t slot;
+    uint32_t index;
+    uint64_t i;
+
+    memset(sequence, 0, sizeof(sequence));
+    seed = 2009 + producer;
+    for (i = 0; i < events_per_producer; ) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        slot = seed % (BENCH_MACHINES / BENCH_PRODUCERS);
+        index = slot * BENCH_PRODUCERS + producer;
+
+        if (fsm_executor_post(executor, mailbox_table[index], bench_event,
+                              (void *)(unsigned long)(sequence[slot] + 1),
+                              &machines[index]) == RC_FSM_OK) {
+            sequence[slot]++;
+            i++;
+        } else {
+            sched_yield();
+        }
+    }
+    return (NULL);
+}
+
+
+static double
+elapsed_s (struct timespec *start)
+{
+    struct timespec end;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return ((end.tv_sec - start->tv_sec) +
+            (end.tv_nsec - start->tv_nsec) / 1e9);
+}
+
+
+/*
+ * Runs the events through an executor of number_workers workers
+ * and returns the events per second, 0 on error.
+ */
+static double
+bench_run (uint32_t number_workers)
+{
+    pthread_t producers[BENCH_PRODUCERS];
+    fsm_worker_stats_t stats;
+    struct timespec start;
+    uint64_t total;
+    uint64_t events;
+    uint64_t steals;
+    uint64_t out_of_order;
+    double seconds;
+    uint32_t i;
+
+    memset(machines, 0, sizeof(machines));
+    if (fsm_executor_create(&executor, number_workers, 0) != RC_FSM_OK) {
+        printf("failed to create an executor of %u workers\n",
+               number_workers);
+        return (0);
+    }
+
+    total = events_per_producer * BENCH_PRODUCERS;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < BENCH_PRODUCERS; i++) {
+        pthread_create(&producers[i], NULL, bench_producer,
+                       (void *)(unsigned long)i);
+    }
+    for (i = 0; i < BENCH_PRODUCERS; i++) {
+        pthread_join(producers[i], NULL);
+    }
+
+    /* wait for the workers to catch up */
+    do {
+        events = 0;
+        steals = 0;
+        for (i = 0; i < number_workers; i++) {
+            fsm_executor_get_stats(executor, i, &stats);
+            events += stats.events;
+            steals += stats.steals;
+        }
+        if (events < total) {
+            sched_yield();
+        }
+    } while (events < total);
+    seconds = elapsed_s(&start);
+
+    fsm_executor_destroy(&executor);
+
+    out_of_order = 0;
+    for (i = 0; i < BENCH_MACHINES; i++) {
+        out_of_order += machines[i].out_of_order;
+    }
+
+    printf("  %3u workers  %8.2f Mevents/s  steals %10llu"
+           "  out of order %llu\n",
+           number_workers, total / seconds / 1e6,
+           (unsigned long long)steals,
+           (unsigned long long)out_of_order);
+    return (total / seconds);
+}
+
+
+int
+main (int argc, char **argv)
+{
+    static uint32_t default_workers[] = { 1, 2, 4, 8 };
+    uint32_t *workers;
+    uint32_t number_runs;
+    uint64_t number_events;
+    double rate;
+    double base;
+    uint32_t i;
+
+    number_events = BENCH_EVENTS;
+    if (argc > 1) {
+        number_events = strtoull(argv[1], NULL, 0);
+    }
+    events_per_producer = number_events / BENCH_PRODUCERS;
+
+    workers = default_workers;
+    number_runs = sizeof(default_workers) / sizeof(default_workers[0]);
+    if (argc > 2) {
+        number_runs = argc - 2;
+        workers = calloc(number_runs, sizeof(uint32_t));
+        if (workers == NULL) {
+            return (1);
+        }
+        for (i = 0; i < number_runs; i++) {
+            workers[i] = strtoul(argv[i + 2], NULL, 0);
+        }
+    }
+
+    for (i = 0; i < BENCH_MACHINES; i++) {
+        if (fsm_create(&fsm_table[i], "bench", bench_state,
+                       bench_state_description, bench_event_description,
+                       bench_state_table) != RC_FSM_OK ||
+            fsm_mailbox_create(&mailbox_table[i], fsm_table[i],
+                               BENCH_MAILBOX) != RC_FSM_OK) {
+            printf("failed to create the state machines\n");
+            return (1);
+        }
+    }
+
+    printf("executor, %u state machines, %u producers, %llu events\n",
+           BENCH_MACHINES, BENCH_PRODUCERS,
+           (unsigned long long)(events_per_producer * BENCH_PRODUCERS));
+    base = 0;
+    for (i = 0; i < number_runs; i++) {
+        rate = bench_run(workers[i]);
+        if (rate == 0) {
+            return (1);
+        }
+        if (base == 0) {
+            base = rate;
+        }
+        printf("               %.2fx the first run\n", rate / base);
+    }
+
+    for (i = 0; i < BENCH_MACHINES; i++) {
+        fsm_mailbox_destroy(&mailbox_table[i]);
+        fsm_destroy(&fsm_table[i]);
+    }
+    if (workers != default_workers) {
+        free(workers);
+    }
+    return (0);
+}
@@ -0,0 +1,104 @@
+/*------------------------------------------------------------------
+ * fsm_bench_handlers.h -- handlers of the code generator benchmark
+ *
+ * Copyright (c) 2005-2009 by Cisco Systems, Inc.
+ * All rights reserved. 
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *------------------------------------------------------------------
+ */
+
+#ifndef __FSM_BENCH_HANDLERS_H__
+#define __FSM_BENCH_HANDLERS_H__
+
+#include "fsm.h"
+
+
+/*
+ * The demo session handlers, reduced to counting, for 
+ * fsm_bench_codegen.  Being static inline, the generated engines
+ * inline them while the generic engine calls them through the 
+ * tables.
+ */
+typedef struct {
+    uint64_t   handled;
+    uint64_t   ignored;
+} bench_context_t;
+
+
+static inline RC_FSM_t 
+bench_count (void *p2parm)
+{
+    ((bench_context_t *)p2parm)->handled++;
+    return (RC_FSM_OK);
+}
+
+static inline RC_FSM_t 
+event_ignore (void *p2event, void *p2parm)
+{
+    ((bench_context_t *)p2parm)->ignored++;
+    return (RC_FSM_OK);
+}
+
+static inline RC_FSM_t 
+event_start_init (void *p2event, void *p2parm)
+{
+    return (bench_count(p2parm));
+}
+
+static inline RC_FSM_t 
+event_init_rcvd (void *p2event, void *p2parm)
+{
+    return (bench_count(p2parm));
+}
+
+static inline RC_FSM_t 
+event_init_ack_rcvd (void *p2event, void *p2parm)
+{
+    return (bench_count(p2parm));
+}
+
+static inline RC_FSM_t 
+event_init_ack_tmo (void *p2event, void *p2parm)
+{
+    return (bench_count(p2parm));
+}
+
+static inline RC_FSM_t 
+event_start_term (void *p2event, void *p2parm)
+{
+    return (bench_count(p2parm));
+}
+
+static inline RC_FSM_t 
+event_term_rcvd (void *p2event, void *p2parm)
+{
+    return (bench_count(p2parm));
+}
+
+static inline RC_FSM_t 
+event_term_ack_rcvd (void *p2event, void *p2parm)
+{
+    return (bench_count(p2parm));
+}
+
+#endif
@@ -0,0 +1,303 @@
+/*------------------------------------------------------------------
+ * fsm_bench_layout.c -- table layouts chosen by the class
+ *
+ * Copyright (c) 2005-2009 by Cisco Systems, Inc.
+ * All rights reserved. 
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *------------------------------------------------------------------
+ */
+
+/*
+ * Drives the demo session class and synthetic large classes with
+ * fsm_instance_engine under each layout mode, and prints the time
+ * per event and table size of each, so the choice of 
+ * FSM_LAYOUT_AUTO can be checked against the modes it picks from.
+ *
+ *    fsm_bench_layout [number of events]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "fsm.h"
+#include "demo_session_fsm.h"
+#include "fsm_bench_handlers.h"
+#include "demo_session_switch.h"
+
+
+#define BENCH_STREAM       ( 1 << 16 )
+#define BENCH_EVENTS       ( 10000000 )
+
+/* synthetic handlers, counting as the demo ones */
+#define BENCH_HANDLERS     ( 8 )
+
+/* events handled in most states of the synthetic protocols */
+#define BENCH_HOT          ( 64 )
+
+static uint32_t  stream[BENCH_STREAM];
+static uint32_t  seed;
+
+
+static uint32_t
+bench_random (void)
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return (seed);
+}
+
+
+static RC_FSM_t bench_h0 (void *e, void *p) { return (bench_count(p)); }
+static RC_FSM_t bench_h1 (void *e, void *p) { return (bench_count(p)); }
+static RC_FSM_t bench_h2 (void *e, void *p) { return (bench_count(p)); }
+static RC_FSM_t bench_h3 (void *e, void *p) { return (bench_count(p)); }
+static RC_FSM_t bench_h4 (void *e, void *p) { return (bench_count(p)); }
+static RC_FSM_t bench_h5 (void *e, void *p) { return (bench_count(p)); }
+static RC_FSM_t bench_h6 (void *e, void *p) { return (bench_count(p)); }
+static RC_FSM_t bench_h7 (void *e, void *p) { return (bench_count(p)); }
+
+static event_cb_t bench_handlers[BENCH_HANDLERS] = 
+    { bench_h0, bench_h1, bench_h2, bench_h3, 
+      bench_h4, bench_h5, bench_h6, bench_h7 };
+
+
+/*
+ * Synthetic class of dense tables, as written by hand, with
+ * handled events per state, half of them from the first 
+ * BENCH_HOT events, every other event ignored in the state.  
+ * handled of 0 gives random rows instead.
+ */
+typedef struct {
+    const char            *name;
+    uint32_t               number_states;
+    uint32_t               number_events;
+    uint32_t               handled;
+    state_description_t   *state_description;
+    event_description_t   *event_description;
+    state_tuple_t         *state_table;
+} bench_fsm_t;
+
+
+static int
+bench_build (bench_fsm_t *bench)
+{
+    event_tuple_t *event_ptr;
+    uint32_t i;
+    uint32_t j;
+    uint32_t k;
+
+    bench->state_description = calloc(bench->number_states + 1, 
+                                      sizeof(state_description_t));
+    bench->event_description = calloc(bench->number_events + 1, 
+                                      sizeof(event_description_t));
+    bench->state_table = calloc(bench->number_states + 1, 
+                                sizeof(state_tuple_t));
+    if (!bench->state_description || !bench->event_description ||
+        !bench->state_table) {
+        return (-1);
+    }
+
+    for (j=0; j<bench->number_events; j++) {
+        bench->event_description[j].event_id = j;
+        bench->event_description[j].description = "event";
+    }
+    bench->event_description[j].event_id = FSM_NULL_EVENT_ID;
+
+    for (i=0; i<bench->number_states; i++) {
+        bench->state_description[i].state_id = i;
+        bench->state_description[i].description = "state";
+
+        event_ptr = calloc(bench->number_events, sizeof(event_tuple_t));
+        if (event_ptr == NULL) {
+            return (-1);
+        }
+        for (j=0; j<bench->number_events; j++) {
+            event_ptr[j].eventID = j;
+            if (bench->handled) {
+                event_ptr[j].event_handler = event_ignore;
+                event_ptr[j].next_state = i;
+            } else {
+                event_ptr[j].event_handler = 
+                    bench_handlers[bench_random() % BENCH_HANDLERS];
+                event_ptr[j].next_state = 
+                    bench_random() % bench->number_states;
+            }
+        }
+        for (k=0; k<bench->handled; k++) {
+            j = bench_random() % ((k & 1) ? bench->number_events : BENCH_HOT);
+            event_ptr[j].event_handler = 
+                bench_handlers[bench_random() % BENCH_HANDLERS];
+            event_ptr[j].next_state = bench_random() % bench->number_states;
+        }
+
+        bench->state_table[i].state_id = i;
+        bench->state_table[i].p2event_tuple = event_ptr;
+    }
+    bench->state_description[i].state_id = FSM_NULL_STATE_ID;
+    bench->state_table[i].state_id = FSM_NULL_STATE_ID;
+    return (0);
+}
+
+
+static void
+bench_free (bench_fsm_t *bench)
+{
+    uint32_t i;
+
+    for (i=0; i<bench->number_states; i++) {
+        free(bench->state_table[i].p2event_tuple);
+    }
+    free(bench->state_description);
+    free(bench->event_description);
+    free(bench->state_table);
+    return;
+}
+
+
+static double
+elapsed_ns (struct timespec *start)
+{
+    struct timespec end;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return ((end.tv_sec - start->tv_sec) * 1e9 + 
+            (end.tv_nsec - start->tv_nsec));
+}
+
+
+/*
+ * Times the class under each layout mode, from a random event 
+ * stream where one event in two is from a small set most states
+ * handle, and reports how the automatic choice compares with the
+ * best mode.
+ */
+static const char *mode_names[] = { "auto", "dense", "sparse" };
+
+static void
+bench_class (const char *name, fsm_class_t *fsm_class, 
+             uint32_t hot_events, uint64_t number_events)
+{
+    fsm_instance_t instance;
+    fsm_class_layout_t layout;
+    bench_context_t context;
+    struct timespec start;
+    double ns[3];
+    double best;
+    uint64_t i;
+    uint32_t mode;
+
+    for (i = 0; i < BENCH_STREAM; i++) {
+        stream[i] = (i & 1) ? 
+            bench_random() % hot_events :
+            bench_random() % fsm_class->number_events;
+    }
+
+    printf("%s\n", name);
+    for (mode = FSM_LAYOUT_AUTO; mode <= FSM_LAYOUT_SPARSE; mode++) {
+        if (fsm_class_set_layout(fsm_class, mode) != RC_FSM_OK) {
+            printf("failed to set the layout\n");
+            return;
+        }
+        fsm_class_get_layout(fsm_class, &layout);
+
+        fsm_instance_init(&instance, fsm_class, 0);
+        context.handled = 0;
+        context.ignored = 0;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (i = 0; i < number_events; i++) {
+            fsm_instance_engine(&instance, stream[i & (BENCH_STREAM - 1)],
+                                NULL, &context);
+        }
+        ns[mode] = elapsed_ns(&start) / number_events;
+
+        printf("  %-8s %8.2f ns/event  %10llu bytes  sparse states %u"
+               "  rows %u  handled %llu\n",
+               mode_names[mode], ns[mode], 
+               (unsigned long long)layout.compressed_bytes, 
+               layout.number_sparse_states, layout.number_rows,
+               (unsigned long long)context.handled);
+    }
+
+    best = (ns[FSM_LAYOUT_DENSE] < ns[FSM_LAYOUT_SPARSE]) ?
+                         ns[FSM_LAYOUT_DENSE] : ns[FSM_LAYOUT_SPARSE];
+    printf("  auto at %.2fx the best fixed mode\n\n", 
+           ns[FSM_LAYOUT_AUTO] / best);
+
+    fsm_class_set_layout(fsm_class, FSM_LAYOUT_AUTO);
+    return;
+}
+
+
+int 
+main (int argc, char **argv)
+{
+    static bench_fsm_t synthetic[] = {
+        { "protocol, 512 states x 2048 events, 8 handled per state",
+          512, 2048, 8 },
+        { "protocol, 4096 states x 4096 events, 16 handled per state",
+          4096, 4096, 16 },
+        { "random, 256 states x 256 events",
+          256, 256, 0 },
+        { "random, 32 states x 64 events",
+          32, 64, 0 },
+    };
+    fsm_class_t *fsm_class;
+    uint64_t number_events;
+    uint32_t i;
+
+    number_events = BENCH_EVENTS;
+    if (argc > 1) {
+        number_events = strtoull(argv[1], NULL, 0);
+    }
+    seed = 2009;
+
+    if (demo_session_switch_class_create(&fsm_class) != RC_FSM_OK) {
+        printf("failed to create the demo class\n");
+        return (1);
+    }
+    bench_class("demo session, 4 states x 7 events", fsm_class, 
+                term_ack_e + 1, number_events);
+    fsm_display_layout(fsm_class);
+    fsm_class_destroy(&fsm_class);
+
+    for (i = 0; i < sizeof(synthetic) / sizeof(synthetic[0]); i++) {
+        if (bench_build(&synthetic[i]) ||
+            fsm_class_create(&fsm_class, "synthetic", 
+                             synthetic[i].state_description,
+                             synthetic[i].event_description,
+                             synthetic[i].state_table) != RC_FSM_OK) {
+            printf("failed to create %s\n", synthetic[i].name);
+            return (1);
+        }
+        bench_class(synthetic[i].name, fsm_class, 
+                    synthetic[i].handled ? 
+                        BENCH_HOT : synthetic[i].number_events,
+                    number_events);
+        fsm_class_destroy(&fsm_class);
+        bench_free(&synthetic[i]);
+    }
+    return (0);
+}
@@ -0,0 +1,224 @@
+/*------------------------------------------------------------------
+ * fsm_bench_machine.cpp -- the C++ engine against the generic engine
+ *
+ * Copyright (c) 2005-2009 by Cisco Systems, Inc.
+ * All rights reserved. 
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *------------------------------------------------------------------
+ */
+
+/*
+ * The demo session tables as an efsm::machine, with the counting
+ * handlers of fsm_bench_codegen, driven by a random event stream
+ * with machine::engine and with fsm_instance_engine on the C 
+ * tables the machine builds, and prints the time per event of 
+ * each.
+ *
+ *    fsm_bench_machine [number of events]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "fsm.hpp"
+#include "fsm_bench_handlers.h"
+
+
+#define BENCH_STREAM       ( 1 << 16 )
+#define BENCH_EVENTS       ( 10000000 )
+
+enum class bench_state { idle, wait_for_init_ack, established, 
+                         wait_for_term_ack };
+
+enum class bench_event { start_init, init_rcvd, init_tmo, init_ack, 
+                         start_term, term_rcvd, term_ack };
+
+using S = bench_state;
+using E = bench_event;
+
+static constexpr auto states = efsm::names(
+    efsm::name(S::idle, "Idle State"),
+    efsm::name(S::wait_for_init_ack, "Wait for Init Ack State"),
+    efsm::name(S::established, "Established State"),
+    efsm::name(S::wait_for_term_ack, "Wait for Terminate Ack State"));
+
+static constexpr auto events = efsm::names(
+    efsm::name(E::start_init, "Start Session Init"),
+    efsm::name(E::init_rcvd, "Session Init"),
+    efsm::name(E::init_tmo, "Session Init ACK TMO"),
+    efsm::name(E::init_ack, "Session Init ACK"),
+    efsm::name(E::start_term, "Start Session Termination"),
+    efsm::name(E::term_rcvd, "Session Terminate"),
+    efsm::name(E::term_ack, "Session Terminate ACK"));
+
+static constexpr auto rows = efsm::rows(
+    efsm::transition(S::idle, E::start_init, event_start_init, 
+                     S::wait_for_init_ack),
+    efsm::transition(S::idle, E::init_rcvd, event_init_rcvd, 
+                     S::established),
+    efsm::transition(S::idle, E::init_tmo, event_ignore, S::idle),
+    efsm::transition(S::idle, E::init_ack, event_ignore, S::idle),
+    efsm::transition(S::idle, E::start_term, event_ignore, S::idle),
+    efsm::transition(S::idle, E::term_rcvd, event_ignore, S::idle),
+    efsm::transition(S::idle, E::term_ack, event_ignore, S::idle),
+
+    efsm::transition(S::wait_for_init_ack, E::start_init, event_ignore,
+                     S::wait_for_init_ack),
+    efsm::transition(S::wait_for_init_ack, E::init_rcvd, event_ignore,
+                     S::wait_for_init_ack),
+    efsm::transition(S::wait_for_init_ack, E::init_tmo, 
+                     event_init_ack_tmo, S::wait_for_init_ack),
+    efsm::transition(S::wait_for_init_ack, E::init_ack, 
+                     event_init_ack_rcvd, S::established),
+    efsm::transition(S::wait_for_init_ack, E::start_term, 
+                     event_term_rcvd, S::wait_for_init_ack),
+    efsm::transition(S::wait_for_init_ack, E::term_rcvd, 
+                     event_term_rcvd, S::idle),
+    efsm::transition(S::wait_for_init_ack, E::term_ack, event_ignore,
+                     S::wait_for_init_ack),
+
+    efsm::transition(S::established, E::start_init, event_ignore, 
+                     S::established),
+    efsm::transition(S::established, E::init_rcvd, event_ignore, 
+                     S::established),
+    efsm::transition(S::established, E::init_tmo, event_ignore, 
+                     S::established),
+    efsm::transition(S::established, E::init_ack, event_ignore, 
+                     S::established),
+    efsm::transition(S::established, E::start_term, event_start_term, 
+                     S::wait_for_term_ack),
+    efsm::transition(S::established, E::term_rcvd, event_term_rcvd, 
+                     S::idle),
+    efsm::transition(S::established, E::term_ack, event_ignore, 
+                     S::established),
+
+    efsm::transition(S::wait_for_term_ack, E::start_init, event_ignore,
+                     S::wait_for_term_ack),
+    efsm::transition(S::wait_for_term_ack, E::init_rcvd, event_ignore,
+                     S::wait_for_term_ack),
+    efsm::transition(S::wait_for_term_ack, E::init_tmo, event_ignore,
+                     S::wait_for_term_ack),
+    efsm::transition(S::wait_for_term_ack, E::init_ack, event_ignore,
+                     S::wait_for_term_ack),
+    efsm::transition(S::wait_for_term_ack, E::start_term, event_ignore,
+                     S::wait_for_term_ack),
+    efsm::transition(S::wait_for_term_ack, E::term_rcvd, event_ignore,
+                     S::idle),
+    efsm::transition(S::wait_for_term_ack, E::term_ack, 
+                     event_term_ack_rcvd, S::idle));
+
+using bench_machine = efsm::machine<states, events, rows>;
+
+static bench_event  stream[BENCH_STREAM];
+static uint32_t     seed;
+
+
+static uint32_t
+bench_random (void)
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return (seed);
+}
+
+
+static double
+elapsed_ns (struct timespec *start)
+{
+    struct timespec end;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return ((end.tv_sec - start->tv_sec) * 1e9 + 
+            (end.tv_nsec - start->tv_nsec));
+}
+
+
+static void
+bench_report (const char *name, double ns, bench_context_t *context, 
+              fsm_instance_t *instance)
+{
+    printf("  %-22s %8.2f ns/event  handled %llu  ignored %llu"
+           "  state %u\n",
+           name, ns, (unsigned long long)context->handled,
+           (unsigned long long)context->ignored, 
+           (unsigned)instance->curr_state);
+    return;
+}
+
+
+int 
+main (int argc, char **argv)
+{
+    fsm_class_t *fsm_class;
+    fsm_instance_t instance;
+    bench_context_t context;
+    struct timespec start;
+    uint64_t number_events;
+    uint64_t i;
+
+    number_events = BENCH_EVENTS;
+    if (argc > 1) {
+        number_events = strtoull(argv[1], NULL, 0);
+    }
+    seed = 2009;
+    for (i = 0; i < BENCH_STREAM; i++) {
+        stream[i] = static_cast<bench_event>(bench_random() % 
+                                         bench_machine::number_events);
+    }
+
+    if (bench_machine::class_create(&fsm_class, 
+                                    "Demo State Machine") != RC_FSM_OK) {
+        printf("failed to create the class\n");
+        return (1);
+    }
+    printf("demo session, 4 states x 7 events, %llu events\n",
+           (unsigned long long)number_events);
+
+    fsm_instance_init(&instance, fsm_class, 0);
+    context.handled = 0;
+    context.ignored = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < number_events; i++) {
+        bench_machine::engine(&instance, stream[i & (BENCH_STREAM - 1)],
+                              NULL, &context);
+    }
+    bench_report("machine::engine", elapsed_ns(&start) / number_events,
+                 &context, &instance);
+
+    fsm_instance_init(&instance, fsm_class, 0);
+    context.handled = 0;
+    context.ignored = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < number_events; i++) {
+        fsm_instance_engine(&instance, 
+               static_cast<uint32_t>(stream[i & (BENCH_STREAM - 1)]),
+               NULL, &context);
+    }
+    bench_report("fsm_instance_engine", elapsed_ns(&start) / number_events,
+                 &context, &instance);
+
+    fsm_class_destroy(&fsm_class);
+    return (0);
+}
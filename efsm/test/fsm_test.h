@@ -0,0 +1,161 @@
+/*------------------------------------------------------------------
+ * fsm_test.h -- helpers of the behavior tests
+ *
+ * Copyright (c) 2005-2009 by Cisco Systems, Inc.
+ * All rights reserved. 
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *------------------------------------------------------------------
+ */
+
+#ifndef __FSM_TEST_H__
+#define __FSM_TEST_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fsm.h"
+
+
+/*
+ * Helpers shared by the behavior tests of make check.  A test 
+ * counts the checks that failed, prints them, and exits non-zero
+ * when there was any.
+ */
+static uint32_t  test_failures;
+
+#define TEST_CHECK(condition)                                         \
+    do {                                                              \
+        if (!(condition)) {                                           \
+            test_failures++;                                          \
+            printf("%s:%u: check failed: %s\n",                       \
+                   __FILE__, __LINE__, #condition);                   \
+        }                                                             \
+    } while (0)
+
+static inline int
+test_report (const char *name)
+{
+    printf("%-24s %s\n", name, test_failures ? "FAILED" : "passed");
+    return (test_failures != 0);
+}
+
+
+#ifndef __cplusplus
+
+/*
+ * Synthetic tables of number_states x number_events, where event
+ * e moves state s to (s + e) % number_states through the handler
+ * given.  Event 0 thus stays in the state.
+ */
+typedef struct {
+    uint32_t               number_states;
+    uint32_t               number_events;
+    state_description_t   *state_description;
+    event_description_t   *event_description;
+    state_tuple_t         *state_table;
+} test_tables_t;
+
+static inline int
+test_tables_build (test_tables_t *tables,
+                   uint32_t number_states,
+                   uint32_t number_events,
+                   event_cb_t handler)
+{
+    event_tuple_t *event_ptr;
+    uint32_t i;
+    uint32_t j;
+
+    tables->number_states = number_states;
+    tables->number_events = number_events;
+    tables->state_description = calloc(number_states + 1, 
+                                       sizeof(state_description_t));
+    tables->event_description = calloc(number_events + 1, 
+                                       sizeof(event_description_t));
+    tables->state_table = calloc(number_states + 1, sizeof(state_tuple_t));
+    if (!tables->state_description || !tables->event_description ||
+        !tables->state_table) {
+        return (-1);
+    }
+
+    for (j=0; j<number_events; j++) {
+        tables->event_description[j].event_id = j;
+        tables->event_description[j].description = "event";
+    }
+    tables->event_description[j].event_id = FSM_NULL_EVENT_ID;
+
+    for (i=0; i<number_states; i++) {
+        tables->state_description[i].state_id = i;
+        tables->state_description[i].description = "state";
+
+        event_ptr = calloc(number_events, sizeof(event_tuple_t));
+        if (event_ptr == NULL) {
+            return (-1);
+        }
+        for (j=0; j<number_events; j++) {
+            event_ptr[j].eventID = j;
+            event_ptr[j].event_handler = handler;
+            event_ptr[j].next_state = (i + j) % number_states;
+        }
+        tables->state_table[i].state_id = i;
+        tables->state_table[i].p2event_tuple = event_ptr;
+    }
+    tables->state_description[i].state_id = FSM_NULL_STATE_ID;
+    tables->state_table[i].state_id = FSM_NULL_STATE_ID;
+    return (0);
+}
+
+static inline void
+test_tables_free (test_tables_t *tables)
+{
+    uint32_t i;
+
+    for (i=0; i<tables->number_states; i++) {
+        free(tables->state_table[i].p2event_tuple);
+    }
+    free(tables->state_description);
+    free(tables->event_description);
+    free(tables->state_table);
+    return;
+}
+
+static inline fsm_class_t *
+test_class_create (test_tables_t *tables,
+                   uint32_t number_states,
+                   uint32_t number_events,
+                   event_cb_t handler)
+{
+    fsm_class_t *fsm_class;
+
+    if (test_tables_build(tables, number_states, number_events, handler) ||
+        fsm_class_create(&fsm_class, "test", tables->state_description,
+                         tables->event_description, 
+                         tables->state_table) != RC_FSM_OK) {
+        printf("failed to create the test class\n");
+        exit(1);
+    }
+    return (fsm_class);
+}
+
+#endif  /* C tables, the C++ tests use efsm::machine */
+
+#endif
@@ -0,0 +1,165 @@
+/*------------------------------------------------------------------
+ * fsm_test_batch.c -- grouped batches keep the order of each instance
+ *
+ * Copyright (c) 2005-2009 by Cisco Systems, Inc.
+ * All rights reserved. 
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *------------------------------------------------------------------
+ */
+
+/*
+ * Drives the same batch, in which every instance appears many
+ * times and over several chunks, through fsm_engine_batch on one
+ * store and fsm_engine_batch_grouped on another.  The grouped 
+ * batch must reorder, yet each instance must see its events in 
+ * the order submitted: the handlers, the final states, the return
+ * codes and the histories of both stores must all be the same.
+ *
+ *    fsm_test_batch
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fsm.h"
+#include "fsm_store.h"
+#include "fsm_test.h"
+
+
+#define TEST_STATES       ( 5 )
+#define TEST_EVENTS       ( 4 )
+#define TEST_INSTANCES    ( 12 )
+#define TEST_ENTRIES      ( 3 * FSM_BATCH_GROUP_MAX + 17 )
+#define TEST_HISTORY      ( 256 )
+
+/* entries seen by the handlers, per store and instance */
+typedef struct {
+    uint32_t   handled;
+    uint32_t   last;
+} test_log_t;
+
+static test_log_t  logs[2][TEST_INSTANCES];
+
+
+/*
+ * the event buffer carries the position of the entry in the 
+ * batch, the parm the log of the instance
+ */
+static RC_FSM_t
+test_handler (void *p2event, void *p2parm)
+{
+    uint32_t position = *(uint32_t *)p2event;
+    test_log_t *log = (test_log_t *)p2parm;
+
+    TEST_CHECK(log->handled == 0 || position > log->last);
+    log->last = position;
+    log->handled++;
+    return (RC_FSM_OK);
+}
+
+
+static void
+test_batch (fsm_store_t *store, uint32_t grouped, 
+            fsm_batch_entry_t *template, RC_FSM_t *rc_out)
+{
+    static uint32_t positions[TEST_ENTRIES];
+    fsm_batch_entry_t batch[TEST_ENTRIES];
+    fsm_batch_stats_t stats;
+    uint32_t i;
+
+    for (i=0; i<TEST_ENTRIES; i++) {
+        positions[i] = i;
+        batch[i] = template[i];
+        batch[i].p2event_buffer = &positions[i];
+        batch[i].p2parm = &logs[grouped][batch[i].instance];
+    }
+
+    if (grouped) {
+        TEST_CHECK(fsm_engine_batch_grouped(store, batch, TEST_ENTRIES, 
+                                            rc_out, &stats) == RC_FSM_OK);
+        TEST_CHECK(stats.entries == TEST_ENTRIES);
+        TEST_CHECK(stats.waves > 1 && stats.reordered > 0);
+    } else {
+        TEST_CHECK(fsm_engine_batch(store, batch, TEST_ENTRIES, 
+                                    rc_out) == RC_FSM_OK);
+    }
+    return;
+}
+
+
+int
+main (int argc, char **argv)
+{
+    static fsm_batch_entry_t template[TEST_ENTRIES];
+    static RC_FSM_t rc_out[2][TEST_ENTRIES];
+    test_tables_t tables;
+    fsm_class_t *fsm_class;
+    fsm_store_t *store[2];
+    uint32_t state[2];
+    uint32_t seed;
+    uint32_t i;
+
+    fsm_class = test_class_create(&tables, TEST_STATES, TEST_EVENTS, 
+                                  test_handler);
+
+    /* mostly a few hot instances, so each one recurs in a chunk */
+    seed = 2009;
+    for (i=0; i<TEST_ENTRIES; i++) {
+        seed = seed * 1103515245 + 12345;
+        template[i].instance = (seed >> 8) % (i % 3 ? 3 : TEST_INSTANCES);
+        template[i].normalized_event = (seed >> 16) % TEST_EVENTS;
+    }
+
+    for (i=0; i<2; i++) {
+        TEST_CHECK(fsm_store_create(&store[i], fsm_class, TEST_INSTANCES, 
+                                    0, TEST_HISTORY) == RC_FSM_OK);
+    }
+
+    test_batch(store[0], 0, template, rc_out[0]);
+    test_batch(store[1], 1, template, rc_out[1]);
+
+    TEST_CHECK(memcmp(rc_out[0], rc_out[1], sizeof(rc_out[0])) == 0);
+    for (i=0; i<TEST_INSTANCES; i++) {
+        TEST_CHECK(logs[0][i].handled == logs[1][i].handled);
+        TEST_CHECK(fsm_store_get_state(store[0], i, &state[0]) == 
+                                                        RC_FSM_OK);
+        TEST_CHECK(fsm_store_get_state(store[1], i, &state[1]) == 
+                                                        RC_FSM_OK);
+        TEST_CHECK(state[0] == state[1]);
+    }
+
+    /* the histories record the transitions of each instance in order */
+    TEST_CHECK(memcmp(store[0]->history_index, store[1]->history_index,
+                      TEST_INSTANCES) == 0);
+    TEST_CHECK(memcmp(store[0]->history, store[1]->history,
+                      TEST_INSTANCES * TEST_HISTORY * 
+                      sizeof(fsm_store_history_t)) == 0);
+
+    for (i=0; i<2; i++) {
+        fsm_store_destroy(&store[i]);
+    }
+    fsm_class_destroy(&fsm_class);
+    test_tables_free(&tables);
+    return (test_report("fsm_test_batch"));
+}
@@ -0,0 +1,117 @@
+/*------------------------------------------------------------------
+ * fsm_test_broadcast.c -- fsm_broadcast delivers per-member parms
+ *
+ * Copyright (c) 2005-2009 by Cisco Systems, Inc.
+ * All rights reserved. 
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *------------------------------------------------------------------
+ */
+
+/*
+ * Moves every third instance of an indexed store to another state
+ * and broadcasts an event to that state with an array of per
+ * instance contexts.  Each member must see exactly the event, 
+ * with its own context, and no other instance any.
+ *
+ *    fsm_test_broadcast
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fsm.h"
+#include "fsm_store.h"
+#include "fsm_test.h"
+
+
+#define TEST_CAPACITY     ( 1000 )
+
+typedef struct {
+    uint32_t   events;
+} test_context_t;
+
+
+static RC_FSM_t
+test_handler (void *p2event, void *p2parm)
+{
+    if (p2parm) {
+        ((test_context_t *)p2parm)->events++;
+    }
+    return (RC_FSM_OK);
+}
+
+
+int
+main (int argc, char **argv)
+{
+    static test_context_t context[TEST_CAPACITY];
+    static void *parms[TEST_CAPACITY];
+    test_tables_t tables;
+    fsm_class_t *fsm_class;
+    fsm_store_t *store;
+    uint32_t members;
+    uint32_t count;
+    uint32_t failed;
+    uint32_t state;
+    uint32_t i;
+
+    fsm_class = test_class_create(&tables, 4, 4, test_handler);
+    TEST_CHECK(fsm_store_create(&store, fsm_class, TEST_CAPACITY, 
+                                0, 0) == RC_FSM_OK);
+    TEST_CHECK(fsm_store_index_states(store) == RC_FSM_OK);
+
+    /* event 1 moves state 0 to state 1 */
+    members = 0;
+    for (i=0; i<TEST_CAPACITY; i+=3) {
+        TEST_CHECK(fsm_store_engine(store, i, 1, NULL, NULL) == RC_FSM_OK);
+        members++;
+    }
+    TEST_CHECK(fsm_store_get_members(store, 1, &count) == RC_FSM_OK &&
+               count == members);
+
+    for (i=0; i<TEST_CAPACITY; i++) {
+        parms[i] = &context[i];
+    }
+
+    /* event 0 stays in the state */
+    TEST_CHECK(fsm_broadcast(store, 1, 0, NULL, parms, 
+                             &count, &failed) == RC_FSM_OK);
+    TEST_CHECK(count == members && failed == 0);
+
+    for (i=0; i<TEST_CAPACITY; i++) {
+        TEST_CHECK(context[i].events == ((i % 3) == 0 ? 1 : 0));
+        TEST_CHECK(fsm_store_get_state(store, i, &state) == RC_FSM_OK &&
+                   state == ((i % 3) == 0 ? 1 : 0));
+    }
+
+    /* without parms the handlers get NULL */
+    TEST_CHECK(fsm_broadcast(store, 1, 0, NULL, NULL, 
+                             &count, &failed) == RC_FSM_OK);
+    TEST_CHECK(count == members && failed == 0);
+    TEST_CHECK(context[0].events == 1);
+
+    fsm_store_destroy(&store);
+    fsm_class_destroy(&fsm_class);
+    test_tables_free(&tables);
+    return (test_report("fsm_test_broadcast"));
+}
@@ -0,0 +1,194 @@
+/*------------------------------------------------------------------
+ * fsm_test_compress.c -- compressed class tables
+ *
+ * Copyright (c) 2005-2009 by Cisco Systems, Inc.
+ * All rights reserved. 
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *------------------------------------------------------------------
+ */
+
+/*
+ * Builds synthetic tables where events past the first few are 
+ * handled alike in every state and half the states repeat the 
+ * rows of the others, so the class merges event classes and 
+ * shares rows, and checks that every (state, event) dispatches to
+ * the handler and next state of the tables.  Then checks that 
+ * square synthetic tables, where no two rows or columns are equal,
+ * keep the state x event matrix and dispatch the same.
+ *
+ *    fsm_test_compress
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fsm.h"
+#include "fsm_test.h"
+
+
+#define TEST_STATES       ( 8 )
+#define TEST_EVENTS       ( 40 )
+
+/* events below this differ per state, the others are alike */
+#define TEST_DISTINCT     ( 8 )
+
+/* states from this one repeat the rows of those before */
+#define TEST_REPEAT       ( 4 )
+
+
+static RC_FSM_t test_h0 (void *, void *);
+static RC_FSM_t test_h1 (void *, void *);
+static RC_FSM_t test_h2 (void *, void *);
+static RC_FSM_t test_h3 (void *, void *);
+
+static event_cb_t test_handlers[] = { test_h0, test_h1, test_h2, test_h3 };
+
+#define TEST_HANDLERS     ( sizeof(test_handlers) / sizeof(event_cb_t) )
+
+/* each handler leaves its address in p2parm */
+static RC_FSM_t
+test_h0 (void *p2event, void *p2parm)
+{
+    *(event_cb_t *)p2parm = test_h0;
+    return (RC_FSM_OK);
+}
+
+static RC_FSM_t
+test_h1 (void *p2event, void *p2parm)
+{
+    *(event_cb_t *)p2parm = test_h1;
+    return (RC_FSM_OK);
+}
+
+static RC_FSM_t
+test_h2 (void *p2event, void *p2parm)
+{
+    *(event_cb_t *)p2parm = test_h2;
+    return (RC_FSM_OK);
+}
+
+static RC_FSM_t
+test_h3 (void *p2event, void *p2parm)
+{
+    *(event_cb_t *)p2parm = test_h3;
+    return (RC_FSM_OK);
+}
+
+
+/*
+ * Every (state, event) of the class against the cell of its table,
+ * the NULL handler leaving the state as it is.
+ */
+static void
+test_dispatch (fsm_class_t *fsm_class, test_tables_t *tables)
+{
+    fsm_instance_t instance;
+    event_tuple_t *tuple;
+    event_cb_t called;
+    uint32_t expected;
+    uint32_t i;
+    uint32_t j;
+
+    for (i=0; i<tables->number_states; i++) {
+        for (j=0; j<tables->number_events; j++) {
+            tuple = &tables->state_table[i].p2event_tuple[j];
+            expected = tuple->event_handler ? tuple->next_state : i;
+
+            called = NULL;
+            TEST_CHECK(fsm_instance_init(&instance, fsm_class, 
+                                         i) == RC_FSM_OK);
+            TEST_CHECK(fsm_instance_engine(&instance, j, NULL, 
+                                           &called) == RC_FSM_OK);
+            if (called != tuple->event_handler || 
+                instance.curr_state != expected) {
+                printf("state %u event %u: state %u, expected %u\n",
+                       i, j, instance.curr_state, expected);
+                test_failures++;
+            }
+        }
+    }
+    return;
+}
+
+
+int
+main (int argc, char **argv)
+{
+    test_tables_t tables;
+    fsm_class_t *fsm_class;
+    fsm_class_layout_t layout;
+    event_tuple_t *tuple;
+    uint32_t row;
+    uint32_t i;
+    uint32_t j;
+
+    if (test_tables_build(&tables, TEST_STATES, TEST_EVENTS, test_h0)) {
+        printf("failed to build the tables\n");
+        return (1);
+    }
+    for (i=0; i<TEST_STATES; i++) {
+        row = i % TEST_REPEAT;
+        for (j=0; j<TEST_EVENTS; j++) {
+            tuple = &tables.state_table[i].p2event_tuple[j];
+            if (j < TEST_DISTINCT) {
+                tuple->event_handler = 
+                    test_handlers[(row + j) % TEST_HANDLERS];
+                tuple->next_state = (row + j) % TEST_STATES;
+            } else {
+                tuple->event_handler = (j & 1) ? NULL : test_h3;
+                tuple->next_state = 0;
+            }
+        }
+    }
+
+    /* the rows of DENSE, AUTO may list some states instead */
+    TEST_CHECK(fsm_class_create(&fsm_class, "compressed", 
+                                tables.state_description,
+                                tables.event_description, 
+                                tables.state_table) == RC_FSM_OK);
+    TEST_CHECK(fsm_class_set_layout(fsm_class, 
+                                    FSM_LAYOUT_DENSE) == RC_FSM_OK);
+    TEST_CHECK(fsm_class_get_layout(fsm_class, &layout) == RC_FSM_OK);
+    TEST_CHECK(layout.number_rows == TEST_REPEAT);
+    TEST_CHECK(layout.number_event_classes == TEST_DISTINCT + 2);
+    TEST_CHECK(layout.number_sparse_states == 0);
+    TEST_CHECK(layout.compressed_bytes < layout.dense_bytes);
+    test_dispatch(fsm_class, &tables);
+    fsm_class_destroy(&fsm_class);
+    test_tables_free(&tables);
+
+    /* nothing to merge or share, the matrix is kept */
+    fsm_class = test_class_create(&tables, TEST_STATES, TEST_DISTINCT, 
+                                  test_h1);
+    TEST_CHECK(fsm_class_set_layout(fsm_class, 
+                                    FSM_LAYOUT_DENSE) == RC_FSM_OK);
+    TEST_CHECK(fsm_class_get_layout(fsm_class, &layout) == RC_FSM_OK);
+    TEST_CHECK(layout.number_rows == TEST_STATES);
+    TEST_CHECK(layout.number_event_classes == TEST_DISTINCT);
+    TEST_CHECK(layout.compressed_bytes == layout.dense_bytes);
+    test_dispatch(fsm_class, &tables);
+    fsm_class_destroy(&fsm_class);
+    test_tables_free(&tables);
+
+    return (test_report("fsm_test_compress"));
+}
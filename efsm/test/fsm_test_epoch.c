@@ -0,0 +1,131 @@
+/*------------------------------------------------------------------
+ * fsm_test_epoch.c -- deferred destroy while a reader is in a section
+ *
+ * Copyright (c) 2005-2009 by Cisco Systems, Inc.
+ * All rights reserved. 
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *------------------------------------------------------------------
+ */
+
+/*
+ * Destroys state machines of a pool with fsm_destroy_deferred 
+ * while another thread is in an fsm_epoch_enter section.  They
+ * must be refused at once, yet stay in the pool until the reader
+ * has left its section and the retired objects are drained.
+ *
+ *    fsm_test_epoch
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "fsm.h"
+#include "fsm_epoch.h"
+#include "fsm_pool.h"
+#include "fsm_test.h"
+
+
+#define TEST_MACHINES     ( 16 )
+
+static volatile int  reader_in;
+static volatile int  reader_out;
+
+
+static RC_FSM_t
+test_handler (void *p2event, void *p2parm)
+{
+    return (RC_FSM_OK);
+}
+
+static void *
+test_reader (void *arg)
+{
+    fsm_epoch_enter();
+    __atomic_store_n(&reader_in, 1, __ATOMIC_RELEASE);
+    while (!__atomic_load_n(&reader_out, __ATOMIC_ACQUIRE)) {
+        ;
+    }
+    fsm_epoch_exit();
+    return (NULL);
+}
+
+
+int
+main (int argc, char **argv)
+{
+    fsm_t *fsm_table[TEST_MACHINES];
+    fsm_t *retired[TEST_MACHINES];
+    fsm_pool_stats_t stats;
+    test_tables_t tables;
+    fsm_class_t *fsm_class;
+    fsm_pool_t *pool;
+    pthread_t reader;
+    uint32_t state;
+    uint32_t i;
+
+    fsm_class = test_class_create(&tables, 2, 2, test_handler);
+    TEST_CHECK(fsm_pool_create(&pool, TEST_MACHINES, TEST_MACHINES, 
+                               0, 0) == RC_FSM_OK);
+    for (i=0; i<TEST_MACHINES; i++) {
+        TEST_CHECK(fsm_create_in_pool(pool, &fsm_table[i], fsm_class, 
+                                      0) == RC_FSM_OK);
+    }
+
+    TEST_CHECK(fsm_destroy_deferred(NULL) == RC_FSM_NULL);
+
+    pthread_create(&reader, NULL, test_reader, NULL);
+    while (!__atomic_load_n(&reader_in, __ATOMIC_ACQUIRE)) {
+        ;
+    }
+
+    for (i=0; i<TEST_MACHINES; i++) {
+        retired[i] = fsm_table[i];
+        TEST_CHECK(fsm_destroy_deferred(&fsm_table[i]) == RC_FSM_OK);
+        TEST_CHECK(fsm_table[i] == NULL);
+    }
+
+    /* invalid at once, but not reclaimed under the reader */
+    fsm_epoch_poll();
+    for (i=0; i<TEST_MACHINES; i++) {
+        TEST_CHECK(fsm_get_state(retired[i], 
+                                 &state) == RC_FSM_INVALID_HANDLE);
+        TEST_CHECK(fsm_destroy_deferred(&retired[i]) == 
+                                         RC_FSM_INVALID_HANDLE);
+        TEST_CHECK(retired[i] != NULL);
+    }
+    TEST_CHECK(fsm_pool_get_stats(pool, &stats) == RC_FSM_OK &&
+               stats.in_use == TEST_MACHINES);
+
+    __atomic_store_n(&reader_out, 1, __ATOMIC_RELEASE);
+    pthread_join(reader, NULL);
+
+    fsm_epoch_drain();
+    TEST_CHECK(fsm_pool_get_stats(pool, &stats) == RC_FSM_OK &&
+               stats.in_use == 0);
+
+    fsm_pool_destroy(&pool);
+    fsm_class_destroy(&fsm_class);
+    test_tables_free(&tables);
+    return (test_report("fsm_test_epoch"));
+}
@@ -0,0 +1,189 @@
+/*------------------------------------------------------------------
+ * fsm_test_executor.c -- ordering and exclusion on the executor
+ *
+ * Copyright (c) 2005-2009 by Cisco Systems, Inc.
+ * All rights reserved. 
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *------------------------------------------------------------------
+ */
+
+/*
+ * Producer threads post numbered events to the mailboxes of many
+ * state machines run by an executor.  Checks that every event is
+ * handled, in the order posted to its state machine, and never by
+ * two workers at once, whatever the stealing.  Also built with 
+ * -fsanitize=thread by make check-tsan.
+ *
+ *    fsm_test_executor [worker count]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "fsm.h"
+#include "fsm_mailbox.h"
+#include "fsm_executor.h"
+#include "fsm_test.h"
+
+
+#define TEST_MACHINES     ( 256 )
+#define TEST_MAILBOX      ( 64 )
+#define TEST_PRODUCERS    ( 4 )
+#define TEST_EVENTS       ( 20000 )
+#define TEST_WORKERS      ( 4 )
+
+/* written by the worker that owns the mailbox, checked at the end */
+typedef struct {
+    uint32_t   running;
+    uint32_t   overlaps;
+    uint64_t   last;
+    uint64_t   out_of_order;
+} test_machine_t;
+
+static test_machine_t    machines[TEST_MACHINES];
+static fsm_t            *fsm_table[TEST_MACHINES];
+static fsm_mailbox_t    *mailbox_table[TEST_MACHINES];
+static fsm_executor_t   *executor;
+static uint64_t          handled;
+
+
+static RC_FSM_t
+test_handler (void *p2event, void *p2parm)
+{
+    test_machine_t *machine = (test_machine_t *)p2parm;
+    uint64_t sequence = (uint64_t)(unsigned long)p2event;
+
+    if (__atomic_add_fetch(&machine->running, 1, __ATOMIC_ACQ_REL) != 1) {
+        __atomic_add_fetch(&machine->overlaps, 1, __ATOMIC_RELAXED);
+    }
+    if (sequence != machine->last + 1) {
+        machine->out_of_order++;
+    }
+    machine->last = sequence;
+    __atomic_sub_fetch(&machine->running, 1, __ATOMIC_ACQ_REL);
+    __atomic_add_fetch(&handled, 1, __ATOMIC_RELEASE);
+    return (RC_FSM_OK);
+}
+
+static event_tuple_t test_events[] =
+    { { 0, test_handler, 0 } };
+
+static state_tuple_t test_table[] =
+    { { 0, test_events },
+      { FSM_NULL_STATE_ID, NULL } };
+
+static state_description_t test_state_names[] =
+    { { 0, "state" },
+      { FSM_NULL_STATE_ID, NULL } };
+
+static event_description_t test_event_names[] =
+    { { 0, "event" },
+      { FSM_NULL_EVENT_ID, NULL } };
+
+
+/*
+ * Each producer posts to its own share of the machines, so the 
+ * sequence of a machine has a single writer.
+ */
+static void *
+test_producer (void *arg)
+{
+    uint64_t sequence[TEST_MACHINES / TEST_PRODUCERS] = { 0 };
+    uint32_t producer = (uint32_t)(unsigned long)arg;
+    uint32_t seed;
+    uint32_t slot;
+    uint32_t index;
+    uint32_t i;
+
+    seed = 2009 + producer;
+    for (i=0; i<TEST_EVENTS; ) {
+        seed = seed * 1103515245 + 12345;
+        slot = (seed >> 8) % (TEST_MACHINES / TEST_PRODUCERS);
+        index = slot * TEST_PRODUCERS + producer;
+
+        if (fsm_executor_post(executor, mailbox_table[index], 0,
+                              (void *)(unsigned long)(sequence[slot] + 1),
+                              &machines[index]) == RC_FSM_OK) {
+            sequence[slot]++;
+            i++;
+        } else {
+            sched_yield();
+        }
+    }
+    return (NULL);
+}
+
+
+int
+main (int argc, char **argv)
+{
+    pthread_t producer_threads[TEST_PRODUCERS];
+    uint32_t number_workers;
+    uint64_t total;
+    uint32_t i;
+
+    number_workers = TEST_WORKERS;
+    if (argc > 1) {
+        number_workers = strtoul(argv[1], NULL, 0);
+    }
+
+    for (i=0; i<TEST_MACHINES; i++) {
+        TEST_CHECK(fsm_create(&fsm_table[i], "executor", 0, 
+                              test_state_names, test_event_names, 
+                              test_table) == RC_FSM_OK);
+        TEST_CHECK(fsm_mailbox_create(&mailbox_table[i], fsm_table[i],
+                                      TEST_MAILBOX) == RC_FSM_OK);
+    }
+    TEST_CHECK(fsm_executor_create(&executor, number_workers, 
+                                   0) == RC_FSM_OK);
+    if (executor == NULL) {
+        return (test_report("fsm_test_executor"));
+    }
+
+    for (i=0; i<TEST_PRODUCERS; i++) {
+        pthread_create(&producer_threads[i], NULL, test_producer, 
+                       (void *)(unsigned long)i);
+    }
+    for (i=0; i<TEST_PRODUCERS; i++) {
+        pthread_join(producer_threads[i], NULL);
+    }
+
+    total = (uint64_t)TEST_PRODUCERS * TEST_EVENTS;
+    while (__atomic_load_n(&handled, __ATOMIC_ACQUIRE) < total) {
+        sched_yield();
+    }
+    TEST_CHECK(fsm_executor_destroy(&executor) == RC_FSM_OK);
+
+    total = 0;
+    for (i=0; i<TEST_MACHINES; i++) {
+        TEST_CHECK(machines[i].overlaps == 0);
+        TEST_CHECK(machines[i].out_of_order == 0);
+        total += machines[i].last;
+        fsm_mailbox_destroy(&mailbox_table[i]);
+        fsm_destroy(&fsm_table[i]);
+    }
+    TEST_CHECK(total == (uint64_t)TEST_PRODUCERS * TEST_EVENTS);
+    return (test_report("fsm_test_executor"));
+}
@@ -0,0 +1,181 @@
+/*------------------------------------------------------------------
+ * fsm_test_history.c -- history policies and on-error promotion
+ *
+ * Copyright (c) 2005-2009 by Cisco Systems, Inc.
+ * All rights reserved. 
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *------------------------------------------------------------------
+ */
+
+/*
+ * Drives state machines under each history policy with events 
+ * numbered by their position.  Checks that OFF records nothing, 
+ * ALL keeps the last depth transitions in order, SAMPLED one in 
+ * every sample, and that ON_ERROR keeps no ring until a handler 
+ * fails, then promotes to a ring that starts with the lead-up of 
+ * the last FSM_HISTORY_LEADUP transitions, the failed one last.
+ *
+ *    fsm_test_history
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fsm.h"
+#include "fsm_test.h"
+
+
+#define TEST_STATES       ( 32 )
+#define TEST_EVENTS       ( 32 )
+#define TEST_DEPTH        ( 8 )
+#define TEST_SAMPLE       ( 3 )
+
+static RC_FSM_t   fail_rc = RC_FSM_NO_RESOURCES;
+
+
+/* the event buffer, when given, holds the code to return */
+static RC_FSM_t
+test_handler (void *p2event, void *p2parm)
+{
+    return (p2event ? *(RC_FSM_t *)p2event : RC_FSM_OK);
+}
+
+
+/* events first to last, numbered by their position */
+static void
+test_run (fsm_t *fsm, uint32_t first, uint32_t last)
+{
+    uint32_t i;
+
+    for (i=first; i<=last; i++) {
+        TEST_CHECK(fsm_engine(fsm, i, NULL, NULL) == RC_FSM_OK);
+    }
+    return;
+}
+
+
+/* the entry back entries before the newest */
+static fsm_history_t *
+test_entry (fsm_t *fsm, uint32_t back)
+{
+    return (&fsm->history[(fsm->history_index - back) & 
+                          fsm->history_mask]);
+}
+
+
+static void
+test_policy (fsm_t *fsm, uint32_t mode, uint32_t depth, uint32_t sample)
+{
+    fsm_history_policy_t policy;
+
+    policy.mode = mode;
+    policy.depth = depth;
+    policy.sample = sample;
+    TEST_CHECK(fsm_set_history_policy(fsm, &policy) == RC_FSM_OK);
+    return;
+}
+
+
+int
+main (int argc, char **argv)
+{
+    fsm_history_policy_t policy;
+    test_tables_t tables;
+    fsm_t *fsm;
+    uint32_t i;
+
+    TEST_CHECK(test_tables_build(&tables, TEST_STATES, TEST_EVENTS, 
+                                 test_handler) == 0);
+    TEST_CHECK(fsm_create(&fsm, "history", 0, tables.state_description,
+                          tables.event_description, 
+                          tables.state_table) == RC_FSM_OK);
+
+    /* bad policies */
+    TEST_CHECK(fsm_set_history_policy(fsm, NULL) == RC_FSM_NULL);
+    policy.mode = FSM_HISTORY_ON_ERROR + 1;
+    policy.depth = TEST_DEPTH;
+    policy.sample = 1;
+    TEST_CHECK(fsm_set_history_policy(fsm, &policy) == 
+                                            RC_FSM_INVALID_ARGUMENT);
+    policy.mode = FSM_HISTORY_ALL;
+    policy.depth = TEST_DEPTH - 1;
+    TEST_CHECK(fsm_set_history_policy(fsm, &policy) == 
+                                            RC_FSM_INVALID_ARGUMENT);
+    policy.mode = FSM_HISTORY_SAMPLED;
+    policy.depth = TEST_DEPTH;
+    policy.sample = 0;
+    TEST_CHECK(fsm_set_history_policy(fsm, &policy) == 
+                                            RC_FSM_INVALID_ARGUMENT);
+
+    /* off */
+    test_policy(fsm, FSM_HISTORY_OFF, 0, 0);
+    test_run(fsm, 1, 10);
+    TEST_CHECK(fsm->history == NULL);
+
+    /* all, the ring holds the last depth events */
+    test_policy(fsm, FSM_HISTORY_ALL, TEST_DEPTH, 0);
+    test_run(fsm, 1, 12);
+    TEST_CHECK(fsm->history && fsm->history_mask == TEST_DEPTH - 1);
+    for (i=0; i<TEST_DEPTH; i++) {
+        TEST_CHECK(test_entry(fsm, i)->eventID == 12 - i);
+    }
+
+    /* sampled, every third event */
+    test_policy(fsm, FSM_HISTORY_SAMPLED, TEST_DEPTH, TEST_SAMPLE);
+    test_run(fsm, 1, 10);
+    TEST_CHECK(fsm->history_index == 3);
+    TEST_CHECK(test_entry(fsm, 0)->eventID == 9);
+    TEST_CHECK(test_entry(fsm, 1)->eventID == 6);
+    TEST_CHECK(test_entry(fsm, 2)->eventID == 3);
+
+    /* on error, only the inline lead-up until a handler fails */
+    test_policy(fsm, FSM_HISTORY_ON_ERROR, TEST_DEPTH, 0);
+    test_run(fsm, 1, 6);
+    TEST_CHECK(fsm->history == NULL);
+    TEST_CHECK(fsm_engine(fsm, 7, &fail_rc, NULL) == fail_rc);
+    TEST_CHECK(fsm->history && fsm->history_mask == TEST_DEPTH - 1);
+    TEST_CHECK(fsm->history_index == FSM_HISTORY_LEADUP);
+    for (i=0; i<FSM_HISTORY_LEADUP; i++) {
+        TEST_CHECK(test_entry(fsm, i)->eventID == 7 - i);
+    }
+    TEST_CHECK(test_entry(fsm, 0)->handler_rc == fail_rc);
+    TEST_CHECK(test_entry(fsm, 1)->handler_rc == RC_FSM_OK);
+
+    /* promoted, every transition is recorded from there on */
+    test_run(fsm, 8, 9);
+    TEST_CHECK(fsm->history_index == FSM_HISTORY_LEADUP + 2);
+    TEST_CHECK(test_entry(fsm, 0)->eventID == 9);
+    TEST_CHECK(test_entry(fsm, 2)->eventID == 7);
+
+    /* a failure before the lead-up is full keeps what there is */
+    test_policy(fsm, FSM_HISTORY_ON_ERROR, TEST_DEPTH, 0);
+    test_run(fsm, 1, 2);
+    TEST_CHECK(fsm_engine(fsm, 3, &fail_rc, NULL) == fail_rc);
+    TEST_CHECK(fsm->history && fsm->history_index == 3);
+    TEST_CHECK(test_entry(fsm, 0)->eventID == 3 &&
+               test_entry(fsm, 2)->eventID == 1);
+
+    fsm_destroy(&fsm);
+    test_tables_free(&tables);
+    return (test_report("fsm_test_history"));
+}
@@ -0,0 +1,185 @@
+/*------------------------------------------------------------------
+ * fsm_test_latency.c -- handler timings land in their histogram
+ *
+ * Copyright (c) 2005-2009 by Cisco Systems, Inc.
+ * All rights reserved. 
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *------------------------------------------------------------------
+ */
+
+/*
+ * Times a slow and a fast handler of a state machine, from the
+ * main thread and from another one.  Checks that each handler's
+ * samples land in its own histogram, by handler and by cell, that
+ * the slow one ranks above the fast one, that nothing is recorded
+ * while timing is off, and that a reset zeroes the histograms.
+ *
+ *    fsm_test_latency
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "fsm.h"
+#include "fsm_latency.h"
+#include "fsm_test.h"
+
+
+#define TEST_SLOW         ( 20 )
+#define TEST_FAST         ( 100 )
+#define TEST_SLOW_USEC    ( 200 )
+
+enum { idle_s, busy_s };
+enum { fast_e, slow_e };
+
+static fsm_t  *fsm;
+
+
+static RC_FSM_t
+test_fast (void *p2event, void *p2parm)
+{
+    return (RC_FSM_OK);
+}
+
+/* spins rather than sleeps, so the time stamp counter runs on */
+static RC_FSM_t
+test_slow (void *p2event, void *p2parm)
+{
+    struct timespec start;
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    do {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    } while ((now.tv_sec - start.tv_sec) * 1000000 + 
+             (now.tv_nsec - start.tv_nsec) / 1000 < TEST_SLOW_USEC);
+    return (RC_FSM_OK);
+}
+
+static RC_FSM_t
+test_unused (void *p2event, void *p2parm)
+{
+    return (RC_FSM_OK);
+}
+
+
+static state_description_t test_states[] =
+    { { idle_s, "idle" },
+      { busy_s, "busy" },
+      { FSM_NULL_STATE_ID, NULL } };
+
+static event_description_t test_event_names[] =
+    { { fast_e, "fast" },
+      { slow_e, "slow" },
+      { FSM_NULL_EVENT_ID, NULL } };
+
+static event_tuple_t idle_events[] =
+    { { fast_e, test_fast, idle_s },
+      { slow_e, test_slow, busy_s } };
+
+static event_tuple_t busy_events[] =
+    { { fast_e, test_fast, idle_s },
+      { slow_e, test_slow, busy_s } };
+
+static state_tuple_t test_table[] =
+    { { idle_s, idle_events },
+      { busy_s, busy_events },
+      { FSM_NULL_STATE_ID, NULL } };
+
+
+static void
+test_run (uint32_t event, uint32_t count)
+{
+    uint32_t i;
+
+    for (i=0; i<count; i++) {
+        TEST_CHECK(fsm_engine(fsm, event, NULL, NULL) == RC_FSM_OK);
+    }
+    return;
+}
+
+
+static void *
+test_thread (void *arg)
+{
+    test_run(slow_e, TEST_SLOW);
+    return (NULL);
+}
+
+
+int
+main (int argc, char **argv)
+{
+    fsm_latency_stats_t slow;
+    fsm_latency_stats_t fast;
+    fsm_latency_stats_t cell;
+    pthread_t thread;
+
+    TEST_CHECK(fsm_create(&fsm, "latency", idle_s, test_states, 
+                          test_event_names, test_table) == RC_FSM_OK);
+
+    TEST_CHECK(fsm_latency_enable(fsm) == RC_FSM_OK);
+    TEST_CHECK(fsm->flags & FSM_FLAG_LATENCY);
+    test_run(slow_e, TEST_SLOW);
+    test_run(fast_e, TEST_FAST);
+
+    TEST_CHECK(fsm_latency_get(fsm->fsm_class, test_slow, 
+                               &slow) == RC_FSM_OK);
+    TEST_CHECK(fsm_latency_get(fsm->fsm_class, test_fast, 
+                               &fast) == RC_FSM_OK);
+    TEST_CHECK(slow.count == TEST_SLOW && fast.count == TEST_FAST);
+    TEST_CHECK(slow.p50 <= slow.p99 && slow.p99 <= slow.p999);
+    TEST_CHECK(slow.p999 <= slow.max && slow.max > 0);
+    TEST_CHECK(slow.p50 > fast.p99);
+    TEST_CHECK(fsm_latency_get(fsm->fsm_class, test_unused, 
+                               &cell) == RC_FSM_INVALID_EVENT_HANDLER);
+
+    /* a cell reports its handler, which every state shares here */
+    TEST_CHECK(fsm_latency_get_cell(fsm->fsm_class, busy_s, slow_e, 
+                                    &cell) == RC_FSM_OK);
+    TEST_CHECK(cell.count == TEST_SLOW && cell.max == slow.max);
+
+    /* the samples of another thread are merged in */
+    TEST_CHECK(pthread_create(&thread, NULL, test_thread, NULL) == 0);
+    TEST_CHECK(pthread_join(thread, NULL) == 0);
+    TEST_CHECK(fsm_latency_get(fsm->fsm_class, test_slow, 
+                               &slow) == RC_FSM_OK);
+    TEST_CHECK(slow.count == 2 * TEST_SLOW);
+
+    /* nothing while off, nothing after a reset */
+    TEST_CHECK(fsm_latency_disable(fsm) == RC_FSM_OK);
+    TEST_CHECK(!(fsm->flags & FSM_FLAG_LATENCY));
+    test_run(slow_e, 1);
+    TEST_CHECK(fsm_latency_get(fsm->fsm_class, test_slow, 
+                               &slow) == RC_FSM_OK);
+    TEST_CHECK(slow.count == 2 * TEST_SLOW);
+    TEST_CHECK(fsm_latency_reset(fsm->fsm_class) == RC_FSM_OK);
+    TEST_CHECK(fsm_latency_get(fsm->fsm_class, test_slow, 
+                               &slow) == RC_FSM_OK);
+    TEST_CHECK(slow.count == 0);
+
+    fsm_destroy(&fsm);
+    return (test_report("fsm_test_latency"));
+}
@@ -0,0 +1,296 @@
+/*------------------------------------------------------------------
+ * fsm_test_layout.c -- layout modes of a class
+ *
+ * Copyright (c) 2005-2009 by Cisco Systems, Inc.
+ * All rights reserved. 
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *------------------------------------------------------------------
+ */
+
+/*
+ * Builds a class too large for the rows to fit the cache, of 
+ * states handling every event, states handling a few off a default
+ * and states declaring just those few with FSM_EVENTS_SPARSE, so 
+ * FSM_LAYOUT_AUTO mixes rows and lists.  Checks that every 
+ * (state, event) dispatches the same under each layout mode, that
+ * the FSM_LAYOUT_FORCE_ flags hold against the mode, and that a 
+ * state forced both ways or an unknown mode is refused.
+ *
+ *    fsm_test_layout
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fsm.h"
+#include "fsm_test.h"
+
+
+#define TEST_STATES       ( 64 )
+#define TEST_EVENTS       ( 256 )
+
+/* events handled by the states that do not handle them all */
+#define TEST_HANDLED      ( 4 )
+
+/* of each 8 states, the first handles every event, the fifth declares */
+#define TEST_FULL(i)      ( ((i) & 7) == 0 )
+#define TEST_DECLARED(i)  ( ((i) & 7) == 4 )
+
+/* a state of the few, forced to rows, and a full one forced to a list */
+#define TEST_FORCE_DENSE  ( 1 )
+#define TEST_FORCE_SPARSE ( 8 )
+
+
+static RC_FSM_t test_h0 (void *, void *);
+static RC_FSM_t test_h1 (void *, void *);
+static RC_FSM_t test_h2 (void *, void *);
+static RC_FSM_t test_h3 (void *, void *);
+static RC_FSM_t test_ignore (void *, void *);
+
+static event_cb_t test_handlers[] = { test_h0, test_h1, test_h2, test_h3 };
+
+/* each handler leaves its address in p2parm */
+static RC_FSM_t
+test_h0 (void *p2event, void *p2parm)
+{
+    *(event_cb_t *)p2parm = test_h0;
+    return (RC_FSM_OK);
+}
+
+static RC_FSM_t
+test_h1 (void *p2event, void *p2parm)
+{
+    *(event_cb_t *)p2parm = test_h1;
+    return (RC_FSM_OK);
+}
+
+static RC_FSM_t
+test_h2 (void *p2event, void *p2parm)
+{
+    *(event_cb_t *)p2parm = test_h2;
+    return (RC_FSM_OK);
+}
+
+static RC_FSM_t
+test_h3 (void *p2event, void *p2parm)
+{
+    *(event_cb_t *)p2parm = test_h3;
+    return (RC_FSM_OK);
+}
+
+static RC_FSM_t
+test_ignore (void *p2event, void *p2parm)
+{
+    *(event_cb_t *)p2parm = test_ignore;
+    return (RC_FSM_OK);
+}
+
+
+/*
+ * the handler and next state of (state, event): the full states 
+ * take every event to another state, the others TEST_HANDLED 
+ * events and ignore the rest in the state
+ */
+static void
+test_expect (uint32_t state, uint32_t event, event_cb_t *handler,
+             uint32_t *next_state)
+{
+    uint32_t k;
+
+    if (TEST_FULL(state)) {
+        *handler = test_handlers[event % TEST_HANDLED];
+        *next_state = (state + event) % TEST_STATES;
+        return;
+    }
+
+    for (k=0; k<TEST_HANDLED; k++) {
+        if (event == (state * 7 + k * 13) % TEST_EVENTS) {
+            *handler = test_handlers[k];
+            *next_state = (state + k + 1) % TEST_STATES;
+            return;
+        }
+    }
+    *handler = test_ignore;
+    *next_state = state;
+    return;
+}
+
+
+/*
+ * the event table of a state, written in place of the one of 
+ * test_tables_build, as a list for the declared states
+ */
+static void
+test_state_build (test_tables_t *tables, uint32_t state)
+{
+    event_tuple_t *event_ptr;
+    event_cb_t handler;
+    uint32_t next_state;
+    uint32_t j;
+
+    event_ptr = tables->state_table[state].p2event_tuple;
+    for (j=0; j<TEST_EVENTS; j++) {
+        test_expect(state, j, &handler, &next_state);
+        if (TEST_DECLARED(state) && handler == test_ignore) {
+            continue;
+        }
+        event_ptr->eventID = j;
+        event_ptr->event_handler = handler;
+        event_ptr->next_state = next_state;
+        event_ptr++;
+    }
+
+    if (TEST_DECLARED(state)) {
+        event_ptr->eventID = FSM_DEFAULT_EVENT_ID;
+        event_ptr->event_handler = test_ignore;
+        event_ptr->next_state = FSM_SAME_STATE;
+        event_ptr++;
+        event_ptr->eventID = FSM_NULL_EVENT_ID;
+        tables->state_table[state].event_flags = FSM_EVENTS_SPARSE;
+    }
+    return;
+}
+
+
+static void
+test_dispatch (fsm_class_t *fsm_class, const char *mode)
+{
+    fsm_instance_t instance;
+    event_cb_t called;
+    event_cb_t handler;
+    uint32_t next_state;
+    uint32_t i;
+    uint32_t j;
+
+    for (i=0; i<TEST_STATES; i++) {
+        for (j=0; j<TEST_EVENTS; j++) {
+            test_expect(i, j, &handler, &next_state);
+
+            called = NULL;
+            fsm_instance_init(&instance, fsm_class, i);
+            if (fsm_instance_engine(&instance, j, NULL, 
+                                    &called) != RC_FSM_OK ||
+                called != handler || instance.curr_state != next_state) {
+                printf("%s: state %u event %u reached %u, expected %u\n",
+                       mode, i, j, instance.curr_state, next_state);
+                test_failures++;
+            }
+        }
+    }
+    return;
+}
+
+
+static uint32_t
+test_state_layout (fsm_class_t *fsm_class, uint32_t state)
+{
+    fsm_state_layout_t layout;
+
+    TEST_CHECK(fsm_class_get_state_layout(fsm_class, state, 
+                                          &layout) == RC_FSM_OK);
+    return (layout.layout);
+}
+
+
+int
+main (int argc, char **argv)
+{
+    static const char *mode_names[] = 
+        { "auto", "dense", "sparse", "declared" };
+    test_tables_t tables;
+    fsm_class_t *fsm_class;
+    fsm_class_layout_t layout;
+    uint32_t mode;
+    uint32_t i;
+
+    if (test_tables_build(&tables, TEST_STATES, TEST_EVENTS, test_h0)) {
+        printf("failed to build the tables\n");
+        return (1);
+    }
+    for (i=0; i<TEST_STATES; i++) {
+        test_state_build(&tables, i);
+    }
+
+    /* a state cannot be forced both ways */
+    tables.state_table[TEST_FORCE_DENSE].event_flags = 
+                       FSM_LAYOUT_FORCE_DENSE | FSM_LAYOUT_FORCE_SPARSE;
+    TEST_CHECK(fsm_class_create(&fsm_class, "layout", 
+                                tables.state_description,
+                                tables.event_description, 
+                                tables.state_table) == 
+                                          RC_FSM_INVALID_STATE_TABLE);
+
+    tables.state_table[TEST_FORCE_DENSE].event_flags = 
+                                                 FSM_LAYOUT_FORCE_DENSE;
+    tables.state_table[TEST_FORCE_SPARSE].event_flags = 
+                                                 FSM_LAYOUT_FORCE_SPARSE;
+    TEST_CHECK(fsm_class_create(&fsm_class, "layout", 
+                                tables.state_description,
+                                tables.event_description, 
+                                tables.state_table) == RC_FSM_OK);
+
+    /* AUTO mixes both forms here */
+    TEST_CHECK(fsm_class_get_layout(fsm_class, &layout) == RC_FSM_OK);
+    TEST_CHECK(layout.layout_mode == FSM_LAYOUT_AUTO);
+    TEST_CHECK(layout.number_sparse_states > 0 && 
+               layout.number_sparse_states < TEST_STATES);
+
+    for (mode=FSM_LAYOUT_AUTO; mode<=FSM_LAYOUT_DECLARED; mode++) {
+        TEST_CHECK(fsm_class_set_layout(fsm_class, mode) == RC_FSM_OK);
+        test_dispatch(fsm_class, mode_names[mode]);
+
+        TEST_CHECK(test_state_layout(fsm_class, TEST_FORCE_DENSE) == 
+                                                FSM_STATE_LAYOUT_DENSE);
+        TEST_CHECK(test_state_layout(fsm_class, TEST_FORCE_SPARSE) == 
+                                                FSM_STATE_LAYOUT_SPARSE);
+    }
+
+    /* the modes themselves, the forced states aside */
+    TEST_CHECK(fsm_class_set_layout(fsm_class, 
+                                    FSM_LAYOUT_DENSE) == RC_FSM_OK);
+    TEST_CHECK(fsm_class_get_layout(fsm_class, &layout) == RC_FSM_OK);
+    TEST_CHECK(layout.number_sparse_states == 1);
+
+    TEST_CHECK(fsm_class_set_layout(fsm_class, 
+                                    FSM_LAYOUT_SPARSE) == RC_FSM_OK);
+    TEST_CHECK(fsm_class_get_layout(fsm_class, &layout) == RC_FSM_OK);
+    TEST_CHECK(layout.number_sparse_states == TEST_STATES - 1);
+
+    TEST_CHECK(fsm_class_set_layout(fsm_class, 
+                                    FSM_LAYOUT_DECLARED) == RC_FSM_OK);
+    TEST_CHECK(fsm_class_get_layout(fsm_class, &layout) == RC_FSM_OK);
+    TEST_CHECK(layout.number_sparse_states == TEST_STATES / 8 + 1);
+    TEST_CHECK(test_state_layout(fsm_class, 4) == FSM_STATE_LAYOUT_SPARSE);
+    TEST_CHECK(test_state_layout(fsm_class, 2) == FSM_STATE_LAYOUT_DENSE);
+
+    /* an unknown mode leaves the class as it was */
+    TEST_CHECK(fsm_class_set_layout(fsm_class, FSM_LAYOUT_DECLARED + 1) == 
+                                                 RC_FSM_INVALID_ARGUMENT);
+    TEST_CHECK(fsm_class_get_layout(fsm_class, &layout) == RC_FSM_OK);
+    TEST_CHECK(layout.layout_mode == FSM_LAYOUT_DECLARED);
+    test_dispatch(fsm_class, "declared");
+
+    fsm_class_destroy(&fsm_class);
+    test_tables_free(&tables);
+    return (test_report("fsm_test_layout"));
+}
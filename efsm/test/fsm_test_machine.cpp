@@ -0,0 +1,180 @@
+/*------------------------------------------------------------------
+ * fsm_test_machine.cpp -- the C++ front-end against the C engine
+ *
+ * Copyright (c) 2005-2009 by Cisco Systems, Inc.
+ * All rights reserved. 
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *------------------------------------------------------------------
+ */
+
+/*
+ * Builds an efsm::machine of lambdas, a function object, a plain
+ * function and efsm::none, and drives one instance with its engine
+ * and another with fsm_instance_engine on the C tables it built.
+ * Both must agree on every return code, state and handler call, 
+ * exception states included.
+ *
+ * Built with one of the TEST_BAD_ macros the table is wrong, and
+ * make check expects a static_assert to refuse it.
+ *
+ *    fsm_test_machine
+ */
+
+#include "fsm.hpp"
+#include "fsm_test.h"
+
+
+#define TEST_EVENTS       ( 100000 )
+
+enum class test_state { idle, wait, established };
+enum class test_event { open, ack, close };
+
+static uint32_t  plain_calls;
+
+static RC_FSM_t
+test_plain (void *p2event, void *p2parm)
+{
+    plain_calls++;
+    return (RC_FSM_OK);
+}
+
+struct test_refuse {
+    RC_FSM_t 
+    operator() (void *p2event, void *p2parm) const
+    {
+        return (RC_FSM_IGNORE_EVENT);
+    }
+};
+
+static constexpr auto test_count = [](void *p2event, void *p2parm) {
+    ++*static_cast<uint32_t *>(p2parm);
+    return (RC_FSM_OK);
+};
+
+
+static constexpr auto states = efsm::names(
+#ifdef TEST_BAD_ORDER
+    efsm::name(test_state::wait, "Wait"),
+    efsm::name(test_state::idle, "Idle"),
+#else
+    efsm::name(test_state::idle, "Idle"),
+    efsm::name(test_state::wait, "Wait"),
+#endif
+    efsm::name(test_state::established, "Established"));
+
+static constexpr auto events = efsm::names(
+    efsm::name(test_event::open, "Open"),
+    efsm::name(test_event::ack, "Ack"),
+    efsm::name(test_event::close, "Close"));
+
+static constexpr auto rows = efsm::rows(
+#ifndef TEST_BAD_MISSING
+    efsm::transition(test_state::idle, test_event::open, test_count, 
+                     test_state::wait),
+#endif
+    efsm::transition(test_state::idle, test_event::ack, efsm::none, 
+                     test_state::established),
+    efsm::transition(test_state::idle, test_event::close, test_plain,
+                     test_state::idle),
+    efsm::transition(test_state::wait, test_event::open, test_refuse { },
+                     test_state::established),
+    efsm::transition(test_state::wait, test_event::ack, test_count, 
+                     test_state::established),
+    efsm::transition(test_state::wait, test_event::close, test_plain,
+                     test_state::idle),
+#ifdef TEST_BAD_TWICE
+    efsm::transition(test_state::wait, test_event::close, test_plain,
+                     test_state::idle),
+#endif
+#ifdef TEST_BAD_RANGE
+    efsm::transition(test_state::established, test_event::open, 
+                     test_plain, static_cast<test_state>(7)),
+#else
+    efsm::transition(test_state::established, test_event::open, 
+                     test_plain, test_state::established),
+#endif
+    efsm::transition(test_state::established, test_event::ack, 
+                     test_count, test_state::established),
+    efsm::transition(test_state::established, test_event::close, 
+                     [](void *, void *) { return RC_FSM_STOP_PROCESSING; },
+                     test_state::idle));
+
+using test_machine = efsm::machine<states, events, rows>;
+
+
+int
+main (int argc, char **argv)
+{
+    fsm_instance_t cxx_instance;
+    fsm_instance_t c_instance;
+    fsm_class_t *fsm_class;
+    fsm_t *fsm;
+    uint32_t cxx_count;
+    uint32_t c_count;
+    uint32_t count;
+    uint32_t state;
+    uint32_t seed;
+    test_event event;
+    uint32_t i;
+
+    TEST_CHECK(test_machine::class_create(&fsm_class, "test") == RC_FSM_OK);
+    TEST_CHECK(fsm_instance_init(&cxx_instance, fsm_class, 0) == RC_FSM_OK);
+    TEST_CHECK(fsm_instance_init(&c_instance, fsm_class, 0) == RC_FSM_OK);
+
+    cxx_count = 0;
+    c_count = 0;
+    seed = 2009;
+    for (i=0; i<TEST_EVENTS; i++) {
+        seed = seed * 1103515245 + 12345;
+        event = static_cast<test_event>((seed >> 16) % 3);
+
+        if (i % 1000 == 0) {
+            fsm_instance_set_exception_state(&cxx_instance, 2);
+            fsm_instance_set_exception_state(&c_instance, 2);
+        }
+        TEST_CHECK(test_machine::engine(&cxx_instance, event, NULL, 
+                                        &cxx_count) ==
+                   fsm_instance_engine(&c_instance, 
+                                       static_cast<uint32_t>(event), 
+                                       NULL, &c_count));
+        TEST_CHECK(cxx_instance.curr_state == c_instance.curr_state);
+    }
+    TEST_CHECK(cxx_count == c_count && cxx_count != 0);
+    TEST_CHECK(plain_calls != 0);
+
+    TEST_CHECK(test_machine::engine(&cxx_instance, 
+                                    static_cast<test_event>(9), 
+                                    NULL, NULL) == RC_FSM_INVALID_EVENT);
+
+    /* a state machine of the C library on the same tables */
+    TEST_CHECK(test_machine::create(&fsm, test_state::idle) == RC_FSM_OK);
+    count = 0;
+    TEST_CHECK(fsm_engine(fsm, 0, NULL, &count) == RC_FSM_OK && 
+               count == 1);
+    TEST_CHECK(fsm_get_state(fsm, &state) == RC_FSM_OK && 
+               state == static_cast<uint32_t>(test_state::wait));
+
+    fsm_destroy(&fsm);
+    fsm_class_destroy(&fsm_class);
+    return (test_report("fsm_test_machine"));
+}
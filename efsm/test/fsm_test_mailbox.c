@@ -0,0 +1,217 @@
+/*------------------------------------------------------------------
+ * fsm_test_mailbox.c -- concurrent posts and drains of a mailbox
+ *
+ * Copyright (c) 2005-2009 by Cisco Systems, Inc.
+ * All rights reserved. 
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *------------------------------------------------------------------
+ */
+
+/*
+ * Producer threads post numbered events to one mailbox while 
+ * consumer threads drain it whenever a post says to schedule a 
+ * drain.  Checks that no event is lost, that the events of each
+ * producer are handled in the order posted, and that a drain is
+ * never scheduled while another is due or running.  Also built 
+ * with -fsanitize=thread by make check-tsan.
+ *
+ *    fsm_test_mailbox
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "fsm.h"
+#include "fsm_mailbox.h"
+#include "fsm_test.h"
+
+
+#define TEST_PRODUCERS    ( 4 )
+#define TEST_CONSUMERS    ( 2 )
+#define TEST_EVENTS       ( 20000 )
+#define TEST_MAILBOX      ( 64 )
+#define TEST_DRAIN        ( 16 )
+
+typedef struct {
+    uint64_t   last;
+    uint64_t   out_of_order;
+} test_producer_t;
+
+static test_producer_t   producers[TEST_PRODUCERS];
+static fsm_mailbox_t    *mailbox;
+
+/* handlers running now, more than one is a double drain */
+static uint32_t          running;
+static uint32_t          overlaps;
+static uint64_t          handled;
+
+/* drains scheduled and not yet taken by a consumer */
+static pthread_mutex_t   lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t    cond = PTHREAD_COND_INITIALIZER;
+static uint32_t          due;
+static uint32_t          double_schedules;
+static boolean_t         done;
+
+
+static RC_FSM_t
+test_handler (void *p2event, void *p2parm)
+{
+    test_producer_t *producer = (test_producer_t *)p2parm;
+    uint64_t sequence = (uint64_t)(unsigned long)p2event;
+
+    if (__atomic_add_fetch(&running, 1, __ATOMIC_ACQ_REL) != 1) {
+        __atomic_add_fetch(&overlaps, 1, __ATOMIC_RELAXED);
+    }
+    if (sequence != producer->last + 1) {
+        producer->out_of_order++;
+    }
+    producer->last = sequence;
+    __atomic_add_fetch(&handled, 1, __ATOMIC_RELEASE);
+    __atomic_sub_fetch(&running, 1, __ATOMIC_ACQ_REL);
+    return (RC_FSM_OK);
+}
+
+static event_tuple_t test_events[] =
+    { { 0, test_handler, 0 } };
+
+static state_tuple_t test_table[] =
+    { { 0, test_events },
+      { FSM_NULL_STATE_ID, NULL } };
+
+static state_description_t test_state_names[] =
+    { { 0, "state" },
+      { FSM_NULL_STATE_ID, NULL } };
+
+static event_description_t test_event_names[] =
+    { { 0, "event" },
+      { FSM_NULL_EVENT_ID, NULL } };
+
+
+static void *
+test_producer (void *arg)
+{
+    test_producer_t *producer = (test_producer_t *)arg;
+    boolean_t schedule;
+    uint64_t i;
+
+    for (i=1; i<=TEST_EVENTS; ) {
+        if (fsm_mailbox_post(mailbox, 0, (void *)(unsigned long)i, 
+                             producer, &schedule) != RC_FSM_OK) {
+            sched_yield();
+            continue;
+        }
+        i++;
+        if (schedule) {
+            pthread_mutex_lock(&lock);
+            if (due) {
+                double_schedules++;
+            }
+            due++;
+            pthread_cond_signal(&cond);
+            pthread_mutex_unlock(&lock);
+        }
+    }
+    return (NULL);
+}
+
+static void *
+test_consumer (void *arg)
+{
+    boolean_t reschedule;
+    uint32_t drained;
+
+    for (;;) {
+        pthread_mutex_lock(&lock);
+        while (!due && !done) {
+            pthread_cond_wait(&cond, &lock);
+        }
+        if (!due) {
+            pthread_mutex_unlock(&lock);
+            break;
+        }
+        due--;
+        pthread_mutex_unlock(&lock);
+
+        /* drain in small batches, keeping the flag in between */
+        do {
+            fsm_mailbox_drain(mailbox, TEST_DRAIN, &reschedule, &drained);
+        } while (reschedule);
+    }
+    return (NULL);
+}
+
+
+int
+main (int argc, char **argv)
+{
+    pthread_t producer_threads[TEST_PRODUCERS];
+    pthread_t consumer_threads[TEST_CONSUMERS];
+    fsm_mailbox_stats_t stats;
+    fsm_t *fsm;
+    uint32_t i;
+
+    TEST_CHECK(fsm_create(&fsm, "mailbox", 0, test_state_names, 
+                          test_event_names, test_table) == RC_FSM_OK);
+    TEST_CHECK(fsm_mailbox_create(&mailbox, fsm, 
+                                  TEST_MAILBOX) == RC_FSM_OK);
+
+    for (i=0; i<TEST_CONSUMERS; i++) {
+        pthread_create(&consumer_threads[i], NULL, test_consumer, NULL);
+    }
+    for (i=0; i<TEST_PRODUCERS; i++) {
+        pthread_create(&producer_threads[i], NULL, test_producer, 
+                       &producers[i]);
+    }
+    for (i=0; i<TEST_PRODUCERS; i++) {
+        pthread_join(producer_threads[i], NULL);
+    }
+    while (__atomic_load_n(&handled, __ATOMIC_ACQUIRE) < 
+                                   (uint64_t)TEST_PRODUCERS * TEST_EVENTS) {
+        sched_yield();
+    }
+
+    pthread_mutex_lock(&lock);
+    done = TRUE;
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&lock);
+    for (i=0; i<TEST_CONSUMERS; i++) {
+        pthread_join(consumer_threads[i], NULL);
+    }
+
+    TEST_CHECK(overlaps == 0);
+    TEST_CHECK(double_schedules == 0);
+    for (i=0; i<TEST_PRODUCERS; i++) {
+        TEST_CHECK(producers[i].last == TEST_EVENTS);
+        TEST_CHECK(producers[i].out_of_order == 0);
+    }
+    TEST_CHECK(fsm_mailbox_get_stats(mailbox, &stats) == RC_FSM_OK);
+    TEST_CHECK(stats.depth == 0);
+    TEST_CHECK(stats.posted == (uint64_t)TEST_PRODUCERS * TEST_EVENTS);
+    TEST_CHECK(stats.drained == stats.posted);
+
+    fsm_mailbox_destroy(&mailbox);
+    fsm_destroy(&fsm);
+    return (test_report("fsm_test_mailbox"));
+}
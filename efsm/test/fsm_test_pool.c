@@ -0,0 +1,217 @@
+/*------------------------------------------------------------------
+ * fsm_test_pool.c -- pool create, caches, stats and destroy
+ *
+ * Copyright (c) 2005-2009 by Cisco Systems, Inc.
+ * All rights reserved. 
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *------------------------------------------------------------------
+ */
+
+/*
+ * Creates and destroys state machines in a pool.  Checks that the
+ * thread free list refills from the pool in batches and hands a
+ * batch back when it overflows, that no object is lost between 
+ * the lists, that a thread's free objects go back to the pool when
+ * it exits, the occupancy and fragmentation figures, and that a 
+ * pool with live state machines is not destroyed.
+ *
+ *    fsm_test_pool
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "fsm.h"
+#include "fsm_pool.h"
+#include "fsm_test.h"
+
+
+#define TEST_SLAB         ( 64 )
+#define TEST_MACHINES     ( 130 )
+
+static fsm_pool_t   *pool;
+static fsm_class_t  *fsm_class;
+
+
+static RC_FSM_t
+test_handler (void *p2event, void *p2parm)
+{
+    return (RC_FSM_OK);
+}
+
+
+/*
+ * every object is live, on the shared free list or on a thread
+ * free list
+ */
+static void
+test_accounted (fsm_pool_stats_t *stats)
+{
+    TEST_CHECK(fsm_pool_get_stats(pool, stats) == RC_FSM_OK);
+    TEST_CHECK(stats->in_use + stats->cached + pool->free_count == 
+               stats->capacity);
+    return;
+}
+
+
+static void
+test_create (void)
+{
+    fsm_pool_stats_t stats;
+
+    TEST_CHECK(fsm_pool_create(NULL, 0, 0, 0, 0) == RC_FSM_NULL);
+    TEST_CHECK(fsm_pool_create(&pool, 0, 0, FSM_HISTORY_MAX_DEPTH + 1, 
+                               0) == RC_FSM_INVALID_ARGUMENT);
+
+    TEST_CHECK(fsm_pool_create(&pool, TEST_SLAB, 2 * TEST_SLAB, 4, 
+                               0) == RC_FSM_OK);
+    TEST_CHECK(fsm_pool_get_stats(pool, &stats) == RC_FSM_OK);
+    TEST_CHECK(stats.slabs == 2 && stats.capacity == 2 * TEST_SLAB);
+    TEST_CHECK(stats.in_use == 0 && stats.cached == 0);
+    TEST_CHECK(stats.object_size % FSM_CACHE_LINE == 0);
+    TEST_CHECK(stats.bytes_reserved >= 
+               (uint64_t)stats.capacity * stats.object_size);
+    return;
+}
+
+
+static void
+test_caches (void)
+{
+    static fsm_t *fsm[TEST_MACHINES];
+    fsm_pool_stats_t stats;
+    uint32_t i;
+
+    /* the first create refills the thread list with a batch */
+    TEST_CHECK(fsm_create_in_pool(pool, &fsm[0], fsm_class, 
+                                  0) == RC_FSM_OK);
+    test_accounted(&stats);
+    TEST_CHECK(stats.in_use == 1);
+    TEST_CHECK(stats.cached == FSM_POOL_CACHE_BATCH - 1);
+
+    /* past the preallocated slabs the pool grows */
+    for (i=1; i<TEST_MACHINES; i++) {
+        TEST_CHECK(fsm_create_in_pool(pool, &fsm[i], fsm_class, 
+                                      i % 4) == RC_FSM_OK);
+    }
+    test_accounted(&stats);
+    TEST_CHECK(stats.in_use == TEST_MACHINES);
+    TEST_CHECK(stats.slabs == 3 && stats.capacity == 3 * TEST_SLAB);
+    TEST_CHECK(stats.cached < FSM_POOL_CACHE_BATCH);
+
+    /* destroys overflow the thread list back to the pool */
+    for (i=0; i<TEST_MACHINES; i++) {
+        TEST_CHECK(fsm_destroy(&fsm[i]) == RC_FSM_OK);
+        TEST_CHECK(fsm_pool_get_stats(pool, &stats) == RC_FSM_OK);
+        TEST_CHECK(stats.cached <= FSM_POOL_CACHE_MAX);
+    }
+    test_accounted(&stats);
+    TEST_CHECK(stats.in_use == 0 && pool->free_count > 0);
+    return;
+}
+
+
+static void *
+test_thread (void *arg)
+{
+    fsm_t *fsm;
+
+    TEST_CHECK(fsm_create_in_pool(pool, &fsm, fsm_class, 0) == RC_FSM_OK);
+    TEST_CHECK(fsm_destroy(&fsm) == RC_FSM_OK);
+    return (NULL);
+}
+
+
+static void
+test_thread_exit (void)
+{
+    fsm_pool_stats_t before;
+    fsm_pool_stats_t after;
+    pthread_t thread;
+
+    test_accounted(&before);
+    TEST_CHECK(pthread_create(&thread, NULL, test_thread, NULL) == 0);
+    TEST_CHECK(pthread_join(thread, NULL) == 0);
+    test_accounted(&after);
+    TEST_CHECK(after.cached == before.cached);
+    TEST_CHECK(after.capacity == before.capacity);
+    return;
+}
+
+
+static void
+test_stats_and_destroy (void)
+{
+    fsm_t *fsm[TEST_SLAB];
+    fsm_pool_stats_t stats;
+    uint32_t i;
+
+    /* a fresh pool hands out the first slab whole */
+    TEST_CHECK(fsm_pool_create(&pool, TEST_SLAB, 2 * TEST_SLAB, 0, 
+                               0) == RC_FSM_OK);
+    for (i=0; i<TEST_SLAB; i++) {
+        TEST_CHECK(fsm_create_in_pool(pool, &fsm[i], fsm_class, 
+                                      0) == RC_FSM_OK);
+    }
+    TEST_CHECK(fsm_pool_get_stats(pool, &stats) == RC_FSM_OK);
+    TEST_CHECK(stats.occupancy == 50 && stats.fragmentation == 0);
+
+    /* one hole in a live slab strands one of the free objects */
+    TEST_CHECK(fsm_destroy(&fsm[0]) == RC_FSM_OK);
+    TEST_CHECK(fsm_pool_get_stats(pool, &stats) == RC_FSM_OK);
+    TEST_CHECK(stats.fragmentation == 100 / (TEST_SLAB + 1));
+
+    /* refused while any state machine is live, and left usable */
+    TEST_CHECK(fsm_pool_destroy(&pool) == RC_FSM_INVALID_ARGUMENT && 
+               pool != NULL);
+    TEST_CHECK(fsm_create_in_pool(pool, &fsm[0], fsm_class, 
+                                  0) == RC_FSM_OK);
+    for (i=0; i<TEST_SLAB - 1; i++) {
+        TEST_CHECK(fsm_destroy(&fsm[i]) == RC_FSM_OK);
+    }
+    TEST_CHECK(fsm_pool_destroy(&pool) == RC_FSM_INVALID_ARGUMENT);
+    TEST_CHECK(fsm_destroy(&fsm[TEST_SLAB - 1]) == RC_FSM_OK);
+    TEST_CHECK(fsm_pool_destroy(&pool) == RC_FSM_OK && pool == NULL);
+    return;
+}
+
+
+int
+main (int argc, char **argv)
+{
+    test_tables_t tables;
+
+    fsm_class = test_class_create(&tables, 4, 4, test_handler);
+
+    test_create();
+    test_caches();
+    test_thread_exit();
+    TEST_CHECK(fsm_pool_destroy(&pool) == RC_FSM_OK && pool == NULL);
+
+    test_stats_and_destroy();
+
+    fsm_class_destroy(&fsm_class);
+    test_tables_free(&tables);
+    return (test_report("fsm_test_pool"));
+}
@@ -0,0 +1,185 @@
+/*------------------------------------------------------------------
+ * fsm_test_population.c -- state populations and dwell times
+ *
+ * Copyright (c) 2005-2009 by Cisco Systems, Inc.
+ * All rights reserved. 
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *------------------------------------------------------------------
+ */
+
+/*
+ * Keeps the population of a class with dwell times while state 
+ * machines of a pool and instances of a store come, move and go.
+ * Checks that the counts follow each transition to another state
+ * and not those to the same state, that a stay is recorded when a
+ * state is left, and that state machines created before the
+ * population was enabled are counted once tracked, once only.
+ *
+ *    fsm_test_population
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fsm.h"
+#include "fsm_pool.h"
+#include "fsm_store.h"
+#include "fsm_population.h"
+#include "fsm_test.h"
+
+
+#define TEST_STATES       ( 4 )
+#define TEST_EVENTS       ( 4 )
+#define TEST_EARLY        ( 2 )
+#define TEST_MACHINES     ( 5 )
+#define TEST_INSTANCES    ( 10 )
+
+static fsm_class_t  *fsm_class;
+
+
+static RC_FSM_t
+test_handler (void *p2event, void *p2parm)
+{
+    return (RC_FSM_OK);
+}
+
+
+/* the populations of states 0 to 3 are a, b, c and d */
+static void
+test_expect (uint64_t a, uint64_t b, uint64_t c, uint64_t d, int line)
+{
+    uint64_t expected[TEST_STATES];
+    uint64_t population;
+    uint32_t i;
+
+    expected[0] = a;
+    expected[1] = b;
+    expected[2] = c;
+    expected[3] = d;
+    for (i=0; i<TEST_STATES; i++) {
+        if (fsm_population_get(fsm_class, i, &population) != RC_FSM_OK ||
+            population != expected[i]) {
+            printf("line %d: state %u population %llu, expected %llu\n",
+                   line, i, (unsigned long long)population, 
+                   (unsigned long long)expected[i]);
+            test_failures++;
+        }
+    }
+    return;
+}
+
+
+static uint64_t
+test_stays (uint32_t state)
+{
+    fsm_dwell_stats_t stats;
+
+    TEST_CHECK(fsm_dwell_get(fsm_class, state, &stats) == RC_FSM_OK);
+    return (stats.count);
+}
+
+
+int
+main (int argc, char **argv)
+{
+    test_tables_t tables;
+    fsm_pool_t *pool;
+    fsm_store_t *store;
+    fsm_t *fsm[TEST_MACHINES];
+    fsm_t *untracked;
+    uint32_t i;
+
+    fsm_class = test_class_create(&tables, TEST_STATES, TEST_EVENTS, 
+                                  test_handler);
+    TEST_CHECK(fsm_pool_create(&pool, 0, TEST_MACHINES, 0, 
+                               0) == RC_FSM_OK);
+
+    /* created before the population is kept, counted once tracked */
+    for (i=0; i<TEST_EARLY; i++) {
+        TEST_CHECK(fsm_create_in_pool(pool, &fsm[i], fsm_class, 
+                                      0) == RC_FSM_OK);
+    }
+    TEST_CHECK(fsm_engine(fsm[1], 2, NULL, NULL) == RC_FSM_OK);
+    TEST_CHECK(fsm_population_track(fsm[0]) == RC_FSM_INVALID_HANDLE);
+
+    TEST_CHECK(fsm_population_enable(fsm_class, 
+                                     FSM_POPULATION_DWELL) == RC_FSM_OK);
+    test_expect(0, 0, 0, 0, __LINE__);
+    for (i=0; i<TEST_EARLY; i++) {
+        TEST_CHECK(fsm_population_track(fsm[i]) == RC_FSM_OK);
+        TEST_CHECK(fsm_population_track(fsm[i]) == RC_FSM_OK);
+    }
+    test_expect(1, 0, 1, 0, __LINE__);
+
+    /* created from then on */
+    for (i=TEST_EARLY; i<TEST_MACHINES; i++) {
+        TEST_CHECK(fsm_create_in_pool(pool, &fsm[i], fsm_class, 
+                                      0) == RC_FSM_OK);
+    }
+    test_expect(4, 0, 1, 0, __LINE__);
+
+    /* a transition to the same state moves nothing */
+    TEST_CHECK(fsm_engine(fsm[2], 0, NULL, NULL) == RC_FSM_OK);
+    test_expect(4, 0, 1, 0, __LINE__);
+    TEST_CHECK(test_stays(0) == 0);
+
+    /* others move one machine and record the stay left */
+    TEST_CHECK(fsm_engine(fsm[2], 1, NULL, NULL) == RC_FSM_OK);
+    TEST_CHECK(fsm_engine(fsm[3], 3, NULL, NULL) == RC_FSM_OK);
+    TEST_CHECK(fsm_engine(fsm[1], 1, NULL, NULL) == RC_FSM_OK);
+    test_expect(2, 1, 0, 2, __LINE__);
+    TEST_CHECK(test_stays(0) == 2 && test_stays(2) == 1);
+
+    /* store instances are counted as well */
+    TEST_CHECK(fsm_store_create(&store, fsm_class, TEST_INSTANCES, 1, 
+                                0) == RC_FSM_OK);
+    test_expect(2, 1 + TEST_INSTANCES, 0, 2, __LINE__);
+    TEST_CHECK(fsm_store_engine(store, 4, 2, NULL, NULL) == RC_FSM_OK);
+    test_expect(2, TEST_INSTANCES, 0, 3, __LINE__);
+    TEST_CHECK(test_stays(1) == 1);
+    fsm_store_destroy(&store);
+    test_expect(2, 1, 0, 2, __LINE__);
+
+    /* the dwell times reset, the populations stay */
+    TEST_CHECK(fsm_dwell_reset(fsm_class) == RC_FSM_OK);
+    TEST_CHECK(test_stays(0) == 0 && test_stays(1) == 0);
+    test_expect(2, 1, 0, 2, __LINE__);
+
+    for (i=0; i<TEST_MACHINES; i++) {
+        TEST_CHECK(fsm_destroy(&fsm[i]) == RC_FSM_OK);
+    }
+    test_expect(0, 0, 0, 0, __LINE__);
+
+    /* a state machine of fsm_create has a class of its own */
+    TEST_CHECK(fsm_create(&untracked, "own class", 0, 
+                          tables.state_description, 
+                          tables.event_description, 
+                          tables.state_table) == RC_FSM_OK);
+    TEST_CHECK(fsm_population_track(untracked) == RC_FSM_INVALID_HANDLE);
+    fsm_destroy(&untracked);
+
+    TEST_CHECK(fsm_pool_destroy(&pool) == RC_FSM_OK);
+    fsm_class_destroy(&fsm_class);
+    test_tables_free(&tables);
+    return (test_report("fsm_test_population"));
+}
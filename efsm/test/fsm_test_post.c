@@ -0,0 +1,184 @@
+/*------------------------------------------------------------------
+ * fsm_test_post.c -- posted events run to completion, in order
+ *
+ * Copyright (c) 2005-2009 by Cisco Systems, Inc.
+ * All rights reserved. 
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *------------------------------------------------------------------
+ */
+
+/*
+ * Handlers post follow-up events with fsm_post_event.  Checks that
+ * each handler completes before the next event starts, that posted
+ * events run in the order posted, those posted while draining 
+ * included, that a full queue refuses the post and the queued
+ * events still run, and that fsm_set_event_queue is refused from 
+ * a handler while the engine is running.
+ *
+ *    fsm_test_post
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fsm.h"
+#include "fsm_test.h"
+
+
+#define TEST_STATES       ( 7 )
+#define TEST_EVENTS       ( 3 )
+#define TEST_QUEUE        ( 3 )
+#define TEST_MAX_POSTS    ( 5 )
+
+/*
+ * What a handler does, passed as the event buffer: its name in
+ * the log, and the steps it posts with their events.
+ */
+typedef struct test_step_s {
+    char                  name;
+    uint32_t              event;
+    struct test_step_s   *posts[TEST_MAX_POSTS];
+    RC_FSM_t              post_rc[TEST_MAX_POSTS];
+} test_step_t;
+
+static fsm_t     *fsm;
+static char       trace[64];
+static uint32_t   trace_length;
+static RC_FSM_t   queue_rc;
+
+
+static void
+test_log (char c)
+{
+    if (trace_length < sizeof(trace) - 1) {
+        trace[trace_length++] = c;
+    }
+    return;
+}
+
+
+/* logs the name on entry, then '.' on exit */
+static RC_FSM_t
+test_handler (void *p2event, void *p2parm)
+{
+    test_step_t *step = (test_step_t *)p2event;
+    uint32_t i;
+
+    test_log(step->name);
+    for (i=0; i<TEST_MAX_POSTS && step->posts[i]; i++) {
+        step->post_rc[i] = fsm_post_event(fsm, step->posts[i]->event,
+                                          step->posts[i], NULL);
+    }
+    if (step->name == 'Q') {
+        queue_rc = fsm_set_event_queue(fsm, 2 * TEST_QUEUE);
+    }
+    test_log('.');
+    return (RC_FSM_OK);
+}
+
+
+static void
+test_reset (void)
+{
+    memset(trace, 0, sizeof(trace));
+    trace_length = 0;
+    return;
+}
+
+
+int
+main (int argc, char **argv)
+{
+    test_step_t a = { 'A', 1 };
+    test_step_t b = { 'B', 2 };
+    test_step_t c = { 'C', 1 };
+    test_step_t d = { 'D', 2 };
+    test_step_t f = { 'F', 1 };
+    test_step_t q = { 'Q', 0 };
+    test_step_t x = { 'X', 1 };
+    test_tables_t tables;
+    uint32_t state;
+    uint32_t i;
+
+    TEST_CHECK(test_tables_build(&tables, TEST_STATES, TEST_EVENTS, 
+                                 test_handler) == 0);
+    TEST_CHECK(fsm_create(&fsm, "post", 0, tables.state_description,
+                          tables.event_description, 
+                          tables.state_table) == RC_FSM_OK);
+
+    /* no queue, nothing to post to */
+    TEST_CHECK(fsm_post_event(fsm, 1, &a, NULL) == RC_FSM_NO_RESOURCES);
+    TEST_CHECK(fsm_set_event_queue(fsm, 1 << 20) == 
+                                            RC_FSM_INVALID_ARGUMENT);
+    TEST_CHECK(fsm_set_event_queue(fsm, TEST_QUEUE) == RC_FSM_OK);
+
+    /* 
+     * A posts B and C, B posts D while it is drained: each handler
+     * runs to completion, in the order posted
+     */
+    a.posts[0] = &b;
+    a.posts[1] = &c;
+    b.posts[0] = &d;
+    test_reset();
+    TEST_CHECK(fsm_engine(fsm, a.event, &a, NULL) == RC_FSM_OK);
+    TEST_CHECK(strcmp(trace, "A.B.C.D.") == 0);
+    TEST_CHECK(a.post_rc[0] == RC_FSM_OK && a.post_rc[1] == RC_FSM_OK &&
+               b.post_rc[0] == RC_FSM_OK);
+    TEST_CHECK(fsm_get_state(fsm, &state) == RC_FSM_OK && state == 6);
+
+    /* the queue was rounded up to 4, the fifth post is refused */
+    for (i=0; i<TEST_MAX_POSTS; i++) {
+        f.posts[i] = &x;
+    }
+    test_reset();
+    TEST_CHECK(fsm_engine(fsm, f.event, &f, NULL) == RC_FSM_OK);
+    for (i=0; i<TEST_MAX_POSTS - 1; i++) {
+        TEST_CHECK(f.post_rc[i] == RC_FSM_OK);
+    }
+    TEST_CHECK(f.post_rc[TEST_MAX_POSTS - 1] == RC_FSM_NO_RESOURCES);
+    TEST_CHECK(strcmp(trace, "F.X.X.X.X.") == 0);
+    TEST_CHECK(fsm_get_state(fsm, &state) == RC_FSM_OK && state == 4);
+
+    /* posted outside of a handler, it runs after the next event */
+    test_reset();
+    TEST_CHECK(fsm_post_event(fsm, c.event, &c, NULL) == RC_FSM_OK);
+    TEST_CHECK(trace_length == 0);
+    TEST_CHECK(fsm_engine(fsm, d.event, &d, NULL) == RC_FSM_OK);
+    TEST_CHECK(strcmp(trace, "D.C.") == 0);
+
+    /* the queue cannot be changed under the running engine */
+    test_reset();
+    queue_rc = RC_FSM_OK;
+    TEST_CHECK(fsm_engine(fsm, q.event, &q, NULL) == RC_FSM_OK);
+    TEST_CHECK(queue_rc == RC_FSM_INVALID_ARGUMENT);
+    TEST_CHECK(fsm_set_event_queue(fsm, 2 * TEST_QUEUE) == RC_FSM_OK);
+
+    /* and removed once idle */
+    TEST_CHECK(fsm_set_event_queue(fsm, 0) == RC_FSM_OK);
+    TEST_CHECK(fsm_post_event(fsm, 1, &a, NULL) == RC_FSM_NO_RESOURCES);
+
+    fsm_destroy(&fsm);
+    test_tables_free(&tables);
+    return (test_report("fsm_test_post"));
+}
@@ -0,0 +1,111 @@
+/*------------------------------------------------------------------
+ * fsm_test_session.c -- stale session handles after slot reuse
+ *
+ * Copyright (c) 2005-2009 by Cisco Systems, Inc.
+ * All rights reserved. 
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *------------------------------------------------------------------
+ */
+
+/*
+ * Reuses the slot of a session table far more often than an 8 
+ * bit generation could tell apart, and checks every handle of an
+ * earlier session is refused while the current one still works.
+ * Then checks that a slot whose generation would wrap is retired
+ * rather than handed out again.
+ *
+ *    fsm_test_session
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fsm.h"
+#include "fsm_session.h"
+#include "fsm_test.h"
+
+
+#define TEST_REUSES       ( 1000 )
+
+
+static RC_FSM_t
+test_handler (void *p2event, void *p2parm)
+{
+    return (RC_FSM_OK);
+}
+
+
+int
+main (int argc, char **argv)
+{
+    static fsm_session_handle_t handles[TEST_REUSES];
+    fsm_session_table_t *table;
+    fsm_session_handle_t handle;
+    test_tables_t tables;
+    fsm_t *fsm;
+    fsm_t *p2fsm;
+    uint32_t i;
+
+    TEST_CHECK(test_tables_build(&tables, 2, 2, test_handler) == 0);
+    TEST_CHECK(fsm_create(&fsm, "test", 0, tables.state_description,
+                          tables.event_description, 
+                          tables.state_table) == RC_FSM_OK);
+
+    /* a table of one slot, so every session reuses it */
+    TEST_CHECK(fsm_session_table_create(&table, 1) == RC_FSM_OK);
+    for (i=0; i<TEST_REUSES; i++) {
+        TEST_CHECK(fsm_session_insert(table, 2009 + i, fsm, 
+                                      &handles[i]) == RC_FSM_OK);
+        TEST_CHECK(fsm_session_get(table, handles[i], 
+                                   &p2fsm) == RC_FSM_OK && p2fsm == fsm);
+        TEST_CHECK(fsm_session_remove(table, handles[i]) == RC_FSM_OK);
+    }
+
+    TEST_CHECK(fsm_session_insert(table, 1, fsm, &handle) == RC_FSM_OK);
+    for (i=0; i<TEST_REUSES; i++) {
+        TEST_CHECK(handles[i] != handle);
+        TEST_CHECK(fsm_session_get(table, handles[i], 
+                                   &p2fsm) == RC_FSM_INVALID_HANDLE);
+        TEST_CHECK(fsm_session_engine_handle(table, handles[i], 0, 
+                                     NULL, NULL) == RC_FSM_INVALID_HANDLE);
+    }
+    TEST_CHECK(fsm_session_get(table, handle, &p2fsm) == RC_FSM_OK && 
+               p2fsm == fsm);
+    TEST_CHECK(fsm_session_engine_handle(table, handle, 0, 
+                                         NULL, NULL) == RC_FSM_OK);
+
+    /* the last generation of the slot, after it the slot is retired */
+    TEST_CHECK(fsm_session_remove(table, handle) == RC_FSM_OK);
+    table->slots[0].generation = 0xffffffff;
+    TEST_CHECK(fsm_session_insert(table, 1, fsm, &handle) == RC_FSM_OK);
+    TEST_CHECK(fsm_session_remove(table, handle) == RC_FSM_OK);
+    TEST_CHECK(fsm_session_get(table, handle, 
+                               &p2fsm) == RC_FSM_INVALID_HANDLE);
+    TEST_CHECK(fsm_session_insert(table, 1, fsm, 
+                                  &handle) == RC_FSM_NO_RESOURCES);
+
+    fsm_session_table_destroy(&table);
+    fsm_destroy(&fsm);
+    test_tables_free(&tables);
+    return (test_report("fsm_test_session"));
+}
@@ -0,0 +1,296 @@
+/*------------------------------------------------------------------
+ * fsm_test_sparse.c -- sparse event tables and defaults
+ *
+ * Copyright (c) 2005-2009 by Cisco Systems, Inc.
+ * All rights reserved. 
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *------------------------------------------------------------------
+ */
+
+/*
+ * A class of many events whose states list only those they 
+ * handle: one with a default of its own, one taking the class 
+ * default of the state table terminator, one with no default, and
+ * a dense state for comparison.  Checks the events listed and 
+ * those left out of each, FSM_SAME_STATE, with the states kept as
+ * lists and as rows, and that broken sparse tables are refused.
+ *
+ *    fsm_test_sparse
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fsm.h"
+#include "fsm_test.h"
+
+
+#define TEST_EVENTS       ( 64 )
+
+enum { test_idle_s, test_open_s, test_closing_s, test_dense_s, 
+       TEST_STATES };
+
+
+static RC_FSM_t test_open (void *, void *);
+static RC_FSM_t test_close (void *, void *);
+static RC_FSM_t test_default (void *, void *);
+static RC_FSM_t test_class_default (void *, void *);
+
+/* each handler leaves its address in p2parm */
+static RC_FSM_t
+test_open (void *p2event, void *p2parm)
+{
+    *(event_cb_t *)p2parm = test_open;
+    return (RC_FSM_OK);
+}
+
+static RC_FSM_t
+test_close (void *p2event, void *p2parm)
+{
+    *(event_cb_t *)p2parm = test_close;
+    return (RC_FSM_OK);
+}
+
+static RC_FSM_t
+test_default (void *p2event, void *p2parm)
+{
+    *(event_cb_t *)p2parm = test_default;
+    return (RC_FSM_OK);
+}
+
+static RC_FSM_t
+test_class_default (void *p2event, void *p2parm)
+{
+    *(event_cb_t *)p2parm = test_class_default;
+    return (RC_FSM_OK);
+}
+
+
+static state_description_t test_states[] = 
+   {{test_idle_s,     "Idle"},
+    {test_open_s,     "Open"},
+    {test_closing_s,  "Closing"},
+    {test_dense_s,    "Dense"},
+    {FSM_NULL_STATE_ID, NULL}};
+
+static event_description_t  test_event_names[TEST_EVENTS + 1];
+
+static event_tuple_t  test_idle_events[] = 
+   {{1,                    test_open,      test_open_s},
+    {5,                    test_close,     FSM_SAME_STATE},
+    {FSM_DEFAULT_EVENT_ID, test_default,   FSM_SAME_STATE},
+    {FSM_NULL_EVENT_ID,    NULL,           0}};
+
+static event_tuple_t  test_open_events[] = 
+   {{2,                    test_open,      test_closing_s},
+    {TEST_EVENTS - 1,      test_close,     test_idle_s},
+    {FSM_NULL_EVENT_ID,    NULL,           0}};
+
+static event_tuple_t  test_closing_events[] = 
+   {{0,                    test_close,     test_dense_s},
+    {FSM_NULL_EVENT_ID,    NULL,           0}};
+
+static event_tuple_t  test_dense_events[TEST_EVENTS];
+
+static event_tuple_t  test_class_default_event[] = 
+   {{FSM_DEFAULT_EVENT_ID, test_class_default, FSM_SAME_STATE}};
+
+static state_tuple_t  test_table[] = 
+   {{test_idle_s,      test_idle_events,     0, 0, 0, FSM_EVENTS_SPARSE},
+    {test_open_s,      test_open_events,     0, 0, 0, FSM_EVENTS_SPARSE},
+    {test_closing_s,   test_closing_events,  0, 0, 0, FSM_EVENTS_SPARSE},
+    {test_dense_s,     test_dense_events,    0, 0, 0, 0},
+    {FSM_NULL_STATE_ID, test_class_default_event}};
+
+
+/* tables of test_closing_s that must be refused */
+static event_tuple_t  test_bad_range[] = 
+   {{TEST_EVENTS,          test_close,     test_dense_s},
+    {FSM_NULL_EVENT_ID,    NULL,           0}};
+
+static event_tuple_t  test_bad_order[] = 
+   {{7,                    test_close,     test_dense_s},
+    {3,                    test_close,     test_dense_s},
+    {FSM_NULL_EVENT_ID,    NULL,           0}};
+
+static event_tuple_t  test_bad_twice[] = 
+   {{3,                    test_close,     test_dense_s},
+    {3,                    test_open,      test_dense_s},
+    {FSM_NULL_EVENT_ID,    NULL,           0}};
+
+static event_tuple_t  test_bad_defaults[] = 
+   {{FSM_DEFAULT_EVENT_ID, test_default,   FSM_SAME_STATE},
+    {3,                    test_close,     test_dense_s},
+    {FSM_DEFAULT_EVENT_ID, test_default,   FSM_SAME_STATE},
+    {FSM_NULL_EVENT_ID,    NULL,           0}};
+
+static event_tuple_t  test_bad_next[] = 
+   {{3,                    test_close,     TEST_STATES},
+    {FSM_NULL_EVENT_ID,    NULL,           0}};
+
+static event_tuple_t  test_bad_terminator[] = 
+   {{0,                    test_class_default, FSM_SAME_STATE}};
+
+
+/*
+ * one event from a state, the handler called, NULL for none, and
+ * the state reached
+ */
+static void
+test_event (fsm_class_t *fsm_class, uint32_t state, uint32_t event,
+            event_cb_t handler, uint32_t next_state, int line)
+{
+    fsm_instance_t instance;
+    event_cb_t called;
+
+    called = NULL;
+    fsm_instance_init(&instance, fsm_class, state);
+    if (fsm_instance_engine(&instance, event, NULL, &called) != RC_FSM_OK ||
+        called != handler || instance.curr_state != next_state) {
+        printf("line %d: state %u event %u reached %u\n",
+               line, state, event, instance.curr_state);
+        test_failures++;
+    }
+    return;
+}
+
+
+static void
+test_dispatch (fsm_class_t *fsm_class, event_cb_t missed)
+{
+    /* listed, and left out to the state's own default */
+    test_event(fsm_class, test_idle_s, 1, test_open, test_open_s, 
+               __LINE__);
+    test_event(fsm_class, test_idle_s, 5, test_close, test_idle_s, 
+               __LINE__);
+    test_event(fsm_class, test_idle_s, 0, test_default, test_idle_s, 
+               __LINE__);
+    test_event(fsm_class, test_idle_s, TEST_EVENTS - 1, test_default, 
+               test_idle_s, __LINE__);
+
+    /* left out to the class default, or ignored without one */
+    test_event(fsm_class, test_open_s, 2, test_open, test_closing_s, 
+               __LINE__);
+    test_event(fsm_class, test_open_s, TEST_EVENTS - 1, test_close, 
+               test_idle_s, __LINE__);
+    test_event(fsm_class, test_open_s, 3, missed, test_open_s, __LINE__);
+    test_event(fsm_class, test_closing_s, 0, test_close, test_dense_s, 
+               __LINE__);
+    test_event(fsm_class, test_closing_s, 1, missed, test_closing_s, 
+               __LINE__);
+    test_event(fsm_class, test_closing_s, TEST_EVENTS - 1, missed, 
+               test_closing_s, __LINE__);
+
+    /* FSM_SAME_STATE in a dense table */
+    test_event(fsm_class, test_dense_s, 0, test_open, test_idle_s, 
+               __LINE__);
+    test_event(fsm_class, test_dense_s, 9, test_default, test_dense_s, 
+               __LINE__);
+    return;
+}
+
+
+static void
+test_refused (event_tuple_t *events, RC_FSM_t expected, int line)
+{
+    fsm_class_t *fsm_class;
+    RC_FSM_t rc;
+
+    test_table[test_closing_s].p2event_tuple = events;
+    rc = fsm_class_create(&fsm_class, "bad", test_states, 
+                          test_event_names, test_table);
+    if (rc != expected) {
+        printf("line %d: class create gave %d, expected %d\n",
+               line, rc, expected);
+        test_failures++;
+        if (rc == RC_FSM_OK) {
+            fsm_class_destroy(&fsm_class);
+        }
+    }
+    test_table[test_closing_s].p2event_tuple = test_closing_events;
+    return;
+}
+
+
+int
+main (int argc, char **argv)
+{
+    fsm_class_t *fsm_class;
+    fsm_state_layout_t layout;
+    uint32_t i;
+
+    for (i=0; i<TEST_EVENTS; i++) {
+        test_event_names[i].event_id = i;
+        test_event_names[i].description = "event";
+        test_dense_events[i].eventID = i;
+        test_dense_events[i].event_handler = test_default;
+        test_dense_events[i].next_state = FSM_SAME_STATE;
+    }
+    test_event_names[i].event_id = FSM_NULL_EVENT_ID;
+    test_dense_events[0].event_handler = test_open;
+    test_dense_events[0].next_state = test_idle_s;
+
+    TEST_CHECK(fsm_class_create(&fsm_class, "sparse", test_states, 
+                                test_event_names, 
+                                test_table) == RC_FSM_OK);
+
+    /* the declared states as sorted lists, then all as rows */
+    TEST_CHECK(fsm_class_set_layout(fsm_class, 
+                                    FSM_LAYOUT_DECLARED) == RC_FSM_OK);
+    for (i=test_idle_s; i<=test_closing_s; i++) {
+        TEST_CHECK(fsm_class_get_state_layout(fsm_class, i, 
+                                              &layout) == RC_FSM_OK);
+        TEST_CHECK(layout.layout == FSM_STATE_LAYOUT_SPARSE);
+    }
+    test_dispatch(fsm_class, test_class_default);
+
+    TEST_CHECK(fsm_class_set_layout(fsm_class, 
+                                    FSM_LAYOUT_DENSE) == RC_FSM_OK);
+    TEST_CHECK(fsm_class_get_state_layout(fsm_class, test_idle_s, 
+                                          &layout) == RC_FSM_OK);
+    TEST_CHECK(layout.layout == FSM_STATE_LAYOUT_DENSE);
+    test_dispatch(fsm_class, test_class_default);
+    fsm_class_destroy(&fsm_class);
+
+    /* without the class default the events left out are ignored */
+    test_table[TEST_STATES].p2event_tuple = NULL;
+    TEST_CHECK(fsm_class_create(&fsm_class, "sparse", test_states, 
+                                test_event_names, 
+                                test_table) == RC_FSM_OK);
+    TEST_CHECK(fsm_class_set_layout(fsm_class, 
+                                    FSM_LAYOUT_DECLARED) == RC_FSM_OK);
+    test_dispatch(fsm_class, NULL);
+    fsm_class_destroy(&fsm_class);
+
+    test_refused(test_bad_range, RC_FSM_INVALID_EVENT_TABLE, __LINE__);
+    test_refused(test_bad_order, RC_FSM_INVALID_EVENT_TABLE, __LINE__);
+    test_refused(test_bad_twice, RC_FSM_INVALID_EVENT_TABLE, __LINE__);
+    test_refused(test_bad_defaults, RC_FSM_INVALID_EVENT_TABLE, __LINE__);
+    test_refused(test_bad_next, RC_FSM_INVALID_STATE_TABLE, __LINE__);
+
+    test_table[TEST_STATES].p2event_tuple = test_bad_terminator;
+    test_refused(test_closing_events, RC_FSM_INVALID_EVENT_TABLE, 
+                 __LINE__);
+
+    return (test_report("fsm_test_sparse"));
+}
@@ -0,0 +1,103 @@
+/*------------------------------------------------------------------
+ * fsm_test_store.c -- store arguments and sizes past 32 bits
+ *
+ * Copyright (c) 2005-2009 by Cisco Systems, Inc.
+ * All rights reserved. 
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *------------------------------------------------------------------
+ */
+
+/*
+ * Checks that fsm_store_create refuses bad arguments, and that a 
+ * store whose history needs more than 4 GB, once its size no 
+ * longer fits 32 bits, either is refused or really holds every 
+ * instance: the last one is driven, writing its history at the 
+ * far end of the array.
+ *
+ *    fsm_test_store
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fsm.h"
+#include "fsm_store.h"
+#include "fsm_test.h"
+
+
+/* capacity x FSM_STORE_MAX_HISTORY records just past 4 GB */
+#define TEST_LARGE_CAPACITY  ( (1 << 21) + 1 )
+
+
+static RC_FSM_t
+test_handler (void *p2event, void *p2parm)
+{
+    return (RC_FSM_OK);
+}
+
+
+int
+main (int argc, char **argv)
+{
+    test_tables_t tables;
+    fsm_class_t *fsm_class;
+    fsm_store_t *store;
+    uint32_t last;
+    uint32_t state;
+    RC_FSM_t rc;
+
+    fsm_class = test_class_create(&tables, 4, 4, test_handler);
+
+    TEST_CHECK(fsm_store_create(NULL, fsm_class, 1, 0, 0) == RC_FSM_NULL);
+    TEST_CHECK(fsm_store_create(&store, fsm_class, 0, 0, 0) == 
+                                                RC_FSM_INVALID_ARGUMENT);
+    TEST_CHECK(fsm_store_create(&store, fsm_class, 1, 0, 3) == 
+                                                RC_FSM_INVALID_ARGUMENT);
+    TEST_CHECK(fsm_store_create(&store, fsm_class, 1, 0, 
+                                FSM_STORE_MAX_HISTORY * 2) == 
+                                                RC_FSM_INVALID_ARGUMENT);
+    TEST_CHECK(fsm_store_create(&store, fsm_class, 1, 4, 0) == 
+                                                RC_FSM_INVALID_STATE);
+
+    rc = fsm_store_create(&store, fsm_class, TEST_LARGE_CAPACITY, 0,
+                          FSM_STORE_MAX_HISTORY);
+    TEST_CHECK(rc == RC_FSM_OK || rc == RC_FSM_NO_RESOURCES);
+    if (rc == RC_FSM_OK) {
+        last = TEST_LARGE_CAPACITY - 1;
+        TEST_CHECK(fsm_store_engine(store, last, 1, NULL, 
+                                    NULL) == RC_FSM_OK);
+        TEST_CHECK(fsm_store_engine(store, last, 2, NULL, 
+                                    NULL) == RC_FSM_OK);
+        TEST_CHECK(fsm_store_get_state(store, last, &state) == RC_FSM_OK &&
+                   state == 3);
+        TEST_CHECK(fsm_store_get_state(store, 0, &state) == RC_FSM_OK &&
+                   state == 0);
+        fsm_store_destroy(&store);
+    } else {
+        printf("fsm_test_store: no memory for the large store\n");
+    }
+
+    fsm_class_destroy(&fsm_class);
+    test_tables_free(&tables);
+    return (test_report("fsm_test_store"));
+}
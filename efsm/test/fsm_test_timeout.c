@@ -0,0 +1,159 @@
+/*------------------------------------------------------------------
+ * fsm_test_timeout.c -- per-state timeouts arm, rearm and cancel
+ *
+ * Copyright (c) 2005-2009 by Cisco Systems, Inc.
+ * All rights reserved. 
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *------------------------------------------------------------------
+ */
+
+/*
+ * Drives a table with per-state timeouts on an attached wheel.
+ * Checks that entering a state arms its timeout and staying in it
+ * leaves the timer running, that a rearming state restarts it on
+ * every transition to itself, that leaving cancels it, and that
+ * destroying the state machine detaches it from the wheel.
+ *
+ *    fsm_test_timeout
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fsm.h"
+#include "fsm_timer.h"
+#include "fsm_test.h"
+
+
+enum { idle_s, wait_s, retry_s };
+enum { open_e, next_e, timeout_e, test_events };
+
+static fsm_timer_wheel_t  *wheel;
+static uint32_t            timeouts;
+
+
+static RC_FSM_t
+test_ok (void *p2event, void *p2parm)
+{
+    return (RC_FSM_OK);
+}
+
+static RC_FSM_t
+test_timeout (void *p2event, void *p2parm)
+{
+    timeouts++;
+    return (RC_FSM_OK);
+}
+
+
+static state_description_t test_states[] =
+    { { idle_s, "idle" },
+      { wait_s, "wait" },
+      { retry_s, "retry" },
+      { FSM_NULL_STATE_ID, NULL } };
+
+static event_description_t test_event_names[] =
+    { { open_e, "open" },
+      { next_e, "next" },
+      { timeout_e, "timeout" },
+      { FSM_NULL_EVENT_ID, NULL } };
+
+/* wait times out to idle, retry restarts its timeout on itself */
+static event_tuple_t idle_events[] =
+    { { open_e, test_ok, wait_s },
+      { next_e, test_ok, idle_s },
+      { timeout_e, test_timeout, idle_s } };
+
+static event_tuple_t wait_events[] =
+    { { open_e, test_ok, wait_s },
+      { next_e, test_ok, retry_s },
+      { timeout_e, test_timeout, idle_s } };
+
+static event_tuple_t retry_events[] =
+    { { open_e, test_ok, retry_s },
+      { next_e, test_ok, idle_s },
+      { timeout_e, test_timeout, retry_s } };
+
+static state_tuple_t timeout_table[] =
+    { { idle_s, idle_events },
+      { wait_s, wait_events, 10, timeout_e, 0 },
+      { retry_s, retry_events, 5, timeout_e, FSM_TIMEOUT_REARM },
+      { FSM_NULL_STATE_ID, NULL } };
+
+
+static void
+test_state_timeouts (void)
+{
+    uint32_t state;
+    fsm_t *fsm;
+
+    TEST_CHECK(fsm_create(&fsm, "timeouts", idle_s, test_states, 
+                          test_event_names, timeout_table) == RC_FSM_OK);
+    TEST_CHECK(fsm_timer_wheel_create(&wheel, 0) == RC_FSM_OK);
+    TEST_CHECK(fsm_timer_attach(fsm, wheel, NULL, NULL) == RC_FSM_OK);
+
+    /* entering wait arms its timeout, staying leaves it running */
+    TEST_CHECK(fsm_engine(fsm, open_e, NULL, NULL) == RC_FSM_OK);
+    TEST_CHECK(wheel->armed == 1);
+    fsm_timer_advance(wheel, 5);
+    TEST_CHECK(fsm_engine(fsm, open_e, NULL, NULL) == RC_FSM_OK);
+    fsm_timer_advance(wheel, 9);
+    TEST_CHECK(timeouts == 0);
+    fsm_timer_advance(wheel, 10);
+    TEST_CHECK(timeouts == 1);
+    TEST_CHECK(fsm_get_state(fsm, &state) == RC_FSM_OK && state == idle_s);
+    TEST_CHECK(wheel->armed == 0);
+
+    /* retry rearms on every transition to itself */
+    TEST_CHECK(fsm_engine(fsm, open_e, NULL, NULL) == RC_FSM_OK);
+    TEST_CHECK(fsm_engine(fsm, next_e, NULL, NULL) == RC_FSM_OK);
+    TEST_CHECK(fsm_get_state(fsm, &state) == RC_FSM_OK && 
+               state == retry_s);
+    fsm_timer_advance(wheel, 14);
+    TEST_CHECK(fsm_engine(fsm, open_e, NULL, NULL) == RC_FSM_OK);
+    fsm_timer_advance(wheel, 18);
+    TEST_CHECK(timeouts == 1);
+    fsm_timer_advance(wheel, 19);
+    TEST_CHECK(timeouts == 2 && wheel->armed == 1);
+    fsm_timer_advance(wheel, 24);
+    TEST_CHECK(timeouts == 3);
+
+    /* leaving cancels, destroying detaches */
+    TEST_CHECK(fsm_engine(fsm, next_e, NULL, NULL) == RC_FSM_OK);
+    TEST_CHECK(wheel->armed == 0);
+    TEST_CHECK(fsm_engine(fsm, open_e, NULL, NULL) == RC_FSM_OK);
+    TEST_CHECK(wheel->armed == 1);
+    TEST_CHECK(fsm_destroy(&fsm) == RC_FSM_OK);
+    TEST_CHECK(wheel->armed == 0 && wheel->attached == 0);
+
+    TEST_CHECK(fsm_timer_wheel_destroy(&wheel) == RC_FSM_OK);
+    return;
+}
+
+
+int
+main (int argc, char **argv)
+{
+    test_state_timeouts();
+    return (test_report("fsm_test_timeout"));
+}
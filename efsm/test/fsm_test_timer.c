@@ -0,0 +1,218 @@
+/*------------------------------------------------------------------
+ * fsm_test_timer.c -- timing wheel expiry order and in-use checks
+ *
+ * Copyright (c) 2005-2009 by Cisco Systems, Inc.
+ * All rights reserved. 
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *------------------------------------------------------------------
+ */
+
+/*
+ * Arms timers over every level of the wheel, stops a third of 
+ * them, and checks the others fire once each, in expiry order and
+ * never early.  Then checks the batch expiries of store instances,
+ * that a wheel in use is not destroyed, and that a delay past the
+ * end of time is clamped.
+ *
+ *    fsm_test_timer
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fsm.h"
+#include "fsm_timer.h"
+#include "fsm_test.h"
+
+
+#define TEST_TIMERS       ( 20000 )
+
+enum { idle_s, wait_s, retry_s };
+enum { open_e, next_e, timeout_e, test_events };
+
+static fsm_timer_wheel_t  *wheel;
+static uint64_t            last_expiry;
+static uint32_t            fired;
+
+
+static RC_FSM_t
+test_expiry (void *p2event, void *p2parm)
+{
+    uint64_t expires = *(uint64_t *)p2event;
+
+    TEST_CHECK(wheel->now >= expires);
+    TEST_CHECK(expires >= last_expiry);
+    last_expiry = expires;
+    fired++;
+    return (RC_FSM_OK);
+}
+
+
+static state_description_t test_states[] =
+    { { idle_s, "idle" },
+      { wait_s, "wait" },
+      { retry_s, "retry" },
+      { FSM_NULL_STATE_ID, NULL } };
+
+static event_description_t test_event_names[] =
+    { { open_e, "open" },
+      { next_e, "next" },
+      { timeout_e, "timeout" },
+      { FSM_NULL_EVENT_ID, NULL } };
+
+static event_tuple_t expiry_events[] =
+    { { open_e, test_expiry, idle_s },
+      { next_e, test_expiry, idle_s },
+      { timeout_e, test_expiry, idle_s } };
+
+static state_tuple_t expiry_table[] =
+    { { idle_s, expiry_events },
+      { wait_s, expiry_events },
+      { retry_s, expiry_events },
+      { FSM_NULL_STATE_ID, NULL } };
+
+
+static void
+test_wheel (void)
+{
+    static fsm_timer_t timers[TEST_TIMERS];
+    static uint64_t expires[TEST_TIMERS];
+    fsm_batch_entry_t batch[4];
+    fsm_timer_t instance_timers[10];
+    uint64_t delay;
+    uint64_t latest;
+    uint64_t now;
+    uint32_t stopped;
+    uint32_t count;
+    uint32_t total;
+    uint32_t seed;
+    uint32_t i;
+    fsm_t *fsm;
+
+    TEST_CHECK(fsm_create(&fsm, "expiry", idle_s, test_states, 
+                          test_event_names, expiry_table) == RC_FSM_OK);
+    TEST_CHECK(fsm_timer_wheel_create(&wheel, 5) == RC_FSM_OK);
+
+    /* delays within each level and past the last one */
+    seed = 2009;
+    latest = 0;
+    for (i=0; i<TEST_TIMERS; i++) {
+        seed = seed * 1103515245 + 12345;
+        delay = (seed >> 8) & 0xffff;
+        switch (i % 4) {
+        case 0:  delay = delay % 300;                   break;
+        case 1:  delay = delay * 3;                     break;
+        case 2:  delay = delay << 12;                   break;
+        default: delay = ((uint64_t)1 << 32) + delay;   break;
+        }
+        fsm_timer_init(&timers[i], &expires[i], NULL);
+        TEST_CHECK(fsm_timer_start(wheel, &timers[i], fsm, open_e, 
+                                   delay) == RC_FSM_OK);
+        expires[i] = timers[i].expires;
+        if (expires[i] > latest) {
+            latest = expires[i];
+        }
+    }
+
+    stopped = 0;
+    for (i=0; i<TEST_TIMERS; i+=3) {
+        TEST_CHECK(fsm_timer_stop(wheel, &timers[i]) == RC_FSM_OK);
+        TEST_CHECK(!fsm_timer_armed(&timers[i]));
+        stopped++;
+    }
+
+    now = 5;
+    while (now < latest) {
+        seed = seed * 1103515245 + 12345;
+        now += 1 + ((uint64_t)(seed >> 8) << 8);
+        if (now > latest) {
+            now = latest;
+        }
+        TEST_CHECK(fsm_timer_advance(wheel, now) == RC_FSM_OK);
+    }
+    TEST_CHECK(fired == TEST_TIMERS - stopped);
+    TEST_CHECK(wheel->armed == 0);
+
+    /* store instance expiries come back as batches, soonest first */
+    for (i=0; i<10; i++) {
+        fsm_timer_init(&instance_timers[i], NULL, NULL);
+        TEST_CHECK(fsm_timer_start_instance(wheel, &instance_timers[i], 
+                                            i, next_e, 10 - i) == RC_FSM_OK);
+    }
+    total = 0;
+    do {
+        TEST_CHECK(fsm_timer_advance_batch(wheel, now + 20, batch, 4,
+                                           &count) == RC_FSM_OK);
+        if (total == 0 && count) {
+            TEST_CHECK(batch[0].instance == 9);
+        }
+        total += count;
+    } while (count == 4);
+    TEST_CHECK(total == 10 && wheel->armed == 0);
+
+    TEST_CHECK(fsm_timer_wheel_destroy(&wheel) == RC_FSM_OK && 
+               wheel == NULL);
+    fsm_destroy(&fsm);
+    return;
+}
+
+
+static void
+test_in_use (void)
+{
+    fsm_timer_t timer;
+    fsm_t *fsm;
+
+    TEST_CHECK(fsm_create(&fsm, "in use", idle_s, test_states, 
+                          test_event_names, expiry_table) == RC_FSM_OK);
+
+    /* a delay past the last tick is clamped to it */
+    TEST_CHECK(fsm_timer_wheel_create(&wheel, 
+                                      (uint64_t)-1 - 10) == RC_FSM_OK);
+    fsm_timer_init(&timer, NULL, NULL);
+    TEST_CHECK(fsm_timer_start(wheel, &timer, fsm, open_e, 
+                               100) == RC_FSM_OK);
+    TEST_CHECK(timer.expires == (uint64_t)-1);
+
+    TEST_CHECK(fsm_timer_wheel_destroy(&wheel) == RC_FSM_INVALID_ARGUMENT &&
+               wheel != NULL);
+    TEST_CHECK(fsm_timer_stop(wheel, &timer) == RC_FSM_OK);
+
+    TEST_CHECK(fsm_timer_attach(fsm, wheel, NULL, NULL) == RC_FSM_OK);
+    TEST_CHECK(fsm_timer_wheel_destroy(&wheel) == RC_FSM_INVALID_ARGUMENT &&
+               wheel != NULL);
+    TEST_CHECK(fsm_timer_detach(fsm) == RC_FSM_OK);
+    TEST_CHECK(fsm_timer_wheel_destroy(&wheel) == RC_FSM_OK);
+
+    fsm_destroy(&fsm);
+    return;
+}
+
+
+int
+main (int argc, char **argv)
+{
+    test_wheel();
+    test_in_use();
+    return (test_report("fsm_test_timer"));
+}
@@ -0,0 +1,833 @@
+/*------------------------------------------------------------------
+ * fsm_codegen.c -- generates specialized state machine engines
+ *
+ * Copyright (c) 2005-2009 by Cisco Systems, Inc.
+ * All rights reserved. 
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *------------------------------------------------------------------
+ */
+
+/*
+ * Reads a state machine definition in text form and writes a C 
+ * engine specialized for it, with the handlers called directly 
+ * from nested switches, or from a computed goto table, and no 
+ * run time checks of the tables.
+ *
+ *    fsm_codegen [-m switch|goto] [-p prefix] [-i header]... 
+ *                <definition> <output base>
+ *
+ * writes <output base>.c and <output base>.h.  The prefix of the
+ * generated names defaults to the file name of the output base.
+ *
+ * The definition holds the same content as the tables given to
+ * fsm_create, see test/demo_session.fsm.  # starts a comment.
+ *
+ *    name   "<state machine name>"
+ *    event  <event ID>  "<description>"
+ *    state  <state ID>  "<description>"
+ *    table  <state ID>
+ *           <event ID>  <handler | NULL>  <next state ID>
+ *           ...
+ *
+ * Events and states are listed in ID order.  The IDs are the 
+ * enumerations of the application and the handlers its functions,
+ * both declared by the headers given with -i.  Handlers declared
+ * static inline there are inlined into the engine.  An event left
+ * out of a table has a NULL handler.  Quotes and backslashes in 
+ * the name and descriptions are escaped in the output, and a 
+ * definition past the limits below is refused with an error.
+ *
+ * The generated engine drives an fsm_instance_t:
+ *
+ *    RC_FSM_t <prefix>_engine(fsm_instance_t *instance,
+ *                             uint32_t normalized_event,
+ *                             void *p2event_buffer,
+ *                             void *p2parm)
+ *
+ * with the results of fsm_instance_engine, including exception
+ * states, except that the state and event are not range checked
+ * by the goto engine.  The tables are written out too, with 
+ * <prefix>_class_create and <prefix>_create to build a class or 
+ * a state machine of the generic engine from them.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+
+#define CODEGEN_ID_LEN      ( 64 )
+#define CODEGEN_TEXT_LEN    ( 128 )
+#define CODEGEN_MAX_IDS     ( 1024 )
+#define CODEGEN_MAX_HEADERS ( 16 )
+
+#define CODEGEN_MODE_SWITCH ( 0 )
+#define CODEGEN_MODE_GOTO   ( 1 )
+
+/* cell without a handler, table rows that leave an event out */
+#define CODEGEN_NO_HANDLER  ( -1 )
+
+
+typedef struct {
+    char    id[CODEGEN_ID_LEN];
+    char    description[CODEGEN_TEXT_LEN];
+} codegen_name_t;
+
+typedef struct {
+    int     handler;
+    int     next_state;
+    int     target;
+    int     defined;
+} codegen_cell_t;
+
+static char            fsm_name[CODEGEN_TEXT_LEN];
+
+static codegen_name_t  states[CODEGEN_MAX_IDS];
+static int             number_states;
+
+static codegen_name_t  events[CODEGEN_MAX_IDS];
+static int             number_events;
+
+/* de-duplicated handler names */
+static char            handlers[CODEGEN_MAX_IDS][CODEGEN_ID_LEN];
+static int             number_handlers;
+
+/* rows as read, resolved once all states are known */
+typedef struct {
+    int     line;
+    int     state;
+    char    event[CODEGEN_ID_LEN];
+    char    handler[CODEGEN_ID_LEN];
+    char    next_state[CODEGEN_ID_LEN];
+} codegen_row_t;
+
+static codegen_row_t  *rows;
+static int             number_rows;
+static int             size_rows;
+
+static codegen_cell_t *cells;
+
+static char           *headers[CODEGEN_MAX_HEADERS];
+static int             number_headers;
+
+static char           *input_name;
+
+
+static void
+fail (int line, const char *message, const char *detail)
+{
+    fprintf(stderr, "%s:%d: %s%s%s\n", input_name, line, message,
+            detail ? " " : "", detail ? detail : "");
+    exit(1);
+}
+
+
+/*
+ * splits a line into tokens, a quoted token may hold blanks
+ */
+static int
+tokenize (char *line, char **tokens, int max_tokens, int line_number)
+{
+    int number_tokens;
+    char *p;
+
+    number_tokens = 0;
+    p = line;
+    while (*p) {
+        while (isspace((unsigned char)*p)) {
+            p++;
+        }
+        if (*p == '\0' || *p == '#') {
+            break;
+        }
+        if (number_tokens == max_tokens) {
+            fail(line_number, "too many fields", NULL);
+        }
+
+        if (*p == '"') {
+            tokens[number_tokens++] = ++p;
+            while (*p && *p != '"') {
+                p++;
+            }
+            if (*p != '"') {
+                fail(line_number, "unterminated string", NULL);
+            }
+        } else {
+            tokens[number_tokens++] = p;
+            while (*p && !isspace((unsigned char)*p)) {
+                p++;
+            }
+        }
+        if (*p) {
+            *p++ = '\0';
+        }
+    }
+    return (number_tokens);
+}
+
+
+static void
+check_id (const char *id, int line_number)
+{
+    const char *p;
+
+    if (strlen(id) >= CODEGEN_ID_LEN) {
+        fail(line_number, "identifier too long:", id);
+    }
+    if (!isalpha((unsigned char)*id) && *id != '_') {
+        fail(line_number, "not a C identifier:", id);
+    }
+    for (p = id; *p; p++) {
+        if (!isalnum((unsigned char)*p) && *p != '_') {
+            fail(line_number, "not a C identifier:", id);
+        }
+    }
+    return;
+}
+
+
+/*
+ * copies text for a C string literal, escaping quotes and 
+ * backslashes, and fails when it does not fit
+ */
+static void
+copy_text (char *dest, const char *text, int line_number)
+{
+    int length;
+
+    length = 0;
+    for (; *text; text++) {
+        if (length + 2 >= CODEGEN_TEXT_LEN) {
+            fail(line_number, "text too long", NULL);
+        }
+        if (*text == '"' || *text == '\\') {
+            dest[length++] = '\\';
+        }
+        dest[length++] = *text;
+    }
+    dest[length] = '\0';
+    return;
+}
+
+
+static int
+find_name (codegen_name_t *names, int number_names, const char *id)
+{
+    int i;
+
+    for (i = 0; i < number_names; i++) {
+        if (strcmp(names[i].id, id) == 0) {
+            return (i);
+        }
+    }
+    return (-1);
+}
+
+
+static void
+add_name (codegen_name_t *names, int *number_names, char **tokens,
+          int number_tokens, int line_number)
+{
+    if (number_tokens != 3) {
+        fail(line_number, "expected", "<ID> \"<description>\"");
+    }
+    check_id(tokens[1], line_number);
+    if (find_name(names, *number_names, tokens[1]) >= 0) {
+        fail(line_number, "defined twice:", tokens[1]);
+    }
+    if (*number_names == CODEGEN_MAX_IDS) {
+        fail(line_number, "too many IDs", NULL);
+    }
+    strcpy(names[*number_names].id, tokens[1]);
+    copy_text(names[*number_names].description, tokens[2], line_number);
+    (*number_names)++;
+    return;
+}
+
+
+static int
+add_handler (const char *handler, int line_number)
+{
+    int i;
+
+    if (strcmp(handler, "NULL") == 0) {
+        return (CODEGEN_NO_HANDLER);
+    }
+    for (i = 0; i < number_handlers; i++) {
+        if (strcmp(handlers[i], handler) == 0) {
+            return (i);
+        }
+    }
+    if (number_handlers == CODEGEN_MAX_IDS) {
+        fail(line_number, "too many handlers", NULL);
+    }
+    if (strlen(handler) >= CODEGEN_ID_LEN) {
+        fail(line_number, "identifier too long:", handler);
+    }
+    strcpy(handlers[number_handlers], handler);
+    return (number_handlers++);
+}
+
+
+static void
+read_definition (FILE *fp)
+{
+    char line[512];
+    char *tokens[8];
+    int number_tokens;
+    int line_number;
+    int table_state;
+    codegen_row_t *row;
+
+    table_state = -1;
+    line_number = 0;
+
+    while (fgets(line, sizeof(line), fp)) {
+        line_number++;
+
+        number_tokens = tokenize(line, tokens, 8, line_number);
+        if (number_tokens == 0) {
+            continue;
+        }
+
+        if (strcmp(tokens[0], "name") == 0) {
+            if (number_tokens != 2) {
+                fail(line_number, "expected", "name \"<name>\"");
+            }
+            copy_text(fsm_name, tokens[1], line_number);
+            table_state = -1;
+
+        } else if (strcmp(tokens[0], "event") == 0) {
+            add_name(events, &number_events, tokens, number_tokens,
+                     line_number);
+            table_state = -1;
+
+        } else if (strcmp(tokens[0], "state") == 0) {
+            add_name(states, &number_states, tokens, number_tokens,
+                     line_number);
+            table_state = -1;
+
+        } else if (strcmp(tokens[0], "table") == 0) {
+            if (number_tokens != 2) {
+                fail(line_number, "expected", "table <state ID>");
+            }
+            table_state = find_name(states, number_states, tokens[1]);
+            if (table_state < 0) {
+                fail(line_number, "unknown state:", tokens[1]);
+            }
+
+        } else {
+            if (table_state < 0) {
+                fail(line_number, "row outside a table:", tokens[0]);
+            }
+            if (number_tokens != 3) {
+                fail(line_number, "expected", 
+                     "<event ID> <handler> <next state ID>");
+            }
+            check_id(tokens[0], line_number);
+            check_id(tokens[1], line_number);
+            check_id(tokens[2], line_number);
+
+            if (number_rows == size_rows) {
+                size_rows = size_rows ? size_rows * 2 : 64;
+                rows = realloc(rows, size_rows * sizeof(codegen_row_t));
+                if (rows == NULL) {
+                    fail(line_number, "out of memory", NULL);
+                }
+            }
+            row = &rows[number_rows++];
+            row->line = line_number;
+            row->state = table_state;
+            strcpy(row->event, tokens[0]);
+            strcpy(row->handler, tokens[1]);
+            strcpy(row->next_state, tokens[2]);
+        }
+    }
+    return;
+}
+
+
+/*
+ * resolves the rows into the state x event cells and numbers the
+ * distinct (handler, next state) pairs, the jump targets
+ */
+static int
+build_cells (void)
+{
+    codegen_cell_t *cell;
+    codegen_cell_t *other;
+    codegen_row_t *row;
+    int number_targets;
+    int event;
+    int i;
+    int j;
+
+    if (number_states == 0 || number_events == 0) {
+        fail(0, "no states or no events", NULL);
+    }
+
+    cells = calloc((size_t)number_states * number_events, 
+                   sizeof(codegen_cell_t));
+    if (cells == NULL) {
+        fail(0, "out of memory", NULL);
+    }
+    for (i = 0; i < number_states * number_events; i++) {
+        cells[i].handler = CODEGEN_NO_HANDLER;
+        cells[i].next_state = i / number_events;
+    }
+
+    for (i = 0; i < number_rows; i++) {
+        row = &rows[i];
+
+        event = find_name(events, number_events, row->event);
+        if (event < 0) {
+            fail(row->line, "unknown event:", row->event);
+        }
+        cell = &cells[row->state * number_events + event];
+        if (cell->defined) {
+            fail(row->line, "event given twice:", row->event);
+        }
+        cell->defined = 1;
+        cell->handler = add_handler(row->handler, row->line);
+        cell->next_state = find_name(states, number_states, 
+                                     row->next_state);
+        if (cell->next_state < 0) {
+            fail(row->line, "unknown state:", row->next_state);
+        }
+    }
+
+    number_targets = 0;
+    for (i = 0; i < number_states * number_events; i++) {
+        cell = &cells[i];
+        cell->target = -1;
+        for (j = 0; j < i; j++) {
+            other = &cells[j];
+            if (other->handler == cell->handler &&
+                (cell->handler == CODEGEN_NO_HANDLER ||
+                 other->next_state == cell->next_state)) {
+                cell->target = other->target;
+                break;
+            }
+        }
+        if (cell->target < 0) {
+            cell->target = number_targets++;
+        }
+    }
+    return (number_targets);
+}
+
+
+static void
+write_header (FILE *fp, const char *prefix, const char *guard)
+{
+    fprintf(fp, 
+        "/*\n"
+        " * %s.h -- generated by fsm_codegen from %s, do not edit\n"
+        " */\n\n"
+        "#ifndef __%s_H__\n"
+        "#define __%s_H__\n\n"
+        "#include \"fsm.h\"\n\n\n"
+        "extern RC_FSM_t\n"
+        "%s_class_create(fsm_class_t **fsm_class);\n\n"
+        "extern RC_FSM_t\n"
+        "%s_create(fsm_t **fsm, uint32_t initial_state);\n\n"
+        "extern RC_FSM_t\n"
+        "%s_engine(fsm_instance_t *instance,\n"
+        "%*s uint32_t normalized_event,\n"
+        "%*s void *p2event_buffer,\n"
+        "%*s void *p2parm);\n\n"
+        "#endif\n",
+        prefix, input_name, guard, guard, prefix, prefix, prefix,
+        (int)strlen(prefix) + 7, "", (int)strlen(prefix) + 7, "",
+        (int)strlen(prefix) + 7, "");
+    return;
+}
+
+
+static void
+write_tables (FILE *fp, const char *prefix)
+{
+    codegen_cell_t *cell;
+    int i;
+    int j;
+
+    fprintf(fp, "/*\n * the tables, for the generic engine\n */\n");
+    fprintf(fp, "static event_description_t %s_event_table[] = {\n",
+            prefix);
+    for (i = 0; i < number_events; i++) {
+        fprintf(fp, "    {%s, \"%s\"},\n", events[i].id, 
+                events[i].description);
+    }
+    fprintf(fp, "    {FSM_NULL_EVENT_ID, NULL} };\n\n");
+
+    fprintf(fp, "static state_description_t %s_state_table[] = {\n",
+            prefix);
+    for (i = 0; i < number_states; i++) {
+        fprintf(fp, "    {%s, \"%s\"},\n", states[i].id, 
+                states[i].description);
+    }
+    fprintf(fp, "    {FSM_NULL_STATE_ID, NULL} };\n\n");
+
+    for (i = 0; i < number_states; i++) {
+        fprintf(fp, "static event_tuple_t %s_%s_events[] = {\n", 
+                prefix, states[i].id);
+        for (j = 0; j < number_events; j++) {
+            cell = &cells[i * number_events + j];
+            fprintf(fp, "    {%s, %s, %s}%s\n", events[j].id, 
+                    cell->handler == CODEGEN_NO_HANDLER ? 
+                        "NULL" : handlers[cell->handler],
+                    states[cell->next_state].id,
+                    j == number_events - 1 ? " };\n" : ",");
+        }
+    }
+
+    fprintf(fp, "static state_tuple_t %s_table[] = {\n", prefix);
+    for (i = 0; i < number_states; i++) {
+        fprintf(fp, "    {%s, %s_%s_events},\n", states[i].id, 
+                prefix, states[i].id);
+    }
+    fprintf(fp, "    {FSM_NULL_STATE_ID, NULL} };\n\n\n");
+
+    fprintf(fp, 
+        "RC_FSM_t\n"
+        "%s_class_create (fsm_class_t **fsm_class)\n"
+        "{\n"
+        "    return (fsm_class_create(fsm_class, \"%s\",\n"
+        "                             %s_state_table,\n"
+        "                             %s_event_table,\n"
+        "                             %s_table));\n"
+        "}\n\n\n"
+        "RC_FSM_t\n"
+        "%s_create (fsm_t **fsm, uint32_t initial_state)\n"
+        "{\n"
+        "    return (fsm_create(fsm, \"%s\", initial_state,\n"
+        "                       %s_state_table,\n"
+        "                       %s_event_table,\n"
+        "                       %s_table));\n"
+        "}\n\n\n",
+        prefix, fsm_name, prefix, prefix, prefix,
+        prefix, fsm_name, prefix, prefix, prefix);
+    return;
+}
+
+
+/*
+ * the common tail of both engines, a transition once the handler
+ * has returned
+ */
+static void
+write_transition (FILE *fp)
+{
+    fprintf(fp,
+        "    if (rc != RC_FSM_OK) {\n"
+        "        return (rc);\n"
+        "    }\n\n"
+        "    if (instance->flags & FSM_INSTANCE_EXCEPTION) {\n"
+        "        instance->flags &= ~FSM_INSTANCE_EXCEPTION;\n"
+        "        next_state = instance->exception_state;\n"
+        "    }\n"
+        "    instance->curr_state = (uint16_t)next_state;\n"
+        "    return (RC_FSM_OK);\n"
+        "}\n");
+    return;
+}
+
+
+static void
+write_switch_engine (FILE *fp)
+{
+    codegen_cell_t *cell;
+    codegen_cell_t *other;
+    int i;
+    int j;
+    int k;
+
+    fprintf(fp, 
+        "    RC_FSM_t rc;\n"
+        "    uint32_t next_state;\n\n"
+        "    switch (instance->curr_state) {\n");
+
+    for (i = 0; i < number_states; i++) {
+        fprintf(fp, "\n    case %s:\n", states[i].id);
+        fprintf(fp, "        switch (normalized_event) {\n");
+
+        /* events of the same target share one body */
+        for (j = 0; j < number_events; j++) {
+            cell = &cells[i * number_events + j];
+            for (k = 0; k < j; k++) {
+                if (cells[i * number_events + k].target == cell->target) {
+                    break;
+                }
+            }
+            if (k < j) {
+                continue;
+            }
+
+            for (k = j; k < number_events; k++) {
+                other = &cells[i * number_events + k];
+                if (other->target == cell->target) {
+                    fprintf(fp, "        case %s:\n", events[k].id);
+                }
+            }
+            if (cell->handler == CODEGEN_NO_HANDLER) {
+                fprintf(fp, "            return (RC_FSM_OK);\n");
+            } else {
+                fprintf(fp, 
+                    "            rc = %s(p2event_buffer, p2parm);\n"
+                    "            next_state = %s;\n"
+                    "            break;\n",
+                    handlers[cell->handler], 
+                    states[cell->next_state].id);
+            }
+        }
+        fprintf(fp, 
+            "        default:\n"
+            "            return (RC_FSM_INVALID_EVENT);\n"
+            "        }\n"
+            "        break;\n");
+    }
+
+    fprintf(fp, 
+        "\n    default:\n"
+        "        return (RC_FSM_INVALID_STATE);\n"
+        "    }\n\n");
+    write_transition(fp);
+    return;
+}
+
+
+static void
+write_goto_engine (FILE *fp, int number_targets)
+{
+    codegen_cell_t *cell;
+    int target;
+    int i;
+    int j;
+
+    fprintf(fp, 
+        "    static void * const dispatch[%d][%d] = {\n", 
+        number_states, number_events);
+    for (i = 0; i < number_states; i++) {
+        fprintf(fp, "        /* %s */\n        {", states[i].id);
+        for (j = 0; j < number_events; j++) {
+            cell = &cells[i * number_events + j];
+            fprintf(fp, "%s&&target_%d%s", 
+                    j && (j % 4) == 0 ? "\n          " : " ",
+                    cell->target, 
+                    j == number_events - 1 ? " }" : ",");
+        }
+        fprintf(fp, "%s\n", i == number_states - 1 ? " };" : ",");
+    }
+
+    fprintf(fp, 
+        "    RC_FSM_t rc;\n"
+        "    uint32_t next_state;\n\n"
+        "    goto *dispatch[instance->curr_state][normalized_event];\n\n");
+
+    for (target = 0; target < number_targets; target++) {
+        for (i = 0; i < number_states * number_events; i++) {
+            if (cells[i].target == target) {
+                break;
+            }
+        }
+        cell = &cells[i];
+
+        if (cell->handler == CODEGEN_NO_HANDLER) {
+            fprintf(fp, 
+                "target_%d:\n"
+                "    return (RC_FSM_OK);\n\n", target);
+        } else {
+            fprintf(fp, 
+                "target_%d:\n"
+                "    rc = %s(p2event_buffer, p2parm);\n"
+                "    next_state = %s;\n"
+                "    goto transition;\n\n", 
+                target, handlers[cell->handler], 
+                states[cell->next_state].id);
+        }
+    }
+
+    fprintf(fp, "transition:\n");
+    write_transition(fp);
+    return;
+}
+
+
+static void
+write_source (FILE *fp, const char *prefix, const char *header_name,
+              int mode, int number_targets)
+{
+    int i;
+
+    fprintf(fp, 
+        "/*\n"
+        " * %s.c -- generated by fsm_codegen from %s, do not edit\n"
+        " *\n"
+        " * %s engine, %d states, %d events, %d handlers, "
+        "%d targets\n"
+        " */\n\n"
+        "#include \"fsm.h\"\n",
+        prefix, input_name, 
+        mode == CODEGEN_MODE_GOTO ? "computed goto" : "switch",
+        number_states, number_events, number_handlers, number_targets);
+    for (i = 0; i < number_headers; i++) {
+        fprintf(fp, "#include \"%s\"\n", headers[i]);
+    }
+    fprintf(fp, "#include \"%s\"\n\n\n", header_name);
+
+    /*
+     * the engine and the tables index by ID, a compile time check
+     * that the IDs are those of the definition order
+     */
+    fprintf(fp, "/* the IDs must number from 0 in definition order */\n");
+    for (i = 0; i < number_states; i++) {
+        fprintf(fp, "typedef char %s_state_%d_t[(%s == %d) ? 1 : -1];\n",
+                prefix, i, states[i].id, i);
+    }
+    for (i = 0; i < number_events; i++) {
+        fprintf(fp, "typedef char %s_event_%d_t[(%s == %d) ? 1 : -1];\n",
+                prefix, i, events[i].id, i);
+    }
+    fprintf(fp, "\n\n");
+
+    write_tables(fp, prefix);
+
+    fprintf(fp, 
+        "RC_FSM_t\n"
+        "%s_engine (fsm_instance_t *instance,\n"
+        "%*s uint32_t normalized_event,\n"
+        "%*s void *p2event_buffer,\n"
+        "%*s void *p2parm)\n"
+        "{\n",
+        prefix, (int)strlen(prefix) + 7, "", (int)strlen(prefix) + 7, "",
+        (int)strlen(prefix) + 7, "");
+
+    if (mode == CODEGEN_MODE_GOTO) {
+        write_goto_engine(fp, number_targets);
+    } else {
+        write_switch_engine(fp);
+    }
+    return;
+}
+
+
+static void
+usage (char *program)
+{
+    fprintf(stderr, 
+            "usage: %s [-m switch|goto] [-p prefix] [-i header]... "
+            "<definition> <output base>\n", program);
+    exit(1);
+}
+
+
+int 
+main (int argc, char **argv)
+{
+    char path[1024];
+    char guard[CODEGEN_ID_LEN];
+    char header_file[1024];
+    char *output_base;
+    char *header_name;
+    char *prefix;
+    int number_targets;
+    int mode;
+    int i;
+    FILE *fp;
+
+    mode = CODEGEN_MODE_SWITCH;
+    prefix = NULL;
+
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if (i + 1 == argc) {
+            usage(argv[0]);
+        }
+        if (strcmp(argv[i], "-m") == 0) {
+            i++;
+            if (strcmp(argv[i], "switch") == 0) {
+                mode = CODEGEN_MODE_SWITCH;
+            } else if (strcmp(argv[i], "goto") == 0) {
+                mode = CODEGEN_MODE_GOTO;
+            } else {
+                usage(argv[0]);
+            }
+        } else if (strcmp(argv[i], "-p") == 0) {
+            prefix = argv[++i];
+        } else if (strcmp(argv[i], "-i") == 0) {
+            if (number_headers == CODEGEN_MAX_HEADERS) {
+                usage(argv[0]);
+            }
+            headers[number_headers++] = argv[++i];
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (argc - i != 2) {
+        usage(argv[0]);
+    }
+    input_name = argv[i];
+    output_base = argv[i + 1];
+
+    header_name = strrchr(output_base, '/');
+    header_name = header_name ? header_name + 1 : output_base;
+    if (prefix == NULL) {
+        prefix = header_name;
+    }
+    check_id(prefix, 0);
+    for (i = 0; prefix[i]; i++) {
+        guard[i] = (char)toupper((unsigned char)prefix[i]);
+    }
+    guard[i] = '\0';
+
+    fp = fopen(input_name, "r");
+    if (fp == NULL) {
+        perror(input_name);
+        return (1);
+    }
+    copy_text(fsm_name, prefix, 0);
+    read_definition(fp);
+    fclose(fp);
+
+    number_targets = build_cells();
+
+    snprintf(path, sizeof(path), "%s.h", output_base);
+    fp = fopen(path, "w");
+    if (fp == NULL) {
+        perror(path);
+        return (1);
+    }
+    write_header(fp, prefix, guard);
+    fclose(fp);
+
+    snprintf(path, sizeof(path), "%s.c", output_base);
+    fp = fopen(path, "w");
+    if (fp == NULL) {
+        perror(path);
+        return (1);
+    }
+    snprintf(header_file, sizeof(header_file), "%s.h", header_name);
+    write_source(fp, prefix, header_file, mode, number_targets);
+    fclose(fp);
+    return (0);
+}
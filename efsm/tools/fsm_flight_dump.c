@@ -0,0 +1,333 @@
+/*------------------------------------------------------------------
+ * fsm_flight_dump.c -- dumps a flight recorder file
+ *
+ * Copyright (c) 2005-2009 by Cisco Systems, Inc.
+ * All rights reserved. 
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *------------------------------------------------------------------
+ */
+
+/*
+ * Reads a flight recorder file, typically after the process that
+ * wrote it has died, and prints the records it holds with the 
+ * state and event names of their class.  The rings of the regions
+ * are merged into one time order.
+ *
+ *    fsm_flight_dump <flight recorder file>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "fsm.h"
+#include "fsm_trace.h"
+#include "fsm_flight.h"
+
+
+typedef struct {
+    char       fsm_name[FSM_NAME_LEN];
+    uint32_t   number_states;
+    uint32_t   number_events;
+    char     **state_names;
+    char     **event_names;
+} dump_class_t;
+
+static dump_class_t  classes[FSM_TRACE_MAX_CLASSES];
+
+
+/*
+ * read a length and string from the names, NULL past the end
+ */
+static char *
+get_string (char *names, uint32_t size, uint32_t *p2offset)
+{
+    uint32_t length;
+    char *string;
+
+    if (*p2offset + sizeof(length) > size) {
+        return (NULL);
+    }
+    memcpy(&length, names + *p2offset, sizeof(length));
+    if (*p2offset + sizeof(length) + length > size) {
+        return (NULL);
+    }
+
+    string = (char *)malloc(length + 1);
+    if (string == NULL) {
+        return (NULL);
+    }
+    memcpy(string, names + *p2offset + sizeof(length), length);
+    string[length] = '\0';
+    *p2offset += sizeof(length) + length;
+    return (string);
+}
+
+
+static char *
+class_name (uint32_t class_id)
+{
+    if (class_id == 0 || class_id >= FSM_TRACE_MAX_CLASSES) {
+        return ("?");
+    }
+    return (classes[class_id].fsm_name);
+}
+
+
+static char *
+state_name (uint32_t class_id, uint32_t state)
+{
+    if (class_id == 0 || class_id >= FSM_TRACE_MAX_CLASSES ||
+        state >= classes[class_id].number_states ||
+        classes[class_id].state_names[state] == NULL) {
+        return ("?");
+    }
+    return (classes[class_id].state_names[state]);
+}
+
+
+static char *
+event_name (uint32_t class_id, uint32_t event)
+{
+    if (class_id == 0 || class_id >= FSM_TRACE_MAX_CLASSES ||
+        event >= classes[class_id].number_events ||
+        classes[class_id].event_names[event] == NULL) {
+        return ("?");
+    }
+    return (classes[class_id].event_names[event]);
+}
+
+
+static int
+compare_records (const void *a, const void *b)
+{
+    const fsm_trace_record_t *ra = (const fsm_trace_record_t *)a;
+    const fsm_trace_record_t *rb = (const fsm_trace_record_t *)b;
+
+    if (ra->tsc != rb->tsc) {
+        return (ra->tsc < rb->tsc ? -1 : 1);
+    }
+    if (ra->thread != rb->thread) {
+        return (ra->thread < rb->thread ? -1 : 1);
+    }
+    if (ra->reserved != rb->reserved) {
+        return (ra->reserved < rb->reserved ? -1 : 1);
+    }
+    return (0);
+}
+
+
+int 
+main (int argc, char **argv)
+{
+    fsm_flight_header_t header;
+    fsm_trace_file_class_t file_class;
+    fsm_flight_region_t *regions;
+    fsm_trace_record_t *slots;
+    fsm_trace_record_t *records;
+    fsm_trace_record_t *record;
+    dump_class_t *c;
+    char transition[64];
+    char stamp[32];
+    char *names;
+    uint32_t offset;
+    uint32_t i;
+    uint32_t r;
+    uint64_t head;
+    uint64_t first;
+    uint64_t total_slots;
+    uint64_t number_records;
+    uint64_t overwritten;
+    uint64_t torn;
+    uint64_t n;
+    uint64_t nsec;
+    time_t seconds;
+    struct tm tm_time;
+    FILE *fp;
+
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <flight recorder file>\n", argv[0]);
+        return (1);
+    }
+
+    fp = fopen(argv[1], "rb");
+    if (fp == NULL) {
+        perror(argv[1]);
+        return (1);
+    }
+
+    if (fread(&header, sizeof(header), 1, fp) != 1 ||
+        header.magic != FSM_FLIGHT_MAGIC ||
+        header.version != FSM_FLIGHT_VERSION ||
+        header.record_size != sizeof(fsm_trace_record_t) ||
+        header.number_records == 0 ||
+        (header.number_records & (header.number_records - 1)) ||
+        header.number_regions == 0 || 
+        header.number_regions > FSM_FLIGHT_REGIONS) {
+        fprintf(stderr, "%s: not an fsm flight recorder file\n", argv[1]);
+        return (1);
+    }
+
+    /*
+     * class names
+     */
+    total_slots = (uint64_t)header.number_regions * header.number_records;
+    names = (char *)malloc(header.names_size);
+    regions = (fsm_flight_region_t *)malloc(header.number_regions * 
+                                            sizeof(fsm_flight_region_t));
+    slots = (fsm_trace_record_t *)malloc(total_slots * 
+                                         sizeof(fsm_trace_record_t));
+    records = (fsm_trace_record_t *)malloc(total_slots * 
+                                           sizeof(fsm_trace_record_t));
+    if (names == NULL || regions == NULL || slots == NULL || 
+        records == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return (1);
+    }
+
+    if (header.names_used > header.names_size ||
+        fseek(fp, header.names_offset, SEEK_SET) ||
+        fread(names, 1, header.names_used, fp) != header.names_used) {
+        fprintf(stderr, "%s: truncated\n", argv[1]);
+        return (1);
+    }
+
+    offset = 0;
+    while (offset + sizeof(file_class) <= header.names_used) {
+        memcpy(&file_class, names + offset, sizeof(file_class));
+        offset += sizeof(file_class);
+        if (file_class.class_id == 0 || 
+            file_class.class_id >= FSM_TRACE_MAX_CLASSES) {
+            break;
+        }
+
+        c = &classes[file_class.class_id];
+        memcpy(c->fsm_name, file_class.fsm_name, FSM_NAME_LEN);
+        c->fsm_name[FSM_NAME_LEN-1] = '\0';
+        c->number_states = file_class.number_states;
+        c->number_events = file_class.number_events;
+        c->state_names = (char **)calloc(c->number_states + 1, 
+                                         sizeof(char *));
+        c->event_names = (char **)calloc(c->number_events + 1, 
+                                         sizeof(char *));
+        if (c->state_names == NULL || c->event_names == NULL) {
+            fprintf(stderr, "out of memory\n");
+            return (1);
+        }
+
+        for (i=0; i<c->number_states; i++) {
+            c->state_names[i] = get_string(names, header.names_used, 
+                                           &offset);
+        }
+        for (i=0; i<c->number_events; i++) {
+            c->event_names[i] = get_string(names, header.names_used, 
+                                           &offset);
+        }
+    }
+
+    /*
+     * the records still in the ring of each region, less any cut
+     * short, merged by time stamp
+     */
+    if (fseek(fp, header.regions_offset, SEEK_SET) ||
+        fread(regions, sizeof(fsm_flight_region_t), header.number_regions,
+              fp) != header.number_regions ||
+        fseek(fp, header.records_offset, SEEK_SET) ||
+        fread(slots, sizeof(fsm_trace_record_t), total_slots, 
+              fp) != total_slots) {
+        fprintf(stderr, "%s: truncated\n", argv[1]);
+        return (1);
+    }
+    fclose(fp);
+
+    number_records = 0;
+    overwritten = 0;
+    torn = 0;
+    for (r=0; r<header.number_regions; r++) {
+        head = regions[r].head;
+        first = (head > header.number_records) ? 
+                                      head - header.number_records : 0;
+        overwritten += first;
+        for (n=first; n<head; n++) {
+            record = &slots[(uint64_t)r * header.number_records + 
+                            (n & (header.number_records - 1))];
+            if (record->reserved != (uint32_t)(n + 1)) {
+                torn++;
+                continue;
+            }
+            records[number_records++] = *record;
+        }
+    }
+
+    qsort(records, number_records, sizeof(fsm_trace_record_t), 
+          compare_records);
+
+    printf("pid %u, %s, %llu records, %llu overwritten, %llu incomplete\n",
+           header.pid, 
+           header.closed ? "closed cleanly" : "not closed",
+           (unsigned long long)number_records, 
+           (unsigned long long)overwritten, 
+           (unsigned long long)torn);
+    printf("%-26s %4s %-16s %10s  %-28s %-20s %4s %10s\n",
+           "time", "thr", "fsm", "instance", "transition", 
+           "event", "rc", "nsec");
+
+    for (n=0; n<number_records; n++) {
+        record = &records[n];
+
+        /*
+         * wall clock from the time stamp counter
+         */
+        nsec = header.open_time;
+        if (header.tsc_hz) {
+            nsec += (uint64_t)((double)(int64_t)(record->tsc - 
+                        header.open_tsc) * 1e9 / (double)header.tsc_hz);
+        }
+        seconds = (time_t)(nsec / 1000000000ULL);
+        localtime_r(&seconds, &tm_time);
+        strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &tm_time);
+
+        snprintf(transition, sizeof(transition), "%s -> %s",
+                 state_name(record->class_id, record->prev_state),
+                 state_name(record->class_id, record->next_state));
+
+        printf("%s.%06llu %4u %-16.16s %10u  %-28s %-20s %4u %10.0f\n",
+               stamp,
+               (unsigned long long)((nsec % 1000000000ULL) / 1000),
+               record->thread,
+               class_name(record->class_id),
+               record->instance,
+               transition,
+               event_name(record->class_id, record->event),
+               record->rc,
+               header.tsc_hz ? 
+                   record->duration * 1e9 / (double)header.tsc_hz : 0.0);
+    }
+
+    free(records);
+    free(slots);
+    free(regions);
+    free(names);
+    return (0);
+}
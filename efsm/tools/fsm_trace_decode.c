@@ -0,0 +1,279 @@
+/*------------------------------------------------------------------
+ * fsm_trace_decode.c -- decodes fsm_trace_dump files
+ *
+ * Copyright (c) 2005-2009 by Cisco Systems, Inc.
+ * All rights reserved. 
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *------------------------------------------------------------------
+ */
+
+/*
+ * Reads a file written by fsm_trace_dump, merges the per-thread
+ * rings in time stamp order and prints each transition with the 
+ * state and event names of its class.
+ *
+ *    fsm_trace_decode <dump file>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fsm.h"
+#include "fsm_trace.h"
+
+
+typedef struct {
+    char       fsm_name[FSM_NAME_LEN];
+    uint32_t   number_states;
+    uint32_t   number_events;
+    char     **state_names;
+    char     **event_names;
+} decode_class_t;
+
+static decode_class_t  classes[FSM_TRACE_MAX_CLASSES];
+
+
+static char *
+read_string (FILE *fp)
+{
+    uint32_t length;
+    char *string;
+
+    if (fread(&length, sizeof(length), 1, fp) != 1 || length > 4096) {
+        return (NULL);
+    }
+    string = (char *)malloc(length + 1);
+    if (string == NULL) {
+        return (NULL);
+    }
+    if (length && fread(string, 1, length, fp) != length) {
+        free(string);
+        return (NULL);
+    }
+    string[length] = '\0';
+    return (string);
+}
+
+
+static char *
+class_name (uint32_t class_id)
+{
+    if (class_id == 0 || class_id >= FSM_TRACE_MAX_CLASSES) {
+        return ("?");
+    }
+    return (classes[class_id].fsm_name);
+}
+
+
+static char *
+state_name (uint32_t class_id, uint32_t state)
+{
+    if (class_id == 0 || class_id >= FSM_TRACE_MAX_CLASSES ||
+        state >= classes[class_id].number_states) {
+        return ("?");
+    }
+    return (classes[class_id].state_names[state]);
+}
+
+
+static char *
+event_name (uint32_t class_id, uint32_t event)
+{
+    if (class_id == 0 || class_id >= FSM_TRACE_MAX_CLASSES ||
+        event >= classes[class_id].number_events) {
+        return ("?");
+    }
+    return (classes[class_id].event_names[event]);
+}
+
+
+/*
+ * time order, then thread to keep each ring's own order on ties
+ */
+static int
+compare_records (const void *a, const void *b)
+{
+    const fsm_trace_record_t *ra = (const fsm_trace_record_t *)a;
+    const fsm_trace_record_t *rb = (const fsm_trace_record_t *)b;
+
+    if (ra->tsc != rb->tsc) {
+        return (ra->tsc < rb->tsc ? -1 : 1);
+    }
+    return ((int)ra->thread - (int)rb->thread);
+}
+
+
+int 
+main (int argc, char **argv)
+{
+    fsm_trace_file_header_t header;
+    fsm_trace_file_class_t file_class;
+    fsm_trace_file_ring_t file_ring;
+    fsm_trace_record_t *records;
+    fsm_trace_record_t *record;
+    decode_class_t *c;
+    char transition[64];
+    uint64_t number_records;
+    uint64_t dropped;
+    uint64_t first_tsc;
+    double ticks_per_usec;
+    uint32_t i;
+    uint32_t j;
+    uint64_t k;
+    FILE *fp;
+
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <trace dump file>\n", argv[0]);
+        return (1);
+    }
+
+    fp = fopen(argv[1], "rb");
+    if (fp == NULL) {
+        perror(argv[1]);
+        return (1);
+    }
+
+    if (fread(&header, sizeof(header), 1, fp) != 1 ||
+        header.magic != FSM_TRACE_FILE_MAGIC ||
+        header.version != FSM_TRACE_FILE_VERSION ||
+        header.record_size != sizeof(fsm_trace_record_t)) {
+        fprintf(stderr, "%s: not an fsm trace dump\n", argv[1]);
+        return (1);
+    }
+
+    /*
+     * class names
+     */
+    for (i=0; i<header.number_classes; i++) {
+        if (fread(&file_class, sizeof(file_class), 1, fp) != 1 ||
+            file_class.class_id == 0 ||
+            file_class.class_id >= FSM_TRACE_MAX_CLASSES) {
+            fprintf(stderr, "%s: bad class\n", argv[1]);
+            return (1);
+        }
+
+        c = &classes[file_class.class_id];
+        memcpy(c->fsm_name, file_class.fsm_name, FSM_NAME_LEN);
+        c->fsm_name[FSM_NAME_LEN-1] = '\0';
+        c->number_states = file_class.number_states;
+        c->number_events = file_class.number_events;
+        c->state_names = (char **)calloc(c->number_states + 1, 
+                                         sizeof(char *));
+        c->event_names = (char **)calloc(c->number_events + 1, 
+                                         sizeof(char *));
+        if (c->state_names == NULL || c->event_names == NULL) {
+            fprintf(stderr, "out of memory\n");
+            return (1);
+        }
+
+        for (j=0; j<c->number_states; j++) {
+            c->state_names[j] = read_string(fp);
+        }
+        for (j=0; j<c->number_events; j++) {
+            c->event_names[j] = read_string(fp);
+        }
+    }
+
+    /*
+     * the rings, gathered into one array
+     */
+    records = NULL;
+    number_records = 0;
+    dropped = 0;
+    for (i=0; i<header.number_rings; i++) {
+        if (fread(&file_ring, sizeof(file_ring), 1, fp) != 1) {
+            fprintf(stderr, "%s: truncated\n", argv[1]);
+            return (1);
+        }
+
+        records = (fsm_trace_record_t *)realloc(records, 
+                    (number_records + file_ring.number_records) * 
+                                          sizeof(fsm_trace_record_t));
+        if (records == NULL && file_ring.number_records) {
+            fprintf(stderr, "out of memory\n");
+            return (1);
+        }
+        if (fread(&records[number_records], sizeof(fsm_trace_record_t), 
+                  file_ring.number_records, fp) != 
+                                        file_ring.number_records) {
+            fprintf(stderr, "%s: truncated\n", argv[1]);
+            return (1);
+        }
+        number_records += file_ring.number_records;
+        dropped += file_ring.dropped;
+    }
+    fclose(fp);
+
+    qsort(records, number_records, sizeof(fsm_trace_record_t), 
+          compare_records);
+
+    printf("%llu records from %u threads, %llu overwritten\n",
+           (unsigned long long)number_records, header.number_rings,
+           (unsigned long long)dropped);
+
+    ticks_per_usec = header.tsc_hz / 1e6;
+    if (ticks_per_usec > 0) {
+        printf("%12s %4s %-16s %10s  %-28s %-20s %4s %10s\n",
+               "usec", "thr", "fsm", "instance", "transition", 
+               "event", "rc", "nsec");
+    } else {
+        printf("%12s %4s %-16s %10s  %-28s %-20s %4s %10s\n",
+               "ticks", "thr", "fsm", "instance", "transition", 
+               "event", "rc", "ticks");
+    }
+
+    first_tsc = number_records ? records[0].tsc : 0;
+    for (k=0; k<number_records; k++) {
+        record = &records[k];
+
+        snprintf(transition, sizeof(transition), "%s -> %s",
+                 state_name(record->class_id, record->prev_state),
+                 state_name(record->class_id, record->next_state));
+
+        if (ticks_per_usec > 0) {
+            printf("%12.3f %4u %-16.16s %10u  %-28s %-20s %4u %10.0f\n",
+                   (record->tsc - first_tsc) / ticks_per_usec,
+                   record->thread,
+                   class_name(record->class_id),
+                   record->instance,
+                   transition,
+                   event_name(record->class_id, record->event),
+                   record->rc,
+                   record->duration * 1e3 / ticks_per_usec);
+        } else {
+            printf("%12llu %4u %-16.16s %10u  %-28s %-20s %4u %10u\n",
+                   (unsigned long long)(record->tsc - first_tsc),
+                   record->thread,
+                   class_name(record->class_id),
+                   record->instance,
+                   transition,
+                   event_name(record->class_id, record->event),
+                   record->rc,
+                   record->duration);
+        }
+    }
+
+    free(records);
+    return (0);
+}